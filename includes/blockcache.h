@@ -0,0 +1,131 @@
+//
+//  blockcache.h
+//  myfs
+//
+
+#ifndef blockcache_h
+#define blockcache_h
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "blockdevice.h"
+
+/// @brief LRU cache of device blocks
+///
+/// This class keeps recently used blocks of a block device in memory. Writes go through to the device, so cached
+/// blocks are never dirty and can be dropped at any time.
+///
+/// Optionally the cache keeps a CRC32C checksum of every block in a range of the device. Checksums are computed when
+/// a block of the range is written and verified whenever it is read from the device, a block with a wrong checksum
+/// is never cached. Changed checksums are tracked per block of the checksum table, so the owner of the table can
+/// write back just the changed parts.
+class BlockCache {
+private:
+    struct Entry {
+        uint32_t blockNo;
+        char *data;
+    };
+
+    BlockDevice *device;
+    uint32_t blockSize;
+    size_t capacity;
+    std::list<Entry> lru;   // most recently used first
+    std::unordered_map<uint32_t, std::list<Entry>::iterator> index;
+    uint32_t *checksums;            // checksum table, NULL if blocks are not checksummed
+    uint32_t csumFirst;             // block the first checksum belongs to
+    uint32_t csumCount;             // number of checksummed blocks
+    std::vector<bool> csumDirty;    // blocks of the checksum table changed since dirtyChecksums()
+
+    char *insert(uint32_t blockNo);
+    void drop(uint32_t blockNo);
+    void updateChecksum(uint32_t blockNo, const char *data);
+    bool verifyChecksum(uint32_t blockNo, const char *data);
+
+public:
+    size_t hits;
+    size_t misses;
+    size_t checksumErrors;
+
+    /// @brief Create a new block cache.
+    ///
+    /// \param device Block device the cached blocks belong to.
+    /// \param blockSize Block size of the device.
+    /// \param capacity Maximum number of cached blocks.
+    BlockCache(BlockDevice *device, uint32_t blockSize, size_t capacity);
+    ~BlockCache();
+
+    /// @brief Read a block through the cache.
+    ///
+    /// \param [in] blockNo Number of the block to read.
+    /// \param [out] buffer Buffer for storing the content of the block.
+    /// \return 0 on success, -ERRNO on failure.
+    int read(uint32_t blockNo, char *buffer);
+
+    /// @brief Write a block through the cache to the device.
+    ///
+    /// \param [in] blockNo Number of the block to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    int write(uint32_t blockNo, char *buffer);
+
+    /// @brief Write consecutive blocks through the cache to the device.
+    ///
+    /// The blocks are written with a single device request.
+    /// \param [in] blockNo Number of the first block to write.
+    /// \param [in] count Number of blocks to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    int writeBlocks(uint32_t blockNo, uint32_t count, char *buffer);
+
+    /// @brief Write a batch of block runs through the cache to the device.
+    ///
+    /// All runs are written with a single batch request.
+    /// \param [in] requests Runs to write.
+    /// \param [in] count Number of runs.
+    /// \return 0 on success, -ERRNO on failure.
+    int writeBatch(BlockRequest *requests, int count);
+
+    /// @brief Load consecutive blocks into the cache.
+    ///
+    /// Blocks that are not cached yet are read from the device with one batch request.
+    /// \param [in] blockNo Number of the first block.
+    /// \param [in] count Number of blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    int load(uint32_t blockNo, uint32_t count);
+
+    /// @brief Load several runs of consecutive blocks into the cache.
+    ///
+    /// Blocks that are not cached yet are read from the device with one batch request for all runs. The buffers of
+    /// the runs are not used.
+    /// \param [in] runs Runs to load.
+    /// \param [in] count Number of runs.
+    /// \return 0 on success, -ERRNO on failure.
+    int loadBatch(const BlockRequest *runs, int count);
+
+    /// @brief Drop a block that was changed on the device without going through the cache.
+    void invalidate(uint32_t blockNo);
+
+    /// @brief Check if a block is cached.
+    bool contains(uint32_t blockNo);
+
+    /// @brief Drop all cached blocks.
+    void clear();
+
+    /// @brief Checksum a range of blocks.
+    ///
+    /// \param [in] first First block of the range.
+    /// \param [in] count Number of blocks in the range.
+    /// \param [in] table Checksums of the blocks in the range, kept up to date by the cache. NULL to turn checksums
+    /// off.
+    void setChecksums(uint32_t first, uint32_t count, uint32_t *table);
+
+    /// @brief Get the blocks of the checksum table changed since the last call.
+    ///
+    /// \param [out] blocks Indices of the changed blocks of the table, in ascending order.
+    void dirtyChecksums(std::vector<uint32_t> &blocks);
+};
+
+#endif /* blockcache_h */
@@ -13,8 +13,25 @@
 
 #include <stdio.h>
 #include <cstdint>
+#include <vector>
 
 #define BD_BLOCK_SIZE 512
+/* requests in flight on the io_uring of a block device */
+#define BD_RING_DEPTH 64
+/* alignment of offsets, sizes and buffers for O_DIRECT access */
+#define BD_DIRECT_ALIGN 4096
+/* size of the buffers in the I/O buffer pool, and number of buffers kept for reuse */
+#define BD_POOL_BUFFER_SIZE (128 * 1024)
+#define BD_POOL_BUFFERS 16
+
+/// @brief A run of consecutive blocks in a batch request.
+struct BlockRequest {
+    uint32_t blockNo;
+    uint32_t count;
+    char *buffer;
+};
+
+class IoUring;
 
 /// @brief Emulate a block device
 ///
@@ -25,6 +42,15 @@ private:
     uint32_t blockSize;
     int contFile;
     // uint32_t size;
+    IoUring *ring;
+    bool direct;
+    std::vector<char *> pool;
+
+    void setupIO();
+    bool isAligned(uint32_t blockNo, uint32_t count, const char *buffer);
+    int transfer(bool write, uint32_t blockNo, uint32_t count, char *buffer);
+    int bounce(bool write, uint32_t blockNo, uint32_t count, char *buffer);
+    int batch(bool write, BlockRequest *requests, int count);
     
 public:
     /// @brief Create a new block device.
@@ -32,6 +58,7 @@ public:
     /// Create a block device object with a given block size.
     /// \param blockSize Block size.
     BlockDevice(uint32_t blockSize);
+    ~BlockDevice();
 
     /// @brief Open an existing container file.
     ///
@@ -72,6 +99,90 @@ public:
     /// \param [out] buffer Buffer storing the content to write.
     /// \return 0 on success, -ERRNO on failure.
     int write(uint32_t blockNo, char *buffer);
+
+    /// @brief Read consecutive blocks.
+    ///
+    /// This method reads count blocks starting with the block blockNo from the container file using a single
+    /// system call. Note that the size of the buffer must be at least count blocks.
+    /// \param [in] blockNo Number of the first block to read.
+    /// \param [in] count Number of blocks to read.
+    /// \param [out] buffer Buffer for storing the content of the blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    int readBlocks(uint32_t blockNo, uint32_t count, char *buffer);
+
+    /// @brief Write consecutive blocks.
+    ///
+    /// This method writes count blocks starting with the block blockNo into the container file using a single
+    /// system call. Note that the size of the buffer must be at least count blocks.
+    /// \param [in] blockNo Number of the first block to write.
+    /// \param [in] count Number of blocks to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    int writeBlocks(uint32_t blockNo, uint32_t count, char *buffer);
+
+    /// @brief Read a batch of block runs.
+    ///
+    /// All runs are submitted to the host with a single system call and read in parallel if io_uring is
+    /// available, otherwise they are read one after the other. Blocks past the end of the container read as zero.
+    /// \param [in,out] requests Runs to read, the buffer of each run must hold at least count blocks.
+    /// \param [in] count Number of runs.
+    /// \return 0 on success, -ERRNO of the first failed run otherwise.
+    int readBatch(BlockRequest *requests, int count);
+
+    /// @brief Write a batch of block runs.
+    ///
+    /// All runs are submitted to the host with a single system call and written in parallel if io_uring is
+    /// available, otherwise they are written one after the other.
+    /// \param [in] requests Runs to write, the buffer of each run must hold at least count blocks.
+    /// \param [in] count Number of runs.
+    /// \return 0 on success, -ERRNO of the first failed run otherwise.
+    int writeBatch(BlockRequest *requests, int count);
+
+    /// @brief Check if batches are submitted through io_uring.
+    bool asyncIO();
+
+    /// @brief Access the container file with O_DIRECT.
+    ///
+    /// This bypasses the page cache of the host, so blocks are only cached by the file system itself. Transfers
+    /// that are not aligned to BD_DIRECT_ALIGN are done through aligned buffers from the buffer pool, writes of
+    /// partial BD_DIRECT_ALIGN units read the rest of the unit first. Must be called before open() or create(), if
+    /// the host file system does not support O_DIRECT the container is accessed through the page cache.
+    /// \param enable True to enable O_DIRECT.
+    void setDirectIO(bool enable);
+
+    /// @brief Check if the container file is accessed with O_DIRECT.
+    bool directIO();
+
+    /// @brief File descriptor of the container file.
+    ///
+    /// Used to splice data between the container and other file descriptors without copying it. Data written this
+    /// way must be dropped from any block cache.
+    int fileDescriptor();
+
+    /// @brief Get a buffer from the I/O buffer pool.
+    ///
+    /// The buffer holds BD_POOL_BUFFER_SIZE bytes and is aligned to BD_DIRECT_ALIGN, so transfers from and to it
+    /// can bypass the page cache without copying.
+    /// \return The buffer, NULL if no memory is available.
+    char *allocBuffer();
+
+    /// @brief Return a buffer to the I/O buffer pool.
+    ///
+    /// \param buffer Buffer returned by allocBuffer().
+    void releaseBuffer(char *buffer);
+
+    /// @brief Flush written blocks to stable storage.
+    ///
+    /// \return 0 on success, -ERRNO on failure.
+    int sync();
+
+    /// @brief Announce future reads.
+    ///
+    /// This method tells the host kernel that the given blocks will be read soon, so it can fetch them in the
+    /// background. It does not block and may be ignored by the host.
+    /// \param [in] blockNo Number of the first block.
+    /// \param [in] count Number of blocks.
+    void prefetch(uint32_t blockNo, uint32_t count);
 };
 
 #endif /* blockdevice_h */
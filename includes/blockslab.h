@@ -0,0 +1,47 @@
+//
+//  blockslab.h
+//  myfs
+//
+
+#ifndef blockslab_h
+#define blockslab_h
+
+#include <cstddef>
+#include <vector>
+
+/// @brief Buffers of one block each, carved out of large chunks of memory
+///
+/// Buffers that are given back are kept on a free list and handed out again, so once the slab has grown to the number
+/// of buffers in use at the same time, getting a buffer does not allocate memory. The list is kept in the free buffers
+/// themselves. Chunks are only freed with the slab.
+class BlockSlab {
+private:
+    size_t blockSize;
+    size_t chunkBlocks;         // buffers added at a time once all are in use
+    std::vector<char *> chunks;
+    char *freeList;             // first free buffer, each one starts with a pointer to the next
+
+    bool grow(size_t blocks);
+
+public:
+    size_t used;                // buffers handed out and not given back
+    size_t capacity;            // buffers in all chunks
+
+    /// @brief Create a slab.
+    ///
+    /// \param [in] blockSize Size of a buffer, at least the size of a pointer.
+    /// \param [in] chunkBlocks Number of buffers added when all are in use.
+    /// \param [in] reserved Number of buffers allocated right away.
+    BlockSlab(size_t blockSize, size_t chunkBlocks, size_t reserved);
+    ~BlockSlab();
+
+    /// @brief Get a buffer, its content is undefined.
+    ///
+    /// \return the buffer, NULL if no memory is available.
+    char *get();
+
+    /// @brief Give back a buffer got from this slab.
+    void put(char *block);
+};
+
+#endif /* blockslab_h */
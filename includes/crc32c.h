@@ -0,0 +1,27 @@
+//
+//  crc32c.h
+//  myfs
+//
+
+#ifndef crc32c_h
+#define crc32c_h
+
+#include <cstddef>
+#include <cstdint>
+
+/// @brief CRC32C (Castagnoli) checksum of a buffer.
+///
+/// Uses the CRC32 instructions of SSE4.2 or ARMv8 if the CPU has them, a table-driven implementation otherwise.
+/// \param [in] crc Checksum of the preceding data, 0 for the first buffer.
+/// \param [in] data Data to checksum.
+/// \param [in] len Length of the data in bytes.
+/// \return checksum of the preceding data followed by this buffer.
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/// @brief CRC32C checksum computed without CPU support, for comparison with crc32c().
+uint32_t crc32cSoftware(uint32_t crc, const void *data, size_t len);
+
+/// @brief Check if crc32c() uses CRC32 instructions of the CPU.
+bool crc32cHardware();
+
+#endif /* crc32c_h */
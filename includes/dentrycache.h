@@ -0,0 +1,98 @@
+//
+//  dentrycache.h
+//  myfs
+//
+
+#ifndef dentrycache_h
+#define dentrycache_h
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+/// @brief Index of directory entries by parent directory and name
+///
+/// Directory entries of both file systems live in a flat table, every entry names its parent directory by an id. This
+/// class maps (parent id, name) to the slot of the entry in the table, so a path is resolved with one hash lookup per
+/// component instead of a scan of the table. The slots of the entries of every directory are kept in order as well,
+/// so listing a directory touches its own entries only. The cache is authoritative: it is built from the table when the file
+/// system starts and the owner keeps it up to date on every change of a name or parent.
+class DentryCache {
+private:
+    struct Key {
+        int dir;
+        std::string name;
+
+        bool operator==(const Key &other) const { return dir == other.dir && name == other.name; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<std::string>()(key.name) ^ ((size_t) key.dir * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+
+    struct Value {
+        int index;
+        bool directory;
+    };
+
+    std::unordered_map<Key, Value, KeyHash> entries;
+    std::unordered_map<int, std::set<int>> children;    // slots of the entries in a directory
+    std::unordered_map<int, size_t> subdirs;        // number of directories in a directory
+    int rootDir;
+
+public:
+    /// @brief Create an empty cache.
+    ///
+    /// \param rootDir Id of the root directory.
+    DentryCache(int rootDir);
+
+    /// @brief Add an entry.
+    ///
+    /// \param [in] dir Id of the directory holding the entry.
+    /// \param [in] name Name of the entry without any '/'.
+    /// \param [in] index Slot of the entry, which is also the id of a directory.
+    /// \param [in] directory The entry is a directory.
+    void insert(int dir, const char *name, int index, bool directory);
+
+    /// @brief Remove an entry, nothing happens if there is no such entry.
+    void remove(int dir, const char *name);
+
+    /// @brief Look up a name in a directory.
+    ///
+    /// \param [in] dir Id of the directory.
+    /// \param [in] name Name, not necessarily terminated.
+    /// \param [in] len Length of the name.
+    /// \param [out] directory Set to whether the entry is a directory, may be NULL.
+    /// \return Slot of the entry, -1 if there is no such entry.
+    int lookup(int dir, const char *name, size_t len, bool *directory = NULL) const;
+
+    /// @brief Resolve an absolute path.
+    ///
+    /// Empty components are skipped, so "/a//b" is "/a/b".
+    /// \param [in] path Path starting with '/'.
+    /// \param [out] dir Id of the directory holding the last component, -1 if a directory on the way is missing.
+    /// \param [out] name Last component of the path, an empty string for the root directory.
+    /// \return Slot of the entry, the root directory id for "/", -ENOENT if the last component or a directory on the
+    /// way does not exist, -ENOTDIR if a component on the way is no directory.
+    int resolve(const char *path, int *dir, const char **name) const;
+
+    /// @brief Number of entries in a directory.
+    size_t countChildren(int dir) const;
+
+    /// @brief Slots of the entries in a directory, in ascending order.
+    const std::set<int> &childrenOf(int dir) const;
+
+    /// @brief Number of directories in a directory.
+    size_t countSubdirs(int dir) const;
+
+    /// @brief Remove all entries.
+    void clear();
+
+    /// @brief Number of entries in the cache.
+    size_t size() const { return entries.size(); }
+};
+
+#endif /* dentrycache_h */
@@ -0,0 +1,85 @@
+//
+//  filetier.h
+//  myfs
+//
+
+#ifndef filetier_h
+#define filetier_h
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+/// @brief RAM tier of whole files, ranked by access heat
+///
+/// The heat of a file is the number of bytes read from or written to it, halved every halfLife seconds, so the files
+/// of the current working set are the hottest ones. A file becomes hot enough for the tier once its heat reaches its
+/// size, i.e. after it was read about once in full, and it is only taken in if it is hotter than every file it
+/// displaces, so a scan over cold files does not push out the working set. The copies are clean: the owner drops the
+/// copy of a file whenever its content changes.
+class FileTier {
+private:
+    struct File {
+        double heat;
+        double stamp;               // time of the last update of heat
+        bool resident;
+        std::vector<char> data;     // copy of the file while resident
+    };
+
+    std::unordered_map<int, File> files;
+    size_t budget;
+    size_t bytes;                   // size of all copies
+    double halfLife;
+
+    double decayed(const File &file, double now) const;
+
+public:
+    size_t hits;
+    size_t misses;
+
+    FileTier(size_t budget, double halfLife);
+
+    /// @brief Record an access to a file.
+    ///
+    /// \param [in] file Number of the file.
+    /// \param [in] len Number of bytes read or written.
+    /// \param [in] now Current time in seconds.
+    void touch(int file, size_t len, double now);
+
+    /// @brief Heat of a file, 0 for files that were never accessed.
+    double heat(int file, double now) const;
+
+    /// @brief Read from the copy of a file.
+    ///
+    /// \param [in] file Number of the file.
+    /// \param [out] buf Buffer for the data.
+    /// \param [in] size Number of bytes to read.
+    /// \param [in] offset Offset in the file.
+    /// \return Number of bytes read, -1 if the file is not in the tier.
+    int read(int file, char *buf, size_t size, size_t offset);
+
+    /// @brief Check if a file should be taken into the tier, colder files are dropped to make room for it.
+    ///
+    /// \param [in] file Number of the file.
+    /// \param [in] size Size of the file.
+    /// \param [in] now Current time in seconds.
+    /// \return true if the caller should store() the file now.
+    bool admit(int file, size_t size, double now);
+
+    /// @brief Store the copy of a file after admit() agreed.
+    void store(int file, const char *data, size_t size);
+
+    /// @brief Drop the copy of a file, its heat is kept.
+    void drop(int file);
+
+    /// @brief Drop the copy and the heat of a file that was removed.
+    void forget(int file);
+
+    /// @brief Drop all copies and heat.
+    void clear();
+
+    /// @brief Size of all copies in the tier.
+    size_t used() const { return bytes; }
+};
+
+#endif /* filetier_h */
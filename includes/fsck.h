@@ -0,0 +1,97 @@
+//
+//  fsck.h
+//  myfs
+//
+
+#ifndef fsck_h
+#define fsck_h
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "blockdevice.h"
+#include "myfs-structs.h"
+
+/* exit codes, with the same meaning as for fsck(8) */
+#define FSCK_OK 0
+#define FSCK_REPAIRED 1
+#define FSCK_UNCORRECTED 4
+#define FSCK_FAILED 8
+
+/// @brief Consistency checker for MyFS containers.
+///
+/// A container is consistent if every entry is in a directory reachable from the root directory, every chain of a
+/// directory entry or snapshot entry ends properly, attribute chains included, every file has as many blocks as its size requires (in compressed
+/// containers, as its extents within the size take), the reference count of every block equals the number of links
+/// to it (directory entries plus FAT entries of reachable blocks) and every block without a link is free. After a
+/// clean unmount the free-space bitmap must agree with the FAT as well. The tables are read with a single batch
+/// request, chains and blocks are checked by several threads. All repairs are done in memory first and only written
+/// back to the container when repairing is enabled.
+class MyFsChecker {
+private:
+    BlockDevice *device;
+    bool repair;
+    unsigned numThreads;
+    int problems;
+    int unfixed;
+
+    MyFsSuperBlock sb;
+    int *fat;
+    uint16_t *refs;
+    DiskFileInfo *root;
+    DiskSnapshot *snaps;
+
+    std::vector<DiskFileInfo *> entries;        // entries with a name, root directory first
+    std::vector<int> snapshotOf;                // snapshot slot of an entry, -1 for the root directory
+    std::vector<int *> chains;                  // links to the data chains of all entries, then to attribute chains
+    std::vector<size_t> chainOwner;             // entry a chain belongs to
+    std::vector<int> brokenAt;                  // result of followChains(), see walk()
+    std::vector<int> lengths;                   // number of blocks in a chain
+    std::atomic<uint32_t> *links;               // number of links to a block
+    std::atomic<bool> *reached;                 // block is part of a chain
+    std::vector<uint8_t> blockState;            // result of checkBlocks()
+
+    void report(bool fixable, const char *fmt, ...);
+    DiskFileInfo *entryTable(size_t entry);
+    std::string entryName(size_t entry);
+    std::string chainName(size_t chain);
+    bool validBlock(int block);
+    void collectChains();
+    int walk(size_t chain, std::vector<uint32_t> &seen, int *target);
+    void parallel(void (MyFsChecker::*work)(size_t, size_t), size_t count);
+    int transferTables(bool write);
+    bool checkSuperBlock();
+    void checkFreeMap();
+    void checkNames();
+    void checkTree();
+    void followChains(size_t first, size_t last);
+    void repairChains();
+    void countLinks(size_t first, size_t last);
+    int extentBlocks(size_t entry);
+    bool checkSizes();
+    void checkBlocks(size_t first, size_t last);
+    void reportBlocks();
+
+public:
+    /// @brief Constructor.
+    ///
+    /// \param [in] repair Repair the problems found, otherwise the container is only read.
+    /// \param [in] threads Number of threads, 0 for one per CPU.
+    MyFsChecker(bool repair, unsigned threads);
+    ~MyFsChecker();
+
+    /// @brief Check a container file.
+    ///
+    /// Problems are printed to stdout, the container must not be mounted.
+    /// \param [in] path Path of the container file.
+    /// \return FSCK_OK if the container is consistent, FSCK_REPAIRED if all problems have been repaired,
+    /// FSCK_UNCORRECTED if problems are left and FSCK_FAILED if the container could not be checked.
+    int run(const char *path);
+
+    /// @brief Number of problems found by the last run.
+    int problemsFound() const { return problems; }
+};
+
+#endif /* fsck_h */
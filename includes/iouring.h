@@ -0,0 +1,84 @@
+//
+//  iouring.h
+//  myfs
+//
+
+#ifndef iouring_h
+#define iouring_h
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+/// @brief Minimal io_uring submission and completion ring
+///
+/// This class talks to the kernel through the raw io_uring system calls, so no additional library is needed. It
+/// only supports plain reads and writes on a file descriptor, which is all the block device needs. On systems other than
+/// Linux, setup() fails with -ENOSYS.
+class IoUring {
+private:
+    int ringFd;
+    unsigned entries;
+    unsigned queued;
+
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+
+public:
+    IoUring();
+    ~IoUring();
+
+    /// @brief Set up a ring.
+    ///
+    /// \param depth Number of requests that can be in flight at the same time.
+    /// \return 0 on success, -ERRNO if the kernel does not support io_uring.
+    int setup(unsigned depth);
+
+    /// @brief Tear down the ring, requests in flight are lost.
+    void teardown();
+
+    /// @brief Check if the ring is set up.
+    bool available() const { return ringFd >= 0; }
+
+    /// @brief Number of requests that can be in flight at the same time.
+    unsigned depth() const { return entries; }
+
+    /// @brief Queue a read or write request, it is not submitted before submit() is called.
+    ///
+    /// \param [in] write True for a write, false for a read.
+    /// \param [in] fd File descriptor.
+    /// \param [in] buffer Buffer to read to or write from, must stay valid until the request completed.
+    /// \param [in] size Number of bytes.
+    /// \param [in] offset Position in the file.
+    /// \param [in] tag Value returned with the completion of the request.
+    /// \return False if the submission queue is full.
+    bool queue(bool write, int fd, char *buffer, size_t size, off_t offset, uint64_t tag);
+
+    /// @brief Submit all queued requests and wait for completions.
+    ///
+    /// \param [in] wait Number of completions to wait for.
+    /// \return 0 on success, -ERRNO on failure.
+    int submit(unsigned wait);
+
+    /// @brief Take the next completion off the ring.
+    ///
+    /// \param [out] tag Tag of the completed request.
+    /// \param [out] result Number of bytes transferred or -ERRNO.
+    /// \return False if no request has completed.
+    bool complete(uint64_t *tag, int *result);
+};
+
+#endif /* iouring_h */
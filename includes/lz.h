@@ -0,0 +1,33 @@
+//
+//  lz.h
+//  myfs
+//
+
+#ifndef lz_h
+#define lz_h
+
+#include <cstddef>
+
+/// @brief Compress a buffer with a fast LZ77 codec.
+///
+/// The output uses the LZ4 block format: sequences of literals followed by a match of at least four bytes at an
+/// offset of up to 64 KiB. Matches are found greedily with a hash table of the last position of every four byte
+/// sequence, so compression is fast rather than tight.
+/// \param [in] src Data to compress.
+/// \param [in] len Length of the data.
+/// \param [out] dst Buffer for the compressed data.
+/// \param [in] capacity Size of dst.
+/// \return length of the compressed data, 0 if it does not fit into dst.
+size_t lzCompress(const char *src, size_t len, char *dst, size_t capacity);
+
+/// @brief Decompress data created by lzCompress().
+///
+/// Corrupted input is detected as far as it would make the decompressor read or write out of bounds.
+/// \param [in] src Compressed data.
+/// \param [in] len Length of the compressed data.
+/// \param [out] dst Buffer for the decompressed data.
+/// \param [in] capacity Size of dst.
+/// \return length of the decompressed data, -1 if the input is corrupted or does not fit into dst.
+long lzDecompress(const char *src, size_t len, char *dst, size_t capacity);
+
+#endif /* lz_h */
@@ -14,6 +14,13 @@
 struct MyFsInfo {
     char *logFile;
     char *contFile;
+    int directIO;
+    int defrag;
+    int checksums;
+    int compress;
+    int dedup;
+    char *imageFile;    // image of the in-memory file system, NULL if it starts empty and is not kept
+    int tier;           // RAM budget of the tiered mode in MiB, 0 if it is off
 };
 
 #endif /* myfs_info_h */
@@ -11,7 +11,8 @@
 
 #define NAME_LENGTH 255
 #define NUM_DIR_ENTRIES 64
-#define NUM_OPEN_FILES 64
+/* open file handles, the on-disk table of handles grows up to this limit */
+#define MAX_OPEN_FILES 65536
 
 #define BLOCK_SIZE 512
 #define FS_SIZE_MIB 20
@@ -21,11 +22,91 @@
 #define EMPTY_BLOCK 0
 #define EOC_BLOCK -1
 
+/* FAT entry 0 is reserved, a link to it would be indistinguishable from EMPTY_BLOCK */
+#define FAT_ENTRY_COUNT (DATA_BLOCK_COUNT + 1)
+
+#define MYFS_MAGIC 0x4d794653 /* "MyFS" */
+
+/* a container is MYFS_DIRTY from mount to a clean unmount, only then the free-space bitmap is up to date */
+#define MYFS_DIRTY 0
+#define MYFS_CLEAN 1
+
+/* FAT entries and their reference counts are loaded in regions of this many entries on first access */
+#define FAT_REGION_ENTRIES 1024
+
+/* number of data blocks kept in the block cache */
+#define BLOCK_CACHE_BLOCKS 4096
+/* readahead window limits in blocks */
+#define RA_MIN_BLOCKS 8
+#define RA_MAX_BLOCKS 512
+
+/* buffered blocks of delayed writes before files are flushed, and blocks per device write */
+#define DELALLOC_MAX_BLOCKS 4096
+#define DELALLOC_BATCH_BLOCKS 256
+/* file system tables are read and written in chunks of this many blocks, submitted as one batch */
+#define TABLE_IO_BLOCKS 64
+
+/* largest request size negotiated with the kernel in fuseInit */
+#define FUSE_MAX_WRITE (128 * 1024)
+#define FUSE_MAX_READAHEAD (RA_MAX_BLOCKS * BLOCK_SIZE)
+
+/* online defragmentation: blocks moved per step, blocks moved per second and seconds between scans for
+ * fragmented files once everything is contiguous
+ */
+#define DEFRAG_STEP_BLOCKS 256
+#define DEFRAG_RATE_BLOCKS 2048
+#define DEFRAG_SCAN_INTERVAL 60
+
+/* tiered mode: seconds for the heat of a file to halve, seconds before delayed writes are written back, and
+ * seconds between runs of the write-back thread
+ */
+#define TIER_HALF_LIFE 30
+#define TIER_WRITEBACK_AGE 5
+#define TIER_WRITEBACK_INTERVAL 1
+
+/* compressed containers store files in extents of this many blocks, each extent is compressed on its own */
+#define EXTENT_BLOCKS 32
+#define EXTENT_SIZE (EXTENT_BLOCKS * BLOCK_SIZE)
+#define EXTENT_MAGIC 0x4d794658 /* "MyFX" */
+#define EXTENT_COMPRESSED 1
+
+/* files up to this size are stored in their directory entry, which fills the entry up to 512 bytes */
+#define INLINE_DATA_SIZE 192
+#define FILE_INLINE 1
+
+/* entries name their directory by its slot in the table, entries of the root directory name ROOT_DIR */
+#define ROOT_DIR NUM_DIR_ENTRIES
+
+/* snapshots are read-only copies of the root directory, exposed below SNAPSHOT_DIR */
+#define NUM_SNAPSHOTS 8
+#define SNAPSHOT_DIR "/.snapshots"
+
+/* inode numbers stay the same across mounts (use_ino): 1 is the root directory, the entries follow by slot, then
+   SNAPSHOT_DIR and one range per snapshot slot, where the root of the snapshot takes the place of ROOT_DIR */
+#define ENTRY_INO(slot) ((slot) == ROOT_DIR ? 1 : (slot) + 2)
+#define SNAPSHOT_DIR_INO (NUM_DIR_ENTRIES + 2)
+#define SNAPSHOT_INO(snap, slot) (SNAPSHOT_DIR_INO + 1 + (snap) * (NUM_DIR_ENTRIES + 1) + (slot))
+
+/* readdir offsets: 1 and 2 follow "." and "..", 3 + slot follows the entry in that slot */
+#define DIR_OFFSET(slot) ((off_t)(slot) + 3)
+#define DIR_FIRST_SLOT(offset) ((offset) <= 2 ? 0 : (offset) - 2 < NUM_DIR_ENTRIES ? (int)((offset) - 2) : NUM_DIR_ENTRIES)
+
+/* setting this attribute of a file to a path creates a clone of the file at that path, see MyOnDiskFS::cloneFile() */
+#define CLONE_XATTR "user.myfs.clone"
+
+/* setting this attribute of the root directory writes the image of an in-memory file system, see
+   MyInMemoryFS::saveImage() */
+#define SAVE_XATTR "user.myfs.save"
+
+/* image of an in-memory file system: a MemImageHeader, then a MemImageEntry for every entry, followed by its name,
+   the stored form of its extended attributes and its data */
+#define MEM_IMAGE_MAGIC 0x4d794649 /* "MyFI" */
+
 // TODO: Add structures of your file system here
 
+// the attributes come first, so getattr and readdir find them in the first cache line of the entry
 struct MyFsFileInfo
 {
-	char name[NAME_LENGTH];
 	size_t size;
 	uid_t uid;
 	gid_t gid;
@@ -33,12 +114,14 @@ struct MyFsFileInfo
 	time_t atime;
 	time_t mtime;
 	time_t ctime;
+	int parent;		// slot of the directory holding the entry, ROOT_DIR for the root directory
 	char *data;
+	char name[NAME_LENGTH];
 };
 
 struct DiskFileInfo
 {
-	char name[NAME_LENGTH];
+	char name[NAME_LENGTH];		// last component of the path
 	size_t size;
 	uid_t uid;
 	gid_t gid;
@@ -46,16 +129,67 @@ struct DiskFileInfo
 	time_t atime;
 	time_t mtime;
 	time_t ctime;
-	int firstblock;
+	int firstblock;			// EOC_BLOCK for files in the entry and for directories
+	int parent;			// slot of the directory holding the entry, ROOT_DIR for the root directory
+	int attrblock;			// first block of the extended attributes, 0 if there are none
+	uint32_t flags;			// FILE_INLINE if the content is kept in data
+	char data[INLINE_DATA_SIZE];	// content of small files, zeros behind size
 };
 
+// all *_start fields are block numbers, all *_size fields are bytes aligned to BLOCK_SIZE
 struct MyFsSuperBlock
 {
+	uint32_t magic;
 	uint32_t fat_start;
+	uint32_t ref_start;
 	uint32_t root_start;
+	uint32_t snap_start;
 	uint32_t data_start;
 	size_t fat_size;
+	size_t ref_size;
 	size_t root_size;
+	size_t snap_size;
+	uint32_t state;		// MYFS_CLEAN after a clean unmount, MYFS_DIRTY while mounted
+	uint32_t map_start;	// free-space bitmap behind the data area, valid if the state is MYFS_CLEAN
+	size_t map_size;
+	size_t free_blocks;	// free blocks at the last clean unmount
+	uint32_t csum_start;	// CRC32C of every data block behind the bitmap, 0 if checksums were never turned on
+	size_t csum_size;
+	uint32_t compressed;	// files are stored in compressed extents, chosen when the container is created
+	uint32_t dedup_start;	// fingerprint of every data block behind the checksums, 0 if dedup was never turned on
+	size_t dedup_size;
+};
+
+struct MemImageHeader
+{
+	uint32_t magic;			// MEM_IMAGE_MAGIC
+	uint32_t count;			// number of entries
+	uint64_t size;			// bytes behind the header
+	uint32_t crc;			// CRC32C of the bytes behind the header
+	uint32_t reserved;
+};
+
+struct MemImageEntry
+{
+	int32_t slot;			// entries keep their slot, so parents stay valid
+	int32_t parent;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t nameLen;
+	uint32_t attrSize;		// size of the stored form of the extended attributes, 0 if there are none
+	uint32_t reserved;
+	uint64_t size;
+	int64_t atime;
+	int64_t mtime;
+	int64_t ctime;
+};
+
+struct DiskSnapshot
+{
+	char name[NAME_LENGTH];
+	time_t ctime;
+	DiskFileInfo files[NUM_DIR_ENTRIES];
 };
 
 /*
@@ -68,9 +202,41 @@ struct MyFsDmap
 };
 */
 
+// header of an extent of a file in a compressed container, followed by the stored bytes in the same chain of blocks
+// The extents of a file follow each other in its chain, extents missing at the end and bytes behind raw_size read as
+// zeros.
+struct ExtentHeader {
+	uint32_t magic;		// EXTENT_MAGIC
+	uint32_t raw_size;	// bytes of the extent without trailing zeros
+	uint32_t stored_size;	// bytes stored behind the header
+	uint32_t flags;		// EXTENT_COMPRESSED if the stored bytes are compressed
+};
+
+// readahead state of an open file handle
+struct ReadaheadState {
+	off_t next_offset;	// offset the next read starts at if access is sequential
+	int window;		// current readahead window in blocks
+	int ra_end;		// first block of the file behind the prefetched range
+};
+
+// open file handle of the on-disk file system, see MyOnDiskFS::fuseOpen()
+// Reads and writes on the handle use the entry resolved by open instead of looking up the path again, and continue
+// walking the chain of the file from the block they looked up last. Small reads and writes within one block go to
+// the block buffer of the handle, see MyOnDiskFS::loadHandleBlock().
 struct OpenFile {
-    int buffer[BLOCK_SIZE];
-    int blockNo;
+	bool used;
+	int index;		// slot of the file in the root directory, -1 for files in snapshots
+	int snapshot;		// slot of the snapshot holding the file, -1 for files in the root directory
+	DiskFileInfo *file;	// entry of the file, NULL once the file or its snapshot is removed
+	ReadaheadState ra;
+	unsigned long chainSeq;	// chainPos and chainBlock are valid as long as the FAT has not changed since
+	int chainFirst;		// first block of the chain they belong to
+	int chainPos;		// position of chainBlock in the file
+	int chainBlock;		// block looked up last
+	char *block;		// content of the file at blockPos, allocated on first use and kept with the slot
+	int blockPos;		// position of the buffered block in the file, -1 if none
+	unsigned long blockSeq;	// block is valid as long as the file has not been written since, see writeSeq
+	bool dirty;		// block holds writes not yet passed to the delayed writes, see writeBackBlock()
 };
 
 #endif /* myfs_structs_h */
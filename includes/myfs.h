@@ -15,11 +15,16 @@
 #include "blockdevice.h"
 #include "myfs-structs.h"
 
+struct MyFsInfo;
+
 class MyFS {
 protected:
     static MyFS *_instance;
     FILE *logFile;
+    MyFsInfo *fsInfo = NULL;
 	int checkPath(const char *path);
+	MyFsInfo *getInfo();
+	void setupConnection(struct fuse_conn_info *conn);
 
     BlockDevice *blockDevice;
 
@@ -30,6 +35,12 @@ public:
     
     MyFS();
     virtual ~MyFS();
+
+    /// @brief Use mount options other than the private data of the FUSE context.
+    ///
+    /// This allows to run a file system without a FUSE session, e.g. in the tests. It must be called before fuseInit().
+    /// \param [in] info Options of the mount, must stay valid as long as the file system is used.
+    void setInfo(MyFsInfo *info);
     
     // --- Methods called by FUSE ---
     // For Documentation see https://libfuse.github.io/doxygen/structfuse__operations.html
@@ -49,6 +60,8 @@ public:
     virtual int fuseOpen(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseReadBuf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseWriteBuf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseStatfs(const char *path, struct statvfs *statInfo);
     virtual int fuseFlush(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRelease(const char *path, struct fuse_file_info *fileInfo);
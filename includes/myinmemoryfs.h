@@ -8,10 +8,13 @@
 
 #include <fuse.h>
 #include <cmath>
+#include <string>
 
 #include "myfs.h"
 #include "blockdevice.h"
 #include "myfs-structs.h"
+#include "dentrycache.h"
+#include "xattrset.h"
 
 /// @brief In-memory implementation of a simple file system.
 class MyInMemoryFS : public MyFS {
@@ -21,6 +24,12 @@ class MyInMemoryFS : public MyFS {
     private:
 	int getFileIndex(const char *file_name);
 	int getFreeSlot(void);
+	void setFileSize(MyFsFileInfo *file, size_t size);
+	int createEntry(const char *path, mode_t mode);
+	void removeEntry(int index);
+	void statEntry(int index, struct stat *statbuf);
+	int loadImage(void);
+	int saveImage(void);
 
     public:
 	static MyInMemoryFS *Instance();
@@ -28,6 +37,12 @@ class MyInMemoryFS : public MyFS {
 	// TODO: [PART 1] Add attributes of your file system here
 	MyFsFileInfo files[NUM_DIR_ENTRIES];
 	int numberOfOpenFiles;
+	bool changed[NUM_DIR_ENTRIES];
+	size_t usedBytes;
+	int freeSlots;
+	DentryCache dentries;
+	XattrSet xattrs[NUM_DIR_ENTRIES];
+	std::string imageFile;		// see loadImage(), empty if there is no image to keep
 
 	MyInMemoryFS();
 	~MyInMemoryFS();
@@ -38,7 +53,9 @@ class MyInMemoryFS : public MyFS {
 	// For Documentation see https://libfuse.github.io/doxygen/structfuse__operations.html
 	virtual int fuseGetattr(const char *path, struct stat *statbuf);
 	virtual int fuseMknod(const char *path, mode_t mode, dev_t dev);
+	virtual int fuseMkdir(const char *path, mode_t mode);
 	virtual int fuseUnlink(const char *path);
+	virtual int fuseRmdir(const char *path);
 	virtual int fuseRename(const char *path, const char *newpath);
 	virtual int fuseChmod(const char *path, mode_t mode);
 	virtual int fuseChown(const char *path, uid_t uid, gid_t gid);
@@ -48,6 +65,17 @@ class MyInMemoryFS : public MyFS {
 			     off_t offset, struct fuse_file_info *fileInfo);
 	virtual int fuseWrite(const char *path, const char *buf, size_t size,
 			      off_t offset, struct fuse_file_info *fileInfo);
+	virtual int fuseStatfs(const char *path, struct statvfs *statInfo);
+#ifdef __APPLE__
+	virtual int fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags,
+				 uint32_t x);
+	virtual int fuseGetxattr(const char *path, const char *name, char *value, size_t size, uint x);
+#else
+	virtual int fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags);
+	virtual int fuseGetxattr(const char *path, const char *name, char *value, size_t size);
+#endif
+	virtual int fuseListxattr(const char *path, char *list, size_t size);
+	virtual int fuseRemovexattr(const char *path, const char *name);
 	virtual int fuseRelease(const char *path,
 				struct fuse_file_info *fileInfo);
 	virtual void *fuseInit(struct fuse_conn_info *conn);
@@ -8,27 +8,189 @@
 
 #include "myfs.h"
 #include "myfs-structs.h"
+#include "blockcache.h"
+#include "blockslab.h"
+#include "dentrycache.h"
+#include "xattrset.h"
+#include "filetier.h"
+
+#include <utility>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// Types of paths below the reserved snapshot directory, see MyOnDiskFS::resolveSnapshotPath().
+enum SnapshotPathType {
+	PATH_REGULAR = 0,	// not below SNAPSHOT_DIR
+	PATH_SNAPSHOT_ROOT,	// SNAPSHOT_DIR itself
+	PATH_SNAPSHOT,		// SNAPSHOT_DIR/<snapshot>
+	PATH_SNAPSHOT_FILE	// SNAPSHOT_DIR/<snapshot>/<file>
+};
+
+/// Buffered blocks of a file by position in the file, sorted by position.
+/// A vector keeps its memory when it is cleared, so buffering a file again does not allocate, see findDelayed().
+typedef std::vector<std::pair<int, char *> > DelayedBlocks;
+
+/// Writes to a file that have not been assigned blocks yet, see MyOnDiskFS::flushFile().
+struct DelayedWrite {
+	size_t size;			// file size including the buffered writes, 0 if nothing is buffered
+	DelayedBlocks blocks;		// buffered blocks from delayedSlab
+	time_t since;			// time of the first buffered write, see writebackLoop()
+};
+
+/// Relocation of a fragmented file into a contiguous run of blocks, see MyOnDiskFS::defragStep().
+struct DefragJob {
+	int index;		// file being relocated, -1 if there is no job
+	int run_start;		// first block of the reserved run
+	int num_blocks;		// length of the file and of the run in blocks
+	int done;		// leading blocks of the file already moved into the run
+	int fragments;		// fragments of the file when the job was started
+};
+
+/// Extents of a file in a compressed container found so far and the last one decompressed, see
+/// MyOnDiskFS::findExtent().
+struct ExtentCache {
+	int firstblock;			// chain the extents belong to
+	std::vector<int> starts;	// first block of every extent found
+	std::vector<int> lengths;	// number of blocks of these extents
+	int next;			// block behind the extents found, EOC_BLOCK once all are found
+	int extent;			// extent held in data, -1 if none
+	char *data;			// decompressed extent of EXTENT_SIZE bytes, allocated on first use
+};
 
 /// @brief On-disk implementation of a simple file system.
 class MyOnDiskFS : public MyFS {
 private:
+	class RequestGuard;
+
 	int numberOfOpenFiles;
+	std::vector<OpenFile> openFiles;	// indexed by file handle, see fuseOpen()
+	unsigned long fatSeq;			// changes of the FAT written so far, see OpenFile
+	unsigned long writeSeq[NUM_DIR_ENTRIES];	// changes of the content of each file so far, see OpenFile
+	int dirtyHandle;			// handle whose block is dirty, -1 if none
+	bool blockLoading;			// a block of a handle is being read, see loadHandleBlock()
+	BlockCache *blockCache;
+	char *scratch;				// two aligned blocks for the block helpers, all callers hold fsLock
+	BlockRequest chainRuns[RA_MAX_BLOCKS];		// runs of a batch of prefetchChain()
+	BlockRequest batchRuns[DELALLOC_BATCH_BLOCKS];	// runs of a batch of flushFile(), computeChecksums(), fuseWriteBuf()
+	BlockRequest tableRuns[TABLE_IO_BLOCKS];	// chunks of a batch of the tables, see sync()
+	std::vector<uint32_t> dirtyCsums;	// blocks of the checksum table to write, see syncChecksums()
+	BlockSlab *delayedSlab;			// buffers of the delayed writes
+	DelayedWrite delayed[NUM_DIR_ENTRIES];
+	ExtentCache extents[NUM_DIR_ENTRIES];
+	size_t delayedBlocks;
+	size_t delayLimit;			// buffered blocks before files are written back, see fuseWrite()
+	bool changed[NUM_DIR_ENTRIES];
+	size_t freeBlocks;
+	int freeSlots;
+	std::recursive_mutex fsLock;		// held by every FUSE request and by each step of the defragmenter
+	unsigned long requests;			// number of FUSE requests started
+	std::thread defragThread;
+	std::condition_variable_any defragWake;
+	bool defragRunning;
+	bool defragStop;
+	DefragJob defragJob;
+	int defragNext;				// next root slot to look at for a fragmented file
+	std::vector<int> quarantine;		// blocks moved away from, see releaseQuarantine()
+	unsigned long quarantineSeq;		// request that was running when they were moved
+	unsigned long spliceSeq;		// last request that replied with pieces of the container
+	DentryCache dentries;			// entries of the root table by directory and name
+	std::vector<DentryCache> snapDentries;	// the same for the entries of every snapshot
+	XattrSet attrs[NUM_DIR_ENTRIES];	// extended attributes of the entries, see getXattrs()
+	bool attrsLoaded[NUM_DIR_ENTRIES];
+	FileTier *tier;				// copies of hot files in tiered mode, NULL if the mode is off
+	bool tierLoading;			// a file is being read into the tier
+	std::thread writebackThread;
+	std::condition_variable_any writebackWake;
+	bool writebackRunning;
+	bool writebackStop;
 
     int getFileIndex(const char *file_name);
     int getFreeRootSlot(void);
+	int createEntry(const char *path, mode_t mode);
+	void removeEntry(int index);
 	int getEmptyBlockFAT(void);
-    bool entryInOneBlock(int fileindex);
-    int getChangedBlockIndex(int fileIndex);
-    int getNumChangedBlocks(int fileIndex);
+	void loadRegion(int region);
+	int &fatEntry(int block);
+	uint16_t &refEntry(int block);
+	void claimBlock(int block);
+	void releaseBlock(int block);
 	void sync(uint32_t dest, void *src, size_t len);
+	void load(uint32_t src, void *dest, size_t len);
+	void syncRange(uint32_t dest, void *src, size_t offset, size_t len);
+	void syncLoaded(uint32_t dest, void *src, size_t len, size_t region_size);
 	void syncFAT();
+	void syncRefs();
+	void syncSuperBlock();
+	int writeRootChunks(int count);
 	void syncRoot();
+	void syncSnapshot(int slot);
+	void syncChecksums();
+	int computeChecksums();
 	int fatToDataAddress(int fat_index);
 	int getEmptyBlockChain(int num_blocks);
+	int findFreeRun(int num_blocks);
+	int getEmptyBlockRun(int num_blocks);
+	int getBlockAt(int start_block, int block_no);
+	int unshareChain(int *link, int num_blocks);
 	int writeData(int block_index, const char *buf, size_t size, int offset_in_block);
 	int readData(int block_index, const char *buf, size_t size, int offset_in_block);
+	int prefetchChain(int block_index, int num_blocks);
+	OpenFile *getHandle(struct fuse_file_info *fileInfo);
+	int handleBlockAt(OpenFile *handle, DiskFileInfo *file, int block_no);
+	void readAhead(OpenFile *handle, DiskFileInfo *file, off_t offset, size_t size);
+	bool inHandleBlock(OpenFile *handle, size_t size, off_t offset);
+	int loadHandleBlock(const char *path, struct fuse_file_info *fileInfo, OpenFile *handle, int block_no);
+	int writeBackBlock();
 	void freeFileData(int start_block);
+	size_t getFileSize(int index);
+	char *getDelayedBlock(int index, int block_no, bool keep_content);
+	DelayedBlocks::iterator delayedFrom(int index, int block_no);
+	char *findDelayed(int index, int block_no);
+	void dropDelayedWrites(int index);
+	int flushFile(int index);
+	int findDuplicate(const char *data, int next, int exclude, char *buffer);
+	int findSharedTail(int index, int from, int to, int *tail);
+	int mergeDuplicates(int index, int num_blocks);
+	void resetExtents(ExtentCache *cache, int firstblock);
+	int findExtent(ExtentCache *cache, DiskFileInfo *file, int extent);
+	int countExtents(ExtentCache *cache, DiskFileInfo *file);
+	int extentEnd(ExtentCache *cache, int extent);
+	int loadExtent(ExtentCache *cache, DiskFileInfo *file, int extent);
+	int readExtents(ExtentCache *cache, DiskFileInfo *file, char *buf, size_t size, off_t offset);
+	int unshareExtents(int index, int extent);
+	int storeExtent(int index, int extent, const char *raw, size_t raw_size);
+	int flushExtents(int index);
+	int truncateExtents(int index, size_t new_size);
+	int flushAll();
+	int flushColdest();
 	void appendBlock(int start_block, int block);
+	bool isSnapshotPath(const char *path);
+	int getSnapshotIndex(const char *name, size_t len);
+	int resolveSnapshotPath(const char *path, int *slot, DiskFileInfo **file);
+	DiskFileInfo *lookupFile(const char *path);
+	void statEntry(DiskFileInfo *table, int index, int snapshot, struct stat *statbuf);
+	void statSnapshotDir(struct stat *statbuf);
+	int createSnapshot(const char *name);
+	int deleteSnapshot(int slot);
+	int cloneFile(const char *path, const char *newpath);
+	int loadXattrs(int start_block, XattrSet *set);
+	int storeXattrs(int index);
+	int getXattrs(const char *path, XattrSet *scratch, XattrSet **set, int *index);
+	int countFragments(int start_block, int *num_blocks);
+	bool isMovable(int index);
+	bool startDefragJob();
+	bool checkDefragJob();
+	void abortDefragJob();
+	void releaseQuarantine(bool force);
+	int defragStep();
+	void defragLoop();
+	void startDefrag();
+	void stopDefrag();
+	void writebackLoop();
+	void startWriteback();
+	void stopWriteback();
 
 protected:
     // BlockDevice blockDevice;
@@ -38,7 +200,6 @@ public:
     static MyOnDiskFS *Instance();
 
     //MyFsFileInfo files[NUM_DIR_ENTRIES];
-    //OpenFile openFiles[NUM_OPEN_FILES];
 
     MyOnDiskFS();
     ~MyOnDiskFS();
@@ -49,7 +210,9 @@ public:
     // For Documentation see https://libfuse.github.io/doxygen/structfuse__operations.html
     virtual int fuseGetattr(const char *path, struct stat *statbuf);
     virtual int fuseMknod(const char *path, mode_t mode, dev_t dev);
+    virtual int fuseMkdir(const char *path, mode_t mode);
     virtual int fuseUnlink(const char *path);
+    virtual int fuseRmdir(const char *path);
     virtual int fuseRename(const char *path, const char *newpath);
     virtual int fuseChmod(const char *path, mode_t mode);
     virtual int fuseChown(const char *path, uid_t uid, gid_t gid);
@@ -57,7 +220,21 @@ public:
     virtual int fuseOpen(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseReadBuf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseWriteBuf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo);
+    virtual int fuseStatfs(const char *path, struct statvfs *statInfo);
+    virtual int fuseFlush(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseRelease(const char *path, struct fuse_file_info *fileInfo);
+    virtual int fuseFsync(const char *path, int datasync, struct fuse_file_info *fi);
+#ifdef __APPLE__
+    virtual int fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags, uint32_t x);
+    virtual int fuseGetxattr(const char *path, const char *name, char *value, size_t size, uint x);
+#else
+    virtual int fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags);
+    virtual int fuseGetxattr(const char *path, const char *name, char *value, size_t size);
+#endif
+    virtual int fuseListxattr(const char *path, char *list, size_t size);
+    virtual int fuseRemovexattr(const char *path, const char *name);
     virtual void* fuseInit(struct fuse_conn_info *conn);
     virtual int fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
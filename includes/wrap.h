@@ -46,6 +46,8 @@ extern "C" {
     int wrap_open(const char *path, struct fuse_file_info *fileInfo);
     int wrap_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     int wrap_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    int wrap_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo);
+    int wrap_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo);
     int wrap_statfs(const char *path, struct statvfs *statInfo);
     int wrap_flush(const char *path, struct fuse_file_info *fileInfo);
     int wrap_release(const char *path, struct fuse_file_info *fileInfo);
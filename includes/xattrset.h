@@ -0,0 +1,99 @@
+//
+//  xattrset.h
+//  myfs
+//
+
+#ifndef xattrset_h
+#define xattrset_h
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/* limits of a single attribute and of all attributes of a file */
+#define XATTR_NAME_MAX_LEN 255
+#define XATTR_VALUE_MAX_LEN 65536
+#define XATTR_MAX_BYTES (1 << 20)
+
+#define XATTR_MAGIC 0x4d794641 /* "MyFA" */
+
+// header of the attributes of a file in their stored form, followed by one XattrRecord with name and value for each
+// attribute
+struct XattrHeader {
+    uint32_t magic;     // XATTR_MAGIC
+    uint32_t count;     // number of attributes
+    uint32_t size;      // bytes behind the header
+};
+
+struct XattrRecord {
+    uint32_t nameLen;
+    uint32_t valueLen;
+};
+
+/// @brief Extended attributes of a file
+///
+/// The attributes are kept in a sorted map, so looking one up takes a few string compares even for files with
+/// thousands of attributes, and listing them gives the same order every time. The stored form packs all attributes
+/// into one buffer, the file systems keep it in the directory entry's own chain of blocks.
+class XattrSet {
+private:
+    std::map<std::string, std::string> attrs;
+    size_t bytes;   // size of the stored form without the header
+
+public:
+    XattrSet();
+
+    /// @brief Get the value of an attribute.
+    ///
+    /// \param [in] name Name of the attribute.
+    /// \param [out] value Buffer for the value, not terminated by '\0'.
+    /// \param [in] size Size of the buffer, 0 to ask for the length of the value.
+    /// \return Length of the value, -ENODATA if there is no such attribute, -ERANGE if the buffer is too small.
+    int get(const char *name, char *value, size_t size) const;
+
+    /// @brief Set the value of an attribute.
+    ///
+    /// \param [in] name Name of the attribute.
+    /// \param [in] value Value, not necessarily terminated by '\0'.
+    /// \param [in] size Length of the value.
+    /// \param [in] flags XATTR_CREATE to fail if the attribute exists, XATTR_REPLACE to fail if it does not.
+    /// \return 0 on success, -EEXIST or -ENODATA as requested by the flags, -ERANGE for a name that is too long,
+    /// -E2BIG for a value that is too long and -ENOSPC if the attributes of the file would exceed XATTR_MAX_BYTES.
+    int set(const char *name, const char *value, size_t size, int flags);
+
+    /// @brief Remove an attribute.
+    ///
+    /// \return 0 on success, -ENODATA if there is no such attribute.
+    int remove(const char *name);
+
+    /// @brief List the names of all attributes.
+    ///
+    /// \param [out] list Buffer for the names, each one terminated by '\0'.
+    /// \param [in] size Size of the buffer, 0 to ask for the length of the list.
+    /// \return Length of the list, -ERANGE if the buffer is too small.
+    int list(char *list, size_t size) const;
+
+    /// @brief Size of the stored form including the header, 0 if there are no attributes.
+    size_t storedSize() const;
+
+    /// @brief Store all attributes.
+    ///
+    /// \param [out] buf Buffer of at least storedSize() bytes.
+    void store(char *buf) const;
+
+    /// @brief Replace all attributes by the ones of a stored form.
+    ///
+    /// \param [in] buf Stored form.
+    /// \param [in] len Number of bytes available in buf.
+    /// \return 0 on success, -EIO if the stored form is damaged, the set is empty then.
+    int load(const char *buf, size_t len);
+
+    /// @brief Remove all attributes.
+    void clear();
+
+    /// @brief Number of attributes.
+    size_t size() const { return attrs.size(); }
+};
+
+#endif /* xattrset_h */
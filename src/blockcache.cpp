@@ -0,0 +1,255 @@
+//
+//  blockcache.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <vector>
+
+#include "blockcache.h"
+#include "crc32c.h"
+
+BlockCache::BlockCache(BlockDevice *device, uint32_t blockSize, size_t capacity) {
+    this->device = device;
+    this->blockSize = blockSize;
+    this->capacity = capacity;
+    this->hits = 0;
+    this->misses = 0;
+    this->checksumErrors = 0;
+    this->checksums = NULL;
+    this->csumFirst = 0;
+    this->csumCount = 0;
+}
+
+BlockCache::~BlockCache() {
+    clear();
+}
+
+// Get a cache entry for a block, the least recently used entry is reused if the cache is full.
+// Returns the buffer of the entry, NULL if no memory is available.
+char *BlockCache::insert(uint32_t blockNo) {
+    std::unordered_map<uint32_t, std::list<Entry>::iterator>::iterator it = index.find(blockNo);
+    if (it != index.end()) {
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->data;
+    }
+
+    Entry e;
+    if (lru.size() >= capacity) {
+        e = lru.back();
+        lru.pop_back();
+        index.erase(e.blockNo);
+    } else {
+        e.data = (char *) malloc(blockSize);
+        if (e.data == NULL)
+            return NULL;
+    }
+
+    e.blockNo = blockNo;
+    lru.push_front(e);
+    index[blockNo] = lru.begin();
+
+    return e.data;
+}
+
+// Remove a block from the cache
+void BlockCache::drop(uint32_t blockNo) {
+    std::unordered_map<uint32_t, std::list<Entry>::iterator>::iterator it = index.find(blockNo);
+    if (it != index.end()) {
+        free(it->second->data);
+        lru.erase(it->second);
+        index.erase(it);
+    }
+}
+
+// Compute the checksum of a block that is written, if it is in the checksummed range
+void BlockCache::updateChecksum(uint32_t blockNo, const char *data) {
+    if (checksums == NULL || blockNo < csumFirst || blockNo - csumFirst >= csumCount)
+        return;
+
+    uint32_t i = blockNo - csumFirst;
+    checksums[i] = crc32c(0, data, blockSize);
+    csumDirty[(size_t) i * sizeof(uint32_t) / blockSize] = true;
+}
+
+// Check a block read from the device against its checksum
+bool BlockCache::verifyChecksum(uint32_t blockNo, const char *data) {
+    if (checksums == NULL || blockNo < csumFirst || blockNo - csumFirst >= csumCount)
+        return true;
+
+    if (crc32c(0, data, blockSize) == checksums[blockNo - csumFirst])
+        return true;
+
+    checksumErrors++;
+    return false;
+}
+
+int BlockCache::read(uint32_t blockNo, char *buffer) {
+    std::unordered_map<uint32_t, std::list<Entry>::iterator>::iterator it = index.find(blockNo);
+    if (it != index.end()) {
+        hits++;
+        lru.splice(lru.begin(), lru, it->second);
+        memcpy(buffer, it->second->data, blockSize);
+        return 0;
+    }
+
+    misses++;
+    int ret = device->read(blockNo, buffer);
+    if (ret < 0)
+        return ret;
+    if (!verifyChecksum(blockNo, buffer))
+        return -EIO;
+
+    char *data = insert(blockNo);
+    if (data != NULL)
+        memcpy(data, buffer, blockSize);
+
+    return 0;
+}
+
+int BlockCache::write(uint32_t blockNo, char *buffer) {
+    int ret = device->write(blockNo, buffer);
+    if (ret < 0) {
+        // the device content is unknown now
+        drop(blockNo);
+        return ret;
+    }
+
+    updateChecksum(blockNo, buffer);
+    char *data = insert(blockNo);
+    if (data != NULL)
+        memcpy(data, buffer, blockSize);
+
+    return 0;
+}
+
+int BlockCache::writeBlocks(uint32_t blockNo, uint32_t count, char *buffer) {
+    BlockRequest request = { blockNo, count, buffer };
+
+    return writeBatch(&request, 1);
+}
+
+int BlockCache::writeBatch(BlockRequest *requests, int count) {
+    int ret = (count == 1) ? device->writeBlocks(requests[0].blockNo, requests[0].count, requests[0].buffer) :
+              device->writeBatch(requests, count);
+
+    for (int r = 0; r < count; r++) {
+        for (uint32_t i = 0; i < requests[r].count; i++) {
+            if (ret < 0) {
+                drop(requests[r].blockNo + i);
+                continue;
+            }
+            updateChecksum(requests[r].blockNo + i, requests[r].buffer + (size_t) i * blockSize);
+            char *data = insert(requests[r].blockNo + i);
+            if (data != NULL)
+                memcpy(data, requests[r].buffer + (size_t) i * blockSize, blockSize);
+        }
+    }
+
+    return ret;
+}
+
+int BlockCache::load(uint32_t blockNo, uint32_t count) {
+    BlockRequest run = { blockNo, count, NULL };
+
+    return loadBatch(&run, 1);
+}
+
+int BlockCache::loadBatch(const BlockRequest *runs, int count) {
+    std::vector<BlockRequest> missing;
+    size_t total = 0;
+
+    // collect the runs of blocks that are not cached yet
+    for (int r = 0; r < count; r++) {
+        uint32_t block = runs[r].blockNo;
+        uint32_t end = runs[r].blockNo + runs[r].count;
+
+        while (block < end) {
+            if (contains(block)) {
+                block++;
+                continue;
+            }
+
+            uint32_t run = 1;
+            while (block + run < end && !contains(block + run))
+                run++;
+
+            BlockRequest request = { block, run, NULL };
+            missing.push_back(request);
+            total += run;
+            block += run;
+        }
+    }
+
+    if (missing.empty())
+        return 0;
+
+    // aligned, so runs at aligned blocks can bypass the page cache of the host without copying
+    void *mem;
+    if (posix_memalign(&mem, BD_DIRECT_ALIGN, total * blockSize) != 0)
+        return -ENOMEM;
+    char *buf = (char *) mem;
+
+    size_t pos = 0;
+    for (size_t r = 0; r < missing.size(); r++) {
+        missing[r].buffer = buf + pos * blockSize;
+        pos += missing[r].count;
+    }
+
+    int ret = (missing.size() == 1) ? device->readBlocks(missing[0].blockNo, missing[0].count, buf) :
+              device->readBatch(missing.data(), (int) missing.size());
+    if (ret < 0) {
+        free(buf);
+        return ret;
+    }
+
+    for (size_t r = 0; r < missing.size(); r++) {
+        for (uint32_t i = 0; i < missing[r].count; i++) {
+            if (!verifyChecksum(missing[r].blockNo + i, missing[r].buffer + (size_t) i * blockSize)) {
+                ret = -EIO;
+                continue;
+            }
+            char *data = insert(missing[r].blockNo + i);
+            if (data != NULL)
+                memcpy(data, missing[r].buffer + (size_t) i * blockSize, blockSize);
+        }
+    }
+
+    free(buf);
+    return ret < 0 ? ret : 0;
+}
+
+void BlockCache::invalidate(uint32_t blockNo) {
+    drop(blockNo);
+}
+
+bool BlockCache::contains(uint32_t blockNo) {
+    return index.find(blockNo) != index.end();
+}
+
+void BlockCache::clear() {
+    for (std::list<Entry>::iterator it = lru.begin(); it != lru.end(); it++)
+        free(it->data);
+    lru.clear();
+    index.clear();
+}
+
+void BlockCache::setChecksums(uint32_t first, uint32_t count, uint32_t *table) {
+    this->checksums = table;
+    this->csumFirst = first;
+    this->csumCount = count;
+    this->csumDirty.assign(table == NULL ? 0 : ((size_t) count * sizeof(uint32_t) + blockSize - 1) / blockSize,
+                           false);
+}
+
+void BlockCache::dirtyChecksums(std::vector<uint32_t> &blocks) {
+    blocks.clear();
+    for (size_t b = 0; b < csumDirty.size(); b++) {
+        if (csumDirty[b]) {
+            blocks.push_back(b);
+            csumDirty[b] = false;
+        }
+    }
+}
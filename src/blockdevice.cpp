@@ -19,12 +19,43 @@
 #include "macros.h"
 
 #include "blockdevice.h"
+#include "iouring.h"
 
 #undef DEBUG
 
 BlockDevice::BlockDevice(uint32_t blockSize) {
     assert(blockSize % 512 == 0);
     this->blockSize= blockSize;
+    this->contFile= -1;
+    this->ring= new IoUring();
+    this->direct= false;
+}
+
+BlockDevice::~BlockDevice() {
+    delete this->ring;
+    for (size_t i = 0; i < this->pool.size(); i++)
+        free(this->pool[i]);
+}
+
+// Prepare I/O on a freshly opened container file
+void BlockDevice::setupIO() {
+    // not all host file systems support O_DIRECT, use the page cache then
+    if (this->direct) {
+#if defined(O_DIRECT)
+        int flags = fcntl(this->contFile, F_GETFL);
+        if (flags < 0 || fcntl(this->contFile, F_SETFL, flags | O_DIRECT) < 0)
+            this->direct = false;
+#elif defined(F_NOCACHE)
+        // macOS has no O_DIRECT, but can keep the data of a file out of its cache
+        if (fcntl(this->contFile, F_NOCACHE, 1) < 0)
+            this->direct = false;
+#else
+        this->direct = false;
+#endif
+    }
+
+    // without io_uring, batches fall back to pread/pwrite
+    this->ring->setup(BD_RING_DEPTH);
 }
 
 int BlockDevice::create(const char *path) {
@@ -47,6 +78,9 @@ int BlockDevice::create(const char *path) {
     }
     
 //    this->size= 0;
+
+    if (ret == 0)
+        setupIO();
     
     return ret;
 }
@@ -67,6 +101,9 @@ int BlockDevice::open(const char *path) {
 
     }
 
+    if (ret == 0)
+        setupIO();
+
     return ret;
 }
 
@@ -75,6 +112,8 @@ int BlockDevice::close() {
 
     int ret= 0;
 
+    this->ring->teardown();
+
     if(::close(this->contFile) < 0)
         ret= -errno;
     
@@ -86,6 +125,9 @@ int BlockDevice::read(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Reading block %d\n", blockNo);
 #endif
+    if (this->direct)
+        return transfer(false, blockNo, 1, buffer);
+
     off_t pos = (off_t) blockNo * this->blockSize;
     if (lseek (this->contFile, pos, SEEK_SET) != pos)
         return -errno;
@@ -105,6 +147,9 @@ int BlockDevice::write(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Writing block %d\n", blockNo);
 #endif
+    if (this->direct)
+        return transfer(true, blockNo, 1, buffer);
+
     off_t pos = (off_t) blockNo * this->blockSize;
     if (lseek (this->contFile, pos, SEEK_SET) != pos)
         return -errno;
@@ -119,3 +164,247 @@ int BlockDevice::write(uint32_t blockNo, char *buffer) {
     return 0;
 }
 
+// Check if a transfer can be done with O_DIRECT as it is
+bool BlockDevice::isAligned(uint32_t blockNo, uint32_t count, const char *buffer) {
+    return ((off_t) blockNo * this->blockSize) % BD_DIRECT_ALIGN == 0 &&
+           ((size_t) count * this->blockSize) % BD_DIRECT_ALIGN == 0 &&
+           (uintptr_t) buffer % BD_DIRECT_ALIGN == 0;
+}
+
+// Read or write consecutive blocks with pread/pwrite, blocks past the end of the file read as zero
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::transfer(bool write, uint32_t blockNo, uint32_t count, char *buffer) {
+    if (this->direct && !isAligned(blockNo, count, buffer))
+        return bounce(write, blockNo, count, buffer);
+
+    off_t pos = (off_t) blockNo * this->blockSize;
+    size_t size = (size_t) count * this->blockSize;
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t r;
+        if (write)
+            r = ::pwrite(this->contFile, buffer + done, size - done, pos + done);
+        else
+            r = ::pread(this->contFile, buffer + done, size - done, pos + done);
+        if (r < 0)
+            return -errno;
+        if (r == 0) {
+            if (write)
+                return -ENOSPC;
+            break;
+        }
+        done += r;
+    }
+    if (done < size)
+        memset(buffer + done, 0, size - done);
+
+    return 0;
+}
+
+// Transfer blocks that are not aligned for O_DIRECT through a buffer of the pool
+// Every chunk is widened to whole BD_DIRECT_ALIGN units, for writes the units at both ends are read first.
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::bounce(bool write, uint32_t blockNo, uint32_t count, char *buffer) {
+    const uint32_t unit = BD_DIRECT_ALIGN / this->blockSize;
+    int ret = 0;
+
+    char *buf = allocBuffer();
+    if (buf == NULL)
+        return -ENOMEM;
+
+    while (count > 0) {
+        uint32_t start = blockNo - blockNo % unit;
+        uint32_t head = blockNo - start;
+        uint32_t n = BD_POOL_BUFFER_SIZE / this->blockSize - head;
+        if (n > count)
+            n = count;
+        uint32_t span = (head + n + unit - 1) / unit * unit;
+
+        if (!write) {
+            ret = transfer(false, start, span, buf);
+        } else {
+            if (head != 0)
+                ret = transfer(false, start, unit, buf);
+            if (ret == 0 && (head + n) % unit != 0 && (span > unit || head == 0))
+                ret = transfer(false, start + span - unit, unit, buf + (size_t) (span - unit) * this->blockSize);
+        }
+        if (ret < 0)
+            break;
+
+        if (write) {
+            memcpy(buf + (size_t) head * this->blockSize, buffer, (size_t) n * this->blockSize);
+            ret = transfer(true, start, span, buf);
+            if (ret < 0)
+                break;
+        } else {
+            memcpy(buffer, buf + (size_t) head * this->blockSize, (size_t) n * this->blockSize);
+        }
+
+        blockNo += n;
+        count -= n;
+        buffer += (size_t) n * this->blockSize;
+    }
+
+    releaseBuffer(buf);
+    return ret;
+}
+
+// Submit all runs of a batch through the ring and wait until they completed.
+// A run that was transferred only partially is finished with transfer().
+// this method returns 0 if successful, -errno of the first failed run otherwise
+int BlockDevice::batch(bool write, BlockRequest *requests, int count) {
+    int ret = 0;
+
+    if (!this->ring->available()) {
+        for (int i = 0; i < count; i++) {
+            ret = transfer(write, requests[i].blockNo, requests[i].count, requests[i].buffer);
+            if (ret < 0)
+                return ret;
+        }
+        return 0;
+    }
+
+    int next = 0, inflight = 0;
+    while (next < count || inflight > 0) {
+        while (next < count) {
+            BlockRequest *req = &requests[next];
+
+            // runs that cannot bypass the page cache as they are go through the buffer pool
+            if (this->direct && !isAligned(req->blockNo, req->count, req->buffer)) {
+                ret = transfer(write, req->blockNo, req->count, req->buffer);
+                next = (ret < 0) ? count : next + 1;
+                continue;
+            }
+
+            if (!this->ring->queue(write, this->contFile, req->buffer, (size_t) req->count * this->blockSize,
+                                   (off_t) req->blockNo * this->blockSize, next))
+                break;
+            next++;
+            inflight++;
+        }
+        if (inflight == 0)
+            break;
+
+        int r = this->ring->submit(1);
+        if (r < 0)
+            return r;
+
+        uint64_t tag;
+        int res;
+        while (this->ring->complete(&tag, &res)) {
+            BlockRequest *req = &requests[tag];
+            size_t size = (size_t) req->count * this->blockSize;
+
+            inflight--;
+            if (res < 0) {
+                if (ret == 0)
+                    ret = res;
+                // do not start further runs after a failure
+                next = count;
+            } else if ((size_t) res < size && ret == 0) {
+                uint32_t done = (uint32_t) res / this->blockSize;
+                char *buf = req->buffer + (size_t) done * this->blockSize;
+
+                // short transfers are finished synchronously, res is not necessarily block aligned
+                ret = transfer(write, req->blockNo + done, req->count - done, buf);
+                if (ret < 0)
+                    next = count;
+            }
+        }
+    }
+
+    return ret;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readBlocks(uint32_t blockNo, uint32_t count, char *buffer) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Reading blocks %d-%d\n", blockNo, blockNo + count - 1);
+#endif
+    return transfer(false, blockNo, count, buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeBlocks(uint32_t blockNo, uint32_t count, char *buffer) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Writing blocks %d-%d\n", blockNo, blockNo + count - 1);
+#endif
+    return transfer(true, blockNo, count, buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readBatch(BlockRequest *requests, int count) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Reading batch of %d runs\n", count);
+#endif
+    return batch(false, requests, count);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeBatch(BlockRequest *requests, int count) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: Writing batch of %d runs\n", count);
+#endif
+    return batch(true, requests, count);
+}
+
+bool BlockDevice::asyncIO() {
+    return this->ring->available();
+}
+
+int BlockDevice::fileDescriptor() {
+    return this->contFile;
+}
+
+void BlockDevice::setDirectIO(bool enable) {
+    this->direct = enable;
+}
+
+bool BlockDevice::directIO() {
+    return this->direct;
+}
+
+char *BlockDevice::allocBuffer() {
+    void *buffer;
+
+    if (!this->pool.empty()) {
+        buffer = this->pool.back();
+        this->pool.pop_back();
+        return (char *) buffer;
+    }
+
+    if (posix_memalign(&buffer, BD_DIRECT_ALIGN, BD_POOL_BUFFER_SIZE) != 0)
+        return NULL;
+
+    return (char *) buffer;
+}
+
+void BlockDevice::releaseBuffer(char *buffer) {
+    if (buffer == NULL)
+        return;
+
+    if (this->pool.size() < BD_POOL_BUFFERS)
+        this->pool.push_back(buffer);
+    else
+        free(buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::sync() {
+    if (::fsync(this->contFile) < 0)
+        return -errno;
+
+    return 0;
+}
+
+void BlockDevice::prefetch(uint32_t blockNo, uint32_t count) {
+    // there is no page cache to fill
+    if (this->direct)
+        return;
+
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(this->contFile, (off_t) blockNo * this->blockSize, (off_t) count * this->blockSize,
+                  POSIX_FADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,59 @@
+//
+//  blockslab.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+
+#include "blockslab.h"
+
+BlockSlab::BlockSlab(size_t blockSize, size_t chunkBlocks, size_t reserved) {
+    this->blockSize = blockSize;
+    this->chunkBlocks = chunkBlocks;
+    this->freeList = NULL;
+    this->used = 0;
+    this->capacity = 0;
+
+    if (reserved > 0)
+        grow(reserved);
+}
+
+BlockSlab::~BlockSlab() {
+    for (size_t i = 0; i < chunks.size(); i++)
+        free(chunks[i]);
+}
+
+// Add a chunk of buffers to the free list
+bool BlockSlab::grow(size_t blocks) {
+    char *chunk = (char *) malloc(blocks * blockSize);
+    if (chunk == NULL)
+        return false;
+
+    chunks.push_back(chunk);
+    for (size_t i = blocks; i > 0; i--) {
+        char *block = chunk + (i - 1) * blockSize;
+        memcpy(block, &freeList, sizeof(char *));
+        freeList = block;
+    }
+    capacity += blocks;
+
+    return true;
+}
+
+char *BlockSlab::get() {
+    if (freeList == NULL && !grow(chunkBlocks))
+        return NULL;
+
+    char *block = freeList;
+    memcpy(&freeList, block, sizeof(char *));
+    used++;
+
+    return block;
+}
+
+void BlockSlab::put(char *block) {
+    memcpy(block, &freeList, sizeof(char *));
+    freeList = block;
+    used--;
+}
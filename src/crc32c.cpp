@@ -0,0 +1,137 @@
+//
+//  crc32c.cpp
+//  myfs
+//
+
+#include <cstring>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARMV8
+#endif
+
+/* reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+// Tables for slicing-by-8, table[k][b] is the checksum of byte b followed by k zero bytes
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = b;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; b++) {
+            for (int k = 1; k < 8; k++)
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+        }
+    }
+};
+
+static const Crc32cTables tables;
+
+uint32_t crc32cSoftware(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    const uint32_t (*t)[256] = tables.table;
+
+    crc = ~crc;
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;  // little endian, like every host MyFS runs on
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+    return ~crc;
+}
+
+#if defined(CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHw(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+
+    crc = ~crc;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return ~crc;
+}
+
+static bool hwAvailable() {
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(CRC32C_ARMV8)
+// only built if the compiler targets CPUs with the CRC32 extension, so no check at run time is needed
+static uint32_t crc32cHw(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+        crc = __crc32cb(crc, *p++);
+
+    return ~crc;
+}
+
+static bool hwAvailable() {
+    return true;
+}
+#else
+static uint32_t crc32cHw(uint32_t crc, const void *data, size_t len) {
+    return crc32cSoftware(crc, data, len);
+}
+
+static bool hwAvailable() {
+    return false;
+}
+#endif
+
+bool crc32cHardware() {
+    static const bool available = hwAvailable();
+
+    return available;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    if (crc32cHardware())
+        return crc32cHw(crc, data, len);
+    return crc32cSoftware(crc, data, len);
+}
@@ -0,0 +1,110 @@
+//
+//  dentrycache.cpp
+//  myfs
+//
+
+#include <cstring>
+#include <errno.h>
+
+#include "dentrycache.h"
+
+DentryCache::DentryCache(int rootDir) {
+    this->rootDir = rootDir;
+}
+
+void DentryCache::insert(int dir, const char *name, int index, bool directory) {
+    Key key = { dir, name };
+    auto result = entries.emplace(key, Value { index, directory });
+    if (!result.second) {
+        // replaced entries keep the counters of their directory balanced
+        if (result.first->second.directory)
+            subdirs[dir]--;
+        children[dir].erase(result.first->second.index);
+        result.first->second = Value { index, directory };
+    }
+    children[dir].insert(index);
+    if (directory)
+        subdirs[dir]++;
+}
+
+void DentryCache::remove(int dir, const char *name) {
+    auto it = entries.find(Key { dir, name });
+    if (it == entries.end())
+        return;
+    if (it->second.directory && --subdirs[dir] == 0)
+        subdirs.erase(dir);
+    auto members = children.find(dir);
+    members->second.erase(it->second.index);
+    if (members->second.empty())
+        children.erase(members);
+    entries.erase(it);
+}
+
+int DentryCache::lookup(int dir, const char *name, size_t len, bool *directory) const {
+    auto it = entries.find(Key { dir, std::string(name, len) });
+    if (it == entries.end())
+        return -1;
+    if (directory != NULL)
+        *directory = it->second.directory;
+    return it->second.index;
+}
+
+int DentryCache::resolve(const char *path, int *dir, const char **name) const {
+    int current = rootDir;
+    bool isDir = true;
+
+    *dir = -1;
+    *name = path + strlen(path);
+
+    const char *p = path;
+    while (*p == '/')
+        p++;
+    while (*p != '\0') {
+        const char *end = strchr(p, '/');
+        size_t len = (end != NULL) ? (size_t) (end - p) : strlen(p);
+        const char *next = p + len;
+        while (*next == '/')
+            next++;
+
+        if (!isDir)
+            return -ENOTDIR;
+        if (*next == '\0') {
+            // last component
+            *dir = current;
+            *name = p;
+            int index = lookup(current, p, len, NULL);
+            return (index >= 0) ? index : -ENOENT;
+        }
+        current = lookup(current, p, len, &isDir);
+        if (current < 0)
+            return -ENOENT;
+        p = next;
+    }
+
+    // the root directory itself
+    *dir = rootDir;
+    return rootDir;
+}
+
+size_t DentryCache::countChildren(int dir) const {
+    auto it = children.find(dir);
+    return (it != children.end()) ? it->second.size() : 0;
+}
+
+const std::set<int> &DentryCache::childrenOf(int dir) const {
+    static const std::set<int> none;
+
+    auto it = children.find(dir);
+    return (it != children.end()) ? it->second : none;
+}
+
+size_t DentryCache::countSubdirs(int dir) const {
+    auto it = subdirs.find(dir);
+    return (it != subdirs.end()) ? it->second : 0;
+}
+
+void DentryCache::clear() {
+    entries.clear();
+    children.clear();
+    subdirs.clear();
+}
@@ -0,0 +1,115 @@
+//
+//  filetier.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "filetier.h"
+
+FileTier::FileTier(size_t budget, double halfLife) {
+    this->budget = budget;
+    this->bytes = 0;
+    this->halfLife = halfLife;
+    this->hits = 0;
+    this->misses = 0;
+}
+
+double FileTier::decayed(const File &file, double now) const {
+    if (now <= file.stamp)
+        return file.heat;
+    return file.heat * std::exp2((file.stamp - now) / halfLife);
+}
+
+void FileTier::touch(int file, size_t len, double now) {
+    auto it = files.find(file);
+    if (it == files.end())
+        it = files.emplace(file, File { 0, now, false, std::vector<char>() }).first;
+
+    it->second.heat = decayed(it->second, now) + len;
+    it->second.stamp = now;
+}
+
+double FileTier::heat(int file, double now) const {
+    auto it = files.find(file);
+    return (it != files.end()) ? decayed(it->second, now) : 0;
+}
+
+int FileTier::read(int file, char *buf, size_t size, size_t offset) {
+    auto it = files.find(file);
+    if (it == files.end() || !it->second.resident) {
+        misses++;
+        return -1;
+    }
+
+    hits++;
+    const std::vector<char> &data = it->second.data;
+    if (offset >= data.size())
+        return 0;
+    size = std::min(size, data.size() - offset);
+    memcpy(buf, data.data() + offset, size);
+    return (int) size;
+}
+
+bool FileTier::admit(int file, size_t size, double now) {
+    auto it = files.find(file);
+    if (it == files.end() || it->second.resident || size == 0 || size > budget)
+        return false;
+
+    double candidate = decayed(it->second, now);
+    if (candidate < size)
+        return false;
+    if (bytes + size <= budget)
+        return true;
+
+    // the coldest copies go first, but only ones colder than the candidate
+    std::vector<std::pair<double, int>> victims;
+    for (auto &f : files) {
+        if (f.second.resident)
+            victims.push_back(std::make_pair(decayed(f.second, now), f.first));
+    }
+    std::sort(victims.begin(), victims.end());
+
+    size_t freed = 0;
+    size_t count = 0;
+    while (bytes - freed + size > budget && count < victims.size() && victims[count].first < candidate)
+        freed += files[victims[count++].second].data.size();
+    if (bytes - freed + size > budget)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+        drop(victims[i].second);
+    return true;
+}
+
+void FileTier::store(int file, const char *data, size_t size) {
+    auto it = files.find(file);
+    if (it == files.end() || it->second.resident)
+        return;
+
+    it->second.data.assign(data, data + size);
+    it->second.resident = true;
+    bytes += size;
+}
+
+void FileTier::drop(int file) {
+    auto it = files.find(file);
+    if (it == files.end() || !it->second.resident)
+        return;
+
+    bytes -= it->second.data.size();
+    it->second.resident = false;
+    std::vector<char>().swap(it->second.data);
+}
+
+void FileTier::forget(int file) {
+    drop(file);
+    files.erase(file);
+}
+
+void FileTier::clear() {
+    files.clear();
+    bytes = 0;
+}
@@ -0,0 +1,618 @@
+//
+//  fsck.cpp
+//  myfs
+//
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <thread>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "fsck.h"
+
+/* results of walk() that are no block numbers */
+#define CHAIN_INTACT -2
+#define CHAIN_BROKEN_ENTRY -1
+
+/* results of checkBlocks() */
+#define BLOCK_OK 0
+#define BLOCK_LEAKED 1
+#define BLOCK_BAD_REFS 2
+
+MyFsChecker::MyFsChecker(bool repair, unsigned threads) {
+    this->device = new BlockDevice(BLOCK_SIZE);
+    this->repair = repair;
+    this->numThreads = (threads > 0) ? threads : std::thread::hardware_concurrency();
+    if (this->numThreads == 0)
+        this->numThreads = 1;
+    this->problems = 0;
+    this->unfixed = 0;
+    this->fat = NULL;
+    this->refs = NULL;
+    this->root = NULL;
+    this->snaps = NULL;
+    this->links = new std::atomic<uint32_t>[FAT_ENTRY_COUNT];
+    this->reached = new std::atomic<bool>[FAT_ENTRY_COUNT];
+}
+
+MyFsChecker::~MyFsChecker() {
+    free(this->fat);
+    free(this->refs);
+    free(this->root);
+    free(this->snaps);
+    delete[] this->links;
+    delete[] this->reached;
+    delete this->device;
+}
+
+// Print a problem and count it
+// \param [in] fixable The problem is repaired in memory, it is written back if repairing is enabled.
+void MyFsChecker::report(bool fixable, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+
+    if (this->repair)
+        printf(fixable ? " - repaired\n" : " - not repaired\n");
+    else
+        printf("\n");
+
+    this->problems++;
+    if (!fixable || !this->repair)
+        this->unfixed++;
+}
+
+// Table of directory entries an entry belongs to
+DiskFileInfo *MyFsChecker::entryTable(size_t entry) {
+    return (this->snapshotOf[entry] < 0) ? this->root : this->snaps[this->snapshotOf[entry]].files;
+}
+
+// Check if a parent id names a directory of a table
+static bool isDirectory(const DiskFileInfo *files, int dir) {
+    return dir >= 0 && dir < NUM_DIR_ENTRIES && files[dir].name[0] != '\0' && S_ISDIR(files[dir].mode);
+}
+
+// Path of an entry as seen in the mounted file system
+// Directories that do not exist end the path, so do loops after as many directories as there are entries.
+std::string MyFsChecker::entryName(size_t entry) {
+    DiskFileInfo *files = entryTable(entry);
+    std::string name = std::string("/") + this->entries[entry]->name;
+    int dir = this->entries[entry]->parent;
+
+    for (int steps = 0; dir != ROOT_DIR && steps < NUM_DIR_ENTRIES && isDirectory(files, dir); steps++) {
+        name = std::string("/") + files[dir].name + name;
+        dir = files[dir].parent;
+    }
+
+    if (this->snapshotOf[entry] >= 0)
+        name = std::string(SNAPSHOT_DIR) + "/" + this->snaps[this->snapshotOf[entry]].name + name;
+
+    return name;
+}
+
+// Check if a link points to a block in use
+bool MyFsChecker::validBlock(int block) {
+    return block > 0 && block < (int) FAT_ENTRY_COUNT && this->fat[block] != EMPTY_BLOCK;
+}
+
+// Name of a chain for reports
+std::string MyFsChecker::chainName(size_t chain) {
+    if (chain < this->entries.size())
+        return entryName(chain);
+    return entryName(this->chainOwner[chain]) + " (attributes)";
+}
+
+// Collect the chains to check, the data chains of all entries first, so a data chain has the index of its entry
+void MyFsChecker::collectChains() {
+    this->chains.clear();
+    this->chainOwner.clear();
+
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        this->chains.push_back(&this->entries[i]->firstblock);
+        this->chainOwner.push_back(i);
+    }
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        if (this->entries[i]->attrblock == 0)
+            continue;
+        this->chains.push_back(&this->entries[i]->attrblock);
+        this->chainOwner.push_back(i);
+    }
+}
+
+// Follow a chain up to the first bad link
+// A link is bad if it points outside the FAT, to a free block or back into the chain.
+// \param [in] chain Index of the chain.
+// \param [in,out] seen Blocks visited, marked with chain + 1, one array per thread.
+// \param [out] target Block the bad link points to.
+// \return CHAIN_INTACT, CHAIN_BROKEN_ENTRY if the link in the entry is bad, otherwise the block with the bad link.
+int MyFsChecker::walk(size_t chain, std::vector<uint32_t> &seen, int *target) {
+    int prev = CHAIN_BROKEN_ENTRY;
+    int block = *this->chains[chain];
+
+    while (block != EOC_BLOCK) {
+        if (!validBlock(block) || seen[block] == chain + 1) {
+            *target = block;
+            return prev;
+        }
+        seen[block] = chain + 1;
+        prev = block;
+        block = this->fat[block];
+    }
+
+    return CHAIN_INTACT;
+}
+
+// Split [0, count) into one slice per thread and run work on all slices
+void MyFsChecker::parallel(void (MyFsChecker::*work)(size_t, size_t), size_t count) {
+    std::vector<std::thread> threads;
+    size_t slice = (count + this->numThreads - 1) / this->numThreads;
+
+    for (size_t first = 0; first < count; first += slice)
+        threads.push_back(std::thread(work, this, first, std::min(count, first + slice)));
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+}
+
+// Read or write all tables with a single batch request
+int MyFsChecker::transferTables(bool write) {
+    std::vector<BlockRequest> chunks;
+    struct { uint32_t start; size_t size; void *table; } tables[] = {
+        { this->sb.fat_start, this->sb.fat_size, this->fat },
+        { this->sb.ref_start, this->sb.ref_size, this->refs },
+        { this->sb.root_start, this->sb.root_size, this->root },
+        { this->sb.snap_start, this->sb.snap_size, this->snaps }
+    };
+
+    for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+        uint32_t blocks = tables[i].size / BLOCK_SIZE;
+
+        for (uint32_t block = 0; block < blocks; block += TABLE_IO_BLOCKS) {
+            BlockRequest chunk = { tables[i].start + block, std::min<uint32_t>(TABLE_IO_BLOCKS, blocks - block),
+                                   (char *) tables[i].table + (size_t) block * BLOCK_SIZE };
+            chunks.push_back(chunk);
+        }
+    }
+
+    if (write)
+        return this->device->writeBatch(chunks.data(), chunks.size());
+    return this->device->readBatch(chunks.data(), chunks.size());
+}
+
+// Check that the areas of the container are in order and large enough
+bool MyFsChecker::checkSuperBlock() {
+    struct { const char *name; uint32_t start; size_t size; size_t needed; } areas[] = {
+        { "FAT", this->sb.fat_start, this->sb.fat_size, FAT_ENTRY_COUNT * sizeof(int) },
+        { "reference counts", this->sb.ref_start, this->sb.ref_size, FAT_ENTRY_COUNT * sizeof(uint16_t) },
+        { "root directory", this->sb.root_start, this->sb.root_size, NUM_DIR_ENTRIES * sizeof(DiskFileInfo) },
+        { "snapshots", this->sb.snap_start, this->sb.snap_size, NUM_SNAPSHOTS * sizeof(DiskSnapshot) }
+    };
+    uint32_t end = 1;   // block 0 holds the superblock
+
+    if (this->sb.magic != MYFS_MAGIC) {
+        report(false, "superblock: bad magic number 0x%08x", this->sb.magic);
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(areas) / sizeof(areas[0]); i++) {
+        if (areas[i].start < end || areas[i].size < areas[i].needed || areas[i].size % BLOCK_SIZE != 0) {
+            report(false, "superblock: %s at block %u with %zu bytes does not fit the layout", areas[i].name,
+                   areas[i].start, areas[i].size);
+            return false;
+        }
+        end = areas[i].start + areas[i].size / BLOCK_SIZE;
+    }
+
+    if (this->sb.data_start < end) {
+        report(false, "superblock: data area at block %u overlaps the tables", this->sb.data_start);
+        return false;
+    }
+
+    return true;
+}
+
+// Compare the free-space bitmap of a cleanly unmounted container with the FAT
+// A bad bitmap is dropped by marking the container dirty, the next mount builds it from the FAT again.
+void MyFsChecker::checkFreeMap() {
+    std::vector<uint64_t> map;
+    size_t free = 0;
+    int wrong = 0;
+
+    if (this->sb.state != MYFS_CLEAN || this->sb.map_start == 0)
+        return;
+
+    if (this->sb.map_start < this->sb.data_start + FAT_ENTRY_COUNT || this->sb.map_size % BLOCK_SIZE != 0 ||
+        this->sb.map_size < (FAT_ENTRY_COUNT + 63) / 64 * sizeof(uint64_t)) {
+        report(true, "superblock: free-space bitmap at block %u does not fit the layout", this->sb.map_start);
+        this->sb.state = MYFS_DIRTY;
+        return;
+    }
+
+    map.resize(this->sb.map_size / sizeof(uint64_t));
+    if (this->device->readBlocks(this->sb.map_start, this->sb.map_size / BLOCK_SIZE, (char *) map.data()) < 0) {
+        report(true, "free-space bitmap cannot be read");
+        this->sb.state = MYFS_DIRTY;
+        return;
+    }
+
+    for (size_t block = 1; block < FAT_ENTRY_COUNT; block++) {
+        bool marked = (map[block / 64] >> (block % 64)) & 1;
+
+        if (marked != (this->fat[block] == EMPTY_BLOCK))
+            wrong++;
+        if (this->fat[block] == EMPTY_BLOCK)
+            free++;
+    }
+
+    if (wrong > 0) {
+        report(true, "free-space bitmap disagrees with the FAT for %d blocks", wrong);
+        this->sb.state = MYFS_DIRTY;
+    }
+    if (this->sb.free_blocks != free) {
+        report(true, "superblock: %zu free blocks recorded, the FAT has %zu", this->sb.free_blocks, free);
+        this->sb.state = MYFS_DIRTY;
+    }
+}
+
+// Collect all entries with a name, names that are not terminated are cut
+void MyFsChecker::checkNames() {
+    this->entries.clear();
+    this->snapshotOf.clear();
+
+    for (int slot = -1; slot < NUM_SNAPSHOTS; slot++) {
+        DiskFileInfo *files = (slot < 0) ? this->root : this->snaps[slot].files;
+
+        if (slot >= 0) {
+            if (this->snaps[slot].name[0] == '\0')
+                continue;
+            if (memchr(this->snaps[slot].name, '\0', NAME_LENGTH) == NULL) {
+                this->snaps[slot].name[NAME_LENGTH - 1] = '\0';
+                report(true, "snapshot %d: name is not terminated", slot);
+            }
+        }
+
+        for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+            if (files[i].name[0] == '\0')
+                continue;
+            if (memchr(files[i].name, '\0', NAME_LENGTH) == NULL) {
+                files[i].name[NAME_LENGTH - 1] = '\0';
+                report(true, "entry %d of %s: name is not terminated", i, (slot < 0) ? "/" : this->snaps[slot].name);
+            }
+            this->entries.push_back(&files[i]);
+            this->snapshotOf.push_back(slot);
+        }
+    }
+}
+
+// Check that every entry can be reached from the root directory
+// Entries in a directory that does not exist or in a loop of directories are moved to the root directory. Names used
+// twice in a directory are reported only, there is no way to tell which of the entries is meant.
+void MyFsChecker::checkTree() {
+    std::set<std::pair<const DiskFileInfo *, std::string>> names;
+
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        DiskFileInfo *files = entryTable(i);
+        DiskFileInfo *file = this->entries[i];
+        int dir = file->parent, steps = 0;
+
+        while (dir != ROOT_DIR && steps <= NUM_DIR_ENTRIES && isDirectory(files, dir)) {
+            dir = files[dir].parent;
+            steps++;
+        }
+
+        if (dir != ROOT_DIR) {
+            if (steps > NUM_DIR_ENTRIES)
+                report(true, "%s: directories form a loop, moved to the root directory", entryName(i).c_str());
+            else
+                report(true, "%s: directory %d does not exist, moved to the root directory", entryName(i).c_str(),
+                       file->parent);
+            file->parent = ROOT_DIR;
+        }
+    }
+
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        const DiskFileInfo *parent = entryTable(i) + this->entries[i]->parent;
+
+        if (!names.insert(std::make_pair(parent, std::string(this->entries[i]->name))).second)
+            report(false, "%s: name is used twice", entryName(i).c_str());
+    }
+}
+
+// Find the broken chains, the chains are not changed
+void MyFsChecker::followChains(size_t first, size_t last) {
+    std::vector<uint32_t> seen(FAT_ENTRY_COUNT, 0);
+    int target;
+
+    for (size_t i = first; i < last; i++)
+        this->brokenAt[i] = walk(i, seen, &target);
+}
+
+// End broken chains in front of the bad link
+// Entries sharing a broken chain are followed again, the chain may have been repaired for another entry already.
+void MyFsChecker::repairChains() {
+    std::vector<uint32_t> seen(FAT_ENTRY_COUNT, 0);
+    int at, target;
+
+    for (size_t i = 0; i < this->chains.size(); i++) {
+        if (this->brokenAt[i] == CHAIN_INTACT)
+            continue;
+
+        at = walk(i, seen, &target);
+        if (at == CHAIN_INTACT)
+            continue;
+
+        if (target <= 0 || target >= (int) FAT_ENTRY_COUNT)
+            report(true, "%s: chain links to invalid block %d", chainName(i).c_str(), target);
+        else if (this->fat[target] == EMPTY_BLOCK)
+            report(true, "%s: chain links to free block %d", chainName(i).c_str(), target);
+        else
+            report(true, "%s: chain loops back to block %d", chainName(i).c_str(), target);
+
+        if (at == CHAIN_BROKEN_ENTRY)
+            *this->chains[i] = (i < this->entries.size()) ? EOC_BLOCK : 0;
+        else
+            this->fat[at] = EOC_BLOCK;
+    }
+}
+
+// Count the links to every block, all chains must be intact
+// A FAT link is counted by the first thread that reaches its block, so shared parts of chains count once.
+void MyFsChecker::countLinks(size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+        int block = *this->chains[i];
+        int length = 0;
+
+        if (block != EOC_BLOCK)
+            this->links[block]++;
+
+        while (block != EOC_BLOCK) {
+            length++;
+            if (!this->reached[block].exchange(true) && this->fat[block] != EOC_BLOCK)
+                this->links[this->fat[block]]++;
+            block = this->fat[block];
+        }
+
+        this->lengths[i] = length;
+    }
+}
+
+// Number of blocks the chain of a file in a compressed container needs
+// The headers of the extents are followed up to the last extent within the size of the file. An extent with a bad
+// header or cut off by the end of the chain ends the file, so the chain is ended in front of it by checkSizes().
+// Missing extents read as zeros.
+int MyFsChecker::extentBlocks(size_t entry) {
+    DiskFileInfo *file = this->entries[entry];
+    int max_extents = (file->size + EXTENT_SIZE - 1) / EXTENT_SIZE;
+    int needed = 0;
+    int block = file->firstblock;
+    ExtentHeader header;
+    char buf[BLOCK_SIZE];
+
+    for (int extent = 0; extent < max_extents && block != EOC_BLOCK; extent++) {
+        if (this->device->read(this->sb.data_start + block, buf) < 0) {
+            report(false, "%s: extent %d cannot be read", entryName(entry).c_str(), extent);
+            return this->lengths[entry];
+        }
+
+        memcpy(&header, buf, sizeof(header));
+        int num_blocks = (sizeof(header) + header.stored_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (header.magic != EXTENT_MAGIC || header.raw_size > EXTENT_SIZE || header.stored_size > EXTENT_SIZE ||
+            needed + num_blocks > this->lengths[entry])
+            break;
+
+        for (int i = 0; i < num_blocks; i++)
+            block = this->fat[block];
+        needed += num_blocks;
+    }
+
+    return needed;
+}
+
+// Compare the length of every chain with the size of its file
+// Sizes beyond the chain are reduced, chains beyond the size are ended if their blocks are not shared.
+// \return true if a chain has been ended and the links have to be counted again.
+bool MyFsChecker::checkSizes() {
+    bool changed = false;
+
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        DiskFileInfo *file = this->entries[i];
+        int needed;
+
+        if (file->flags & FILE_INLINE) {
+            // small files are kept in the entry and have no chain
+            needed = 0;
+            if (file->size > INLINE_DATA_SIZE) {
+                report(true, "%s: size %zu does not fit into the entry", entryName(i).c_str(), file->size);
+                file->size = INLINE_DATA_SIZE;
+            }
+        } else {
+            needed = this->sb.compressed ? extentBlocks(i) : (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        }
+
+        if (this->lengths[i] < needed) {
+            report(true, "%s: size %zu needs %d blocks, the chain has %d", entryName(i).c_str(), file->size, needed,
+                   this->lengths[i]);
+            file->size = (size_t) this->lengths[i] * BLOCK_SIZE;
+        } else if (this->lengths[i] > needed) {
+            bool exclusive = true;
+            int block = file->firstblock, last = EOC_BLOCK;
+
+            for (int j = 0; j < needed; j++) {
+                if (this->links[block] > 1)
+                    exclusive = false;
+                last = block;
+                block = this->fat[block];
+            }
+
+            report(exclusive, "%s: chain has %d blocks, size %zu needs %d", entryName(i).c_str(), this->lengths[i],
+                   file->size, needed);
+            if (!exclusive)
+                continue;
+
+            if (needed == 0)
+                file->firstblock = EOC_BLOCK;
+            else
+                this->fat[last] = EOC_BLOCK;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// Compare the reference count of every block with its links
+void MyFsChecker::checkBlocks(size_t first, size_t last) {
+    for (size_t block = std::max<size_t>(first, 1); block < last; block++) {
+        if (!this->reached[block] && this->fat[block] != EMPTY_BLOCK)
+            this->blockState[block] = BLOCK_LEAKED;
+        else if (this->refs[block] != this->links[block])
+            this->blockState[block] = BLOCK_BAD_REFS;
+        else
+            this->blockState[block] = BLOCK_OK;
+    }
+}
+
+// Report and repair the problems found by checkBlocks(), leaked blocks are reported as runs
+void MyFsChecker::reportBlocks() {
+    for (int block = 1; block < (int) FAT_ENTRY_COUNT; block++) {
+        if (this->blockState[block] == BLOCK_LEAKED) {
+            int end = block;
+
+            while (end + 1 < (int) FAT_ENTRY_COUNT && this->blockState[end + 1] == BLOCK_LEAKED)
+                end++;
+
+            if (end == block)
+                report(true, "block %d is not part of any chain", block);
+            else
+                report(true, "blocks %d-%d are not part of any chain", block, end);
+
+            for (; block <= end; block++) {
+                this->fat[block] = EMPTY_BLOCK;
+                this->refs[block] = 0;
+            }
+            block = end;
+        } else if (this->blockState[block] == BLOCK_BAD_REFS) {
+            uint32_t count = this->links[block];
+
+            if (this->refs[block] < count)
+                report(true, "block %d is cross-linked, %u links but a reference count of %u", block, count,
+                       this->refs[block]);
+            else
+                report(true, "block %d has %u links but a reference count of %u", block, count, this->refs[block]);
+
+            this->refs[block] = count;
+        }
+    }
+}
+
+int MyFsChecker::run(const char *path) {
+    int ret;
+    size_t used = 0;
+    char *buf;
+
+    this->problems = 0;
+    this->unfixed = 0;
+
+    ret = this->device->open(path);
+    if (ret < 0) {
+        fprintf(stderr, "fsck.myfs: cannot open %s: %s\n", path, strerror(-ret));
+        return FSCK_FAILED;
+    }
+
+    buf = (char *) malloc(BLOCK_SIZE);
+    if (buf == NULL || this->device->read(0, buf) < 0) {
+        free(buf);
+        this->device->close();
+        fprintf(stderr, "fsck.myfs: cannot read the superblock of %s\n", path);
+        return FSCK_FAILED;
+    }
+    memcpy(&this->sb, buf, sizeof(this->sb));
+    free(buf);
+
+    if (!checkSuperBlock()) {
+        this->device->close();
+        return FSCK_UNCORRECTED;
+    }
+
+    free(this->fat);
+    free(this->refs);
+    free(this->root);
+    free(this->snaps);
+    this->fat = NULL;
+    this->refs = NULL;
+    this->root = NULL;
+    this->snaps = NULL;
+    if (posix_memalign((void **) &this->fat, BD_DIRECT_ALIGN, this->sb.fat_size) != 0 ||
+        posix_memalign((void **) &this->refs, BD_DIRECT_ALIGN, this->sb.ref_size) != 0 ||
+        posix_memalign((void **) &this->root, BD_DIRECT_ALIGN, this->sb.root_size) != 0 ||
+        posix_memalign((void **) &this->snaps, BD_DIRECT_ALIGN, this->sb.snap_size) != 0 ||
+        transferTables(false) < 0) {
+        this->device->close();
+        fprintf(stderr, "fsck.myfs: cannot read the tables of %s\n", path);
+        return FSCK_FAILED;
+    }
+
+    for (size_t block = 1; block < FAT_ENTRY_COUNT; block++) {
+        if (this->fat[block] != EMPTY_BLOCK)
+            used++;
+    }
+
+    checkFreeMap();
+    checkNames();
+    checkTree();
+
+    collectChains();
+    this->brokenAt.assign(this->chains.size(), CHAIN_INTACT);
+    parallel(&MyFsChecker::followChains, this->chains.size());
+    repairChains();
+
+    do {
+        for (size_t block = 0; block < FAT_ENTRY_COUNT; block++) {
+            this->links[block] = 0;
+            this->reached[block] = false;
+        }
+        this->lengths.assign(this->chains.size(), 0);
+        parallel(&MyFsChecker::countLinks, this->chains.size());
+    } while (checkSizes());
+
+    this->blockState.assign(FAT_ENTRY_COUNT, BLOCK_OK);
+    parallel(&MyFsChecker::checkBlocks, FAT_ENTRY_COUNT);
+    reportBlocks();
+
+    printf("%s: %zu entries, %zu of %zu blocks used, %d problems found\n", path, this->entries.size(), used,
+           FAT_ENTRY_COUNT - 1, this->problems);
+
+    if (this->repair && this->problems > 0) {
+        /* the bitmap does not match the repaired FAT, it is built again at the next mount */
+        this->sb.state = MYFS_DIRTY;
+        buf = (char *) calloc(1, BLOCK_SIZE);
+        ret = (buf != NULL) ? transferTables(true) : -ENOMEM;
+        if (ret == 0)
+            ret = this->device->sync();
+        if (ret == 0) {
+            memcpy(buf, &this->sb, sizeof(this->sb));
+            ret = this->device->write(0, buf);
+        }
+        free(buf);
+        if (ret == 0)
+            ret = this->device->sync();
+        if (ret < 0) {
+            this->device->close();
+            fprintf(stderr, "fsck.myfs: cannot write the tables of %s: %s\n", path, strerror(-ret));
+            return FSCK_FAILED;
+        }
+    }
+
+    this->device->close();
+
+    if (this->problems == 0)
+        return FSCK_OK;
+    return (this->unfixed > 0) ? FSCK_UNCORRECTED : FSCK_REPAIRED;
+}
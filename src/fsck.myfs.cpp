@@ -0,0 +1,51 @@
+//
+//  fsck.myfs.cpp
+//  myfs
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "fsck.h"
+
+static void usage() {
+    fprintf(stderr,
+            "usage: fsck.myfs [-n | -y] [-j THREADS] CONTAINER\n"
+            "\n"
+            "    -n          only check the container (default)\n"
+            "    -y          repair all problems found\n"
+            "    -j THREADS  number of threads, default is one per CPU\n"
+            "\n"
+            "The container must not be mounted.\n");
+    exit(FSCK_FAILED);
+}
+
+int main(int argc, char *argv[]) {
+    bool repair = false;
+    unsigned threads = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "nyj:")) != -1) {
+        switch (opt) {
+            case 'n':
+                repair = false;
+                break;
+            case 'y':
+                repair = true;
+                break;
+            case 'j':
+                threads = (unsigned) atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (optind != argc - 1)
+        usage();
+
+    MyFsChecker checker(repair, threads);
+
+    return checker.run(argv[optind]);
+}
@@ -0,0 +1,211 @@
+//
+//  iouring.cpp
+//  myfs
+//
+
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "iouring.h"
+
+#ifdef __linux__
+
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+IoUring::IoUring() {
+    ringFd = -1;
+    entries = 0;
+    queued = 0;
+    sqRing = cqRing = MAP_FAILED;
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+    sqRingSize = cqRingSize = sqesSize = 0;
+}
+
+IoUring::~IoUring() {
+    teardown();
+}
+
+int IoUring::setup(unsigned depth) {
+    struct io_uring_params p;
+
+    if (ringFd >= 0)
+        return 0;
+
+    memset(&p, 0, sizeof(p));
+    ringFd = io_uring_setup(depth, &p);
+    if (ringFd < 0)
+        return -errno;
+
+    // IORING_OP_READ and IORING_OP_WRITE came with the same kernel as this feature flag
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        teardown();
+        return -EOPNOTSUPP;
+    }
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cqRingSize > sqRingSize)
+            sqRingSize = cqRingSize;
+        cqRingSize = sqRingSize;
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                  IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            goto fail;
+    }
+
+    sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                        ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        goto fail;
+
+    sqHead = (unsigned *) ((char *) sqRing + p.sq_off.head);
+    sqTail = (unsigned *) ((char *) sqRing + p.sq_off.tail);
+    sqMask = (unsigned *) ((char *) sqRing + p.sq_off.ring_mask);
+    sqArray = (unsigned *) ((char *) sqRing + p.sq_off.array);
+    cqHead = (unsigned *) ((char *) cqRing + p.cq_off.head);
+    cqTail = (unsigned *) ((char *) cqRing + p.cq_off.tail);
+    cqMask = (unsigned *) ((char *) cqRing + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) ((char *) cqRing + p.cq_off.cqes);
+
+    entries = p.sq_entries;
+    queued = 0;
+    return 0;
+
+fail:
+    int ret = -errno;
+    teardown();
+    return ret;
+}
+
+void IoUring::teardown() {
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+    if (ringFd >= 0)
+        ::close(ringFd);
+
+    ringFd = -1;
+    entries = 0;
+    queued = 0;
+    sqRing = cqRing = MAP_FAILED;
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+}
+
+bool IoUring::queue(bool write, int fd, char *buffer, size_t size, off_t offset, uint64_t tag) {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *sqTail;
+
+    if (tail - head >= entries)
+        return false;
+
+    unsigned slot = tail & *sqMask;
+    struct io_uring_sqe *sqe = &sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = (uint32_t) size;
+    sqe->off = (uint64_t) offset;
+    sqe->user_data = tag;
+
+    sqArray[slot] = slot;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+
+    return true;
+}
+
+int IoUring::submit(unsigned wait) {
+    while (true) {
+        int r = io_uring_enter(ringFd, queued, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (r >= 0) {
+            queued -= (unsigned) r;
+            return 0;
+        }
+        if (errno != EINTR)
+            return -errno;
+    }
+}
+
+bool IoUring::complete(uint64_t *tag, int *result) {
+    unsigned head = *cqHead;
+
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+        return false;
+
+    struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+    *tag = cqe->user_data;
+    *result = cqe->res;
+
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+#else /* __linux__ */
+
+// io_uring is Linux only, elsewhere the ring cannot be set up and the block device transfers batches one by one
+
+IoUring::IoUring() {
+    ringFd = -1;
+    entries = 0;
+    queued = 0;
+    sqRing = cqRing = MAP_FAILED;
+    sqes = NULL;
+    sqRingSize = cqRingSize = sqesSize = 0;
+}
+
+IoUring::~IoUring() {
+}
+
+int IoUring::setup(unsigned depth) {
+    (void) depth;
+    return -ENOSYS;
+}
+
+void IoUring::teardown() {
+}
+
+bool IoUring::queue(bool write, int fd, char *buffer, size_t size, off_t offset, uint64_t tag) {
+    (void) write; (void) fd; (void) buffer; (void) size; (void) offset; (void) tag;
+    return false;
+}
+
+int IoUring::submit(unsigned wait) {
+    (void) wait;
+    return -ENOSYS;
+}
+
+bool IoUring::complete(uint64_t *tag, int *result) {
+    (void) tag; (void) result;
+    return false;
+}
+
+#endif /* __linux__ */
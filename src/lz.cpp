@@ -0,0 +1,170 @@
+//
+//  lz.cpp
+//  myfs
+//
+
+#include <cstdint>
+#include <cstring>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+/* the last match starts at least this many bytes before the end, the last bytes are always literals */
+#define LZ_MATCH_LIMIT 12
+#define LZ_LAST_LITERALS 5
+
+static uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Write a length of 15 or more as a sequence of bytes of 255 and a final byte below 255
+static bool putLength(char **op, char *end, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (*op >= end)
+            return false;
+        *(*op)++ = (char) 255;
+    }
+    if (*op >= end)
+        return false;
+    *(*op)++ = (char) len;
+    return true;
+}
+
+// Write a sequence of literals followed by a match, a match length of 0 ends the data
+static bool putSequence(char **op, char *end, const char *literals, size_t num_literals, size_t offset,
+                        size_t match_len) {
+    size_t lit_code = (num_literals < 15) ? num_literals : 15;
+    size_t match_code = 0;
+
+    if (match_len > 0)
+        match_code = (match_len - LZ_MIN_MATCH < 15) ? match_len - LZ_MIN_MATCH : 15;
+
+    if (*op >= end)
+        return false;
+    *(*op)++ = (char) ((lit_code << 4) | match_code);
+    if (lit_code == 15 && !putLength(op, end, num_literals - 15))
+        return false;
+
+    if ((size_t) (end - *op) < num_literals)
+        return false;
+    memcpy(*op, literals, num_literals);
+    *op += num_literals;
+
+    if (match_len == 0)
+        return true;
+
+    if (end - *op < 2)
+        return false;
+    *(*op)++ = (char) (offset & 0xff);
+    *(*op)++ = (char) (offset >> 8);
+
+    return match_code < 15 || putLength(op, end, match_len - LZ_MIN_MATCH - 15);
+}
+
+size_t lzCompress(const char *src, size_t len, char *dst, size_t capacity) {
+    int32_t table[1 << LZ_HASH_BITS];
+    const char *anchor = src;
+    char *op = dst;
+    char *end = dst + capacity;
+
+    if (len > LZ_MATCH_LIMIT) {
+        const char *limit = src + len - LZ_MATCH_LIMIT;
+        const char *ip = src;
+
+        for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+            table[i] = -1;
+
+        while (ip < limit) {
+            uint32_t h = hash(read32(ip));
+            int32_t ref = table[h];
+
+            table[h] = ip - src;
+            if (ref < 0 || ip - (src + ref) > LZ_MAX_OFFSET || read32(src + ref) != read32(ip)) {
+                ip++;
+                continue;
+            }
+
+            size_t match_len = LZ_MIN_MATCH;
+            while (ip + match_len < src + len - LZ_LAST_LITERALS && src[ref + match_len] == ip[match_len])
+                match_len++;
+
+            if (!putSequence(&op, end, anchor, ip - anchor, ip - (src + ref), match_len))
+                return 0;
+
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+
+    if (!putSequence(&op, end, anchor, src + len - anchor, 0, 0))
+        return 0;
+
+    return op - dst;
+}
+
+// Add a length continued in bytes of 255, false if the input ends first
+static bool getLength(const unsigned char **ip, const unsigned char *end, size_t *len) {
+    unsigned char b;
+
+    do {
+        if (*ip >= end)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return true;
+}
+
+long lzDecompress(const char *src, size_t len, char *dst, size_t capacity) {
+    const unsigned char *ip = (const unsigned char *) src;
+    const unsigned char *end = ip + len;
+    char *op = dst;
+    char *out_end = dst + capacity;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t num_literals = token >> 4;
+        size_t match_len = token & 15;
+        size_t offset;
+
+        if (num_literals == 15 && !getLength(&ip, end, &num_literals))
+            return -1;
+        if ((size_t) (end - ip) < num_literals || (size_t) (out_end - op) < num_literals)
+            return -1;
+        memcpy(op, ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+
+        /* the last sequence has no match */
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - dst))
+            return -1;
+
+        if (match_len == 15 && !getLength(&ip, end, &match_len))
+            return -1;
+        match_len += LZ_MIN_MATCH;
+        if ((size_t) (out_end - op) < match_len)
+            return -1;
+
+        /* matches may overlap their own output */
+        for (size_t i = 0; i < match_len; i++, op++)
+            *op = *(op - offset);
+    }
+
+    return op - dst;
+}
@@ -23,6 +23,13 @@ struct fuse_operations myfs_oper;
 struct myfs_config {
     char *containerFileName;
     char *logFileName;
+    int directIO;
+    int defrag;
+    int checksums;
+    int compress;
+    int dedup;
+    char *imageFileName;
+    int tier;
 };
 enum {
     KEY_HELP,
@@ -36,6 +43,13 @@ static struct fuse_opt myfs_opts[] = {
         MYFS_OPT("containerfile=%s",  containerFileName, 0),
         MYFS_OPT("-l %s",             logFileName, 0),
         MYFS_OPT("logfile=%s",        logFileName, 0),
+        MYFS_OPT("containerdirect",   directIO, 1),
+        MYFS_OPT("defrag",            defrag, 1),
+        MYFS_OPT("checksums",         checksums, 1),
+        MYFS_OPT("compress",          compress, 1),
+        MYFS_OPT("dedup",             dedup, 1),
+        MYFS_OPT("image=%s",          imageFileName, 0),
+        MYFS_OPT("tier=%d",           tier, 0),
 
         FUSE_OPT_KEY("-V",             KEY_VERSION),
         FUSE_OPT_KEY("--version",      KEY_VERSION),
@@ -56,7 +70,14 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
                     "    -o containerfile=FILE\n"
                     "    -c FILE            same as '-o containerfile=FILE'\n"
                     "    -o logfile=FILE\n"
-                    "    -l FILE            same as '-o logfile=FILE'\n");
+                    "    -l FILE            same as '-o logfile=FILE'\n"
+                    "    -o containerdirect  access the container file with O_DIRECT\n"
+                    "    -o defrag           defragment files in the background\n"
+                    "    -o checksums        checksum data blocks, stays on for the container\n"
+                    "    -o compress         compress files, only when the container is created\n"
+                    "    -o dedup            share identical blocks between files, stays on for the container\n"
+                    "    -o image=FILE       in-memory mode: restore the files from FILE, save them there at unmount\n"
+                    "    -o tier=MIB         keep hot files in MIB of RAM and write files back in the background\n");
             exit(1);
 
         case KEY_VERSION:
@@ -68,6 +89,24 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
     return 1;
 }
 
+// Absolute path of an image file, which may not exist yet, NULL if its directory cannot be written
+static char *imagePath(const char *name) {
+    char *dirCopy = strdup(name);
+    char *baseCopy = strdup(name);
+    char *dir = realpath(dirname(dirCopy), NULL);
+    char *path = NULL;
+
+    if (dir != NULL && access(dir, R_OK | W_OK | X_OK) == 0) {
+        path = malloc(PATH_MAX);
+        snprintf(path, PATH_MAX, "%s/%s", dir, basename(baseCopy));
+    }
+
+    free(dir);
+    free(dirCopy);
+    free(baseCopy);
+    return path;
+}
+
 int main(int argc, char *argv[]) {
     int fuse_stat;
 
@@ -88,6 +127,8 @@ int main(int argc, char *argv[]) {
     myfs_oper.open = wrap_open;
     myfs_oper.read = wrap_read;
     myfs_oper.write = wrap_write;
+    myfs_oper.read_buf = wrap_read_buf;
+    myfs_oper.write_buf = wrap_write_buf;
     myfs_oper.statfs = wrap_statfs;
     myfs_oper.flush = wrap_flush;
     myfs_oper.release = wrap_release;
@@ -106,6 +147,7 @@ int main(int argc, char *argv[]) {
 
     char* containerFileName= NULL;
     char* logFileName= NULL;
+    char* imageFileName= NULL;
 
     // parse arguments
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
@@ -156,6 +198,25 @@ int main(int argc, char *argv[]) {
         setInstance(0);
     }
 
+    // the image keeps an in-memory file system across mounts
+    if(conf.imageFileName != NULL) {
+        if(containerFileName != NULL) {
+            fprintf(stderr, "Error: -o image is for the in-memory mode only\n");
+            exit(EXIT_FAILURE);
+        }
+        imageFileName= imagePath(conf.imageFileName);
+        if(imageFileName == NULL) {
+            fprintf(stderr, "Error: Cannot access the directory of image file %s\n", conf.imageFileName);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the tiered mode puts RAM in front of a container
+    if(conf.tier < 0 || (conf.tier > 0 && containerFileName == NULL)) {
+        fprintf(stderr, "Error: -o tier needs a container and a positive size in MiB\n");
+        exit(EXIT_FAILURE);
+    }
+
     // check if logfile can be accessed
     if(conf.logFileName != NULL) {
         FILE *logFile = fopen(conf.logFileName, "w+");
@@ -175,9 +236,18 @@ int main(int argc, char *argv[]) {
     // container & log file name will be passed to fuse functions
     FsInfo->contFile= containerFileName;
     FsInfo->logFile= logFileName;
+    FsInfo->directIO= conf.directIO;
+    FsInfo->defrag= conf.defrag;
+    FsInfo->checksums= conf.checksums;
+    FsInfo->compress= conf.compress;
+    FsInfo->dedup= conf.dedup;
+    FsInfo->imageFile= imageFileName;
+    FsInfo->tier= conf.tier;
 
     // add additoinal "-s"
     fuse_opt_add_arg(&args, "-s");
+    // getattr and readdir report stable inode numbers, see ENTRY_INO() in myfs-structs.h
+    fuse_opt_add_arg(&args, "-ouse_ino");
 
     // call fuse initialization method
     fuse_stat = fuse_main(args.argc, args.argv, &myfs_oper, FsInfo);
@@ -188,6 +258,7 @@ int main(int argc, char *argv[]) {
     free(FsInfo);
     free(containerFileName);
     free(logFileName);
+    free(imageFileName);
 
     return fuse_stat;
 }
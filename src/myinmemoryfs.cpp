@@ -32,20 +32,30 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
 
 #include "macros.h"
 #include "myfs.h"
 #include "myfs-info.h"
 #include "blockdevice.h"
+#include "crc32c.h"
 
 /// @brief Constructor of the in-memory file system class.
 ///
 /// You may add your own constructor code here.
 MyInMemoryFS::MyInMemoryFS()
-		: MyFS()
+		: MyFS(), dentries(ROOT_DIR)
 {
 	// TODO: [PART 1] Add your constructor code here
+	memset(files, 0, sizeof(files));
 	numberOfOpenFiles = 0;
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++)
+		changed[i] = true;
+	usedBytes = 0;
+	freeSlots = NUM_DIR_ENTRIES;
 }
 
 /// @brief Destructor of the in-memory file system class.
@@ -54,22 +64,23 @@ MyInMemoryFS::MyInMemoryFS()
 MyInMemoryFS::~MyInMemoryFS()
 {
 	// TODO: [PART 1] Add your cleanup code here
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++)
+		free(files[i].data);
 }
 
 // Definitions of private methods here
 
 // Check if file with file_name exists
-// \param [in] file_name File name to check.
+// The path is resolved through the dentry cache, directories are found as well.
+// \param [in] file_name Path of the file to check.
 // \return index of MyFsFileInfo if file exists, otherwise -1.
 int MyInMemoryFS::getFileIndex(const char *file_name)
 {
-	for (int i = 0; i < NUM_DIR_ENTRIES; i++)
-	{
-		if (strcmp(files[i].name, file_name) == 0)
-			return i;
-	}
-	// Iterated through all file entries and file was not found
-	return -1;
+	int dir;
+	const char *name;
+	int index = dentries.resolve(file_name, &dir, &name);
+
+	return (index >= 0 && index != ROOT_DIR) ? index : -1;
 }
 
 // Get a free slot which doesn't have a file stored
@@ -87,37 +98,33 @@ int MyInMemoryFS::getFreeSlot(void)
 	return -1;
 }
 
-// FUSE callbacks below this line
+// Set the size of a file and account for the memory it uses
+void MyInMemoryFS::setFileSize(MyFsFileInfo *file, size_t size)
+{
+	usedBytes = usedBytes - file->size + size;
+	file->size = size;
+}
 
-/// @brief Create a new file.
-///
-/// Create a new file with given name and permissions.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// \param [in] path Name of the file, starting with "/".
-/// \param [in] mode Permissions for file access.
-/// \param [in] dev Can be ignored.
-/// \return 0 on success, -ERRNO on failure.
-int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
+// Create a file or directory
+// \param [in] path Path of the new entry, the directory holding it must exist.
+// \param [in] mode Type and permissions of the entry.
+// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::createEntry(const char *path, mode_t mode)
 {
-	int ret;
-	char file_name[NAME_LENGTH];
-	int index;
+	int ret, dir, index;
+	const char *name;
 	MyFsFileInfo *new_file;
 	time_t time_now;
 
-	LOGM();
-
-	// TODO: [PART 1] Implement this! Implemented by slno1011
-
 	ret = checkPath(path);
 	if (ret)
 		return ret;
 
-	strncpy(file_name, path, NAME_LENGTH - 1);
-	file_name[NAME_LENGTH - 1] = '\0';
-
-	if (getFileIndex(file_name) != -1)
+	ret = dentries.resolve(path, &dir, &name);
+	if (ret >= 0)
 		return -EEXIST;
+	if (dir == -1)
+		return ret;
 
 	index = getFreeSlot();
 	if (index == -1)
@@ -128,15 +135,284 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
 		return -EFAULT;
 
 	new_file = &files[index];
-	strncpy(new_file->name, file_name, NAME_LENGTH - 1);
+	memset(new_file, 0, sizeof(MyFsFileInfo));
+	strncpy(new_file->name, name, NAME_LENGTH - 1);
+	new_file->parent = dir;
 	new_file->size = 0; /* size = 0, no data allocated yet */
 	new_file->uid = getuid();
 	new_file->gid = getgid();
 	new_file->mode = mode;
 	new_file->atime = new_file->mtime = new_file->ctime = time_now;
 	new_file->data = NULL;
+	changed[index] = true;
+	freeSlots--;
+	dentries.insert(dir, new_file->name, index, S_ISDIR(mode));
 
-	RETURN(0);
+	return 0;
+}
+
+// Remove a file or an empty directory and free its data
+void MyInMemoryFS::removeEntry(int index)
+{
+	MyFsFileInfo *file_ptr = &files[index];
+
+	dentries.remove(file_ptr->parent, file_ptr->name);
+	xattrs[index].clear();
+	if (file_ptr->data)
+		free(file_ptr->data);
+	setFileSize(file_ptr, 0);
+	freeSlots++;
+	/* Setting the first byte of name to '\0' would
+	 * be enough, but in this case we are dealing with
+	 * a structure which has user/group ids and the
+	 * access mode saved. It's good security practice
+	 * to override them with 0.
+	 */
+	memset(file_ptr, 0, sizeof(MyFsFileInfo));
+}
+
+// Forget all entries, used when an image cannot be restored
+static void resetFiles(MyFsFileInfo *files, XattrSet *xattrs)
+{
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		free(files[i].data);
+		xattrs[i].clear();
+	}
+	memset(files, 0, NUM_DIR_ENTRIES * sizeof(MyFsFileInfo));
+}
+
+// Restore the file system from its image
+// The image is mapped with a single mmap() and its checksum is verified before any entry is taken over. A damaged
+// image leaves the file system empty.
+// \return number of entries restored, 0 if there is no image yet, -ERRNO on failure.
+int MyInMemoryFS::loadImage(void)
+{
+	int fd, ret = 0;
+	struct stat st;
+	char *image;
+	MemImageHeader header;
+	size_t pos, len;
+
+	fd = open(imageFile.c_str(), O_RDONLY);
+	if (fd < 0)
+		return (errno == ENOENT) ? 0 : -errno;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+	len = st.st_size;
+	if (len < sizeof(header)) {
+		close(fd);
+		return -EIO;
+	}
+
+	image = (char *)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return -errno;
+	madvise(image, len, MADV_SEQUENTIAL);
+
+	memcpy(&header, image, sizeof(header));
+	if (header.magic != MEM_IMAGE_MAGIC || header.size != len - sizeof(header) ||
+		crc32c(0, image + sizeof(header), header.size) != header.crc)
+		ret = -EIO;
+
+	pos = sizeof(header);
+	for (uint32_t i = 0; ret == 0 && i < header.count; i++) {
+		MemImageEntry entry;
+		MyFsFileInfo *file;
+
+		if (len - pos < sizeof(entry)) {
+			ret = -EIO;
+			break;
+		}
+		memcpy(&entry, image + pos, sizeof(entry));
+		pos += sizeof(entry);
+		if (entry.slot < 0 || entry.slot >= NUM_DIR_ENTRIES || files[entry.slot].name[0] != '\0' ||
+			entry.nameLen == 0 || entry.nameLen >= NAME_LENGTH || (S_ISDIR(entry.mode) && entry.size != 0) ||
+			len - pos < entry.nameLen + (uint64_t)entry.attrSize + entry.size ||
+			memchr(image + pos, '/', entry.nameLen) != NULL || memchr(image + pos, '\0', entry.nameLen) != NULL) {
+			ret = -EIO;
+			break;
+		}
+
+		file = &files[entry.slot];
+		memcpy(file->name, image + pos, entry.nameLen);
+		pos += entry.nameLen;
+		if (entry.attrSize > 0 && xattrs[entry.slot].load(image + pos, entry.attrSize) < 0) {
+			ret = -EIO;
+			break;
+		}
+		pos += entry.attrSize;
+
+		file->parent = entry.parent;
+		file->mode = entry.mode;
+		file->uid = entry.uid;
+		file->gid = entry.gid;
+		file->atime = entry.atime;
+		file->mtime = entry.mtime;
+		file->ctime = entry.ctime;
+		if (entry.size > 0) {
+			file->data = (char *)malloc(entry.size);
+			if (file->data == NULL) {
+				ret = -ENOMEM;
+				break;
+			}
+			memcpy(file->data, image + pos, entry.size);
+			file->size = entry.size;
+			pos += entry.size;
+		}
+	}
+	if (ret == 0 && pos != len)
+		ret = -EIO;
+
+	munmap(image, len);
+
+	/* every entry must be in a directory of the image, with a name of its own */
+	for (int i = 0; ret == 0 && i < NUM_DIR_ENTRIES; i++) {
+		MyFsFileInfo *file = &files[i];
+
+		if (file->name[0] == '\0')
+			continue;
+		if ((file->parent != ROOT_DIR && (file->parent < 0 || file->parent >= NUM_DIR_ENTRIES ||
+			files[file->parent].name[0] == '\0' || !S_ISDIR(files[file->parent].mode))) ||
+			dentries.lookup(file->parent, file->name, strlen(file->name)) != -1) {
+			ret = -EIO;
+			break;
+		}
+		dentries.insert(file->parent, file->name, i, S_ISDIR(file->mode));
+	}
+
+	if (ret < 0) {
+		resetFiles(files, xattrs);
+		dentries.clear();
+		return ret;
+	}
+
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (files[i].name[0] != '\0') {
+			usedBytes += files[i].size;
+			freeSlots--;
+		}
+	}
+
+	return header.count;
+}
+
+// Write the image of the file system
+// The image is built in memory and written with a single write into a new file, which then replaces the old image,
+// so a crash while saving keeps the old image.
+// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::saveImage(void)
+{
+	int fd, ret = 0;
+	MemImageHeader header;
+	size_t len = sizeof(header), pos = sizeof(header);
+	std::string tmp = imageFile + ".tmp";
+
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (files[i].name[0] != '\0')
+			len += sizeof(MemImageEntry) + strlen(files[i].name) + xattrs[i].storedSize() + files[i].size;
+	}
+
+	std::vector<char> image(len);
+	memset(&header, 0, sizeof(header));
+	header.magic = MEM_IMAGE_MAGIC;
+
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		MyFsFileInfo *file = &files[i];
+		MemImageEntry entry;
+
+		if (file->name[0] == '\0')
+			continue;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.slot = i;
+		entry.parent = file->parent;
+		entry.mode = file->mode;
+		entry.uid = file->uid;
+		entry.gid = file->gid;
+		entry.nameLen = strlen(file->name);
+		entry.attrSize = xattrs[i].storedSize();
+		entry.size = file->size;
+		entry.atime = file->atime;
+		entry.mtime = file->mtime;
+		entry.ctime = file->ctime;
+
+		memcpy(&image[pos], &entry, sizeof(entry));
+		pos += sizeof(entry);
+		memcpy(&image[pos], file->name, entry.nameLen);
+		pos += entry.nameLen;
+		if (entry.attrSize > 0)
+			xattrs[i].store(&image[pos]);
+		pos += entry.attrSize;
+		if (file->data != NULL)
+			memcpy(&image[pos], file->data, file->size);
+		pos += file->size;
+		header.count++;
+	}
+
+	header.size = len - sizeof(header);
+	header.crc = crc32c(0, image.data() + sizeof(header), header.size);
+	memcpy(image.data(), &header, sizeof(header));
+
+	fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return -errno;
+	for (pos = 0; pos < len; ) {
+		ssize_t n = write(fd, image.data() + pos, len - pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			ret = -errno;
+			break;
+		}
+		pos += n;
+	}
+	if (ret == 0 && fsync(fd) < 0)
+		ret = -errno;
+	if (close(fd) < 0 && ret == 0)
+		ret = -errno;
+	if (ret == 0 && rename(tmp.c_str(), imageFile.c_str()) < 0)
+		ret = -errno;
+	if (ret < 0)
+		unlink(tmp.c_str());
+
+	return ret;
+}
+
+// FUSE callbacks below this line
+
+/// @brief Create a new file.
+///
+/// Create a new file with given name and permissions.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] mode Permissions for file access.
+/// \param [in] dev Can be ignored.
+/// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
+{
+	LOGM();
+
+	// TODO: [PART 1] Implement this! Implemented by slno1011
+	int ret = createEntry(path, mode);
+	RETURN(ret);
+}
+
+/// @brief Create a directory.
+///
+/// Create a new, empty directory with given name and permissions.
+/// \param [in] path Path of the directory, starting with "/".
+/// \param [in] mode Permissions for directory access.
+/// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::fuseMkdir(const char *path, mode_t mode)
+{
+	LOGM();
+
+	int ret = createEntry(path, S_IFDIR | (mode & ~S_IFMT));
+	RETURN(ret);
 }
 
 /// @brief Delete a file.
@@ -148,8 +424,6 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
 int MyInMemoryFS::fuseUnlink(const char *path)
 {
 	int ret, index;
-	char file_name[NAME_LENGTH];
-	MyFsFileInfo *file_ptr;
 
 	LOGM();
 
@@ -158,23 +432,44 @@ int MyInMemoryFS::fuseUnlink(const char *path)
 	if (ret)
 		return ret;
 
-	strncpy(file_name, path, NAME_LENGTH - 1);
-	file_name[NAME_LENGTH - 1] = '\0';
-
-	index = getFileIndex(file_name);
+	index = getFileIndex(path);
 	if (index == -1)
 		return -ENOENT;
+	if (S_ISDIR(files[index].mode))
+		return -EISDIR;
 
-	file_ptr = &files[index];
-	if (file_ptr->data)
-		free(file_ptr->data);
-	/* Setting the first byte of name to '\0' would
-	 * be enough, but in this case we are dealing with
-	 * a structure which has user/group ids and the
-	 * access mode saved. It's good security practice
-	 * to override them with 0.
-	 */
-	memset(file_ptr, 0, sizeof(MyFsFileInfo));
+	removeEntry(index);
+
+	RETURN(0);
+}
+
+/// @brief Delete a directory.
+///
+/// Delete an empty directory from the file system.
+/// \param [in] path Path of the directory, starting with "/".
+/// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::fuseRmdir(const char *path)
+{
+	int ret, dir;
+	const char *name;
+
+	LOGM();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	ret = dentries.resolve(path, &dir, &name);
+	if (ret == ROOT_DIR)
+		return -EBUSY;
+	if (ret < 0)
+		return ret;
+	if (!S_ISDIR(files[ret].mode))
+		return -ENOTDIR;
+	if (dentries.countChildren(ret) > 0)
+		return -ENOTEMPTY;
+
+	removeEntry(ret);
 
 	RETURN(0);
 }
@@ -193,7 +488,8 @@ int MyInMemoryFS::fuseRename(const char *path, const char *newpath)
 	LOGM();
 
 	// TODO: [PART 1] Implement this! Implemented by heli1017
-	int ret;
+	int ret, dir, target;
+	const char *name;
 	ret = checkPath(path);
 	if (ret)
 		return ret;
@@ -202,22 +498,91 @@ int MyInMemoryFS::fuseRename(const char *path, const char *newpath)
 		return ret;
 
 	int index = getFileIndex(path); // holt sich index der gesuchten Datei path
-	if (index >= 0)									// falls Datei path vorhanden
+	if (index < 0)
+		return -ENOENT; // ERROR, falls Datei path nicht existiert
+
+	target = dentries.resolve(newpath, &dir, &name);
+	if (dir == -1)
+		return target;
+	if (target == ROOT_DIR)
+		return -EBUSY;
+	if (target == index)
+		return 0;
+
+	bool is_dir = S_ISDIR(files[index].mode);
+	if (is_dir)
 	{
-		if (getFileIndex(newpath) >= 0) // checken, ob Datei mit neuem Namen existiert
+		/* a directory cannot be moved below itself */
+		for (int d = dir; d != ROOT_DIR; d = files[d].parent)
 		{
-			fuseUnlink(newpath); // löscht Datei mit neuem Namen
+			if (d == index)
+				return -EINVAL;
 		}
-		strncpy(files[index].name, newpath, NAME_LENGTH - 1); // nennt path in newpath um
 	}
-	else
+
+	if (target >= 0) // checken, ob Datei mit neuem Namen existiert
 	{
-		return -ENOENT; // ERROR, falls Datei path nicht existiert
+		if (S_ISDIR(files[target].mode) != is_dir)
+			return is_dir ? -ENOTDIR : -EISDIR;
+		if (dentries.countChildren(target) > 0)
+			return -ENOTEMPTY;
+		removeEntry(target); // löscht Datei mit neuem Namen
 	}
 
+	dentries.remove(files[index].parent, files[index].name);
+	memset(files[index].name, 0, NAME_LENGTH);
+	strncpy(files[index].name, name, NAME_LENGTH - 1); // nennt path in newpath um
+	files[index].parent = dir;
+	dentries.insert(dir, files[index].name, index, is_dir);
+
 	return 0;
 }
 
+// Fill in the attributes of an entry, used by getattr and readdir
+// \param [in] index Slot of the entry, ROOT_DIR for the root directory.
+// \param [out] statbuf Attributes of the entry.
+void MyInMemoryFS::statEntry(int index, struct stat *statbuf)
+{
+	MyFsFileInfo *file;
+
+	memset(statbuf, 0, sizeof(struct stat));
+	statbuf->st_ino = ENTRY_INO(index);
+	statbuf->st_uid =
+			getuid(); // The owner of the file/directory is the user who mounted the filesystem
+	statbuf->st_gid =
+			getgid(); // The group of the file/directory is the same as the group of the user who mounted the filesystem
+
+	if (index == ROOT_DIR)
+	{
+		statbuf->st_mode = S_IFDIR | 0755;
+		statbuf->st_nlink =
+				2 + dentries.countSubdirs(ROOT_DIR); // Why "two" hardlinks instead of "one"? The answer is here: http://unix.stackexchange.com/a/101536
+		statbuf->st_atime = time(
+				NULL); // The last "a"ccess of the file/directory is right now
+		/* I don't think modification time should be now */
+		statbuf->st_mtime = time(
+				NULL); // The last "m"odification of the file/directory is right now
+		return;
+	}
+
+	file = &files[index];
+	if (S_ISDIR(file->mode))
+	{
+		/* "." and the ".." of every subdirectory link to a directory */
+		statbuf->st_mode = file->mode;
+		statbuf->st_nlink = 2 + dentries.countSubdirs(index);
+	}
+	else
+	{
+		statbuf->st_mode = S_IFREG | file->mode;
+		statbuf->st_nlink = 1;
+	}
+	statbuf->st_size = file->size;
+	statbuf->st_ctime = file->ctime;
+	statbuf->st_mtime = file->mtime;
+	statbuf->st_atime = file->atime;
+}
+
 /// @brief Get file meta data.
 ///
 /// Get the metadata of a file (user & group id, modification times, permissions, ...).
@@ -227,7 +592,6 @@ int MyInMemoryFS::fuseRename(const char *path, const char *newpath)
 int MyInMemoryFS::fuseGetattr(const char *path, struct stat *statbuf)
 {
 	int ret;
-	MyFsFileInfo *file;
 
 	LOGM();
 
@@ -247,22 +611,10 @@ int MyInMemoryFS::fuseGetattr(const char *path, struct stat *statbuf)
 	//		st_size:	This specifies the size of a regular file in bytes. For files that are really devices this field
 	//		            isn’t usually meaningful. For symbolic links this specifies the length of the file name the link
 	//		            refers to.
-	statbuf->st_uid =
-			getuid(); // The owner of the file/directory is the user who mounted the filesystem
-	statbuf->st_gid =
-			getgid(); // The group of the file/directory is the same as the group of the user who mounted the filesystem
-
 	if (strcmp(path, "/") == 0)
 	{
 		LOGF("\tAttributes of dir %s requested\n", path);
-		statbuf->st_mode = S_IFDIR | 0755;
-		statbuf->st_nlink =
-				2; // Why "two" hardlinks instead of "one"? The answer is here: http://unix.stackexchange.com/a/101536
-		statbuf->st_atime = time(
-				NULL); // The last "a"ccess of the file/directory is right now
-		/* I don't think modification time should be now */
-		statbuf->st_mtime = time(
-				NULL); // The last "m"odification of the file/directory is right now
+		statEntry(ROOT_DIR, statbuf);
 	}
 	else
 	{
@@ -275,16 +627,9 @@ int MyInMemoryFS::fuseGetattr(const char *path, struct stat *statbuf)
 		if (ret == -1)
 			return -ENOENT;
 
-		file = &files[ret];
 		/* access time is now */
-		file->atime = time(NULL);
-
-		statbuf->st_mode = S_IFREG | file->mode;
-		statbuf->st_nlink = 1;
-		statbuf->st_size = file->size;
-		statbuf->st_ctime = file->ctime;
-		statbuf->st_mtime = file->mtime;
-		statbuf->st_atime = file->atime;
+		files[ret].atime = time(NULL);
+		statEntry(ret, statbuf);
 	}
 
 	RETURN(0);
@@ -312,7 +657,8 @@ int MyInMemoryFS::fuseChmod(const char *path, mode_t mode)
 	if (index == -1)
 		return -ENOENT;
 
-	files[index].mode = mode;
+	/* the type of an entry never changes */
+	files[index].mode = (files[index].mode & S_IFMT) | (mode & ~S_IFMT);
 
 	RETURN(0);
 }
@@ -352,12 +698,11 @@ int MyInMemoryFS::fuseChown(const char *path, uid_t uid, gid_t gid)
 int MyInMemoryFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo)
 {
 	int ret, index;
-	char file_name[NAME_LENGTH];
 
 	LOGM();
 	// TODO: [PART 1] Implement this! implemented by danisltpi
 
-	if (numberOfOpenFiles == NUM_OPEN_FILES)
+	if (numberOfOpenFiles == MAX_OPEN_FILES)
 	{
 		return -EMFILE;
 	}
@@ -366,16 +711,19 @@ int MyInMemoryFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo)
 	if (ret)
 		return ret;
 
-	strncpy(file_name, path, NAME_LENGTH - 1);
-	file_name[NAME_LENGTH - 1] = '\0';
-	index = getFileIndex(file_name);
+	index = getFileIndex(path);
 	if (index == -1)
 		return -ENOENT;
+	if (S_ISDIR(files[index].mode))
+		return -EISDIR;
 
 	LOGF("\topened %s, index = %d\n", path, index);
 
 	// file handle uses index (because index starts at 0) of the file so if it is not set the file is not open;
 	fileInfo->fh = index;
+	/* pages cached by the kernel stay valid as long as nobody wrote to the file */
+	fileInfo->keep_cache = !changed[index];
+	changed[index] = false;
 	numberOfOpenFiles++;
 
 	RETURN(0);
@@ -488,7 +836,7 @@ int MyInMemoryFS::fuseWrite(const char *path, const char *buf, size_t size,
 			return -ENOMEM;
 
 		memset(file->data, 0, alloc_size);
-		file->size = alloc_size;
+		setFileSize(file, alloc_size);
 	}
 	else if (offset == 0)
 	{
@@ -497,7 +845,7 @@ int MyInMemoryFS::fuseWrite(const char *path, const char *buf, size_t size,
 		 */
 		free(file->data);
 		file->data = NULL;
-		file->size = 0;
+		setFileSize(file, 0);
 
 		alloc_size = offset + size;
 		alloc_buf = (char *)malloc(alloc_size);
@@ -505,7 +853,7 @@ int MyInMemoryFS::fuseWrite(const char *path, const char *buf, size_t size,
 			return -ENOMEM;
 
 		file->data = alloc_buf;
-		file->size = size;
+		setFileSize(file, size);
 	}
 	else if ((write_start + size) > file_end)
 	{
@@ -519,10 +867,11 @@ int MyInMemoryFS::fuseWrite(const char *path, const char *buf, size_t size,
 
 		free(file->data);
 		file->data = alloc_buf;
-		file->size = alloc_size;
+		setFileSize(file, alloc_size);
 	}
 
 	memcpy(file->data + offset, buf, size);
+	changed[index] = true;
 
 	/* do we have to check the return value? */
 	time_now = time(NULL);
@@ -531,6 +880,165 @@ int MyInMemoryFS::fuseWrite(const char *path, const char *buf, size_t size,
 	return size;
 }
 
+/// @brief Get file system statistics.
+///
+/// Computed from counters kept up to date by fuseMknod(), fuseUnlink(), fuseWrite() and fuseTruncate(). The file
+/// data lives in memory, so the free space is the memory still available on the host.
+/// \param [in] path Can be ignored.
+/// \param [out] statInfo Structure for the statistics, for details type "man 3 statvfs" in a terminal.
+/// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::fuseStatfs(const char *path, struct statvfs *statInfo)
+{
+	long pages, page_size;
+	fsblkcnt_t used_blocks, free_blocks;
+
+	LOGM();
+
+	pages = sysconf(_SC_AVPHYS_PAGES);
+	page_size = sysconf(_SC_PAGESIZE);
+	free_blocks = (pages > 0 && page_size > 0) ? (fsblkcnt_t)pages * page_size / BLOCK_SIZE : 0;
+	used_blocks = (usedBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	memset(statInfo, 0, sizeof(struct statvfs));
+	statInfo->f_bsize = BLOCK_SIZE;
+	statInfo->f_frsize = BLOCK_SIZE;
+	statInfo->f_blocks = used_blocks + free_blocks;
+	statInfo->f_bfree = free_blocks;
+	statInfo->f_bavail = free_blocks;
+	statInfo->f_files = NUM_DIR_ENTRIES;
+	statInfo->f_ffree = freeSlots;
+	statInfo->f_favail = freeSlots;
+	/* names are stored with a terminating '\0' */
+	statInfo->f_namemax = NAME_LENGTH - 1;
+
+	RETURN(0);
+}
+
+// Find the entry of a file or directory for its extended attributes
+// \return index of the entry, -ENOTSUP for the root directory, -ERRNO on failure.
+static int xattrIndex(const char *path, int index)
+{
+	if (index == -1)
+		return (strcmp(path, "/") == 0) ? -ENOTSUP : -ENOENT;
+	return index;
+}
+
+/// @brief Set an extended attribute.
+///
+/// SAVE_XATTR of the root directory is no attribute, setting it writes the image of the file system, see saveImage().
+/// \param [in] path Path of the file.
+/// \param [in] name Name of the attribute.
+/// \param [in] value Value of the attribute, not terminated by '\0'.
+/// \param [in] size Length of the value.
+/// \param [in] flags XATTR_CREATE or XATTR_REPLACE.
+/// \return 0 on success, -ERRNO on failure.
+#ifdef __APPLE__
+int MyInMemoryFS::fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags,
+			       uint32_t x)
+#else
+int MyInMemoryFS::fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+#endif
+{
+	int ret;
+
+	LOGM();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	if (strcmp(path, "/") == 0 && strcmp(name, SAVE_XATTR) == 0)
+	{
+		if (imageFile.empty())
+			return -ENOTSUP;
+		ret = saveImage();
+		RETURN(ret);
+	}
+
+	ret = xattrIndex(path, getFileIndex(path));
+	if (ret < 0)
+		return ret;
+
+	ret = xattrs[ret].set(name, value, size, flags);
+
+	RETURN(ret);
+}
+
+/// @brief Get an extended attribute.
+///
+/// \param [in] path Path of the file.
+/// \param [in] name Name of the attribute.
+/// \param [out] value Buffer for the value.
+/// \param [in] size Size of the buffer, 0 to ask for the length of the value.
+/// \return Length of the value on success, -ERRNO on failure.
+#ifdef __APPLE__
+int MyInMemoryFS::fuseGetxattr(const char *path, const char *name, char *value, size_t size, uint x)
+#else
+int MyInMemoryFS::fuseGetxattr(const char *path, const char *name, char *value, size_t size)
+#endif
+{
+	int ret;
+
+	LOGM();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	ret = xattrIndex(path, getFileIndex(path));
+	if (ret < 0)
+		return (ret == -ENOTSUP) ? -ENODATA : ret;
+
+	return xattrs[ret].get(name, value, size);
+}
+
+/// @brief List the extended attributes of a file.
+///
+/// \param [in] path Path of the file.
+/// \param [out] list Buffer for the names, each one terminated by '\0'.
+/// \param [in] size Size of the buffer, 0 to ask for the length of the list.
+/// \return Length of the list on success, -ERRNO on failure.
+int MyInMemoryFS::fuseListxattr(const char *path, char *list, size_t size)
+{
+	int ret;
+
+	LOGM();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	ret = xattrIndex(path, getFileIndex(path));
+	if (ret < 0)
+		return (ret == -ENOTSUP) ? 0 : ret;
+
+	return xattrs[ret].list(list, size);
+}
+
+/// @brief Remove an extended attribute.
+///
+/// \param [in] path Path of the file.
+/// \param [in] name Name of the attribute.
+/// \return 0 on success, -ERRNO on failure.
+int MyInMemoryFS::fuseRemovexattr(const char *path, const char *name)
+{
+	int ret;
+
+	LOGM();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	ret = xattrIndex(path, getFileIndex(path));
+	if (ret < 0)
+		return (ret == -ENOTSUP) ? -ENODATA : ret;
+
+	ret = xattrs[ret].remove(name);
+
+	RETURN(ret);
+}
+
 /// @brief Close a file.
 ///
 /// In Part 1 this includes decrementing the open file count.
@@ -540,16 +1048,13 @@ int MyInMemoryFS::fuseWrite(const char *path, const char *buf, size_t size,
 int MyInMemoryFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo)
 {
 	int ret, index;
-	char file_name[NAME_LENGTH];
 	LOGM();
 
 	// TODO: [PART 1] Implement this! // implemented by danisltpi
 	ret = checkPath(path);
 	if (ret)
 		return ret;
-	strncpy(file_name, path, NAME_LENGTH - 1);
-	file_name[NAME_LENGTH - 1] = '\0';
-	index = getFileIndex(file_name);
+	index = getFileIndex(path);
 	if (index == -1)
 		return -ENOENT;
 
@@ -584,13 +1089,17 @@ int MyInMemoryFS::fuseTruncate(const char *path, off_t newSize)
 	if (index == -1)
 		return -ENOENT;
 
+	if (S_ISDIR(files[index].mode))
+		return -EISDIR;
+
 	file = &files[index];
+	changed[index] = true;
 
 	if (newSize == 0)
 	{
 		free(file->data);
 		file->data = NULL;
-		file->size = 0;
+		setFileSize(file, 0);
 		return 0;
 	}
 
@@ -612,7 +1121,7 @@ int MyInMemoryFS::fuseTruncate(const char *path, off_t newSize)
 	memcpy(buf, file->data, copySize);
 	free(file->data);
 	file->data = buf;
-	file->size = copySize;
+	setFileSize(file, copySize);
 	// TODO: [PART 1] Implement this!
 
 	return 0;
@@ -641,18 +1150,24 @@ int MyInMemoryFS::fuseTruncate(const char *path, off_t newSize,
 
 /// @brief Read a directory.
 ///
-/// Read the content of the (only) directory.
+/// Read the content of a directory, along with the attributes of every entry, so listing a directory takes no
+/// getattr per entry. Entries are passed with their offset (see DIR_OFFSET()), so large directories are read in
+/// several calls when the buffer is full.
 /// You do not have to check file permissions, but can assume that it is always ok to access the directory.
-/// \param [in] path Path of the directory. Should be "/" in our case.
+/// \param [in] path Path of the directory.
 /// \param [out] buf A buffer for storing the directory entries.
 /// \param [in] filler A function for putting entries into the buffer.
-/// \param [in] offset Can be ignored.
+/// \param [in] offset Offset of the entry to continue behind, 0 to start at the beginning.
 /// \param [in] fileInfo Can be ignored.
 /// \return 0 on success, -ERRNO on failure.
 int MyInMemoryFS::fuseReaddir(const char *path, void *buf,
 															fuse_fill_dir_t filler, off_t offset,
 															struct fuse_file_info *fileInfo)
 {
+	int dir;
+	const char *name;
+	struct stat st;
+
 	LOGM();
 
 	// TODO: [PART 1] Implement this!
@@ -663,19 +1178,33 @@ int MyInMemoryFS::fuseReaddir(const char *path, void *buf,
 
 	LOGF("--> Getting The List of Files of %s\n", path);
 
-	filler(buf, ".", NULL, 0);	// Current Directory
-	filler(buf, "..", NULL, 0); // Parent Directory
+	ret = dentries.resolve(path, &dir, &name);
+	if (ret < 0)
+		return ret;
+	if (ret != ROOT_DIR && !S_ISDIR(files[ret].mode))
+		return -ENOTDIR;
+	dir = ret;
 
-	if (strcmp(path, "/") == 0)
+	if (offset < 1)
 	{
-		for (int i = 0; i < NUM_DIR_ENTRIES; i++)
-		{
-			if (files[i].name[0] != '\0')
-			{
-				filler(buf, files[i].name + 1, NULL, 0);
-				LOGF("\t\t%s\n", files[i].name);
-			}
-		}
+		statEntry(dir, &st);
+		if (filler(buf, ".", &st, 1)) // Current Directory
+			RETURN(0);
+	}
+	if (offset < 2)
+	{
+		statEntry((dir == ROOT_DIR) ? ROOT_DIR : files[dir].parent, &st);
+		if (filler(buf, "..", &st, 2)) // Parent Directory
+			RETURN(0);
+	}
+
+	const std::set<int> &children = dentries.childrenOf(dir);
+	for (std::set<int>::const_iterator it = children.lower_bound(DIR_FIRST_SLOT(offset)); it != children.end(); ++it)
+	{
+		statEntry(*it, &st);
+		if (filler(buf, files[*it].name, &st, DIR_OFFSET(*it)))
+			break;
+		LOGF("\t\t%s\n", files[*it].name);
 	}
 
 	RETURN(0);
@@ -684,17 +1213,15 @@ int MyInMemoryFS::fuseReaddir(const char *path, void *buf,
 /// Initialize a file system.
 ///
 /// This function is called when the file system is mounted. You may add some initializing code here.
-/// \param [in] conn Can be ignored.
+/// \param [in,out] conn Connection info, used to request large reads and writes.
 /// \return 0.
 void *MyInMemoryFS::fuseInit(struct fuse_conn_info *conn)
 {
 	// Open logfile
-	this->logFile = fopen(
-			((MyFsInfo *)fuse_get_context()->private_data)->logFile, "w+");
+	this->logFile = fopen(getInfo()->logFile, "w+");
 	if (this->logFile == NULL)
 	{
-		fprintf(stderr, "ERROR: Cannot open logfile %s\n",
-						((MyFsInfo *)fuse_get_context()->private_data)->logFile);
+		fprintf(stderr, "ERROR: Cannot open logfile %s\n", getInfo()->logFile);
 	}
 	else
 	{
@@ -705,7 +1232,25 @@ void *MyInMemoryFS::fuseInit(struct fuse_conn_info *conn)
 
 		LOG("Using in-memory mode");
 
+		setupConnection(conn);
+
 		// TODO: [PART 1] Implement your initialization methods here
+		const char *image = getInfo()->imageFile;
+		if (image != NULL)
+		{
+			imageFile = image;
+			int ret = loadImage();
+			if (ret < 0)
+			{
+				/* do not overwrite an image that may still be repaired */
+				LOGF("ERROR: Cannot restore image %s: %s, it will not be saved", image, strerror(-ret));
+				imageFile.clear();
+			}
+			else
+			{
+				LOGF("Restored %d entries from image %s", ret, image);
+			}
+		}
 	}
 
 	RETURN(0);
@@ -719,6 +1264,12 @@ void MyInMemoryFS::fuseDestroy()
 	LOGM();
 
 	// TODO: [PART 1] Implement this!
+	if (!imageFile.empty())
+	{
+		int ret = saveImage();
+		if (ret < 0)
+			LOGF("ERROR: Cannot save image %s: %s", imageFile.c_str(), strerror(-ret));
+	}
 }
 
 // TODO: [PART 1] You may add your own additional methods here!
@@ -15,31 +15,190 @@
 #define DEBUG_RETURN_VALUES
 
 #include <assert.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <system_error>
 
 #include "macros.h"
 #include "myfs.h"
 #include "myfs-info.h"
 #include "blockdevice.h"
+#include "crc32c.h"
+#include "lz.h"
+
+#if DELALLOC_BATCH_BLOCKS * BLOCK_SIZE > BD_POOL_BUFFER_SIZE
+#error "a flush batch must fit into a buffer of the I/O buffer pool"
+#endif
+#if DEFRAG_STEP_BLOCKS * BLOCK_SIZE > BD_POOL_BUFFER_SIZE
+#error "a defragmentation step must fit into a buffer of the I/O buffer pool"
+#endif
+#if EXTENT_SIZE + BLOCK_SIZE > BD_POOL_BUFFER_SIZE
+#error "a stored extent must fit into a buffer of the I/O buffer pool"
+#endif
+static_assert(sizeof(DiskFileInfo) == BLOCK_SIZE, "a root entry must fill one block, see syncRoot()");
+
+/* serializes a FUSE request with the defragmenter, see defragStep(), and writes back the checksums it changed */
+#define LOCK_REQUEST() RequestGuard request_guard(this)
+/* the same for reads and writes, which take care of the dirty block of a handle themselves, see writeBackBlock() */
+#define LOCK_FILE_REQUEST() RequestGuard request_guard(this, true)
 
 static int *fatBuffer;
+static uint16_t *refBuffer;
 static DiskFileInfo *rootBuffer;
+static DiskFileInfo *rootWritten;	/* root entries as last written, see syncRoot() */
+static DiskSnapshot *snapBuffer;
+static uint64_t *freeMap;		/* one bit per FAT entry, set if the block is free */
+static std::vector<bool> fatLoaded;	/* regions of the FAT and the reference counts in memory */
+static uint32_t *csumBuffer;		/* CRC32C of every data block, NULL if checksums are off */
+static uint32_t *dedupBuffer;		/* fingerprint of data blocks written by flushFile(), NULL if dedup is off */
+static std::unordered_multimap<uint32_t, int> dedupIndex;	/* blocks with a fingerprint by fingerprint */
+
+#define MAP_WORDS ((FAT_ENTRY_COUNT + 63) / 64)
+#define MAP_SIZE align_to_io_size(MAP_WORDS * sizeof(uint64_t))
+#define FAT_REGIONS ((FAT_ENTRY_COUNT + FAT_REGION_ENTRIES - 1) / FAT_REGION_ENTRIES)
+
+#if (FAT_REGION_ENTRIES * 2) % BLOCK_SIZE != 0
+#error "a region of the reference counts must consist of whole blocks"
+#endif
 
 size_t align_to_block_size(size_t x)
 {
 	return (x + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
 }
 
+size_t align_to_io_size(size_t x)
+{
+	return (x + BD_DIRECT_ALIGN - 1) & ~(size_t)(BD_DIRECT_ALIGN - 1);
+}
+
+static bool isFree(int block)
+{
+	return (freeMap[block / 64] >> (block % 64)) & 1;
+}
+
+static void setFree(int block, bool free)
+{
+	if (free)
+		freeMap[block / 64] |= (uint64_t)1 << (block % 64);
+	else
+		freeMap[block / 64] &= ~((uint64_t)1 << (block % 64));
+}
+
+/* fingerprint of the content of a block for deduplication, 0 means there is none */
+static uint32_t fingerprint(const char *data)
+{
+	uint32_t fp = crc32c(0, data, BLOCK_SIZE);
+
+	return (fp != 0) ? fp : 1;
+}
+
+/* record the fingerprint of a block in the table and the index, 0 removes it */
+static void setFingerprint(int block, uint32_t fp)
+{
+	if (dedupBuffer[block] == fp)
+		return;
+
+	if (dedupBuffer[block] != 0) {
+		std::pair<std::unordered_multimap<uint32_t, int>::iterator,
+			std::unordered_multimap<uint32_t, int>::iterator> range = dedupIndex.equal_range(dedupBuffer[block]);
+		for (std::unordered_multimap<uint32_t, int>::iterator it = range.first; it != range.second; it++) {
+			if (it->second == block) {
+				dedupIndex.erase(it);
+				break;
+			}
+		}
+	}
+
+	dedupBuffer[block] = fp;
+	if (fp != 0)
+		dedupIndex.insert(std::make_pair(fp, block));
+}
+
+/* tables are aligned in memory as well, so they are written with O_DIRECT without copying */
+static void *alloc_table(size_t size)
+{
+	void *table;
+
+	if (posix_memalign(&table, BD_DIRECT_ALIGN, size) != 0)
+		return NULL;
+
+	memset(table, 0, size);
+	return table;
+}
+
+/* block of zeros for clearing blocks, never written to */
+alignas(BD_DIRECT_ALIGN) static char zeroBlock[BLOCK_SIZE];
+
+// Holds fsLock for the duration of a FUSE request
+class MyOnDiskFS::RequestGuard {
+private:
+	MyOnDiskFS *fs;
+
+public:
+	RequestGuard(MyOnDiskFS *fs, bool file_request = false) : fs(fs)
+	{
+		fs->fsLock.lock();
+		fs->requests++;
+		/* the reply of the previous request has been sent */
+		fs->releaseQuarantine(false);
+		/* everything else sees the changes of the dirty block, flush and release report a failure */
+		if (!file_request)
+			fs->writeBackBlock();
+	}
+
+	~RequestGuard()
+	{
+		fs->syncChecksums();
+		fs->fsLock.unlock();
+	}
+};
+
 /// @brief Constructor of the on-disk file system class.
 ///
 /// You may add your own constructor code here.
-MyOnDiskFS::MyOnDiskFS() : MyFS()
+MyOnDiskFS::MyOnDiskFS() : MyFS(), dentries(ROOT_DIR), snapDentries(NUM_SNAPSHOTS, DentryCache(ROOT_DIR))
 {
     // create a block device object
 	// allocation failure check is lacking here
     this->blockDevice = new BlockDevice(BLOCK_SIZE);
+	this->blockCache = new BlockCache(this->blockDevice, BLOCK_SIZE, BLOCK_CACHE_BLOCKS);
+	this->scratch = (char *)alloc_table(2 * BLOCK_SIZE);
+	this->delayedSlab = new BlockSlab(BLOCK_SIZE, DELALLOC_BATCH_BLOCKS, DELALLOC_MAX_BLOCKS);
+	numberOfOpenFiles = 0;
+	fatSeq = 0;
+	dirtyHandle = -1;
+	blockLoading = false;
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		writeSeq[i] = 0;
+		delayed[i].size = 0;
+		changed[i] = true;
+		attrsLoaded[i] = false;
+		extents[i].data = NULL;
+		resetExtents(&extents[i], EOC_BLOCK);
+	}
+	delayedBlocks = 0;
+	delayLimit = DELALLOC_MAX_BLOCKS;
+	freeBlocks = 0;
+	freeSlots = 0;
+	requests = 0;
+	defragRunning = false;
+	defragStop = false;
+	defragJob.index = -1;
+	defragNext = 0;
+	quarantineSeq = 0;
+	spliceSeq = 0;
+	tier = NULL;
+	tierLoading = false;
+	writebackRunning = false;
+	writebackStop = false;
 }
 
 /// @brief Destructor of the on-disk file system class.
@@ -47,24 +206,45 @@ MyOnDiskFS::MyOnDiskFS() : MyFS()
 /// You may add your own destructor code here.
 MyOnDiskFS::~MyOnDiskFS()
 {
-    // free block device object
+    // free block cache and block device object
+	delete this->tier;
+	free(this->scratch);
+	delete this->delayedSlab;
+	for (size_t i = 0; i < openFiles.size(); i++)
+		free(openFiles[i].block);
+    delete this->blockCache;
     delete this->blockDevice;
 }
 
 // Definitions of private methods here
 
 // Check if file with file_name exists
-// \param [in] file_name File name to check.
+// The path is resolved through the dentry cache, directories are found as well.
+// \param [in] file_name Path of the file to check.
 // \return index of MyFsFileInfo if file exists, otherwise -1.
 int MyOnDiskFS::getFileIndex(const char *file_name)
 {
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++)
-    {
-        if (strcmp(rootBuffer[i].name, file_name) == 0)
-            return i;
-    }
-    // Iterated through all file entries and file was not found
-    return -1;
+	int dir;
+	const char *name;
+	int index = dentries.resolve(file_name, &dir, &name);
+
+	return (index >= 0 && index != ROOT_DIR) ? index : -1;
+}
+
+// Clock of the heat of files in tiered mode, in seconds
+static double tierClock()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Index all named entries of a table of directory entries
+static void fillDentries(DentryCache &cache, const DiskFileInfo *table)
+{
+	cache.clear();
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (table[i].name[0] != '\0')
+			cache.insert(table[i].parent, table[i].name, i, S_ISDIR(table[i].mode));
+	}
 }
 
 // Get a free slot which doesn't have a file stored
@@ -81,149 +261,476 @@ int MyOnDiskFS::getFreeRootSlot(void)
     return -1;
 }
 
-//checks if entry is in one block only
-bool MyOnDiskFS::entryInOneBlock(int fileindex)
+int MyOnDiskFS::getEmptyBlockFAT(void)
 {
-    int entrypos = sb.root_start + fileindex * sizeof(struct DiskFileInfo);
-	int entryoffset = entrypos % BLOCK_SIZE;
-	size_t entrylen = sizeof(struct DiskFileInfo);
+	if (freeBlocks == 0)
+		return -1;
 
-    if((entryoffset + entrylen) < BLOCK_SIZE)
-        return true;
+	/* entry 0 is reserved, see FAT_ENTRY_COUNT, and never marked free */
+	for (int i = 0; i < (int)MAP_WORDS; i++) {
+		if (freeMap[i] != 0)
+			return i * 64 + __builtin_ctzll(freeMap[i]);
+	}
 
-    return false;
+	return -1;
 }
 
-//Return the block index of the changed rootentry
-int MyOnDiskFS::getChangedBlockIndex(int fileIndex)
+// Load the region of the FAT and the reference counts holding an entry, both with one batch request
+void MyOnDiskFS::loadRegion(int region)
 {
-	//STEP 1: fileIndex * Größe der Struct für DiskFileInfo + rootStart um auf die Position im Container zu kommen
-	//STEP 2: Position % BLOCKSIZE um den Index des Blocks zu bekommen in dem die File ist
+	int ret;
+	size_t fat_offset = (size_t)region * FAT_REGION_ENTRIES * sizeof(int);
+	size_t ref_offset = (size_t)region * FAT_REGION_ENTRIES * sizeof(uint16_t);
+	BlockRequest chunks[2] = {
+		{ (uint32_t)(sb.fat_start + fat_offset / BLOCK_SIZE),
+			(uint32_t)(std::min(FAT_REGION_ENTRIES * sizeof(int), sb.fat_size - fat_offset) / BLOCK_SIZE),
+			(char *)fatBuffer + fat_offset },
+		{ (uint32_t)(sb.ref_start + ref_offset / BLOCK_SIZE),
+			(uint32_t)(std::min(FAT_REGION_ENTRIES * sizeof(uint16_t), sb.ref_size - ref_offset) / BLOCK_SIZE),
+			(char *)refBuffer + ref_offset }
+	};
+
+	ret = this->blockDevice->readBatch(chunks, 2);
+	if (ret < 0)
+		LOGF("FATAL in %s: blockDevice read returned %d\n", __func__, ret);
 
-    int entryPosition = fileIndex * sizeof(struct DiskFileInfo) + sb.root_start;
-    int index = entryPosition / BLOCK_SIZE;
-	return index;
+	fatLoaded[region] = true;
 }
 
-//Return the number of changed blocks
-int MyOnDiskFS::getNumChangedBlocks(int fileIndex)
+// Entry of the FAT, its region is loaded on first access
+int &MyOnDiskFS::fatEntry(int block)
 {
-	//STEP 1: get Position des entries in dem Container (siehe oben)
-	//STEP 2: schauen ob Start des Entries im Block + sizeof(DiskFileInfo) < BLOCK_SIZE wenn ja return 1 else 2
+	if (!fatLoaded[block / FAT_REGION_ENTRIES])
+		loadRegion(block / FAT_REGION_ENTRIES);
 
-    int entryPosition = fileIndex * sizeof(struct DiskFileInfo) + sb.root_start;
-    int changedBlockIndex = getChangedBlockIndex(fileIndex);
-    int changedBlockPosition = changedBlockIndex * BLOCK_SIZE;
-    if((sb.root_start + entryPosition - changedBlockPosition) + sizeof(DiskFileInfo) < BLOCK_SIZE)
-        return 1;
-
-    return 2;
+	return fatBuffer[block];
 }
 
-int MyOnDiskFS::getEmptyBlockFAT(void)
+// Reference count of a block, its region is loaded on first access
+uint16_t &MyOnDiskFS::refEntry(int block)
 {
-	int fat_entries = sb.fat_size / sizeof(int);
+	if (!fatLoaded[block / FAT_REGION_ENTRIES])
+		loadRegion(block / FAT_REGION_ENTRIES);
 
-	for (int i = 0; i < fat_entries; i++) {
-		if (fatBuffer[i] == EMPTY_BLOCK)
-			return i;
-	}
+	return refBuffer[block];
+}
 
-	return -1;
+// Take a free block off the bitmap, the caller sets its FAT entry
+void MyOnDiskFS::claimBlock(int block)
+{
+	setFree(block, false);
+	freeBlocks--;
+}
+
+// Free a block
+void MyOnDiskFS::releaseBlock(int block)
+{
+	fatEntry(block) = EMPTY_BLOCK;
+	setFree(block, true);
+	freeBlocks++;
+	if (dedupBuffer != NULL)
+		setFingerprint(block, 0);
 }
 
+// Write a table to the container
+// The table is written in chunks of TABLE_IO_BLOCKS blocks, up to TABLE_IO_BLOCKS chunks with one batch request.
 void MyOnDiskFS::sync(uint32_t dest, void *src, size_t len)
 {
-	char *bufptr = (char *)src;
+	int ret, count = 0;
+	uint32_t blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
 	LOGF("SYNC: fat = %d, fat_size = %ld, root = %d, root_size = %ld, data = %d\n",
 		sb.fat_start, sb.fat_size, sb.root_start, sb.root_size, sb.data_start);
 
-	for (uint32_t block = 0; block != len; block += BLOCK_SIZE) {
-		this->blockDevice->write(dest + block, bufptr + block);
+	for (uint32_t block = 0; block < blocks; block += TABLE_IO_BLOCKS) {
+		BlockRequest chunk = { dest + block, std::min<uint32_t>(TABLE_IO_BLOCKS, blocks - block),
+			(char *)src + (size_t)block * BLOCK_SIZE };
+		tableRuns[count++] = chunk;
+
+		if (count == TABLE_IO_BLOCKS || block + TABLE_IO_BLOCKS >= blocks) {
+			ret = this->blockDevice->writeBatch(tableRuns, count);
+			if (ret < 0)
+				LOGF("FATAL in %s: blockDevice write returned %d\n", __func__, ret);
+			count = 0;
+		}
+	}
+}
+
+// Read a table from the container, in batches like sync()
+void MyOnDiskFS::load(uint32_t src, void *dest, size_t len)
+{
+	int ret, count = 0;
+	uint32_t blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	for (uint32_t block = 0; block < blocks; block += TABLE_IO_BLOCKS) {
+		BlockRequest chunk = { src + block, std::min<uint32_t>(TABLE_IO_BLOCKS, blocks - block),
+			(char *)dest + (size_t)block * BLOCK_SIZE };
+		tableRuns[count++] = chunk;
+
+		if (count == TABLE_IO_BLOCKS || block + TABLE_IO_BLOCKS >= blocks) {
+			ret = this->blockDevice->readBatch(tableRuns, count);
+			if (ret < 0)
+				LOGF("FATAL in %s: blockDevice read returned %d\n", __func__, ret);
+			count = 0;
+		}
+	}
+}
+
+// Write back only the blocks of an area covering [offset, offset + len)
+void MyOnDiskFS::syncRange(uint32_t dest, void *src, size_t offset, size_t len)
+{
+	size_t first = offset / BLOCK_SIZE;
+	size_t last = (offset + len - 1) / BLOCK_SIZE;
+
+	sync(dest + first, (char *)src + first * BLOCK_SIZE, (last - first + 1) * BLOCK_SIZE);
+}
+
+// Write back the regions of the FAT or the reference counts that are in memory
+// \param [in] dest First block of the table.
+// \param [in] src Table.
+// \param [in] len Size of the table.
+// \param [in] region_size Size of a region in the table.
+void MyOnDiskFS::syncLoaded(uint32_t dest, void *src, size_t len, size_t region_size)
+{
+	size_t start, end, last;
+
+	for (size_t region = 0; region < fatLoaded.size(); region = last) {
+		for (last = region; last < fatLoaded.size() && fatLoaded[last]; last++)
+			;
+		if (last == region) {
+			last++;
+			continue;
+		}
+
+		start = region * region_size;
+		end = std::min(last * region_size, len);
+		sync(dest + start / BLOCK_SIZE, (char *)src + start, end - start);
 	}
 }
 
 void MyOnDiskFS::syncFAT(void)
 {
-	sync(sb.fat_start, fatBuffer, sb.fat_size);
+	/* chains may have changed, positions remembered by open files are void */
+	fatSeq++;
+	syncLoaded(sb.fat_start, fatBuffer, sb.fat_size, FAT_REGION_ENTRIES * sizeof(int));
+}
+
+void MyOnDiskFS::syncRefs(void)
+{
+	syncLoaded(sb.ref_start, refBuffer, sb.ref_size, FAT_REGION_ENTRIES * sizeof(uint16_t));
+}
+
+// Write the superblock to block 0
+void MyOnDiskFS::syncSuperBlock(void)
+{
+	int ret;
+
+	memset(scratch, 0, BLOCK_SIZE);
+	memcpy(scratch, &sb, sizeof(sb));
+	ret = this->blockDevice->write(0, scratch);
+	if (ret < 0)
+		LOGF("FATAL in %s: blockDevice write returned %d\n", __func__, ret);
+}
+
+// Write the root entries collected in tableRuns with one batch request
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeRootChunks(int count)
+{
+	int ret;
+
+	ret = this->blockDevice->writeBatch(tableRuns, count);
+	if (ret < 0) {
+		LOGF("FATAL in %s: blockDevice write returned %d\n", __func__, ret);
+		return ret;
+	}
+
+	/* entries count as written only once they are in the container, a failed write is repeated with the next call */
+	for (int c = 0; c < count; c++)
+		memcpy(&rootWritten[tableRuns[c].blockNo - sb.root_start], tableRuns[c].buffer,
+			tableRuns[c].count * sizeof(DiskFileInfo));
+	return 0;
 }
 
+// Write back the root entries changed since the last call, up to TABLE_IO_BLOCKS chunks with one batch request
+// An entry fills one block, so a changed entry costs one block write and the other entries are not touched.
 void MyOnDiskFS::syncRoot(void)
 {
-	sync(sb.root_start, rootBuffer, sb.root_size);
+	int count = 0;
+
+	for (uint32_t i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (memcmp(&rootBuffer[i], &rootWritten[i], sizeof(DiskFileInfo)) == 0)
+			continue;
+
+		if (count > 0 && tableRuns[count - 1].count < TABLE_IO_BLOCKS &&
+			tableRuns[count - 1].blockNo + tableRuns[count - 1].count == sb.root_start + i) {
+			tableRuns[count - 1].count++;
+			continue;
+		}
+		if (count == TABLE_IO_BLOCKS) {
+			if (writeRootChunks(count) < 0)
+				return;
+			count = 0;
+		}
+		BlockRequest chunk = { sb.root_start + i, 1, (char *)&rootBuffer[i] };
+		tableRuns[count++] = chunk;
+	}
+
+	if (count > 0)
+		writeRootChunks(count);
 }
 
-int MyOnDiskFS::fatToDataAddress(int fat_index)
+void MyOnDiskFS::syncSnapshot(int slot)
 {
-	return sb.data_start + fat_index * BLOCK_SIZE;
+	syncRange(sb.snap_start, snapBuffer, slot * sizeof(DiskSnapshot), sizeof(DiskSnapshot));
 }
 
-int MyOnDiskFS::getEmptyBlockChain(int num_blocks)
+// Write back the blocks of the checksum table changed since the last call, in batches like syncRoot()
+// Called at the end of every request, so a block and its checksum reach the container close together.
+void MyOnDiskFS::syncChecksums()
 {
-	/* used to temporarily store blocks to free in case
-	 * we fail to claim all required blocks
-	 */
-	int *freelist;
-	char *zeromem;
-	int claimed_blocks = 0;
-	int start_block = -1, prev_block = -1;
+	int ret, count = 0;
 
-	freelist = (int *)malloc(sizeof(int) * num_blocks);
-	if (freelist == NULL)
-		return -ENOMEM;
+	if (csumBuffer == NULL)
+		return;
+
+	blockCache->dirtyChecksums(dirtyCsums);
+	for (size_t i = 0; i < dirtyCsums.size(); i++) {
+		if (count > 0 && tableRuns[count - 1].count < TABLE_IO_BLOCKS &&
+			tableRuns[count - 1].blockNo + tableRuns[count - 1].count == sb.csum_start + dirtyCsums[i]) {
+			tableRuns[count - 1].count++;
+			continue;
+		}
+		if (count == TABLE_IO_BLOCKS) {
+			ret = this->blockDevice->writeBatch(tableRuns, count);
+			if (ret < 0)
+				LOGF("FATAL in %s: blockDevice write returned %d\n", __func__, ret);
+			count = 0;
+		}
+		BlockRequest chunk = { sb.csum_start + dirtyCsums[i], 1,
+			(char *)csumBuffer + (size_t)dirtyCsums[i] * BLOCK_SIZE };
+		tableRuns[count++] = chunk;
+	}
+
+	if (count == 0)
+		return;
+
+	ret = this->blockDevice->writeBatch(tableRuns, count);
+	if (ret < 0)
+		LOGF("FATAL in %s: blockDevice write returned %d\n", __func__, ret);
+}
+
+// Compute the checksum of every block in use from the data in the container
+// The blocks are read in runs, one batch request per buffer of the I/O buffer pool.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::computeChecksums()
+{
+	int ret = 0, count = 0;
+	uint32_t filled = 0;
+	char *buffer;
 
-	zeromem = (char *)malloc(BLOCK_SIZE);
-	if (zeromem == NULL) {
-		free(freelist);
+	buffer = this->blockDevice->allocBuffer();
+	if (buffer == NULL)
 		return -ENOMEM;
+
+	for (int block = 1; block <= (int)FAT_ENTRY_COUNT && ret >= 0; block++) {
+		if (block < (int)FAT_ENTRY_COUNT && !isFree(block)) {
+			uint32_t address = fatToDataAddress(block);
+			if (count == 0 || batchRuns[count - 1].blockNo + batchRuns[count - 1].count != address) {
+				BlockRequest run = { address, 0, buffer + (size_t)filled * BLOCK_SIZE };
+				batchRuns[count++] = run;
+			}
+			batchRuns[count - 1].count++;
+			filled++;
+		}
+
+		/* read when the buffer or the runs are used up and at the end */
+		if (count == 0 || (filled < BD_POOL_BUFFER_SIZE / BLOCK_SIZE && count < DELALLOC_BATCH_BLOCKS &&
+			block < (int)FAT_ENTRY_COUNT))
+			continue;
+
+		ret = this->blockDevice->readBatch(batchRuns, count);
+		for (int r = 0; r < count && ret >= 0; r++) {
+			for (uint32_t i = 0; i < batchRuns[r].count; i++)
+				csumBuffer[batchRuns[r].blockNo - sb.data_start + i] =
+					crc32c(0, batchRuns[r].buffer + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+		}
+		count = 0;
+		filled = 0;
 	}
 
-	memset(zeromem, 0, BLOCK_SIZE);
+	this->blockDevice->releaseBuffer(buffer);
+
+	return ret < 0 ? ret : 0;
+}
+
+int MyOnDiskFS::fatToDataAddress(int fat_index)
+{
+	return sb.data_start + fat_index;
+}
+
+int MyOnDiskFS::getEmptyBlockChain(int num_blocks)
+{
+	int claimed_blocks = 0;
+	int start_block = -1, prev_block = -1;
 
 	while (claimed_blocks < num_blocks) {
 		int block = getEmptyBlockFAT();
 
-		if (block == EOC_BLOCK)
-			goto free_blocks;
+		/* the blocks claimed so far are linked already and go back as one chain */
+		if (block == EOC_BLOCK) {
+			if (start_block != -1)
+				freeFileData(start_block);
+			return -ENOSPC;
+		}
 
-		freelist[claimed_blocks++] = block;
+		claimed_blocks++;
 
 		if (start_block == -1)
 			start_block = block;
 
 		if (prev_block != -1)
-			fatBuffer[prev_block] = block;
-		fatBuffer[block] = EOC_BLOCK;
+			fatEntry(prev_block) = block;
+		fatEntry(block) = EOC_BLOCK;
+		refEntry(block) = 1;
+		claimBlock(block);
 		prev_block = block;
 		/* clear claimed memory */
-		blockDevice->write(fatToDataAddress(block), zeromem);
+		blockCache->write(fatToDataAddress(block), zeroBlock);
 	}
 
-	free(freelist);
-	free(zeromem);
-
 	return start_block;
+}
 
-free_blocks:
-	for (int i = 0; i < claimed_blocks; i++) {
-		fatBuffer[freelist[i]] = EMPTY_BLOCK;
+// Find the first run of consecutive free blocks
+// \param [in] num_blocks Length of the run.
+// \return first block of the run, -1 if there is none.
+int MyOnDiskFS::findFreeRun(int num_blocks)
+{
+	int run_start = -1, run_len = 0;
+
+	for (int i = 1; i < (int)FAT_ENTRY_COUNT && run_len < num_blocks; i++) {
+		if (!isFree(i)) {
+			run_len = 0;
+			continue;
+		}
+		if (run_len++ == 0)
+			run_start = i;
+	}
+
+	return (run_len == num_blocks) ? run_start : -1;
+}
+
+// Claim a chain of blocks without clearing them
+// A single run of consecutive blocks is preferred, if there is none the first free blocks are used.
+// \param [in] num_blocks Number of blocks.
+// \return first block of the chain on success, -ERRNO on failure.
+int MyOnDiskFS::getEmptyBlockRun(int num_blocks)
+{
+	int run_start;
+	int start_block = -1, prev_block = -1, claimed_blocks = 0;
+
+	if ((size_t)num_blocks > freeBlocks)
+		return -ENOSPC;
+
+	run_start = findFreeRun(num_blocks);
+
+	for (int i = (run_start != -1) ? run_start : 1;
+			i < (int)FAT_ENTRY_COUNT && claimed_blocks < num_blocks; i++) {
+		if (!isFree(i))
+			continue;
+
+		if (start_block == -1)
+			start_block = i;
+		if (prev_block != -1)
+			fatEntry(prev_block) = i;
+		fatEntry(i) = EOC_BLOCK;
+		refEntry(i) = 1;
+		claimBlock(i);
+		prev_block = i;
+		claimed_blocks++;
 	}
 
-	free(freelist);
-	free(zeromem);
+	if (claimed_blocks < num_blocks) {
+		if (start_block != -1)
+			freeFileData(start_block);
+		return -ENOSPC;
+	}
 
-	return -ENOMEM;
+	return start_block;
 }
 
 void MyOnDiskFS::appendBlock(int start_block, int block)
 {
 	int current_block = start_block;
 
-	while (fatBuffer[current_block] != EOC_BLOCK)
-		current_block = fatBuffer[current_block];
+	while (fatEntry(current_block) != EOC_BLOCK)
+		current_block = fatEntry(current_block);
 
-	fatBuffer[current_block] = block;
+	fatEntry(current_block) = block;
+}
+
+// Follow a chain for a number of blocks
+// \param [in] start_block First block of the chain.
+// \param [in] block_no Position of the requested block in the chain.
+// \return FAT index of the block, EOC_BLOCK if the chain is shorter.
+int MyOnDiskFS::getBlockAt(int start_block, int block_no)
+{
+	int current_block = start_block;
+
+	for (int i = 0; i < block_no && current_block != EOC_BLOCK; i++)
+		current_block = fatEntry(current_block);
+
+	return current_block;
+}
+
+/// @brief Make the leading blocks of a chain private.
+///
+/// Snapshots share the chains of their files. refBuffer counts the links (directory entries and FAT entries)
+/// pointing to a block, so a chain is shared from the first block with a count above one onwards. Before a block or
+/// its FAT link is changed, every shared block up to it is copied and the copy takes over the link, while the rest
+/// of the chain stays shared.
+/// \param [in,out] link Link to the chain, i.e. the firstblock of a directory entry.
+/// \param [in] num_blocks Number of leading blocks that must be private.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::unshareChain(int *link, int num_blocks)
+{
+	int ret = 0;
+	int current_block, copy;
+	char *block = scratch;
+
+	for (int i = 0; i < num_blocks && *link != EOC_BLOCK; i++) {
+		current_block = *link;
+
+		if (refEntry(current_block) > 1) {
+			copy = getEmptyBlockFAT();
+			if (copy == -1) {
+				ret = -ENOSPC;
+				break;
+			}
+
+			ret = this->blockCache->read(fatToDataAddress(current_block), block);
+			if (ret < 0)
+				break;
+			ret = this->blockCache->write(fatToDataAddress(copy), block);
+			if (ret < 0)
+				break;
+
+			/* the copy continues with the shared rest of the chain */
+			fatEntry(copy) = fatEntry(current_block);
+			if (fatEntry(copy) != EOC_BLOCK)
+				refEntry(fatEntry(copy))++;
+			refEntry(copy) = 1;
+			refEntry(current_block)--;
+			claimBlock(copy);
+
+			*link = copy;
+			current_block = copy;
+		}
+
+		link = &fatEntry(current_block);
+	}
+
+	return ret;
 }
 
 /// @brief Write buffer to data segment in container.
@@ -240,526 +747,2747 @@ int MyOnDiskFS::writeData(int block_index, const char *buf,
 	size_t writelen = 0;
 	char *block;
 
-	if (size <= 0)
-		return 0;
-
-	block = (char *)malloc(BLOCK_SIZE);
-	if (block == NULL)
-		return -ENOMEM;
-
 	while (size > 0) {
-		ret = this->blockDevice->read(fatToDataAddress(block_index), block);
-		if (ret < 0)
-			goto exit;
-
-		writelen = (size > BLOCK_SIZE) ? BLOCK_SIZE : size;
-
-		/* this can happen for the first block */
-		if (offset_in_block != 0) {
+		/* full blocks are written from the caller's buffer, partial ones are merged with their old content */
+		if (offset_in_block == 0 && size >= BLOCK_SIZE) {
+			writelen = BLOCK_SIZE;
+			block = (char *)buf + buf_offset;
+		} else {
 			size_t block_space_left = BLOCK_SIZE - offset_in_block;
 			writelen = (size > block_space_left) ? block_space_left : size;
+			block = scratch;
+
+			ret = this->blockCache->read(fatToDataAddress(block_index), block);
+			if (ret < 0)
+				return ret;
 			memcpy(block + offset_in_block, buf + buf_offset, writelen);
 			offset_in_block = 0;
-		} else {
-			memcpy(block, buf + buf_offset, writelen);
 		}
 
 		size -= writelen;
 		buf_offset += writelen;
-		ret = this->blockDevice->write(fatToDataAddress(block_index), block);
+		ret = this->blockCache->write(fatToDataAddress(block_index), block);
 		if (ret < 0)
-			goto exit;
-		block_index = fatBuffer[block_index];
+			return ret;
+		block_index = fatEntry(block_index);
 	}
 
-	ret = 0;
-
-exit:
-	free(block);
-
-	return ret;
+	return 0;
 }
 
 int MyOnDiskFS::readData(int block_index, const char *buf, size_t size,
 							int offset_in_block)
 {
-	int ret;
+	int ret = 0;
 	int buf_offset = 0;
 	int readlen;
-	char *block;
-
-	block = (char *)malloc(BLOCK_SIZE);
-	if (block == NULL)
-		return -ENOMEM;
 
-	memset(block, 0, BLOCK_SIZE);
+	/* fetch all blocks of the request with as few device reads as possible */
+	ret = prefetchChain(block_index, (offset_in_block + size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	if (ret < 0)
+		return ret;
 
 	while (size > 0) {
-		readlen = (size > BLOCK_SIZE) ? BLOCK_SIZE : size;
-
-		if (offset_in_block != 0) {
-			size_t block_space_left = BLOCK_SIZE - offset_in_block;
-			readlen = (size > block_space_left) ? block_space_left : size;
-			offset_in_block = 0;
-		}
+		size_t block_space_left = BLOCK_SIZE - offset_in_block;
+		readlen = (size > block_space_left) ? block_space_left : size;
 
-		ret = this->blockDevice->read(fatToDataAddress(block_index), block);
-		if (ret < 0) {
-			goto exit;
+		/* whole blocks go straight into the caller's buffer */
+		if (readlen == BLOCK_SIZE) {
+			ret = this->blockCache->read(fatToDataAddress(block_index), (char *)(buf + buf_offset));
+			if (ret < 0)
+				return ret;
+		} else {
+			ret = this->blockCache->read(fatToDataAddress(block_index), scratch);
+			if (ret < 0)
+				return ret;
+			memcpy((char *)(buf + buf_offset), scratch + offset_in_block, readlen);
 		}
-		memcpy((char *)(buf + buf_offset), (char *)(block + offset_in_block), readlen);
+		offset_in_block = 0;
 
 		size -= readlen;
 		buf_offset += readlen;
-		block_index = fatBuffer[block_index];
+		block_index = fatEntry(block_index);
 	}
 
-exit:
-	free(block);
-
 	return ret;
 }
 
-/// @brief Create a new file.
-///
-/// Create a new file with given name and permissions.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// \param [in] path Name of the file, starting with "/".
-/// \param [in] mode Permissions for file access.
-/// \param [in] dev Can be ignored.
-/// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
+// Load blocks of a chain into the block cache
+// Every run of physically consecutive blocks becomes one request of a batch, up to RA_MAX_BLOCKS runs per batch.
+// \param [in] block_index First block to load.
+// \param [in] num_blocks Number of blocks to load, stops early at the end of the chain.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::prefetchChain(int block_index, int num_blocks)
 {
-	int ret;
-	int emptyblock, slot;
-	time_t time_now;
-	DiskFileInfo *new_file;
+	int ret, count = 0;
 
-    LOGM();
+	for (int i = 0; i < num_blocks && block_index != EOC_BLOCK; i++) {
+		uint32_t address = fatToDataAddress(block_index);
 
-	ret = checkPath(path);
-	if (ret)
-		return ret;
+		if (count == 0 || address != chainRuns[count - 1].blockNo + chainRuns[count - 1].count) {
+			if (count == RA_MAX_BLOCKS) {
+				ret = blockCache->loadBatch(chainRuns, count);
+				if (ret < 0)
+					return ret;
+				count = 0;
+			}
+			BlockRequest run = { address, 0, NULL };
+			chainRuns[count++] = run;
+		}
+		chainRuns[count - 1].count++;
+		block_index = fatEntry(block_index);
+	}
 
-	if (getFileIndex(path) != -1)
-		return -EEXIST;
+	if (count == 0)
+		return 0;
 
-	time_now = time(NULL);
-	if (time_now == -1)
-		return -EFAULT;
+	return blockCache->loadBatch(chainRuns, count);
+}
 
-	emptyblock = getEmptyBlockFAT();
-	if (emptyblock == -1)
-		return -ENOMEM;
+/// @brief Prefetch the blocks following a read.
+///
+/// Sequential reads on a handle double the readahead window up to RA_MAX_BLOCKS, a read at any other offset halves
+/// it and prefetches nothing. The window is refilled once less than half of it is left in front of the reader; the
+/// window behind it is announced to the host so it can be fetched in the background.
+/// \param [in] handle Open file the read was made on.
+/// \param [in] file Entry of the file.
+/// \param [in] offset Offset of the read.
+/// \param [in] size Number of bytes read.
+void MyOnDiskFS::readAhead(OpenFile *handle, DiskFileInfo *file, off_t offset, size_t size)
+{
+	ReadaheadState *ra = &handle->ra;
+	int last_block, file_blocks, start, end;
 
-	slot = getFreeRootSlot();
-	if (slot == -1)
-		return -ENOMEM;
+	last_block = (offset + size - 1) / BLOCK_SIZE;
+	file_blocks = (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-	/* at this point, we have an empty data block and a free root slot */
-	new_file = &rootBuffer[slot];
-	strncpy(new_file->name, path, NAME_LENGTH - 1);
-	new_file->size = 0;
-	new_file->uid = getuid();
-	new_file->gid = getgid();
-	new_file->mode = mode;
-	new_file->atime = new_file->mtime = new_file->ctime = time_now;
-	new_file->firstblock = -1;
-	/* mark the empty block as used now */
-	//fatBuffer[emptyblock] = EOC_BLOCK;
+	if (offset != ra->next_offset) {
+		ra->window /= 2;
+		ra->next_offset = offset + size;
+		ra->ra_end = last_block + 1;
+		return;
+	}
 
-	/* sync root and fat back to container block device */
-	syncFAT();
-	syncRoot();
+	ra->window = (ra->window == 0) ? RA_MIN_BLOCKS : ra->window * 2;
+	if (ra->window > RA_MAX_BLOCKS)
+		ra->window = RA_MAX_BLOCKS;
+	ra->next_offset = offset + size;
+
+	if (ra->ra_end - last_block > ra->window / 2)
+		return;
+
+	start = (ra->ra_end > last_block + 1) ? ra->ra_end : last_block + 1;
+	end = last_block + 1 + ra->window;
+	if (end > file_blocks)
+		end = file_blocks;
+	if (start >= end)
+		return;
+
+	/* the cursor of the handle stays at the block of this read, the next read continues from there */
+	int block = getBlockAt(handleBlockAt(handle, file, last_block), start - last_block);
+	if (prefetchChain(block, end - start) < 0)
+		return;
+	ra->ra_end = end;
+
+	if (end < file_blocks) {
+		block = getBlockAt(block, end - start);
+		this->blockDevice->prefetch(fatToDataAddress(block), ra->window);
+	}
 
-    // TODO: [PART 2] Implement this!
+	LOGF("readahead: blocks %d-%d, window %d, cache hits %zu misses %zu",
+		start, end - 1, ra->window, blockCache->hits, blockCache->misses);
+}
 
-    RETURN(0);
+// Open file of a FUSE file handle
+// \return the open file, NULL if the handle was not opened by fuseOpen() or has been released.
+OpenFile *MyOnDiskFS::getHandle(struct fuse_file_info *fileInfo)
+{
+	if (fileInfo == NULL || fileInfo->fh >= openFiles.size() || !openFiles[fileInfo->fh].used)
+		return NULL;
+
+	return &openFiles[fileInfo->fh];
+}
+
+// Block at a position in the chain of a file, for reads on an open file
+// The walk continues from the block looked up last on the handle unless that one is behind the position, so sequential
+// reads do not follow the chain from its first block every time.
+// \param [in] handle Open file, NULL to walk from the first block.
+// \param [in] file Entry of the file.
+// \param [in] block_no Position of the block in the file.
+// \return number of the block, EOC_BLOCK if the chain is shorter.
+int MyOnDiskFS::handleBlockAt(OpenFile *handle, DiskFileInfo *file, int block_no)
+{
+	if (handle == NULL)
+		return getBlockAt(file->firstblock, block_no);
+
+	if (handle->chainSeq != fatSeq || handle->chainFirst != file->firstblock || handle->chainBlock == EOC_BLOCK ||
+		handle->chainPos > block_no) {
+		handle->chainSeq = fatSeq;
+		handle->chainFirst = file->firstblock;
+		handle->chainPos = 0;
+		handle->chainBlock = file->firstblock;
+	}
+
+	handle->chainBlock = getBlockAt(handle->chainBlock, block_no - handle->chainPos);
+	handle->chainPos = block_no;
+	return handle->chainBlock;
+}
+
+// Check if a read or write on a handle goes to its block buffer
+// Only accesses within one block do, whole blocks are cheaper without the copy. Hot files in tiered mode are in memory
+// anyway.
+bool MyOnDiskFS::inHandleBlock(OpenFile *handle, size_t size, off_t offset)
+{
+	return tier == NULL && handle != NULL && handle->file != NULL && size < BLOCK_SIZE &&
+		offset % BLOCK_SIZE + size <= BLOCK_SIZE;
+}
+
+// Fill the block buffer of a handle with a block of its file
+// Repeated small reads and writes within the block are then served from the handle without going to the block cache
+// or the device. The block is read with fuseRead(), so it includes delayed writes and drives the readahead of the
+// handle like a read of the whole block. Any write to the file by other means invalidates the buffer, see writeSeq.
+// \param [in] path Name of the file, starting with "/".
+// \param [in] fileInfo File handle set by fuseOpen.
+// \param [in] handle Open file of fileInfo, the file must not have been removed.
+// \param [in] block_no Position of the block in the file.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::loadHandleBlock(const char *path, struct fuse_file_info *fileInfo, OpenFile *handle, int block_no)
+{
+	int ret;
+
+	if (handle->blockPos == block_no && (handle->index == -1 || handle->blockSeq == writeSeq[handle->index]))
+		return 0;
+
+	/* the changes in the previous block are kept in the delayed writes */
+	if (handle->dirty) {
+		ret = writeBackBlock();
+		if (ret < 0)
+			return ret;
+	}
+
+	if (handle->block == NULL) {
+		handle->block = (char *)malloc(BLOCK_SIZE);
+		if (handle->block == NULL)
+			return -ENOMEM;
+	}
+
+	handle->blockPos = -1;
+	blockLoading = true;
+	ret = fuseRead(path, handle->block, BLOCK_SIZE, (off_t)block_no * BLOCK_SIZE, fileInfo);
+	blockLoading = false;
+	if (ret < 0)
+		return ret;
+
+	memset(handle->block + ret, 0, BLOCK_SIZE - ret);
+	handle->blockPos = block_no;
+	handle->blockSeq = (handle->index == -1) ? 0 : writeSeq[handle->index];
+	return 0;
+}
+
+// Pass the dirty block of a handle to the delayed writes of its file
+// Called before any request other than a small read or write on that handle, so the block is always valid while it is
+// dirty and nobody else sees the file without its changes.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeBackBlock()
+{
+	OpenFile *handle;
+	char *block;
+
+	if (dirtyHandle == -1)
+		return 0;
+
+	handle = &openFiles[dirtyHandle];
+	if (handle->file == NULL) {
+		/* nothing left to write to */
+		handle->dirty = false;
+		dirtyHandle = -1;
+		return 0;
+	}
+
+	block = getDelayedBlock(handle->index, handle->blockPos, false);
+	if (block == NULL)
+		return -ENOMEM;
+
+	memcpy(block, handle->block, BLOCK_SIZE);
+	/* the buffer still holds the content of the block */
+	handle->blockSeq = writeSeq[handle->index];
+	handle->dirty = false;
+	dirtyHandle = -1;
+	return 0;
+}
+
+// Check if a path is SNAPSHOT_DIR or below it
+bool MyOnDiskFS::isSnapshotPath(const char *path)
+{
+	size_t dir_len = strlen(SNAPSHOT_DIR);
+
+	return strncmp(path, SNAPSHOT_DIR, dir_len) == 0 &&
+		(path[dir_len] == '\0' || path[dir_len] == '/');
+}
+
+// Find a snapshot by name
+// \param [in] name Name of the snapshot, not necessarily terminated by '\0'.
+// \param [in] len Length of the name.
+// \return index of the snapshot if it exists, otherwise -1.
+int MyOnDiskFS::getSnapshotIndex(const char *name, size_t len)
+{
+	if (len == 0 || len >= NAME_LENGTH)
+		return -1;
+
+	for (int i = 0; i < NUM_SNAPSHOTS; i++) {
+		if (strncmp(snapBuffer[i].name, name, len) == 0 && snapBuffer[i].name[len] == '\0')
+			return i;
+	}
+
+	return -1;
+}
+
+// Resolve a path below SNAPSHOT_DIR
+// \param [in] path Path to resolve.
+// \param [out] slot Index of the snapshot for PATH_SNAPSHOT and PATH_SNAPSHOT_FILE.
+// \param [out] file Entry of the file or directory in the snapshot for PATH_SNAPSHOT_FILE.
+// \return SnapshotPathType of the path, -ENOENT if snapshot or file do not exist, -ENOTDIR if a file is used as a
+// directory.
+int MyOnDiskFS::resolveSnapshotPath(const char *path, int *slot, DiskFileInfo **file)
+{
+	const char *name, *file_name, *last;
+	int index, dir;
+
+	if (!isSnapshotPath(path))
+		return PATH_REGULAR;
+
+	name = path + strlen(SNAPSHOT_DIR);
+	if (name[0] == '\0' || name[1] == '\0')
+		return PATH_SNAPSHOT_ROOT;
+	name++;
+
+	/* the rest of the path is resolved in the snapshot like a path in the root directory */
+	file_name = strchr(name, '/');
+	*slot = getSnapshotIndex(name, file_name ? (size_t)(file_name - name) : strlen(name));
+	if (*slot == -1)
+		return -ENOENT;
+
+	if (file_name == NULL)
+		return PATH_SNAPSHOT;
+
+	index = snapDentries[*slot].resolve(file_name, &dir, &last);
+	if (index < 0)
+		return index;
+	if (index == ROOT_DIR)
+		return PATH_SNAPSHOT;
+
+	*file = &snapBuffer[*slot].files[index];
+	return PATH_SNAPSHOT_FILE;
+}
+
+// Find the entry of a file in the root directory or in a snapshot
+// \param [in] path Path of the file.
+// \return the entry if the file exists, otherwise NULL.
+DiskFileInfo *MyOnDiskFS::lookupFile(const char *path)
+{
+	int index, slot;
+	DiskFileInfo *file;
+
+	if (isSnapshotPath(path))
+		return (resolveSnapshotPath(path, &slot, &file) == PATH_SNAPSHOT_FILE) ? file : NULL;
+
+	index = getFileIndex(path);
+	return (index == -1) ? NULL : &rootBuffer[index];
+}
+
+/// @brief Create a snapshot of the root directory.
+///
+/// The snapshot gets a copy of all directory entries and shares their chains, which only takes a reference to the
+/// first block of each chain. No data blocks are copied or written, blocks are copied when they are changed later
+/// on (see unshareChain()).
+/// \param [in] name Name of the new snapshot.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::createSnapshot(const char *name)
+{
+	int ret, slot = -1;
+	DiskSnapshot *snap;
+
+	if (strchr(name, '/') != NULL)
+		return -EINVAL;
+
+	/* the snapshot includes all writes so far */
+	ret = flushAll();
+	if (ret < 0)
+		return ret;
+
+	if (getSnapshotIndex(name, strlen(name)) != -1)
+		return -EEXIST;
+
+	for (int i = 0; i < NUM_SNAPSHOTS; i++) {
+		if (snapBuffer[i].name[0] == '\0') {
+			slot = i;
+			break;
+		}
+	}
+	if (slot == -1)
+		return -ENOSPC;
+
+	snap = &snapBuffer[slot];
+	strncpy(snap->name, name, NAME_LENGTH - 1);
+	snap->ctime = time(NULL);
+	memcpy(snap->files, rootBuffer, sizeof(snap->files));
+	fillDentries(snapDentries[slot], snap->files);
+
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (snap->files[i].name[0] != '\0' && snap->files[i].firstblock != EOC_BLOCK)
+			refEntry(snap->files[i].firstblock)++;
+		if (snap->files[i].name[0] != '\0' && snap->files[i].attrblock != 0)
+			refEntry(snap->files[i].attrblock)++;
+	}
+
+	syncRefs();
+	syncSnapshot(slot);
+
+	return 0;
+}
+
+/// @brief Delete a snapshot.
+///
+/// Drops the references of the snapshot's files, blocks no longer used by any file or other snapshot are freed.
+/// \param [in] slot Index of the snapshot.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::deleteSnapshot(int slot)
+{
+	DiskSnapshot *snap = &snapBuffer[slot];
+
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (snap->files[i].name[0] != '\0' && snap->files[i].firstblock != EOC_BLOCK)
+			freeFileData(snap->files[i].firstblock);
+		if (snap->files[i].name[0] != '\0' && snap->files[i].attrblock != 0)
+			freeFileData(snap->files[i].attrblock);
+	}
+
+	memset(snap, 0, sizeof(DiskSnapshot));
+	snapDentries[slot].clear();
+	for (size_t i = 0; i < openFiles.size(); i++) {
+		if (openFiles[i].used && openFiles[i].snapshot == slot)
+			openFiles[i].file = NULL;
+	}
+
+	syncFAT();
+	syncRefs();
+	syncSnapshot(slot);
+
+	return 0;
+}
+
+// Create a file or directory
+// \param [in] path Path of the new entry, the directory holding it must exist.
+// \param [in] mode Type and permissions of the entry.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::createEntry(const char *path, mode_t mode)
+{
+	int ret, dir, slot;
+	const char *name;
+	time_t time_now;
+	DiskFileInfo *new_file;
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	if (isSnapshotPath(path))
+		return -EROFS;
+
+	ret = dentries.resolve(path, &dir, &name);
+	if (ret >= 0)
+		return -EEXIST;
+	if (dir == -1)
+		return ret;
+
+	time_now = time(NULL);
+	if (time_now == -1)
+		return -EFAULT;
+
+	slot = getFreeRootSlot();
+	if (slot == -1)
+		return -ENOSPC;
+
+	new_file = &rootBuffer[slot];
+	memset(new_file, 0, sizeof(DiskFileInfo));
+	strncpy(new_file->name, name, NAME_LENGTH - 1);
+	new_file->parent = dir;
+	new_file->size = 0;
+	new_file->uid = getuid();
+	new_file->gid = getgid();
+	new_file->mode = mode;
+	new_file->atime = new_file->mtime = new_file->ctime = time_now;
+	new_file->firstblock = EOC_BLOCK;
+	new_file->flags = 0;
+	changed[slot] = true;
+	attrs[slot].clear();
+	attrsLoaded[slot] = true;
+	freeSlots--;
+	dentries.insert(dir, new_file->name, slot, S_ISDIR(mode));
+
+	/* sync root back to container block device, the FAT is unchanged */
+	syncRoot();
+
+	return 0;
+}
+
+// Remove a file or an empty directory and drop the references to its blocks
+// The root directory is not written back.
+void MyOnDiskFS::removeEntry(int index)
+{
+	DiskFileInfo *file_ptr = &rootBuffer[index];
+
+	dropDelayedWrites(index);
+	dentries.remove(file_ptr->parent, file_ptr->name);
+	if (tier != NULL)
+		tier->forget(index);
+	for (size_t i = 0; i < openFiles.size(); i++) {
+		if (openFiles[i].used && openFiles[i].index == index)
+			openFiles[i].file = NULL;
+	}
+
+	resetExtents(&extents[index], EOC_BLOCK);
+	attrs[index].clear();
+	attrsLoaded[index] = false;
+	if (file_ptr->firstblock != EOC_BLOCK || file_ptr->attrblock != 0) {
+		if (file_ptr->firstblock != EOC_BLOCK)
+			freeFileData(file_ptr->firstblock);
+		if (file_ptr->attrblock != 0)
+			freeFileData(file_ptr->attrblock);
+		syncFAT();
+		syncRefs();
+	}
+
+	memset(file_ptr, 0, sizeof(struct DiskFileInfo));
+	freeSlots++;
+}
+
+/// @brief Clone a file.
+///
+/// The clone gets a copy of the entry of the file and shares its chain and its extended attributes like a snapshot
+/// does, which only takes a reference to the first block of each. Blocks are copied when either file changes them
+/// later on (see unshareChain() and storeXattrs()), small files are copied along with their entry. Files in snapshots
+/// can be cloned as well.
+/// \param [in] path Path of the file to clone.
+/// \param [in] newpath Path of the clone, which must not exist yet.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::cloneFile(const char *path, const char *newpath)
+{
+	int ret, index, slot;
+	DiskFileInfo *file, *clone;
+
+	file = lookupFile(path);
+	if (file == NULL)
+		return -ENOENT;
+	if (S_ISDIR(file->mode))
+		return -EISDIR;
+
+	/* the clone includes all writes so far */
+	index = getFileIndex(path);
+	if (index != -1) {
+		ret = flushFile(index);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = createEntry(newpath, file->mode);
+	if (ret < 0)
+		return ret;
+
+	slot = getFileIndex(newpath);
+	clone = &rootBuffer[slot];
+	clone->size = file->size;
+	clone->uid = file->uid;
+	clone->gid = file->gid;
+	clone->mtime = file->mtime;
+	clone->firstblock = file->firstblock;
+	clone->flags = file->flags;
+	memcpy(clone->data, file->data, INLINE_DATA_SIZE);
+
+	clone->attrblock = file->attrblock;
+	attrsLoaded[slot] = false;
+
+	if (clone->firstblock != EOC_BLOCK)
+		refEntry(clone->firstblock)++;
+	if (clone->attrblock != 0)
+		refEntry(clone->attrblock)++;
+	syncRefs();
+	syncRoot();
+
+	LOGF("cloned %s to %s, %zu bytes", path, newpath, clone->size);
+
+	return 0;
+}
+
+// Load the extended attributes of a file from their chain
+// \param [in] start_block First block of the chain.
+// \param [out] set Attributes found in the chain.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::loadXattrs(int start_block, XattrSet *set)
+{
+	int ret, length = 0;
+	char first[BLOCK_SIZE];
+	XattrHeader header;
+	size_t size;
+
+	set->clear();
+
+	ret = readData(start_block, first, BLOCK_SIZE, 0);
+	if (ret < 0)
+		return ret;
+
+	memcpy(&header, first, sizeof(header));
+	size = sizeof(header) + header.size;
+	if (header.magic != XATTR_MAGIC || size > XATTR_MAX_BYTES)
+		return -EIO;
+
+	/* the chain has to hold all of the attributes */
+	for (int block = start_block; block != EOC_BLOCK; block = fatEntry(block))
+		length++;
+	if ((size_t)length * BLOCK_SIZE < size)
+		return -EIO;
+
+	if (size <= BLOCK_SIZE)
+		return set->load(first, size);
+
+	std::vector<char> buf(size);
+	ret = readData(start_block, buf.data(), size, 0);
+	if (ret < 0)
+		return ret;
+
+	return set->load(buf.data(), size);
+}
+
+// Write the extended attributes of a file back to the container
+// An exclusive chain of the right length is overwritten, otherwise the attributes go into a new chain and the old one
+// loses a reference, so chains shared with snapshots and clones are never changed.
+// \param [in] index Index of the file, its attributes must be loaded.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::storeXattrs(int index)
+{
+	int ret, length = 0;
+	DiskFileInfo *file = &rootBuffer[index];
+	size_t size = attrs[index].storedSize();
+	int num_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int old = file->attrblock, chain = 0;
+	bool exclusive = true;
+
+	for (int block = old; old != 0 && block != EOC_BLOCK; block = fatEntry(block)) {
+		if (refEntry(block) > 1)
+			exclusive = false;
+		length++;
+	}
+
+	if (num_blocks > 0) {
+		chain = (old != 0 && exclusive && length == num_blocks) ? old : getEmptyBlockChain(num_blocks);
+		if (chain < 0)
+			return chain;
+
+		std::vector<char> buf((size_t)num_blocks * BLOCK_SIZE, 0);
+		attrs[index].store(buf.data());
+		ret = writeData(chain, buf.data(), buf.size(), 0);
+		if (ret < 0) {
+			if (chain != old)
+				freeFileData(chain);
+			return ret;
+		}
+	}
+
+	if (old != 0 && chain != old)
+		freeFileData(old);
+	file->attrblock = chain;
+
+	syncFAT();
+	syncRefs();
+	syncRoot();
+
+	return 0;
+}
+
+// Get the extended attributes of a file or directory
+// Attributes of entries in the root table are loaded on first use and kept in memory, attributes of files in
+// snapshots are loaded into scratch on every call.
+// \param [in] path Path of the entry.
+// \param [in] scratch Set to load the attributes of a file in a snapshot into.
+// \param [out] set Attributes of the entry.
+// \param [out] index Index of the entry, -1 for files in snapshots.
+// \return 0 on success, -ENOTSUP for directories without an entry, -ERRNO on failure.
+int MyOnDiskFS::getXattrs(const char *path, XattrSet *scratch, XattrSet **set, int *index)
+{
+	int ret, slot;
+	DiskFileInfo *file;
+
+	ret = resolveSnapshotPath(path, &slot, &file);
+	if (ret < 0)
+		return ret;
+
+	if (ret == PATH_SNAPSHOT_FILE) {
+		*set = scratch;
+		*index = -1;
+		if (file->attrblock == 0)
+			return 0;
+		return loadXattrs(file->attrblock, scratch);
+	}
+	if (ret != PATH_REGULAR)
+		return -ENOTSUP;
+
+	*index = getFileIndex(path);
+	if (*index == -1)
+		return (strcmp(path, "/") == 0) ? -ENOTSUP : -ENOENT;
+
+	if (!attrsLoaded[*index]) {
+		if (rootBuffer[*index].attrblock != 0) {
+			ret = loadXattrs(rootBuffer[*index].attrblock, &attrs[*index]);
+			if (ret < 0)
+				return ret;
+		} else {
+			attrs[*index].clear();
+		}
+		attrsLoaded[*index] = true;
+	}
+
+	*set = &attrs[*index];
+	return 0;
+}
+
+/// @brief Create a new file.
+///
+/// Create a new file with given name and permissions.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] mode Permissions for file access.
+/// \param [in] dev Can be ignored.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev)
+{
+    LOGM();
+    LOCK_REQUEST();
+
+    int ret = createEntry(path, mode);
+    RETURN(ret);
 }
 
 void MyOnDiskFS::freeFileData(int start_block)
 {
-	/* file is deleted, set all linked blocks in FAT to EMPTY_BLOCK */
+	/* drop one reference to the chain, blocks still referenced by a snapshot
+	 * (and everything behind them) are kept, all others are set to EMPTY_BLOCK
+	 */
 	int next, current_block = start_block;
 	while (current_block != EOC_BLOCK) {
-		next = fatBuffer[current_block];
-		fatBuffer[current_block] = EMPTY_BLOCK;
+		if (--refEntry(current_block) > 0)
+			break;
+		next = fatEntry(current_block);
+		releaseBlock(current_block);
 		current_block = next;
 	}
 }
 
-/// @brief Delete a file.
+// Size of a file including writes that have not been flushed yet
+size_t MyOnDiskFS::getFileSize(int index)
+{
+	return (delayed[index].size > rootBuffer[index].size) ? delayed[index].size : rootBuffer[index].size;
+}
+
+// First buffered block of a file at or behind a position
+DelayedBlocks::iterator MyOnDiskFS::delayedFrom(int index, int block_no)
+{
+	DelayedBlocks::iterator it = delayed[index].blocks.begin();
+	size_t count = delayed[index].blocks.size();
+
+	/* binary search, the blocks are sorted by position */
+	while (count > 0) {
+		size_t half = count / 2;
+
+		if (it[half].first < block_no) {
+			it += half + 1;
+			count -= half + 1;
+		} else {
+			count = half;
+		}
+	}
+
+	return it;
+}
+
+// Buffer of a delayed block of a file
+// \return buffer of the block, NULL if the block is not buffered.
+char *MyOnDiskFS::findDelayed(int index, int block_no)
+{
+	DelayedBlocks::iterator it = delayedFrom(index, block_no);
+
+	return (it != delayed[index].blocks.end() && it->first == block_no) ? it->second : NULL;
+}
+
+// Get the buffer of a delayed block to write to, a new buffer is taken from delayedSlab if needed
+// \param [in] index Index of the file.
+// \param [in] block_no Position of the block in the file.
+// \param [in] keep_content Fill a new buffer with the current content of the block, otherwise it is left undefined.
+// \return buffer of the block, NULL on failure.
+char *MyOnDiskFS::getDelayedBlock(int index, int block_no, bool keep_content)
+{
+	DelayedBlocks::iterator it = delayedFrom(index, block_no);
+	DiskFileInfo *file = &rootBuffer[index];
+	char *data;
+
+	/* the caller writes to the block */
+	writeSeq[index]++;
+	if (it != delayed[index].blocks.end() && it->first == block_no)
+		return it->second;
+
+	data = delayedSlab->get();
+	if (data == NULL)
+		return NULL;
+
+	if (keep_content && (file->flags & FILE_INLINE)) {
+		memset(data, 0, BLOCK_SIZE);
+		if (block_no == 0)
+			memcpy(data, file->data, file->size);
+	} else if (keep_content && (size_t)block_no * BLOCK_SIZE < file->size && sb.compressed) {
+		if (readExtents(&extents[index], file, data, BLOCK_SIZE, (off_t)block_no * BLOCK_SIZE) < 0) {
+			delayedSlab->put(data);
+			return NULL;
+		}
+	} else if (keep_content && (size_t)block_no * BLOCK_SIZE < file->size) {
+		if (blockCache->read(fatToDataAddress(getBlockAt(file->firstblock, block_no)), data) < 0) {
+			delayedSlab->put(data);
+			return NULL;
+		}
+	} else if (keep_content) {
+		memset(data, 0, BLOCK_SIZE);
+	}
+
+	if (delayed[index].blocks.empty())
+		delayed[index].since = time(NULL);
+	delayed[index].blocks.insert(it, std::make_pair(block_no, data));
+	delayedBlocks++;
+
+	return data;
+}
+
+// Discard all delayed writes of a file
+void MyOnDiskFS::dropDelayedWrites(int index)
+{
+	DelayedBlocks::iterator it;
+
+	for (it = delayed[index].blocks.begin(); it != delayed[index].blocks.end(); it++)
+		delayedSlab->put(it->second);
+
+	delayedBlocks -= delayed[index].blocks.size();
+	delayed[index].blocks.clear();
+	delayed[index].size = 0;
+}
+
+/// @brief Write the delayed writes of a file to the container.
 ///
-/// Delete a file with given name from the file system.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// \param [in] path Name of the file, starting with "/".
+/// Blocks are only assigned to buffered writes here, when the final size of the file is known. All missing blocks
+/// are claimed as one contiguous run if possible (see getEmptyBlockRun()) and everything from the first buffered
+/// block to the end of the file is written in one pass. Runs of consecutive blocks are collected in batches of up to
+/// DELALLOC_BATCH_BLOCKS blocks, each batch is submitted to the device at once.
+/// \param [in] index Index of the file.
 /// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseUnlink(const char *path)
+int MyOnDiskFS::flushFile(int index)
+{
+	int ret = 0;
+	int allocated_blocks, needed_blocks, first_block, current_block, shared_from, tail = EOC_BLOCK;
+	int batch_len = 0, count = 0;
+	char *batch, *data;
+	DiskFileInfo *file = &rootBuffer[index];
+	DelayedWrite *dw = &delayed[index];
+
+	if (dw->blocks.empty() && dw->size <= file->size) {
+		dw->size = 0;
+		return 0;
+	}
+
+	LOGF("flushing %s: %zu delayed blocks, size %zu -> %zu", file->name, dw->blocks.size(), file->size,
+		getFileSize(index));
+
+	/* small files without blocks are kept in their entry, only the root directory is written */
+	if (file->firstblock == EOC_BLOCK && getFileSize(index) <= INLINE_DATA_SIZE) {
+		if (!(file->flags & FILE_INLINE))
+			memset(file->data, 0, INLINE_DATA_SIZE);
+		data = findDelayed(index, 0);
+		if (data != NULL)
+			memcpy(file->data, data, getFileSize(index));
+		file->flags |= FILE_INLINE;
+		file->size = getFileSize(index);
+		dropDelayedWrites(index);
+		syncRoot();
+		return 0;
+	}
+
+	/* a file growing out of its entry takes its content along as a buffered first block */
+	if (file->flags & FILE_INLINE) {
+		char *first = getDelayedBlock(index, 0, true);
+		if (first == NULL)
+			return -ENOMEM;
+
+		file->flags &= ~FILE_INLINE;
+		memset(file->data, 0, INLINE_DATA_SIZE);
+		ret = flushFile(index);
+		if (ret < 0) {
+			file->flags |= FILE_INLINE;
+			memcpy(file->data, first, file->size);
+		}
+		return ret;
+	}
+
+	if (sb.compressed)
+		return flushExtents(index);
+
+	allocated_blocks = (file->firstblock == EOC_BLOCK) ? 0 : (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	needed_blocks = (getFileSize(index) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	first_block = dw->blocks.empty() ? allocated_blocks : dw->blocks.begin()->first;
+	if (first_block > allocated_blocks)
+		first_block = allocated_blocks;
+
+	/* buffered blocks and, when appending, the current last block are changed */
+	ret = unshareChain(&file->firstblock, (needed_blocks > allocated_blocks) ? allocated_blocks :
+		(dw->blocks.empty() ? 0 : dw->blocks.rbegin()->first + 1));
+	if (ret < 0)
+		return ret;
+
+	/* appended blocks that end like another chain are linked to it instead of being written */
+	shared_from = needed_blocks;
+	if (dedupBuffer != NULL && needed_blocks > allocated_blocks) {
+		shared_from = findSharedTail(index, allocated_blocks, needed_blocks, &tail);
+		if (shared_from < 0)
+			return shared_from;
+	}
+
+	if (shared_from > allocated_blocks) {
+		int block = getEmptyBlockRun(shared_from - allocated_blocks);
+		if (block < 0)
+			return block;
+
+		if (file->firstblock == EOC_BLOCK)
+			file->firstblock = block;
+		else
+			appendBlock(file->firstblock, block);
+	}
+
+	if (tail != EOC_BLOCK) {
+		refEntry(tail)++;
+		if (file->firstblock == EOC_BLOCK)
+			file->firstblock = tail;
+		else
+			appendBlock(file->firstblock, tail);
+		LOGF("dedup: %s shares its last %d blocks", file->name, needed_blocks - shared_from);
+	}
+
+	batch = this->blockDevice->allocBuffer();
+	if (batch == NULL)
+		return -ENOMEM;
+
+	current_block = getBlockAt(file->firstblock, first_block);
+	for (int block_no = first_block; block_no < shared_from; block_no++) {
+		data = findDelayed(index, block_no);
+
+		/* new blocks are written even without buffered data, they have to be cleared */
+		if (data != NULL || block_no >= allocated_blocks) {
+			if (batch_len == DELALLOC_BATCH_BLOCKS) {
+				ret = blockCache->writeBatch(batchRuns, count);
+				if (ret < 0)
+					break;
+				count = 0;
+				batch_len = 0;
+			}
+			if (count == 0 ||
+				(uint32_t)fatToDataAddress(current_block) != batchRuns[count - 1].blockNo + batchRuns[count - 1].count) {
+				BlockRequest run = { (uint32_t)fatToDataAddress(current_block), 0, batch + batch_len * BLOCK_SIZE };
+				batchRuns[count++] = run;
+			}
+			batchRuns[count - 1].count++;
+
+			if (data != NULL)
+				memcpy(batch + batch_len * BLOCK_SIZE, data, BLOCK_SIZE);
+			else
+				memset(batch + batch_len * BLOCK_SIZE, 0, BLOCK_SIZE);
+			if (dedupBuffer != NULL)
+				setFingerprint(current_block, fingerprint(batch + batch_len * BLOCK_SIZE));
+			batch_len++;
+		}
+
+		current_block = fatEntry(current_block);
+	}
+
+	if (ret == 0 && batch_len > 0)
+		ret = blockCache->writeBatch(batchRuns, count);
+
+	this->blockDevice->releaseBuffer(batch);
+
+	/* all appended blocks are shared, the blocks in front of them may be duplicates as well */
+	if (ret == 0 && tail != EOC_BLOCK && shared_from == allocated_blocks && allocated_blocks > 0)
+		ret = mergeDuplicates(index, allocated_blocks);
+
+	if (ret < 0)
+		return ret;
+
+	file->size = getFileSize(index);
+	dropDelayedWrites(index);
+
+	syncFAT();
+	syncRefs();
+	syncRoot();
+
+	return 0;
+}
+
+// Find a block in use with the same content and the same successor in its chain
+// Fingerprints are only a hint, the content of every candidate is compared.
+// \param [in] data Content to look for.
+// \param [in] next Successor the block must have, EOC_BLOCK for the last block of a chain.
+// \param [in] exclude Block that must not be returned.
+// \param [in] buffer Buffer of BLOCK_SIZE bytes for the content of candidates.
+// \return the block, -1 if there is none.
+int MyOnDiskFS::findDuplicate(const char *data, int next, int exclude, char *buffer)
+{
+	std::pair<std::unordered_multimap<uint32_t, int>::iterator,
+		std::unordered_multimap<uint32_t, int>::iterator> range = dedupIndex.equal_range(fingerprint(data));
+
+	for (std::unordered_multimap<uint32_t, int>::iterator it = range.first; it != range.second; it++) {
+		int block = it->second;
+
+		/* blocks reserved or moved away from by the defragmenter have no references */
+		if (block == exclude || isFree(block) || refEntry(block) == 0 || fatEntry(block) != next)
+			continue;
+		if (blockCache->read(fatToDataAddress(block), buffer) < 0 || memcmp(buffer, data, BLOCK_SIZE) != 0)
+			continue;
+
+		return block;
+	}
+
+	return -1;
+}
+
+/// @brief Find the longest run at the end of the blocks appended to a file that another chain ends with.
+///
+/// A FAT entry links a block to a single successor, so a block can only be shared by chains that continue the
+/// same way behind it. Going backwards from the last block, every appended block is looked up with the block found
+/// for its successor. Blocks shared this way are counted in refBuffer like the ones shared with a snapshot, so they
+/// are copied by unshareChain() before they are changed.
+/// \param [in] index Index of the file, its chain must be private.
+/// \param [in] from Position of the first appended block.
+/// \param [in] to Number of blocks of the file including the appended ones.
+/// \param [out] tail First block of the shared run, EOC_BLOCK if there is none.
+/// \return position of the first shared block, to if there is none, -ERRNO on failure.
+int MyOnDiskFS::findSharedTail(int index, int from, int to, int *tail)
+{
+	int pos, block, next = EOC_BLOCK;
+	int last = (from > 0) ? getBlockAt(rootBuffer[index].firstblock, from - 1) : EOC_BLOCK;
+	char *data;
+
+	/* the current last block of the file is the only block of its chain without a successor */
+	for (pos = to - 1; pos >= from; pos--) {
+		data = findDelayed(index, pos);
+		block = findDuplicate((data != NULL) ? data : zeroBlock, next, last, scratch);
+		if (block == -1)
+			break;
+		next = block;
+	}
+
+	*tail = next;
+	return pos + 1;
+}
+
+// Replace the blocks of a file in front of a shared tail by identical blocks of other chains
+// Used when a file is written in several flushes, so its first blocks were written before the tail was found.
+// \param [in] index Index of the file.
+// \param [in] num_blocks Number of private blocks in front of the shared tail.
+// \return number of blocks freed, -ERRNO on failure.
+int MyOnDiskFS::mergeDuplicates(int index, int num_blocks)
+{
+	int ret = 0, merged = 0;
+	int block, copy;
+	int *link;
+	char *data = scratch;
+	std::vector<int> chain;
+
+	for (block = rootBuffer[index].firstblock; (int)chain.size() < num_blocks; block = fatEntry(block))
+		chain.push_back(block);
+
+	for (int i = num_blocks - 1; i >= 0; i--) {
+		block = chain[i];
+
+		ret = blockCache->read(fatToDataAddress(block), data);
+		if (ret < 0)
+			break;
+		copy = findDuplicate(data, fatEntry(block), block, data + BLOCK_SIZE);
+		if (copy == -1)
+			break;
+
+		/* the successor keeps the link of the copy */
+		link = (i == 0) ? &rootBuffer[index].firstblock : &fatEntry(chain[i - 1]);
+		*link = copy;
+		refEntry(copy)++;
+		refEntry(fatEntry(block))--;
+		refEntry(block) = 0;
+		releaseBlock(block);
+		merged++;
+	}
+
+	if (merged > 0)
+		LOGF("dedup: %d blocks of %s merged", merged, rootBuffer[index].name);
+
+	return (ret < 0) ? ret : merged;
+}
+
+// Write the delayed writes of all files to the container
+// \return 0 on success, -ERRNO of the last failure otherwise.
+int MyOnDiskFS::flushAll()
+{
+	int ret = 0;
+
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		int err = flushFile(i);
+		if (err < 0)
+			ret = err;
+	}
+
+	return ret;
+}
+
+// Forget the extents found in a chain, the buffer for decompressed data is kept
+void MyOnDiskFS::resetExtents(ExtentCache *cache, int firstblock)
+{
+	cache->firstblock = firstblock;
+	cache->starts.clear();
+	cache->lengths.clear();
+	cache->next = firstblock;
+	cache->extent = -1;
+}
+
+// Find an extent of a file in a compressed container
+// Extents are found by following the chain from the last extent found so far, reading the header of every extent
+// on the way.
+// \param [in,out] cache Extents of the file found so far.
+// \param [in] file The file.
+// \param [in] extent Position of the extent in the file.
+// \return first block of the extent, EOC_BLOCK if it is not stored, -ERRNO on failure.
+int MyOnDiskFS::findExtent(ExtentCache *cache, DiskFileInfo *file, int extent)
+{
+	int ret = 0, block, num_blocks;
+	ExtentHeader header;
+	char *data = scratch;
+
+	if (cache->firstblock != file->firstblock)
+		resetExtents(cache, file->firstblock);
+
+	if ((int)cache->starts.size() > extent)
+		return cache->starts[extent];
+	if (cache->next == EOC_BLOCK)
+		return EOC_BLOCK;
+
+	while ((int)cache->starts.size() <= extent && cache->next != EOC_BLOCK) {
+		ret = blockCache->read(fatToDataAddress(cache->next), data);
+		if (ret < 0)
+			break;
+
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != EXTENT_MAGIC || header.raw_size > EXTENT_SIZE || header.stored_size > EXTENT_SIZE) {
+			LOGF("ERROR: bad header of extent %zu of %s", cache->starts.size(), file->name);
+			ret = -EIO;
+			break;
+		}
+
+		/* the last block of the extent links to the next one */
+		num_blocks = (sizeof(header) + header.stored_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		block = getBlockAt(cache->next, num_blocks - 1);
+		if (block == EOC_BLOCK) {
+			LOGF("ERROR: extent %zu of %s is cut off", cache->starts.size(), file->name);
+			ret = -EIO;
+			break;
+		}
+
+		cache->starts.push_back(cache->next);
+		cache->lengths.push_back(num_blocks);
+		cache->next = fatEntry(block);
+	}
+
+	if (ret < 0)
+		return ret;
+
+	return ((int)cache->starts.size() > extent) ? cache->starts[extent] : EOC_BLOCK;
+}
+
+// Number of extents stored for a file
+// \return number of extents, -ERRNO on failure.
+int MyOnDiskFS::countExtents(ExtentCache *cache, DiskFileInfo *file)
+{
+	int ret = findExtent(cache, file, INT_MAX);
+
+	return (ret < 0 && ret != EOC_BLOCK) ? ret : (int)cache->starts.size();
+}
+
+// Last block of an extent found before
+int MyOnDiskFS::extentEnd(ExtentCache *cache, int extent)
+{
+	return getBlockAt(cache->starts[extent], cache->lengths[extent] - 1);
+}
+
+// Decompress an extent into the buffer of the cache
+// All blocks of the extent are read with a single batch request.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::loadExtent(ExtentCache *cache, DiskFileInfo *file, int extent)
+{
+	int ret, block;
+	ExtentHeader header;
+	char *stored;
+
+	block = findExtent(cache, file, extent);
+	if (block < 0 && block != EOC_BLOCK)
+		return block;
+	if (cache->extent == extent)
+		return 0;
+
+	if (cache->data == NULL) {
+		cache->data = (char *)malloc(EXTENT_SIZE);
+		if (cache->data == NULL)
+			return -ENOMEM;
+	}
+
+	/* extents behind the last one stored are empty */
+	if (block == EOC_BLOCK) {
+		memset(cache->data, 0, EXTENT_SIZE);
+		cache->extent = extent;
+		return 0;
+	}
+
+	stored = this->blockDevice->allocBuffer();
+	if (stored == NULL)
+		return -ENOMEM;
+
+	ret = prefetchChain(block, cache->lengths[extent]);
+	for (int i = 0; i < cache->lengths[extent] && ret >= 0; i++) {
+		ret = blockCache->read(fatToDataAddress(block), stored + i * BLOCK_SIZE);
+		block = fatEntry(block);
+	}
+
+	if (ret >= 0) {
+		memcpy(&header, stored, sizeof(header));
+		if (!(header.flags & EXTENT_COMPRESSED) && header.stored_size != header.raw_size)
+			ret = -EIO;
+		else if (!(header.flags & EXTENT_COMPRESSED))
+			memcpy(cache->data, stored + sizeof(header), header.raw_size);
+		else if (lzDecompress(stored + sizeof(header), header.stored_size, cache->data, EXTENT_SIZE) !=
+				(long)header.raw_size)
+			ret = -EIO;
+	}
+
+	this->blockDevice->releaseBuffer(stored);
+
+	if (ret < 0) {
+		LOGF("ERROR: cannot load extent %d of %s: %d", extent, file->name, ret);
+		cache->extent = -1;
+		return ret;
+	}
+
+	memset(cache->data + header.raw_size, 0, EXTENT_SIZE - header.raw_size);
+	cache->extent = extent;
+
+	return 0;
+}
+
+// Read bytes of a file in a compressed container
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::readExtents(ExtentCache *cache, DiskFileInfo *file, char *buf, size_t size, off_t offset)
+{
+	int ret;
+
+	while (size > 0) {
+		size_t offset_in_extent = offset % EXTENT_SIZE;
+		size_t len = std::min(size, EXTENT_SIZE - offset_in_extent);
+
+		ret = loadExtent(cache, file, offset / EXTENT_SIZE);
+		if (ret < 0)
+			return ret;
+
+		memcpy(buf, cache->data + offset_in_extent, len);
+		buf += len;
+		offset += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+// Make the link to an extent private, so the extent can be replaced or appended
+// Every block in front of the extent is copied if it is shared with a snapshot, see unshareChain().
+// \param [in] index Index of the file.
+// \param [in] extent Position of the extent, the number of extents to append behind the last one.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::unshareExtents(int index, int extent)
+{
+	int ret, num_blocks = 0;
+	ExtentCache *cache = &extents[index];
+	DiskFileInfo *file = &rootBuffer[index];
+
+	ret = countExtents(cache, file);
+	if (ret < 0)
+		return ret;
+
+	for (int i = 0; i < extent && i < (int)cache->starts.size(); i++)
+		num_blocks += cache->lengths[i];
+
+	ret = unshareChain(&file->firstblock, num_blocks);
+	if (ret < 0)
+		return ret;
+
+	/* copied blocks have new numbers */
+	resetExtents(cache, file->firstblock);
+	ret = countExtents(cache, file);
+
+	return (ret < 0) ? ret : 0;
+}
+
+/// @brief Store an extent of a file in a compressed container.
+///
+/// The extent is compressed and written to a new run of blocks, which replaces the blocks of the extent in the
+/// chain of the file. If the extent is not stored yet, it must be the one behind the last extent stored. Extents
+/// that do not compress by at least a block are stored as they are. The link to the extent must be private, see
+/// unshareExtents().
+/// \param [in] index Index of the file.
+/// \param [in] extent Position of the extent in the file.
+/// \param [in] raw Content of the extent.
+/// \param [in] raw_size Bytes of the content, trailing zeros can be left out.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::storeExtent(int index, int extent, const char *raw, size_t raw_size)
+{
+	int ret, first, last, next, num_blocks;
+	int *link;
+	char *stored;
+	ExtentHeader header;
+	std::vector<BlockRequest> runs;
+	ExtentCache *cache = &extents[index];
+	DiskFileInfo *file = &rootBuffer[index];
+
+	stored = this->blockDevice->allocBuffer();
+	if (stored == NULL)
+		return -ENOMEM;
+
+	header.magic = EXTENT_MAGIC;
+	header.raw_size = raw_size;
+	header.flags = EXTENT_COMPRESSED;
+	header.stored_size = lzCompress(raw, raw_size, stored + sizeof(header), EXTENT_SIZE);
+	if (header.stored_size == 0 || (sizeof(header) + header.stored_size + BLOCK_SIZE - 1) / BLOCK_SIZE >=
+			(sizeof(header) + raw_size + BLOCK_SIZE - 1) / BLOCK_SIZE) {
+		header.flags = 0;
+		header.stored_size = raw_size;
+		memcpy(stored + sizeof(header), raw, raw_size);
+	}
+	memcpy(stored, &header, sizeof(header));
+
+	num_blocks = (sizeof(header) + header.stored_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	memset(stored + sizeof(header) + header.stored_size, 0,
+		(size_t)num_blocks * BLOCK_SIZE - sizeof(header) - header.stored_size);
+
+	first = getEmptyBlockRun(num_blocks);
+	if (first < 0) {
+		this->blockDevice->releaseBuffer(stored);
+		return first;
+	}
+
+	/* the new blocks are written with one batch request before anything links to them */
+	last = first;
+	for (int i = 0; i < num_blocks; i++) {
+		if (runs.empty() || (uint32_t)fatToDataAddress(last) != runs.back().blockNo + runs.back().count) {
+			BlockRequest run = { (uint32_t)fatToDataAddress(last), 0, stored + (size_t)i * BLOCK_SIZE };
+			runs.push_back(run);
+		}
+		runs.back().count++;
+		if (i < num_blocks - 1)
+			last = fatEntry(last);
+	}
+	ret = blockCache->writeBatch(runs.data(), runs.size());
+
+	this->blockDevice->releaseBuffer(stored);
+
+	if (ret < 0) {
+		freeFileData(first);
+		return ret;
+	}
+
+	link = (extent == 0) ? &file->firstblock : &fatEntry(extentEnd(cache, extent - 1));
+	if (extent < (int)cache->starts.size()) {
+		/* the new extent continues with the rest of the chain, the old one loses its link */
+		next = fatEntry(extentEnd(cache, extent));
+		fatEntry(last) = next;
+		if (next != EOC_BLOCK)
+			refEntry(next)++;
+		*link = first;
+		freeFileData(cache->starts[extent]);
+		cache->starts[extent] = first;
+		cache->lengths[extent] = num_blocks;
+	} else {
+		*link = first;
+		cache->starts.push_back(first);
+		cache->lengths.push_back(num_blocks);
+	}
+
+	cache->firstblock = file->firstblock;
+	if (cache->extent == extent)
+		cache->extent = -1;
+
+	LOGF("stored extent %d of %s: %zu bytes in %d blocks", extent, file->name, raw_size, num_blocks);
+
+	return 0;
+}
+
+// Length of an extent without its trailing zeros
+static size_t trimExtent(const char *raw, size_t size)
+{
+	while (size > 0 && raw[size - 1] == '\0')
+		size--;
+
+	return size;
+}
+
+/// @brief Write the delayed writes of a file in a compressed container.
+///
+/// Every extent with buffered blocks is merged with its old content and stored again, see storeExtent(). Extents
+/// between the last one stored and the buffered ones are stored empty, as extents are found by their position in
+/// the chain. A file that only grew needs no new extents at all.
+/// \param [in] index Index of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::flushExtents(int index)
+{
+	int ret = 0, count, next_new;
+	size_t new_size = getFileSize(index);
+	char *raw;
+	std::vector<int> todo;
+	DiskFileInfo *file = &rootBuffer[index];
+	DelayedWrite *dw = &delayed[index];
+	ExtentCache *cache = &extents[index];
+	DelayedBlocks::iterator it;
+
+	count = countExtents(cache, file);
+	if (count < 0)
+		return count;
+
+	/* extents with buffered blocks in ascending order, and the empty extents appended in front of them */
+	next_new = count;
+	for (it = dw->blocks.begin(); it != dw->blocks.end(); it++) {
+		int extent = it->first / EXTENT_BLOCKS;
+
+		if (!todo.empty() && todo.back() == extent)
+			continue;
+		for (; next_new < extent; next_new++)
+			todo.push_back(next_new);
+		todo.push_back(extent);
+		next_new = std::max(next_new, extent + 1);
+	}
+
+	if (!todo.empty()) {
+		ret = unshareExtents(index, todo.back());
+		if (ret < 0)
+			return ret;
+	}
+
+	raw = this->blockDevice->allocBuffer();
+	if (raw == NULL)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < todo.size() && ret >= 0; i++) {
+		int extent = todo[i];
+		size_t raw_size = std::min<size_t>(EXTENT_SIZE, new_size - (size_t)extent * EXTENT_SIZE);
+
+		DelayedBlocks::iterator first = delayedFrom(index, extent * EXTENT_BLOCKS);
+		DelayedBlocks::iterator end = delayedFrom(index, (extent + 1) * EXTENT_BLOCKS);
+
+		/* the old content is only needed if the extent is not overwritten completely */
+		if (std::distance(first, end) < EXTENT_BLOCKS) {
+			ret = loadExtent(cache, file, extent);
+			if (ret < 0)
+				break;
+			memcpy(raw, cache->data, EXTENT_SIZE);
+		}
+
+		for (it = first; it != end; it++)
+			memcpy(raw + (it->first % EXTENT_BLOCKS) * BLOCK_SIZE, it->second, BLOCK_SIZE);
+
+		ret = storeExtent(index, extent, raw, trimExtent(raw, raw_size));
+	}
+
+	this->blockDevice->releaseBuffer(raw);
+
+	if (ret < 0)
+		return ret;
+
+	file->size = new_size;
+	dropDelayedWrites(index);
+
+	syncFAT();
+	syncRefs();
+	syncRoot();
+
+	return 0;
+}
+
+/// @brief Change the size of a file in a compressed container.
+///
+/// Extents behind the new size are dropped, and the new last extent is stored again if it has data behind the new
+/// size. Growing a file only changes its size, as missing extents read as zeros.
+/// \param [in] index Index of the file, without delayed writes.
+/// \param [in] new_size New size of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::truncateExtents(int index, size_t new_size)
+{
+	int ret, count, keep;
+	size_t tail;
+	DiskFileInfo *file = &rootBuffer[index];
+	ExtentCache *cache = &extents[index];
+
+	keep = (new_size + EXTENT_SIZE - 1) / EXTENT_SIZE;
+	count = countExtents(cache, file);
+	if (count < 0)
+		return count;
+
+	if (count > keep) {
+		ret = unshareExtents(index, keep);
+		if (ret < 0)
+			return ret;
+
+		if (keep == 0) {
+			freeFileData(file->firstblock);
+			file->firstblock = EOC_BLOCK;
+		} else {
+			int last = extentEnd(cache, keep - 1);
+
+			freeFileData(fatEntry(last));
+			fatEntry(last) = EOC_BLOCK;
+		}
+		resetExtents(cache, file->firstblock);
+		count = keep;
+	}
+
+	/* bytes behind the new end must read as zero if the file grows again */
+	tail = new_size % EXTENT_SIZE;
+	if (new_size < file->size && tail != 0 && keep <= count) {
+		ret = loadExtent(cache, file, keep - 1);
+		if (ret < 0)
+			return ret;
+
+		if (trimExtent(cache->data, EXTENT_SIZE) > tail) {
+			char *raw = (char *)malloc(EXTENT_SIZE);
+			if (raw == NULL)
+				return -ENOMEM;
+
+			memcpy(raw, cache->data, tail);
+			ret = unshareExtents(index, keep - 1);
+			if (ret == 0)
+				ret = storeExtent(index, keep - 1, raw, trimExtent(raw, tail));
+			free(raw);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	file->size = new_size;
+	file->mtime = time(NULL);
+
+	syncFAT();
+	syncRefs();
+	syncRoot();
+
+	return 0;
+}
+
+/// @brief Delete a file.
+///
+/// Delete a file with given name from the file system.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseUnlink(const char *path)
+{
+	int ret, index;
+
+    LOGM();
+    LOCK_REQUEST();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	if (isSnapshotPath(path))
+		return -EROFS;
+
+	index = getFileIndex(path);
+	if (index == -1)
+		return -ENOENT;
+	if (S_ISDIR(rootBuffer[index].mode))
+		return -EISDIR;
+
+	removeEntry(index);
+
+	syncRoot();
+    RETURN(0);
+}
+
+/// @brief Create a directory.
+///
+/// Creating SNAPSHOT_DIR/<name> takes a read-only snapshot of all files named <name>, everywhere else an empty
+/// directory is created.
+/// \param [in] path Path of the directory, starting with "/".
+/// \param [in] mode Permissions of the directory, ignored for snapshots as they are read-only.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseMkdir(const char *path, mode_t mode)
+{
+	int ret, slot;
+	DiskFileInfo *file;
+
+	LOGM();
+	LOCK_REQUEST();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	if (!isSnapshotPath(path)) {
+		ret = createEntry(path, S_IFDIR | (mode & ~S_IFMT));
+		RETURN(ret);
+	}
+
+	ret = resolveSnapshotPath(path, &slot, &file);
+	if (ret != -ENOENT)
+		return (ret == PATH_SNAPSHOT_FILE) ? -EROFS : -EEXIST;
+
+	/* nested directories in a snapshot are not possible */
+	if (strchr(path + strlen(SNAPSHOT_DIR) + 1, '/') != NULL)
+		return -EROFS;
+
+	ret = createSnapshot(path + strlen(SNAPSHOT_DIR) + 1);
+
+	RETURN(ret);
+}
+
+/// @brief Remove a directory.
+///
+/// Removing SNAPSHOT_DIR/<name> deletes the snapshot <name>, other directories are removed if they are empty.
+/// \param [in] path Path of the directory, starting with "/".
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseRmdir(const char *path)
+{
+	int ret, slot, dir, index;
+	const char *name;
+	DiskFileInfo *file;
+
+	LOGM();
+	LOCK_REQUEST();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	ret = resolveSnapshotPath(path, &slot, &file);
+	if (ret < 0)
+		return ret;
+
+	switch (ret) {
+	case PATH_SNAPSHOT:
+		ret = deleteSnapshot(slot);
+		break;
+	case PATH_SNAPSHOT_ROOT:
+		ret = -EPERM;
+		break;
+	case PATH_SNAPSHOT_FILE:
+		ret = S_ISDIR(file->mode) ? -EROFS : -ENOTDIR;
+		break;
+	default:
+		index = dentries.resolve(path, &dir, &name);
+		if (index < 0 || index == ROOT_DIR) {
+			ret = (index < 0) ? index : -EBUSY;
+		} else if (!S_ISDIR(rootBuffer[index].mode)) {
+			ret = -ENOTDIR;
+		} else if (dentries.countChildren(index) > 0) {
+			ret = -ENOTEMPTY;
+		} else {
+			removeEntry(index);
+			syncRoot();
+			ret = 0;
+		}
+		break;
+	}
+
+	RETURN(ret);
+}
+
+/// @brief Rename a file.
+///
+/// Rename the file with with a given name to a new name.
+/// Note that if a file with the new name already exists it is replaced (i.e., removed
+/// before renaming the file.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] newpath  New name of the file, starting with "/".
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseRename(const char *path, const char *newpath)
+{
+	int ret, index, target, dir;
+	const char *name;
+	bool is_dir;
+
+    LOGM();
+    LOCK_REQUEST();
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+	ret = checkPath(newpath);
+	if (ret)
+		return ret;
+
+	if (isSnapshotPath(path) || isSnapshotPath(newpath))
+		return -EROFS;
+
+	index = getFileIndex(path);
+	if (index == -1)
+		return -ENOENT;
+
+	target = dentries.resolve(newpath, &dir, &name);
+	if (dir == -1)
+		return target;
+	if (target == ROOT_DIR)
+		return -EBUSY;
+	if (target == index)
+		return 0;
+
+	is_dir = S_ISDIR(rootBuffer[index].mode);
+	if (is_dir) {
+		/* a directory cannot be moved below itself */
+		for (int d = dir; d != ROOT_DIR; d = rootBuffer[d].parent) {
+			if (d == index)
+				return -EINVAL;
+		}
+	}
+
+	if (target >= 0) {
+		if (S_ISDIR(rootBuffer[target].mode) != is_dir)
+			return is_dir ? -ENOTDIR : -EISDIR;
+		if (dentries.countChildren(target) > 0)
+			return -ENOTEMPTY;
+		removeEntry(target);
+	}
+
+	dentries.remove(rootBuffer[index].parent, rootBuffer[index].name);
+	memset(rootBuffer[index].name, 0, NAME_LENGTH);
+	strncpy(rootBuffer[index].name, name, NAME_LENGTH - 1);
+	rootBuffer[index].parent = dir;
+	dentries.insert(dir, rootBuffer[index].name, index, is_dir);
+
+	syncRoot();
+
+	RETURN(0);
+}
+
+// Fill in the attributes of an entry, used by getattr and readdir
+// Entries of snapshots are read-only, the root directory of a snapshot carries the time the snapshot was taken.
+// \param [in] table Table holding the entry, rootBuffer or the files of a snapshot.
+// \param [in] index Slot of the entry, ROOT_DIR for the root directory of the table.
+// \param [in] snapshot Slot of the snapshot holding the table, -1 for rootBuffer.
+// \param [out] statbuf Attributes of the entry.
+void MyOnDiskFS::statEntry(DiskFileInfo *table, int index, int snapshot, struct stat *statbuf)
+{
+	DentryCache *cache = (snapshot < 0) ? &dentries : &snapDentries[snapshot];
+	mode_t readonly = (snapshot < 0) ? 0 : 0222;	/* snapshots are read-only */
+	DiskFileInfo *file;
+
+	memset(statbuf, 0, sizeof(struct stat));
+	statbuf->st_ino = (snapshot < 0) ? ENTRY_INO(index) : SNAPSHOT_INO(snapshot, index);
+	statbuf->st_uid =
+			getuid(); // The owner of the file/directory is the user who mounted the filesystem
+	statbuf->st_gid =
+			getgid(); // The group of the file/directory is the same as the group of the user who mounted the filesystem
+
+	if (index == ROOT_DIR) {
+		statbuf->st_mode = S_IFDIR | (0755 & ~readonly);
+		statbuf->st_nlink =
+				2 + cache->countSubdirs(ROOT_DIR); // Why "two" hardlinks instead of "one"? The answer is here: http://unix.stackexchange.com/a/101536
+		if (snapshot < 0) {
+			statbuf->st_atime = time(NULL); // The last "a"ccess of the file/directory is right now
+			/* I don't think modification time should be now */
+			statbuf->st_mtime = time(NULL); // The last "m"odification of the file/directory is right now
+		} else {
+			statbuf->st_atime = statbuf->st_mtime = statbuf->st_ctime = snapBuffer[snapshot].ctime;
+		}
+		return;
+	}
+
+	file = &table[index];
+	if (S_ISDIR(file->mode)) {
+		/* "." and the ".." of every subdirectory link to a directory */
+		statbuf->st_mode = file->mode & ~readonly;
+		statbuf->st_nlink = 2 + cache->countSubdirs(index);
+	} else {
+		statbuf->st_mode = S_IFREG | (file->mode & ~readonly);
+		statbuf->st_nlink = 1;
+	}
+	statbuf->st_size = (snapshot < 0) ? getFileSize(index) : file->size;
+	statbuf->st_ctime = file->ctime;
+	statbuf->st_mtime = file->mtime;
+	statbuf->st_atime = file->atime;
+}
+
+// Fill in the attributes of SNAPSHOT_DIR
+void MyOnDiskFS::statSnapshotDir(struct stat *statbuf)
+{
+	memset(statbuf, 0, sizeof(struct stat));
+	statbuf->st_ino = SNAPSHOT_DIR_INO;
+	statbuf->st_uid = getuid();
+	statbuf->st_gid = getgid();
+	statbuf->st_mode = S_IFDIR | 0555;
+	statbuf->st_nlink = 2;
+	statbuf->st_atime = statbuf->st_mtime = statbuf->st_ctime = time(NULL);
+}
+
+/// @brief Get file meta data.
+///
+/// Get the metadata of a file (user & group id, modification times, permissions, ...).
+/// \param [in] path Name of the file, starting with "/".
+/// \param [out] statbuf Structure containing the meta data, for details type "man 2 stat" in a terminal.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf)
+{
+	int ret;
+	DiskFileInfo *file;
+
+	LOGM();
+	LOCK_REQUEST();
+
+	// TODO: [PART 1] Implement this! Implemented by slno1011
+
+	// GNU's definitions of the attributes (http://www.gnu.org/software/libc/manual/html_node/Attribute-Meanings.html):
+	// 		st_uid: 	The user ID of the file’s owner.
+	//		st_gid: 	The group ID of the file.
+	//		st_atime: 	This is the last access time for the file.
+	//		st_mtime: 	This is the time of the last modification to the contents of the file.
+	//		st_mode: 	Specifies the mode of the file. This includes file type information (see Testing File Type) and
+	//		            the file permission bits (see Permission Bits).
+	//		st_nlink: 	The number of hard links to the file. This count keeps track of how many directories have
+	//	             	entries for this file. If the count is ever decremented to zero, then the file itself is
+	//	             	discarded as soon as no process still holds it open. Symbolic links are not counted in the
+	//	             	total.
+	//		st_size:	This specifies the size of a regular file in bytes. For files that are really devices this field
+	//		            isn’t usually meaningful. For symbolic links this specifies the length of the file name the link
+	//		            refers to.
+	if (strcmp(path, "/") == 0)
+	{
+		LOGF("\tAttributes of dir %s requested\n", path);
+		statEntry(rootBuffer, ROOT_DIR, -1, statbuf);
+	}
+	else if (isSnapshotPath(path))
+	{
+		int slot;
+
+		LOGF("\tAttributes of snapshot path %s requested\n", path);
+		ret = resolveSnapshotPath(path, &slot, &file);
+		if (ret < 0)
+			return ret;
+
+		if (ret == PATH_SNAPSHOT_FILE)
+			statEntry(snapBuffer[slot].files, file - snapBuffer[slot].files, slot, statbuf);
+		else if (ret == PATH_SNAPSHOT)
+			statEntry(snapBuffer[slot].files, ROOT_DIR, slot, statbuf);
+		else
+			statSnapshotDir(statbuf);
+	}
+	else
+	{
+		LOGF("\tAttributes of normal file %s requested\n", path);
+		ret = checkPath(path);
+		if (ret)
+			return ret;
+
+		ret = getFileIndex(path);
+		if (ret == -1)
+			return -ENOENT;
+
+		/* access time is now */
+		rootBuffer[ret].atime = time(NULL);
+		statEntry(rootBuffer, ret, -1, statbuf);
+
+		syncRoot();
+	}
+
+    RETURN(0);
+}
+
+/// @brief Change file permissions.
+///
+/// Set new permissions for a file.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] mode New mode of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseChmod(const char *path, mode_t mode)
+{
+	int ret, index;
+
+	LOGM();
+	LOCK_REQUEST();
+
+	// TODO: [PART 1] Implement this!
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	if (isSnapshotPath(path))
+		return -EROFS;
+
+	index = getFileIndex(path);
+	if (index == -1)
+		return -ENOENT;
+
+	/* the type of an entry never changes */
+	rootBuffer[index].mode = (rootBuffer[index].mode & S_IFMT) | (mode & ~S_IFMT);
+
+	syncRoot();
+
+    RETURN(0);
+}
+
+/// @brief Change the owner of a file.
+///
+/// Change the user and group identifier in the meta data of a file.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] uid New user id.
+/// \param [in] gid New group id.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid)
+{
+	int fileIndex;
+	DiskFileInfo *file;
+
+    LOGM();
+    LOCK_REQUEST();
+
+	if (checkPath(path))
+		return -EINVAL;
+
+	if (isSnapshotPath(path))
+		return -EROFS;
+
+	fileIndex = getFileIndex(path);
+	if (fileIndex == -1)
+		return -ENOENT;
+
+	file = &rootBuffer[fileIndex];
+	file->uid = uid;
+	file->gid = gid;
+
+	syncRoot();
+
+    RETURN(0);
+}
+
+/// @brief Open a file.
+///
+/// Open a file for reading or writing. This includes checking the permissions of the current user and incrementing the
+/// open file count.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [out] fileInfo Can be ignored in Part 1
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo)
+{
+	int ret, index;
+	size_t handle;
+	char *block;
+	DiskFileInfo *file;
+	OpenFile *open_file;
+
+    LOGM();
+    LOCK_REQUEST();
+
+	if (numberOfOpenFiles == MAX_OPEN_FILES)
+		return -EMFILE;
+
+	ret = checkPath(path);
+	if (ret)
+		return ret;
+
+	if (isSnapshotPath(path) && (fileInfo->flags & O_ACCMODE) != O_RDONLY)
+		return -EROFS;
+
+	file = lookupFile(path);
+	if (file == NULL)
+		return -ENOENT;
+	if (S_ISDIR(file->mode))
+		return -EISDIR;
+
+	/* files in snapshots have no index in the root directory */
+	index = getFileIndex(path);
+
+	LOGF("\topened %s, index = %d\n", path, index);
+
+	// file handle is a slot of the table of open files, which grows as needed
+	for (handle = 0; handle < openFiles.size() && openFiles[handle].used; handle++)
+		;
+	if (handle == openFiles.size())
+		openFiles.push_back(OpenFile());
+
+	open_file = &openFiles[handle];
+	block = open_file->block;
+	memset(open_file, 0, sizeof(OpenFile));
+	open_file->used = true;
+	open_file->index = index;
+	open_file->snapshot = -1;
+	if (index == -1)
+		resolveSnapshotPath(path, &open_file->snapshot, &file);
+	open_file->file = file;
+	open_file->chainBlock = EOC_BLOCK;
+	open_file->block = block;
+	open_file->blockPos = -1;
+	fileInfo->fh = handle;
+	/* pages cached by the kernel stay valid as long as nobody wrote to the file,
+	 * snapshot names can be reused, so their files are never kept */
+	if (index != -1) {
+		fileInfo->keep_cache = !changed[index];
+		changed[index] = false;
+	} else {
+		fileInfo->keep_cache = 0;
+	}
+	numberOfOpenFiles++;
+
+    RETURN(0);
+}
+
+/// @brief Read from a file.
+///
+/// Read a given number of bytes from a file starting form a given position.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// Note that the file content is an array of bytes, not a string. I.e., it is not (!) necessarily terminated by '\0'
+/// and may contain an arbitrary number of '\0'at any position. Thus, you should not use strlen(), strcpy(), strcmp(),
+/// ... on both the file content and buf, but explicitly store the length of the file and all buffers somewhere and use
+/// memcpy(), memcmp(), ... to process the content.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [out] buf The data read from the file is stored in this array. You can assume that the size of buffer is at
+/// least 'size'
+/// \param [in] size Number of bytes to read
+/// \param [in] offset Starting position in the file, i.e., number of the first byte to read relative to the first byte of
+/// the file
+/// \param [in] fileInfo Can be ignored in Part 1
+/// \return The Number of bytes read on success. This may be less than size if the file does not contain sufficient bytes.
+/// -ERRNO on failure.
+int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo)
+{
+	int ret, index;
+	size_t file_size, readlen;
+	DiskFileInfo *file;
+	OpenFile *handle;
+
+    LOGM();
+    LOCK_FILE_REQUEST();
+	LOGF("--> Trying to read %s, %lu, %lu\n", path, (unsigned long)offset, size);
+
+	if (size == 0)
+		return 0;
+
+	/* an open file knows its entry, anything else is looked up by path */
+	handle = getHandle(fileInfo);
+	if (handle != NULL && handle->file != NULL) {
+		file = handle->file;
+		index = handle->index;
+	} else {
+		ret = checkPath(path);
+		if (ret)
+			return ret;
+
+		file = lookupFile(path);
+		if (file == NULL)
+			return -ENOENT;
+		index = getFileIndex(path);
+	}
+
+	/* files in snapshots have no delayed writes */
+	file_size = (index == -1) ? file->size : getFileSize(index);
+
+	/* nothing left to read behind the end of the file */
+	if (file_size <= (size_t)offset)
+		return 0;
+
+	/* read would be out of bounds */
+	if (file_size < (offset + size))
+		size = file_size - offset;
+
+	/* the changes in the dirty block of a handle are read from there or from the delayed writes */
+	if (dirtyHandle != -1 && (handle != &openFiles[dirtyHandle] || !inHandleBlock(handle, size, offset))) {
+		ret = writeBackBlock();
+		if (ret < 0)
+			return ret;
+	}
+
+	/* small reads on a handle are served from its block buffer */
+	if (!blockLoading && inHandleBlock(handle, size, offset)) {
+		ret = loadHandleBlock(path, fileInfo, handle, offset / BLOCK_SIZE);
+		if (ret < 0)
+			return ret;
+
+		memcpy(buf, handle->block + offset % BLOCK_SIZE, size);
+		RETURN((int)size);
+	}
+
+	/* in tiered mode hot files are read from their copy, a file turning hot is read in full once */
+	if (tier != NULL && index != -1 && !tierLoading) {
+		double now = tierClock();
+
+		tier->touch(index, size, now);
+		ret = tier->read(index, buf, size, offset);
+		if (ret >= 0)
+			RETURN(ret);
+
+		if (tier->admit(index, file_size, now)) {
+			std::vector<char> copy(file_size);
+
+			tierLoading = true;
+			ret = fuseRead(path, copy.data(), file_size, 0, NULL);
+			tierLoading = false;
+			if (ret < 0)
+				return ret;
+
+			tier->store(index, copy.data(), file_size);
+			memcpy(buf, copy.data() + offset, size);
+			RETURN((int)size);
+		}
+	}
+
+	/* the part already written to the container */
+	readlen = ((size_t)offset < file->size) ? file->size - offset : 0;
+	if (readlen > size)
+		readlen = size;
+
+	if (readlen > 0 && (file->flags & FILE_INLINE)) {
+		memcpy(buf, file->data + offset, readlen);
+	} else if (readlen > 0 && sb.compressed) {
+		ExtentCache snapshot_extents;
+
+		if (index != -1) {
+			ret = readExtents(&extents[index], file, buf, readlen, offset);
+		} else {
+			/* files in snapshots are rarely read, their extents are not kept */
+			snapshot_extents.data = NULL;
+			resetExtents(&snapshot_extents, file->firstblock);
+			ret = readExtents(&snapshot_extents, file, buf, readlen, offset);
+			free(snapshot_extents.data);
+		}
+		if (ret < 0)
+			return ret;
+	} else if (readlen > 0) {
+		int offset_in_blocks = offset / BLOCK_SIZE;
+		int read_offset_in_block = offset % BLOCK_SIZE;
+		int current_block = handleBlockAt(handle, file, offset_in_blocks);
+
+		ret = readData(current_block, buf, readlen, read_offset_in_block);
+		if (ret < 0)
+			return ret;
+
+		if (handle != NULL)
+			readAhead(handle, file, offset, readlen);
+	}
+
+	/* the rest is either buffered or a hole */
+	memset(buf + readlen, 0, size - readlen);
+	if (index != -1) {
+		DelayedBlocks::iterator it = delayedFrom(index, offset / BLOCK_SIZE);
+
+		for (; it != delayed[index].blocks.end() && (off_t)it->first * BLOCK_SIZE < (off_t)(offset + size); it++) {
+			off_t start = (off_t)it->first * BLOCK_SIZE;
+			off_t from = (start > offset) ? start : offset;
+			off_t to = ((off_t)(start + BLOCK_SIZE) < (off_t)(offset + size)) ? start + BLOCK_SIZE : offset + size;
+
+			memcpy(buf + (from - offset), it->second + (from - start), to - from);
+		}
+	}
+
+	RETURN((int)size);
+}
+
+/// @brief Write to a file.
+///
+/// Write a given number of bytes to a file starting at a given position.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// Note that the file content is an array of bytes, not a string. I.e., it is not (!) necessarily terminated by '\0'
+/// and may contain an arbitrary number of '\0'at any position. Thus, you should not use strlen(), strcpy(), strcmp(),
+/// ... on both the file content and buf, but explicitly store the length of the file and all buffers somewhere and use
+/// memcpy(), memcmp(), ... to process the content.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] buf An array containing the bytes that should be written.
+/// \param [in] size Number of bytes to write.
+/// \param [in] offset Starting position in the file, i.e., number of the first byte to read relative to the first byte of
+/// the file.
+/// \param [in] fileInfo Can be ignored in Part 1 .
+/// \return Number of bytes written on success, -ERRNO on failure.
+int MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo)
 {
 	int ret, index;
-	DiskFileInfo *file_ptr;
+	int buf_offset = 0;
+	size_t writelen;
+	bool small;
+	DiskFileInfo *file;
+	OpenFile *handle;
+
+    LOGM();
+    LOCK_FILE_REQUEST();
+
+	handle = getHandle(fileInfo);
+	if (handle != NULL && handle->file != NULL && handle->index != -1) {
+		index = handle->index;
+	} else {
+		ret = checkPath(path);
+		if (ret)
+			return ret;
+
+		if (isSnapshotPath(path))
+			return -EROFS;
+
+		index = getFileIndex(path);
+		if (index == -1)
+			return -ENOENT;
+	}
+
+	if (size == 0)
+		return 0;
+
+	/* the dirty block of a handle is older than this write, unless this one goes to the same buffer */
+	small = inHandleBlock(handle, size, offset) && handle->index == index;
+	if (dirtyHandle != -1 && (handle != &openFiles[dirtyHandle] || !small)) {
+		ret = writeBackBlock();
+		if (ret < 0)
+			return ret;
+	}
+
+	file = &rootBuffer[index];
+	changed[index] = true;
+	if (tier != NULL) {
+		tier->drop(index);
+		tier->touch(index, size, tierClock());
+	}
+
+	if (small) {
+		/* small writes on a handle go to its block buffer, which is passed on as a whole, see writeBackBlock() */
+		ret = loadHandleBlock(path, fileInfo, handle, offset / BLOCK_SIZE);
+		if (ret < 0)
+			return ret;
+
+		memcpy(handle->block + offset % BLOCK_SIZE, buf, size);
+		writeSeq[index]++;
+		handle->blockSeq = writeSeq[index];
+		handle->dirty = true;
+		dirtyHandle = fileInfo->fh;
+	}
+
+	/* other writes are only buffered here, blocks are assigned by flushFile() */
+	for (off_t pos = offset; !small && pos < (off_t)(offset + size); pos += writelen) {
+		int offset_in_block = pos % BLOCK_SIZE;
+		char *block;
+
+		writelen = BLOCK_SIZE - offset_in_block;
+		if (writelen > offset + size - pos)
+			writelen = offset + size - pos;
+
+		block = getDelayedBlock(index, pos / BLOCK_SIZE, writelen < BLOCK_SIZE);
+		if (block == NULL)
+			return -ENOMEM;
+
+		memcpy(block + offset_in_block, buf + buf_offset, writelen);
+		buf_offset += writelen;
+	}
+
+	if (offset + size > getFileSize(index))
+		delayed[index].size = offset + size;
+	file->mtime = time(NULL);
+
+	/* under memory pressure the buffered blocks are written out right away */
+	if (delayedBlocks > delayLimit) {
+		ret = (tier != NULL) ? flushColdest() : flushAll();
+		if (ret < 0)
+			return ret;
+	}
+
+	RETURN((int)size);
+}
+
+/// @brief Read from a file without copying.
+///
+/// Committed data without delayed writes is described by pieces of the container file, so FUSE can splice it to
+/// the kernel without passing it through user space. Everything else (delayed writes, partial blocks at the end of
+/// the committed data, holes) is read into memory with fuseRead(). As FUSE frees every memory piece, a reply that
+/// would need more than one is read into memory as a whole, so a reply costs two allocations at most. With O_DIRECT
+/// there is no page cache of the container to splice from, so the whole request is read into memory. The same holds
+/// if blocks are checksummed, as spliced data could not be verified, for compressed files, and in tiered mode, where
+/// hot files are in memory.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [out] bufp Buffers describing the data, freed by FUSE.
+/// \param [in] size Number of bytes to read.
+/// \param [in] offset Starting position in the file.
+/// \param [in] fileInfo File handle set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseReadBuf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+	struct fuse_file_info *fileInfo)
+{
+	int ret, index, block, memory_pieces = 0;
+	size_t file_size, max_pieces;
+	off_t pos, end;
+	DiskFileInfo *file;
+	OpenFile *handle;
+	struct fuse_bufvec *bufv;
+	bool spliced_pieces = false;
+
+	LOGM();
+	LOCK_FILE_REQUEST();
+
+	/* data spliced from the container would bypass the verification of checksums and the tier, small reads on a
+	 * handle are served from its block buffer */
+	handle = getHandle(fileInfo);
+	if (this->blockDevice->directIO() || csumBuffer != NULL || sb.compressed || tier != NULL ||
+		inHandleBlock(handle, size, offset))
+		return MyFS::fuseReadBuf(path, bufp, size, offset, fileInfo);
+
+	/* the pieces are planned from the delayed writes, which must include the dirty block of a handle */
+	ret = writeBackBlock();
+	if (ret < 0)
+		return ret;
+
+	if (handle != NULL && handle->file != NULL) {
+		file = handle->file;
+		index = handle->index;
+	} else {
+		ret = checkPath(path);
+		if (ret)
+			return ret;
+
+		file = lookupFile(path);
+		if (file == NULL)
+			return -ENOENT;
+		index = getFileIndex(path);
+	}
+
+	/* small files are in memory anyway */
+	if (file->flags & FILE_INLINE)
+		return MyFS::fuseReadBuf(path, bufp, size, offset, fileInfo);
+
+	/* files in snapshots have no delayed writes */
+	file_size = (index == -1) ? file->size : getFileSize(index);
 
-    LOGM();
+	if (file_size <= (size_t)offset)
+		size = 0;
+	else if (file_size < offset + size)
+		size = file_size - offset;
 
-	ret = checkPath(path);
-	if (ret)
-		return ret;
+	/* the pieces are planned right in the buffers of the reply, there is one per block at most */
+	max_pieces = (size == 0) ? 1 : (offset % BLOCK_SIZE + size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	bufv = (struct fuse_bufvec *)malloc(sizeof(struct fuse_bufvec) + (max_pieces - 1) * sizeof(struct fuse_buf));
+	if (bufv == NULL)
+		return -ENOMEM;
 
-	index = getFileIndex(path);
-	if (index == -1)
-		return -ENOENT;
+	*bufv = FUSE_BUFVEC_INIT(0);
+	bufv->count = 0;
+
+	/* memory pieces keep their offset in the file in pos until they are read */
+	pos = offset;
+	end = offset + size;
+	block = ((size_t)offset < file->size) ? handleBlockAt(handle, file, offset / BLOCK_SIZE) : EOC_BLOCK;
+	while (pos < end) {
+		size_t len = BLOCK_SIZE - pos % BLOCK_SIZE;
+		if (len > (size_t)(end - pos))
+			len = end - pos;
+
+		bool spliced = (size_t)(pos + len) <= file->size &&
+			(index == -1 || findDelayed(index, pos / BLOCK_SIZE) == NULL);
+		off_t from = spliced ? (off_t)fatToDataAddress(block) * BLOCK_SIZE + pos % BLOCK_SIZE : pos;
+		struct fuse_buf *piece = (bufv->count > 0) ? &bufv->buf[bufv->count - 1] : NULL;
+
+		if (piece != NULL && ((piece->flags & FUSE_BUF_IS_FD) != 0) == spliced &&
+			piece->pos + (off_t)piece->size == from) {
+			piece->size += len;
+		} else {
+			piece = &bufv->buf[bufv->count++];
+			memset(piece, 0, sizeof(*piece));
+			piece->size = len;
+			piece->flags = spliced ? (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK) : (enum fuse_buf_flags)0;
+			piece->fd = spliced ? this->blockDevice->fileDescriptor() : -1;
+			piece->pos = from;
+			if (spliced)
+				spliced_pieces = true;
+			else
+				memory_pieces++;
+		}
 
-	file_ptr = &rootBuffer[index];
-	if (file_ptr->firstblock != EOC_BLOCK) {
-		freeFileData(file_ptr->firstblock);
-		syncFAT();
+		pos += len;
+		if (block != EOC_BLOCK && pos % BLOCK_SIZE == 0)
+			block = fatEntry(block);
 	}
 
-	memset(file_ptr, 0, sizeof(struct DiskFileInfo));
+	/* FUSE frees every memory piece on its own, a reply that needs several is read into memory as a whole */
+	if (memory_pieces > 1) {
+		free(bufv);
+		return MyFS::fuseReadBuf(path, bufp, size, offset, fileInfo);
+	}
 
-	syncRoot();
-    RETURN(0);
+	if (bufv->count == 0)
+		bufv->count = 1;
+	for (size_t i = 0; i < bufv->count; i++) {
+		struct fuse_buf *piece = &bufv->buf[i];
+		off_t from = piece->pos;
+
+		if ((piece->flags & FUSE_BUF_IS_FD) || piece->size == 0)
+			continue;
+
+		piece->pos = 0;
+		piece->mem = malloc(piece->size);
+		ret = (piece->mem == NULL) ? -ENOMEM : fuseRead(path, (char *)piece->mem, piece->size, from, NULL);
+		if (ret < 0) {
+			free(piece->mem);
+			free(bufv);
+			return ret;
+		}
+	}
+
+	/* the reply reads these pieces from the container after we return, see releaseQuarantine() */
+	if (spliced_pieces)
+		spliceSeq = requests;
+
+	LOGF("read_buf %s: %zu bytes in %zu pieces", path, size, bufv->count);
+
+	*bufp = bufv;
+	RETURN(0);
 }
 
-/// @brief Rename a file.
+/// @brief Write to a file without copying.
 ///
-/// Rename the file with with a given name to a new name.
-/// Note that if a file with the new name already exists it is replaced (i.e., removed
-/// before renaming the file.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// Whole blocks that overwrite committed data are spliced from FUSE into the container file, as long as the
+/// blocks are not shared with a snapshot and have no delayed writes. Other writes are copied into memory and passed
+/// to fuseWrite(), so they take part in delayed allocation. Nothing is spliced if blocks are checksummed or files
+/// are compressed.
 /// \param [in] path Name of the file, starting with "/".
-/// \param [in] newpath  New name of the file, starting with "/".
-/// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseRename(const char *path, const char *newpath)
+/// \param [in] buf Buffers holding the data to write.
+/// \param [in] offset Starting position in the file.
+/// \param [in] fileInfo File handle set by fuseOpen.
+/// \return Number of bytes written on success, -ERRNO on failure.
+int MyOnDiskFS::fuseWriteBuf(const char *path, struct fuse_bufvec *buf, off_t offset,
+	struct fuse_file_info *fileInfo)
 {
-	int ret, index;
+	int ret, index, block;
+	size_t size = fuse_buf_size(buf), count = 0;
+	DiskFileInfo *file;
 
-    LOGM();
+	LOGM();
+	LOCK_FILE_REQUEST();
 
 	ret = checkPath(path);
-	if (ret)
-		return ret;
-	ret = checkPath(newpath);
 	if (ret)
 		return ret;
 
 	index = getFileIndex(path);
-	if (index == -1)
-		return -ENOENT;
+	if (tier != NULL && index != -1)
+		tier->drop(index);
+	if (isSnapshotPath(path) || index == -1 || this->blockDevice->directIO() || csumBuffer != NULL || sb.compressed ||
+		size == 0 ||
+		offset % BLOCK_SIZE != 0 || size % BLOCK_SIZE != 0 || (size_t)offset + size > rootBuffer[index].size)
+		return MyFS::fuseWriteBuf(path, buf, offset, fileInfo);
+
+	/* a dirty block of a handle is older than this write and is found among the delayed writes below */
+	ret = writeBackBlock();
+	if (ret < 0)
+		return ret;
+
+	/* every block up to the last one written must belong to this file only */
+	file = &rootBuffer[index];
+	block = file->firstblock;
+	for (int block_no = 0; block_no < (int)((offset + size) / BLOCK_SIZE); block_no++) {
+		if (refEntry(block) != 1)
+			return MyFS::fuseWriteBuf(path, buf, offset, fileInfo);
+
+		if (block_no >= offset / BLOCK_SIZE) {
+			if (findDelayed(index, block_no) != NULL)
+				return MyFS::fuseWriteBuf(path, buf, offset, fileInfo);
+
+			/* a write that is too fragmented to splice in one batch is copied */
+			uint32_t address = fatToDataAddress(block);
+			if (count == 0 || address != batchRuns[count - 1].blockNo + batchRuns[count - 1].count) {
+				if (count == DELALLOC_BATCH_BLOCKS)
+					return MyFS::fuseWriteBuf(path, buf, offset, fileInfo);
+				BlockRequest run = { address, 0, NULL };
+				batchRuns[count++] = run;
+			}
+			batchRuns[count - 1].count++;
+		}
+		block = fatEntry(block);
+	}
 
-	if (getFileIndex(newpath) != -1)
-		fuseUnlink(newpath);
+	for (size_t i = 0; i < count; i++) {
+		struct fuse_bufvec dst = FUSE_BUFVEC_INIT((size_t)batchRuns[i].count * BLOCK_SIZE);
 
-	strncpy(rootBuffer[index].name, newpath, NAME_LENGTH - 1);
+		dst.buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+		dst.buf[0].fd = this->blockDevice->fileDescriptor();
+		dst.buf[0].pos = (off_t)batchRuns[i].blockNo * BLOCK_SIZE;
 
-	syncRoot();
+		/* the cached copies are stale whatever happens next */
+		for (uint32_t b = 0; b < batchRuns[i].count; b++)
+			blockCache->invalidate(batchRuns[i].blockNo + b);
 
-	RETURN(0);
+		ssize_t res = fuse_buf_copy(&dst, buf, (enum fuse_buf_copy_flags)0);
+		if (res < 0)
+			return res;
+		if ((size_t)res < dst.buf[0].size)
+			return -EIO;
+	}
+
+	file->mtime = time(NULL);
+	changed[index] = true;
+	writeSeq[index]++;
+
+	LOGF("write_buf %s: %zu bytes spliced in %zu runs", path, size, count);
+
+	RETURN((int)size);
 }
 
-/// @brief Get file meta data.
+/// @brief Set an extended attribute.
 ///
-/// Get the metadata of a file (user & group id, modification times, permissions, ...).
-/// \param [in] path Name of the file, starting with "/".
-/// \param [out] statbuf Structure containing the meta data, for details type "man 2 stat" in a terminal.
+/// CLONE_XATTR is no attribute, its value is the path of a clone of the file to create, see cloneFile(). All other
+/// attributes are stored in a chain of the file, see storeXattrs().
+/// \param [in] path Path of the file.
+/// \param [in] name Name of the attribute.
+/// \param [in] value Value of the attribute, not terminated by '\0'.
+/// \param [in] size Length of the value.
+/// \param [in] flags XATTR_CREATE or XATTR_REPLACE.
 /// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf)
+#ifdef __APPLE__
+int MyOnDiskFS::fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags, uint32_t x)
+#else
+int MyOnDiskFS::fuseSetxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+#endif
 {
-	int ret;
-	DiskFileInfo *file;
+	int ret, index;
+	XattrSet *set;
 
 	LOGM();
+	LOCK_REQUEST();
 
-	// TODO: [PART 1] Implement this! Implemented by slno1011
+	ret = checkPath(path);
+	if (ret)
+		return ret;
 
-	// GNU's definitions of the attributes (http://www.gnu.org/software/libc/manual/html_node/Attribute-Meanings.html):
-	// 		st_uid: 	The user ID of the file’s owner.
-	//		st_gid: 	The group ID of the file.
-	//		st_atime: 	This is the last access time for the file.
-	//		st_mtime: 	This is the time of the last modification to the contents of the file.
-	//		st_mode: 	Specifies the mode of the file. This includes file type information (see Testing File Type) and
-	//		            the file permission bits (see Permission Bits).
-	//		st_nlink: 	The number of hard links to the file. This count keeps track of how many directories have
-	//	             	entries for this file. If the count is ever decremented to zero, then the file itself is
-	//	             	discarded as soon as no process still holds it open. Symbolic links are not counted in the
-	//	             	total.
-	//		st_size:	This specifies the size of a regular file in bytes. For files that are really devices this field
-	//		            isn’t usually meaningful. For symbolic links this specifies the length of the file name the link
-	//		            refers to.
-	statbuf->st_uid =
-			getuid(); // The owner of the file/directory is the user who mounted the filesystem
-	statbuf->st_gid =
-			getgid(); // The group of the file/directory is the same as the group of the user who mounted the filesystem
+	if (strcmp(name, CLONE_XATTR) == 0) {
+		std::string newpath(value, size);
+		if (newpath.empty() || newpath[0] != '/' || newpath.find('\0') != std::string::npos)
+			return -EINVAL;
 
-	if (strcmp(path, "/") == 0)
-	{
-		LOGF("\tAttributes of dir %s requested\n", path);
-		statbuf->st_mode = S_IFDIR | 0755;
-		statbuf->st_nlink =
-				2; // Why "two" hardlinks instead of "one"? The answer is here: http://unix.stackexchange.com/a/101536
-		statbuf->st_atime = time(NULL); // The last "a"ccess of the file/directory is right now
-		/* I don't think modification time should be now */
-		statbuf->st_mtime = time(NULL); // The last "m"odification of the file/directory is right now
+		ret = cloneFile(path, newpath.c_str());
+		RETURN(ret);
 	}
-	else
-	{
-		LOGF("\tAttributes of normal file %s requested\n", path);
-		ret = checkPath(path);
-		if (ret)
-			return ret;
 
-		ret = getFileIndex(path);
-		if (ret == -1)
-			return -ENOENT;
+	if (isSnapshotPath(path))
+		return -EROFS;
 
-		file = &rootBuffer[ret];
-		/* access time is now */
-		file->atime = time(NULL);
+	ret = getXattrs(path, NULL, &set, &index);
+	if (ret < 0)
+		return ret;
 
-		statbuf->st_mode = S_IFREG | file->mode;
-		statbuf->st_nlink = 1;
-		statbuf->st_size = file->size;
-		statbuf->st_ctime = file->ctime;
-		statbuf->st_mtime = file->mtime;
-		statbuf->st_atime = file->atime;
+	ret = set->set(name, value, size, flags);
+	if (ret < 0)
+		return ret;
 
-		syncRoot();
+	ret = storeXattrs(index);
+	if (ret < 0) {
+		/* the attributes in memory are ahead of the container, load them again on the next access */
+		attrsLoaded[index] = false;
 	}
 
-    RETURN(0);
+	RETURN(ret);
 }
 
-/// @brief Change file permissions.
+/// @brief Get an extended attribute.
 ///
-/// Set new permissions for a file.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// \param [in] path Name of the file, starting with "/".
-/// \param [in] mode New mode of the file.
-/// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseChmod(const char *path, mode_t mode)
+/// \param [in] path Path of the file.
+/// \param [in] name Name of the attribute.
+/// \param [out] value Buffer for the value.
+/// \param [in] size Size of the buffer, 0 to ask for the length of the value.
+/// \return Length of the value on success, -ERRNO on failure.
+#ifdef __APPLE__
+int MyOnDiskFS::fuseGetxattr(const char *path, const char *name, char *value, size_t size, uint x)
+#else
+int MyOnDiskFS::fuseGetxattr(const char *path, const char *name, char *value, size_t size)
+#endif
 {
 	int ret, index;
+	XattrSet scratch, *set;
 
 	LOGM();
+	LOCK_REQUEST();
 
-	// TODO: [PART 1] Implement this!
 	ret = checkPath(path);
 	if (ret)
 		return ret;
 
-	index = getFileIndex(path);
-	if (index == -1)
-		return -ENOENT;
-
-	rootBuffer[index].mode = mode;
-
-	syncRoot();
+	ret = getXattrs(path, &scratch, &set, &index);
+	if (ret < 0)
+		return (ret == -ENOTSUP) ? -ENODATA : ret;
 
-    RETURN(0);
+	return set->get(name, value, size);
 }
 
-/// @brief Change the owner of a file.
+/// @brief List the extended attributes of a file.
 ///
-/// Change the user and group identifier in the meta data of a file.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// \param [in] path Name of the file, starting with "/".
-/// \param [in] uid New user id.
-/// \param [in] gid New group id.
-/// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid)
+/// \param [in] path Path of the file.
+/// \param [out] list Buffer for the names, each one terminated by '\0'.
+/// \param [in] size Size of the buffer, 0 to ask for the length of the list.
+/// \return Length of the list on success, -ERRNO on failure.
+int MyOnDiskFS::fuseListxattr(const char *path, char *list, size_t size)
 {
-	int fileIndex;
-	DiskFileInfo *file;
-
-    LOGM();
-
-	if (checkPath(path))
-		return -EINVAL;
+	int ret, index;
+	XattrSet scratch, *set;
 
-	fileIndex = getFileIndex(path);
-	if (fileIndex == -1)
-		return -ENOENT;
+	LOGM();
+	LOCK_REQUEST();
 
-	file = &rootBuffer[fileIndex];
-	file->uid = uid;
-	file->gid = gid;
+	ret = checkPath(path);
+	if (ret)
+		return ret;
 
-	syncRoot();
+	ret = getXattrs(path, &scratch, &set, &index);
+	if (ret < 0)
+		return (ret == -ENOTSUP) ? 0 : ret;
 
-    RETURN(0);
+	return set->list(list, size);
 }
 
-/// @brief Open a file.
+/// @brief Remove an extended attribute.
 ///
-/// Open a file for reading or writing. This includes checking the permissions of the current user and incrementing the
-/// open file count.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// \param [in] path Name of the file, starting with "/".
-/// \param [out] fileInfo Can be ignored in Part 1
+/// \param [in] path Path of the file.
+/// \param [in] name Name of the attribute.
 /// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo)
+int MyOnDiskFS::fuseRemovexattr(const char *path, const char *name)
 {
 	int ret, index;
+	XattrSet *set;
 
-    LOGM();
-
-	if (numberOfOpenFiles == NUM_OPEN_FILES)
-		return -EMFILE;
+	LOGM();
+	LOCK_REQUEST();
 
 	ret = checkPath(path);
 	if (ret)
 		return ret;
 
-	index = getFileIndex(path);
-	if (index == -1)
-		return -ENOENT;
+	if (isSnapshotPath(path))
+		return -EROFS;
 
-	LOGF("\topened %s, index = %d\n", path, index);
+	ret = getXattrs(path, NULL, &set, &index);
+	if (ret < 0)
+		return (ret == -ENOTSUP) ? -ENODATA : ret;
 
-	// file handle uses index (because index starts at 0) of the file so if it is not set the file is not open;
-	fileInfo->fh = index;
-	numberOfOpenFiles++;
+	ret = set->remove(name);
+	if (ret < 0)
+		return ret;
+
+	ret = storeXattrs(index);
+	if (ret < 0)
+		attrsLoaded[index] = false;
+
+	RETURN(ret);
+}
+
+/// @brief Get file system statistics.
+///
+/// Computed from counters kept up to date whenever blocks are claimed or freed and files are created or deleted,
+/// so this does not depend on the size of the file system. Buffered blocks of delayed writes may still need new
+/// blocks when they are flushed, they are not available to unprivileged users.
+/// \param [in] path Can be ignored.
+/// \param [out] statInfo Structure for the statistics, for details type "man 3 statvfs" in a terminal.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseStatfs(const char *path, struct statvfs *statInfo)
+{
+    LOGM();
+    LOCK_REQUEST();
+
+	memset(statInfo, 0, sizeof(struct statvfs));
+	statInfo->f_bsize = BLOCK_SIZE;
+	statInfo->f_frsize = BLOCK_SIZE;
+	/* entry 0 of the FAT is reserved, see FAT_ENTRY_COUNT */
+	statInfo->f_blocks = FAT_ENTRY_COUNT - 1;
+	statInfo->f_bfree = freeBlocks;
+	statInfo->f_bavail = (freeBlocks > delayedBlocks) ? freeBlocks - delayedBlocks : 0;
+	statInfo->f_files = NUM_DIR_ENTRIES;
+	statInfo->f_ffree = freeSlots;
+	statInfo->f_favail = freeSlots;
+	/* names are stored with a terminating '\0' */
+	statInfo->f_namemax = NAME_LENGTH - 1;
+
+	LOGF("statfs: %zu free blocks, %zu delayed, %d free slots", freeBlocks, delayedBlocks, freeSlots);
 
     RETURN(0);
 }
 
-/// @brief Read from a file.
+/// @brief Flush a file.
 ///
-/// Read a given number of bytes from a file starting form a given position.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// Note that the file content is an array of bytes, not a string. I.e., it is not (!) necessarily terminated by '\0'
-/// and may contain an arbitrary number of '\0'at any position. Thus, you should not use strlen(), strcpy(), strcmp(),
-/// ... on both the file content and buf, but explicitly store the length of the file and all buffers somewhere and use
-/// memcpy(), memcmp(), ... to process the content.
+/// Called on each close() of a file descriptor. Delayed writes of the file are written to the container, in tiered
+/// mode they are left to the write-back thread (see writebackLoop()).
 /// \param [in] path Name of the file, starting with "/".
-/// \param [out] buf The data read from the file is stored in this array. You can assume that the size of buffer is at
-/// least 'size'
-/// \param [in] size Number of bytes to read
-/// \param [in] offset Starting position in the file, i.e., number of the first byte to read relative to the first byte of
-/// the file
-/// \param [in] fileInfo Can be ignored in Part 1
-/// \return The Number of bytes read on success. This may be less than size if the file does not contain sufficient bytes.
-/// -ERRNO on failure.
-int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo)
+/// \param [in] fileInfo File handle set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFlush(const char *path, struct fuse_file_info *fileInfo)
 {
 	int ret, index;
-	DiskFileInfo *file;
 
-    LOGM();
-	LOGF("--> Trying to read %s, %lu, %lu\n", path, (unsigned long)offset, size);
-
-	if (size == 0)
-		return 0;
+	LOGM();
+	LOCK_REQUEST();
 
 	ret = checkPath(path);
 	if (ret)
 		return ret;
 
-	index = getFileIndex(path);
-	if(index == -1)
-		return -ENOENT;
-
-	file = &rootBuffer[index];
-	if (file->firstblock == EOC_BLOCK)
-		return -ENOBUFS;
-
-	/* offset is out of bounds */
-	if (file->size < (size_t)offset)
-		return -ENOBUFS;
-
-	/* read would be out of bounds */
-	if (file->size < size)
-		size = file->size;
-	else if (file->size < (offset + size))
-		size -= offset;
-
-	int offset_in_blocks = offset / BLOCK_SIZE;
-	int read_offset_in_block = offset % BLOCK_SIZE;
-	int current_block = file->firstblock;
-
-	for (int block_iter = 0; block_iter < offset_in_blocks; block_iter++)
-		current_block = fatBuffer[current_block];
-
-	ret = readData(current_block, buf, size, read_offset_in_block);
+	/* the request guard has written back the dirty block of a handle, unless that failed */
+	ret = writeBackBlock();
 	if (ret < 0)
 		return ret;
 
-	RETURN((int)size);
+	index = getFileIndex(path);
+	if (index == -1)
+		return (lookupFile(path) == NULL) ? -ENOENT : 0;
+
+	if (!writebackRunning)
+		ret = flushFile(index);
+
+	RETURN(ret);
 }
 
-/// @brief Write to a file.
+/// @brief Synchronize a file.
 ///
-/// Write a given number of bytes to a file starting at a given position.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
-/// Note that the file content is an array of bytes, not a string. I.e., it is not (!) necessarily terminated by '\0'
-/// and may contain an arbitrary number of '\0'at any position. Thus, you should not use strlen(), strcpy(), strcmp(),
-/// ... on both the file content and buf, but explicitly store the length of the file and all buffers somewhere and use
-/// memcpy(), memcmp(), ... to process the content.
+/// Delayed writes of the file are written to the container, which is then flushed to stable storage. This happens in
+/// tiered mode as well.
 /// \param [in] path Name of the file, starting with "/".
-/// \param [in] buf An array containing the bytes that should be written.
-/// \param [in] size Number of bytes to write.
-/// \param [in] offset Starting position in the file, i.e., number of the first byte to read relative to the first byte of
-/// the file.
-/// \param [in] fileInfo Can be ignored in Part 1 .
-/// \return Number of bytes written on success, -ERRNO on failure.
-int MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo)
+/// \param [in] datasync Can be ignored, metadata is always written.
+/// \param [in] fi File handle set by fuseOpen.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFsync(const char *path, int datasync, struct fuse_file_info *fi)
 {
 	int ret, index;
-	int needed_blocks = ((offset + size) / BLOCK_SIZE) + 1;
-	int offset_in_block = offset % BLOCK_SIZE;
-	DiskFileInfo *file;
 
-    LOGM();
+	LOGM();
+	LOCK_REQUEST();
 
 	ret = checkPath(path);
 	if (ret)
 		return ret;
 
 	index = getFileIndex(path);
-	if (index == -1)
+	if (index == -1 && lookupFile(path) == NULL)
 		return -ENOENT;
 
-	file = &rootBuffer[index];
-	/* no data yet, fresh allocation */
-	if (file->firstblock == EOC_BLOCK) {
-		int firstblock;
-
-		firstblock = getEmptyBlockChain(needed_blocks);
-		if (firstblock < 0)
-			/* return -ERRNO */
-			return firstblock;
-
-		ret = writeData(firstblock, buf, size, offset_in_block);
-		if (ret < 0)
-			/* TODO: we should free claimed blocks just like in getEmptyBlockChain */
-			return ret;
-
-		file->size = offset + size;
-		file->firstblock = firstblock;
-	} else {
-		int allocated_blocks = (file->size / BLOCK_SIZE) + 1;
-		int blocks_to_append = needed_blocks - allocated_blocks;
-		int write_start_block = offset / BLOCK_SIZE;
-		int offset_in_block = offset % BLOCK_SIZE;
-
-		if (blocks_to_append > 0) {
-			int block = getEmptyBlockChain(blocks_to_append);
-			if (block < 0)
-				return block;
-			appendBlock(file->firstblock, block);
-		}
+	ret = writeBackBlock();
+	if (ret < 0)
+		return ret;
 
-		ret = writeData(write_start_block, buf, size, offset_in_block);
+	if (index != -1) {
+		ret = flushFile(index);
 		if (ret < 0)
 			return ret;
-
-		file->size = ((offset + size) > file->size) ? (offset + size) : file->size;
 	}
 
-	syncRoot();
-	syncFAT();
+	ret = this->blockDevice->sync();
 
-	RETURN((int)size);
+	RETURN(ret);
 }
 
 /// @brief Close a file.
@@ -769,22 +3497,42 @@ int MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo)
 {
-	int ret, index;
+	int ret = 0, index;
+	OpenFile *handle;
 
     LOGM();
+    LOCK_REQUEST();
 
-	ret = checkPath(path);
-	if (ret)
-		return ret;
+	handle = getHandle(fileInfo);
+	if (handle == NULL) {
+		ret = checkPath(path);
+		if (ret)
+			return ret;
 
-	index = getFileIndex(path);
-	if (index == -1)
-		return -ENOENT;
+		if (lookupFile(path) == NULL)
+			return -ENOENT;
+		index = getFileIndex(path);
+	} else {
+		/* a file removed while open has nothing left to write */
+		index = (handle->file != NULL) ? handle->index : -1;
+	}
 
+	/* the handle is closed even if its block or the delayed writes cannot be written */
+	ret = writeBackBlock();
+	if (ret == 0 && index != -1 && !writebackRunning)
+		ret = flushFile(index);
+
+	if (handle != NULL) {
+		if (handle->dirty) {
+			handle->dirty = false;
+			dirtyHandle = -1;
+		}
+		handle->used = false;
+		numberOfOpenFiles--;
+	}
 	fileInfo->fh = -1;
-	numberOfOpenFiles--;
 
-    RETURN(0);
+    RETURN(ret);
 }
 
 /// @brief Truncate a file.
@@ -802,81 +3550,110 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize)
 	DiskFileInfo *file;
 
     LOGM();
+    LOCK_REQUEST();
 
 	ret = checkPath(path);
 	if (ret)
 		return ret;
 
+	if (isSnapshotPath(path))
+		return -EROFS;
+
 	index = getFileIndex(path);
 	if (index == -1)
 		return -ENOENT;
+	if (S_ISDIR(rootBuffer[index].mode))
+		return -EISDIR;
+
+	/* truncate works on the blocks in the container */
+	ret = flushFile(index);
+	if (ret < 0)
+		return ret;
 
 	file = &rootBuffer[index];
+	changed[index] = true;
+	writeSeq[index]++;
+	if (tier != NULL)
+		tier->drop(index);
 
 	if (file->size == (size_t)newSize)
 		return 0;
 
-	if (newSize == 0) {
-		if (file->firstblock != EOC_BLOCK) {
-			freeFileData(file->firstblock);
-			file->firstblock = EOC_BLOCK;
-			syncFAT();
-		}
-		file->size = 0;
+	/* files without blocks stay in or move into their entry as long as they fit */
+	if (file->firstblock == EOC_BLOCK && (size_t)newSize <= INLINE_DATA_SIZE) {
+		if (!(file->flags & FILE_INLINE))
+			memset(file->data, 0, INLINE_DATA_SIZE);
+		else if ((size_t)newSize < file->size)
+			memset(file->data + newSize, 0, file->size - newSize);
+		file->flags |= FILE_INLINE;
+		file->size = newSize;
+		file->mtime = time(NULL);
 		syncRoot();
-		return 0;
+		RETURN(0);
+	}
+
+	/* a file growing out of its entry gets blocks from flushFile() */
+	if (file->flags & FILE_INLINE) {
+		delayed[index].size = newSize;
+		ret = flushFile(index);
+		if (ret < 0)
+			delayed[index].size = 0;
+		else
+			file->mtime = time(NULL);
+		RETURN(ret);
 	}
 
-	allocated_blocks = (file->size / BLOCK_SIZE) + 1;
-	needed_blocks = (newSize / BLOCK_SIZE) + 1;
+	if (sb.compressed) {
+		ret = truncateExtents(index, newSize);
+		RETURN(ret);
+	}
 
-	if ((size_t)newSize > file->size) {
-		int blocks_to_append = needed_blocks - allocated_blocks;
+	allocated_blocks = (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	needed_blocks = (newSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-		if (file->firstblock == EOC_BLOCK) // file->size = 0
-			blocks_to_append = 1;
+	if (needed_blocks == 0) {
+		if (file->firstblock != EOC_BLOCK) {
+			freeFileData(file->firstblock);
+			file->firstblock = EOC_BLOCK;
+		}
+	} else {
+		/* the new last block gets a new link or its tail cleared */
+		ret = unshareChain(&file->firstblock, needed_blocks);
+		if (ret < 0)
+			return ret;
 
-		if (blocks_to_append > 0) {
-			int block_chain = getEmptyBlockChain(blocks_to_append);
+		if (needed_blocks > allocated_blocks) {
+			int block_chain = getEmptyBlockChain(needed_blocks - allocated_blocks);
 			if (block_chain < 0)
-				return ret;
+				return block_chain;
 
 			if (file->firstblock == EOC_BLOCK)
 				file->firstblock = block_chain;
 			else
 				appendBlock(file->firstblock, block_chain);
-		}
-		file->size = newSize;
-	} else {	// newSize < file->size
-		int blocks_to_remove = allocated_blocks - needed_blocks;
-		int current_block, last_block = 0;
-
-		assert(blocks_to_remove >= 0);
-
-		file->size = newSize;
+		} else if (needed_blocks < allocated_blocks) {
+			int last_block = getBlockAt(file->firstblock, needed_blocks - 1);
 
-		if (!blocks_to_remove) {
-			syncRoot();
-			return 0;
+			freeFileData(fatEntry(last_block));
+			fatEntry(last_block) = EOC_BLOCK;
 		}
 
-		assert(file->firstblock != EOC_BLOCK);
+		/* bytes behind the new end must read as zero if the file grows again */
+		if ((size_t)newSize < file->size && newSize % BLOCK_SIZE != 0) {
+			size_t tail = BLOCK_SIZE - newSize % BLOCK_SIZE;
 
-		current_block = file->firstblock;
-
-		for (int block_iter = 0; block_iter < needed_blocks; block_iter++) {
-			current_block = fatBuffer[current_block];
-			/* needed_blocks - 2 can be negative, but in that case
-			 * last_block is set to 0, and that would be the correct last_block
-			 */
-			if (block_iter == (needed_blocks - 2))
-				last_block = current_block;
+			ret = writeData(getBlockAt(file->firstblock, needed_blocks - 1), zeroBlock, tail,
+				newSize % BLOCK_SIZE);
+			if (ret < 0)
+				return ret;
 		}
-		freeFileData(current_block); // remove syncFAT from here
-		fatBuffer[last_block] = EOC_BLOCK;
 	}
 
+	file->size = newSize;
+	file->mtime = time(NULL);
+
 	syncFAT();
+	syncRefs();
 	syncRoot();
 
     RETURN(0);
@@ -897,8 +3674,8 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_i
 	int ret;
 
     LOGM();
+    LOCK_REQUEST();
 
-    // TODO: [PART 2] Implement this!
 	ret = fuseTruncate(path, newSize);
 
     RETURN(ret);
@@ -906,34 +3683,92 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_i
 
 /// @brief Read a directory.
 ///
-/// Read the content of the (only) directory.
+/// Read the content of a directory, a snapshot or SNAPSHOT_DIR, along with the attributes of every entry, so listing a
+/// directory takes no getattr per entry. Entries are passed with their offset (see DIR_OFFSET()), so large directories
+/// are read in several calls when the buffer is full.
 /// You do not have to check file permissions, but can assume that it is always ok to access the directory.
-/// \param [in] path Path of the directory. Should be "/" in our case.
+/// \param [in] path Path of the directory.
 /// \param [out] buf A buffer for storing the directory entries.
 /// \param [in] filler A function for putting entries into the buffer.
-/// \param [in] offset Can be ignored.
+/// \param [in] offset Offset of the entry to continue behind, 0 to start at the beginning.
 /// \param [in] fileInfo Can be ignored.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo)
 {
+	int slot = -1, dir, type;
+	const char *name;
+	DiskFileInfo *file, *table = rootBuffer;
+	struct stat self, parent, st;
+
     LOGM();
+    LOCK_REQUEST();
 
 	int ret = checkPath(path);
 	if (ret)
 		return ret;
 
-	filler(buf, ".", NULL, 0);	// Current Directory
-	filler(buf, "..", NULL, 0); // Parent Directory
+	type = resolveSnapshotPath(path, &slot, &file);
+	if (type < 0)
+		return type;
 
-	if (strcmp(path, "/") == 0)
+	if (type == PATH_REGULAR) {
+		ret = dentries.resolve(path, &dir, &name);
+		if (ret < 0)
+			return ret;
+		if (ret != ROOT_DIR && !S_ISDIR(rootBuffer[ret].mode))
+			return -ENOTDIR;
+		dir = ret;
+		slot = -1;
+		statEntry(table, dir, -1, &self);
+		statEntry(table, (dir == ROOT_DIR) ? ROOT_DIR : table[dir].parent, -1, &parent);
+	} else if (type == PATH_SNAPSHOT_FILE) {
+		if (!S_ISDIR(file->mode))
+			return -ENOTDIR;
+		table = snapBuffer[slot].files;
+		dir = file - table;
+		statEntry(table, dir, slot, &self);
+		statEntry(table, table[dir].parent, slot, &parent);
+	} else if (type == PATH_SNAPSHOT) {
+		table = snapBuffer[slot].files;
+		dir = ROOT_DIR;
+		statEntry(table, dir, slot, &self);
+		statSnapshotDir(&parent);
+	} else {
+		statSnapshotDir(&self);
+		statEntry(rootBuffer, ROOT_DIR, -1, &parent);
+	}
+
+	if (offset < 1 && filler(buf, ".", &self, 1))	// Current Directory
+		RETURN(0);
+	if (offset < 2 && filler(buf, "..", &parent, 2)) // Parent Directory
+		RETURN(0);
+
+	if (type == PATH_SNAPSHOT_ROOT)
 	{
-		for (int i = 0; i < NUM_DIR_ENTRIES; i++)
+		for (int i = DIR_FIRST_SLOT(offset); i < NUM_SNAPSHOTS; i++)
 		{
-			if (rootBuffer[i].name[0] != '\0')
-			{
-				filler(buf, rootBuffer[i].name + 1, NULL, 0);
-				LOGF("\t\t%s\n", rootBuffer[i].name);
-			}
+			if (snapBuffer[i].name[0] == '\0')
+				continue;
+			statEntry(snapBuffer[i].files, ROOT_DIR, i, &st);
+			if (filler(buf, snapBuffer[i].name, &st, DIR_OFFSET(i)))
+				break;
+		}
+	}
+	else
+	{
+		const std::set<int> &children = (slot < 0) ? dentries.childrenOf(dir) : snapDentries[slot].childrenOf(dir);
+		for (std::set<int>::const_iterator it = children.lower_bound(DIR_FIRST_SLOT(offset)); it != children.end();
+			++it)
+		{
+			statEntry(table, *it, slot, &st);
+			if (filler(buf, table[*it].name, &st, DIR_OFFSET(*it)))
+				RETURN(0);
+			LOGF("\t\t%s\n", table[*it].name);
+		}
+		if (type == PATH_REGULAR && dir == ROOT_DIR && offset < DIR_OFFSET(NUM_DIR_ENTRIES))
+		{
+			statSnapshotDir(&st);
+			filler(buf, SNAPSHOT_DIR + 1, &st, DIR_OFFSET(NUM_DIR_ENTRIES));
 		}
 	}
 
@@ -943,15 +3778,15 @@ int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler,
 /// Initialize a file system.
 ///
 /// This function is called when the file system is mounted. You may add some initializing code here.
-/// \param [in] conn Can be ignored.
+/// \param [in,out] conn Connection info, used to request large reads and writes.
 /// \return 0.
 void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn)
 {
     // Open logfile
-    this->logFile = fopen(((MyFsInfo *)fuse_get_context()->private_data)->logFile, "w+");
+    this->logFile = fopen(getInfo()->logFile, "w+");
     if (this->logFile == NULL)
     {
-        fprintf(stderr, "ERROR: Cannot open logfile %s\n", ((MyFsInfo *)fuse_get_context()->private_data)->logFile);
+        fprintf(stderr, "ERROR: Cannot open logfile %s\n", getInfo()->logFile);
 		return 0;
 	}
 
@@ -960,9 +3795,13 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn)
 
 	LOG("Starting logging...\n");
 	LOG("Using on-disk mode");
-	LOGF("Container file name: %s", ((MyFsInfo *)fuse_get_context()->private_data)->contFile);
 
-	int ret = this->blockDevice->open(((MyFsInfo *)fuse_get_context()->private_data)->contFile);
+	setupConnection(conn);
+	LOGF("Container file name: %s", getInfo()->contFile);
+
+	bool created = false;
+	this->blockDevice->setDirectIO(getInfo()->directIO);
+	int ret = this->blockDevice->open(getInfo()->contFile);
 	if (ret < 0 && ret != -ENOENT) {
 		LOGF("ERROR: Access to container file failed with error %d", ret);
 		return 0;
@@ -972,118 +3811,215 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn)
 	{
 		LOG("Container file does exist, reading");
 
-		char *buf = (char *)malloc(BLOCK_SIZE);
-		if (buf == NULL)
-			return 0;
-
-		memset(buf, 0, BLOCK_SIZE);
+		memset(scratch, 0, BLOCK_SIZE);
 
-		ret = this->blockDevice->read(0, buf);
+		ret = this->blockDevice->read(0, scratch);
 		if (ret < 0)
 			LOGF("FATAL in %s: blockDevice read returned %d\n", __func__, ret);
 		// kopiere daten des ersten blocks in sb (Superblock)
-		memcpy(&sb, buf, sizeof(sb));
+		memcpy(&sb, scratch, sizeof(sb));
 
 		LOGF("fat = %d, fat_size = %ld, root = %d, root_size = %ld, data = %d\n",
 			sb.fat_start, sb.fat_size, sb.root_start, sb.root_size, sb.data_start);
 
-		// here should sb input sanity checks happen, but we don't care for now
-
-		fatBuffer = (int *)malloc(sb.fat_size);
-		if (fatBuffer == NULL) {
-			free(buf);
+		if (sb.magic != MYFS_MAGIC) {
+			LOGF("ERROR: %s is not a MyFS container", getInfo()->contFile);
 			return 0;
 		}
 
-		rootBuffer = (DiskFileInfo *)malloc(sb.root_size);
-		if (rootBuffer == NULL) {
-			free(buf);
-			free(fatBuffer);
+		/* directory entries have grown with the content of small files */
+		if (sb.root_size != align_to_io_size(sizeof(struct DiskFileInfo) * NUM_DIR_ENTRIES) ||
+			sb.snap_size != align_to_io_size(sizeof(struct DiskSnapshot) * NUM_SNAPSHOTS)) {
+			LOGF("ERROR: %s has directory entries of a different size",
+				getInfo()->contFile);
 			return 0;
 		}
-
-		// TODO: find better return values in case of allocation failures above
-
-		memset(fatBuffer, 0, sizeof(sb.fat_size));
-		memset(rootBuffer, 0, sizeof(sb.root_size));
-
-		int fat_end = sb.fat_start + sb.fat_size;
-		int offset;
-		char *bufptr = (char *)fatBuffer;
-
-		/* read FAT into RAM, reading is done one block of BLOCK_SIZE at a time */
-		for (int block = sb.fat_start; block != fat_end; block += BLOCK_SIZE) {
-			offset = block - sb.fat_start;
-			ret = this->blockDevice->read(block, bufptr + offset);
-			if (ret < 0)
-				LOGF("FATAL in %s: blockDevice read returned %d\n", __func__, ret);
-		}
-
-		int root_end = sb.root_start + sb.root_size;
-		bufptr = (char *)rootBuffer;
-
-		/* read root entries into RAM, reading is done one block of BLOCK_SIZE at a time */
-		for (int block = sb.root_start; block != root_end; block += BLOCK_SIZE) {
-			offset = block - sb.root_start;
-			ret = this->blockDevice->read(block, bufptr + offset);
-			if (ret < 0)
-				LOGF("FATAL in %s: blockDevice read returned %d\n", __func__, ret);
-		}
 	}
 	else if (ret == -ENOENT)
 	{
 		LOG("Container file does not exist, creating a new one");
 
-		ret = this->blockDevice->create(((MyFsInfo *)fuse_get_context()->private_data)->contFile);
+		ret = this->blockDevice->create(getInfo()->contFile);
 		if (ret < 0) {
 			LOGF("ERROR: Creation of container file failed with error %d", ret);
 			return 0;
 		}
 
-		char *buf = (char *)malloc(BLOCK_SIZE);
-		if (buf == NULL)
-			return 0;
-
-		memset(buf, 0, BLOCK_SIZE);
+		memset(&sb, 0, sizeof(sb));
 
-		/* fat starts at block 1, because the superblock is at the previous block */
-		sb.fat_start = 1;
-		/* fat size is aligned to block size */
-		sb.fat_size = DATA_BLOCK_COUNT * sizeof(int);
-		sb.root_start = sb.fat_start + sb.fat_size;
-		/* root size might need alignment, this makes it easier to
-		 * read/write from/to RAM as it's done one block at a time
+		sb.magic = MYFS_MAGIC;
+		/* fat starts behind the I/O unit holding the superblock */
+		sb.fat_start = BD_DIRECT_ALIGN / BLOCK_SIZE;
+		/* all areas are aligned to the I/O size of O_DIRECT, so tables and runs of
+		 * data blocks starting at an aligned FAT index can bypass the page cache
+		 * of the host without copying
 		 */
-		sb.root_size = align_to_block_size(sizeof(struct DiskFileInfo) * NUM_DIR_ENTRIES);
-		sb.data_start = sb.root_start + sb.root_size;
+		sb.fat_size = align_to_io_size(FAT_ENTRY_COUNT * sizeof(int));
+		sb.ref_start = sb.fat_start + sb.fat_size / BLOCK_SIZE;
+		sb.ref_size = align_to_io_size(FAT_ENTRY_COUNT * sizeof(uint16_t));
+		sb.root_start = sb.ref_start + sb.ref_size / BLOCK_SIZE;
+		sb.root_size = align_to_io_size(sizeof(struct DiskFileInfo) * NUM_DIR_ENTRIES);
+		sb.snap_start = sb.root_start + sb.root_size / BLOCK_SIZE;
+		sb.snap_size = align_to_io_size(sizeof(struct DiskSnapshot) * NUM_SNAPSHOTS);
+		sb.data_start = sb.snap_start + sb.snap_size / BLOCK_SIZE;
+		sb.compressed = getInfo()->compress ? 1 : 0;
 
-		memcpy(buf, &sb, sizeof(sb));
 		/* write the superblock back as it's empty after container creation */
-		ret = this->blockDevice->write(0, buf);
-		if (ret < 0)
-			LOGF("FATAL in %s: blockDevice write returned %d\n", __func__, ret);
+		syncSuperBlock();
+
+		/* FAT, reference counts, root entries and snapshots of a new container
+		 * are all zero, which is what the (sparse) container file reads as
+		 */
+		created = true;
+	}
+
+	fatBuffer = (int *)alloc_table(sb.fat_size);
+	refBuffer = (uint16_t *)alloc_table(sb.ref_size);
+	rootBuffer = (DiskFileInfo *)alloc_table(sb.root_size);
+	rootWritten = (DiskFileInfo *)alloc_table(sb.root_size);
+	snapBuffer = (DiskSnapshot *)alloc_table(sb.snap_size);
+	freeMap = (uint64_t *)alloc_table(MAP_SIZE);
+	if (fatBuffer == NULL || refBuffer == NULL || rootBuffer == NULL || rootWritten == NULL || snapBuffer == NULL ||
+		freeMap == NULL) {
+		LOG("ERROR: Cannot allocate file system tables");
+		return 0;
+	}
+
+	LOGF("O_DIRECT: %d, io_uring: %d, compressed: %d", this->blockDevice->directIO(), this->blockDevice->asyncIO(),
+		sb.compressed);
+
+	if (!created) {
+		load(sb.root_start, rootBuffer, sb.root_size);
+		load(sb.snap_start, snapBuffer, sb.snap_size);
+		memcpy(rootWritten, rootBuffer, sb.root_size);
+
+		/* entries used to be named by their full path in the only directory */
+		for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+			if (rootBuffer[i].name[0] == '/') {
+				LOGF("ERROR: %s has a flat root directory",
+					getInfo()->contFile);
+				return 0;
+			}
+		}
+	}
+
+	if (!created && sb.state == MYFS_CLEAN && sb.map_start != 0) {
+		/* the FAT is loaded region by region when it is accessed, see fatEntry() */
+		fatLoaded.assign(FAT_REGIONS, false);
+		load(sb.map_start, freeMap, MAP_SIZE);
+		freeBlocks = sb.free_blocks;
+		LOGF("Container was unmounted cleanly, %zu free blocks", freeBlocks);
+	} else {
+		if (!created) {
+			LOG("Container was not unmounted cleanly, loading the whole FAT");
+			load(sb.fat_start, fatBuffer, sb.fat_size);
+			load(sb.ref_start, refBuffer, sb.ref_size);
+		}
+		fatLoaded.assign(FAT_REGIONS, true);
+
+		/* the FAT is scanned once here, from now on the bitmap and the counter are kept up to date */
+		freeBlocks = 0;
+		for (int i = 1; i < (int)FAT_ENTRY_COUNT; i++) {
+			if (fatBuffer[i] == EMPTY_BLOCK) {
+				setFree(i, true);
+				freeBlocks++;
+			}
+		}
+	}
+
+	freeSlots = 0;
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (rootBuffer[i].name[0] == '\0')
+			freeSlots++;
+	}
+	fillDentries(dentries, rootBuffer);
+	for (int i = 0; i < NUM_SNAPSHOTS; i++)
+		fillDentries(snapDentries[i], snapBuffer[i].files);
+
+	/* the bitmap is kept behind the data area, containers created before it existed get it here */
+	if (sb.map_start == 0) {
+		sb.map_start = align_to_io_size((size_t)(sb.data_start + FAT_ENTRY_COUNT) * BLOCK_SIZE) / BLOCK_SIZE;
+		sb.map_size = MAP_SIZE;
+	}
 
-		fatBuffer = (int *)malloc(sb.fat_size);
-		if (fatBuffer == NULL) {
-			free(buf);
+	/* checksums are kept behind the bitmap and stay on once they have been turned on for a container */
+	bool new_checksums = false, created_dedup = false;
+	if (sb.csum_start == 0 && getInfo()->checksums) {
+		sb.csum_start = sb.map_start + sb.map_size / BLOCK_SIZE;
+		sb.csum_size = align_to_io_size(FAT_ENTRY_COUNT * sizeof(uint32_t));
+		new_checksums = true;
+	}
+	if (sb.csum_start != 0) {
+		csumBuffer = (uint32_t *)alloc_table(sb.csum_size);
+		if (csumBuffer == NULL) {
+			LOG("ERROR: Cannot allocate the checksum table");
 			return 0;
 		}
 
-		rootBuffer = (DiskFileInfo *)malloc(sb.root_size);
-		if (rootBuffer == NULL) {
-			free(buf);
-			free(fatBuffer);
+		if (!new_checksums && sb.state == MYFS_CLEAN) {
+			load(sb.csum_start, csumBuffer, sb.csum_size);
+		} else {
+			/* after a crash, blocks may have reached the container without their checksums */
+			LOG("Computing checksums of all blocks in use");
+			ret = computeChecksums();
+			if (ret < 0)
+				LOGF("FATAL in %s: computing checksums failed with error %d\n", __func__, ret);
+			sync(sb.csum_start, csumBuffer, sb.csum_size);
+		}
+		this->blockCache->setChecksums(sb.data_start, FAT_ENTRY_COUNT, csumBuffer);
+		LOGF("Checksums on, CRC32C instructions: %d", crc32cHardware());
+	}
+
+	/* fingerprints are kept behind the space for the checksums and stay on once dedup has been turned on, blocks
+	 * written before are not indexed
+	 */
+	if (sb.dedup_start == 0 && getInfo()->dedup) {
+		if (sb.compressed) {
+			LOG("Deduplication is not available for compressed containers");
+		} else {
+			sb.dedup_start = sb.map_start + (sb.map_size + align_to_io_size(FAT_ENTRY_COUNT * sizeof(uint32_t))) /
+				BLOCK_SIZE;
+			sb.dedup_size = align_to_io_size(FAT_ENTRY_COUNT * sizeof(uint32_t));
+			created_dedup = true;
+		}
+	}
+	if (sb.dedup_start != 0) {
+		dedupBuffer = (uint32_t *)alloc_table(sb.dedup_size);
+		if (dedupBuffer == NULL) {
+			LOG("ERROR: Cannot allocate the fingerprint table");
 			return 0;
 		}
 
-		memset(fatBuffer, 0, sizeof(sb.fat_size));
-		memset(rootBuffer, 0, sizeof(sb.root_size));
+		/* the table may be out of date after a crash, which findDuplicate() copes with */
+		if (!created_dedup)
+			load(sb.dedup_start, dedupBuffer, sb.dedup_size);
+		dedupIndex.clear();
+		for (int i = 1; i < (int)FAT_ENTRY_COUNT; i++) {
+			if (dedupBuffer[i] != 0 && isFree(i))
+				dedupBuffer[i] = 0;
+			else if (dedupBuffer[i] != 0)
+				dedupIndex.insert(std::make_pair(dedupBuffer[i], i));
+		}
+		LOGF("Deduplication on, %zu blocks indexed", dedupIndex.size());
+	}
+
+	/* until the next clean unmount, the bitmap on disk must not be trusted */
+	sb.state = MYFS_DIRTY;
+	syncSuperBlock();
+
+	if (getInfo()->defrag) {
+		LOG("Starting online defragmentation");
+		startDefrag();
+	}
 
-		free(buf);
+	/* the RAM budget is split evenly between copies of hot files and delayed writes */
+	if (getInfo()->tier > 0) {
+		size_t budget = (size_t)getInfo()->tier << 20;
 
-		/* write back FAT and root entries to newly created container */
-		//syncFAT();
-		//syncRoot();
+		LOGF("Tiered mode, %zu MiB of RAM", budget >> 20);
+		tier = new FileTier(budget / 2, TIER_HALF_LIFE);
+		delayLimit = budget / 2 / BLOCK_SIZE;
+		startWriteback();
 	}
 
     return 0;
@@ -1096,11 +4032,429 @@ void MyOnDiskFS::fuseDestroy()
 {
     LOGM();
 
-    // TODO: [PART 2] Implement this!
+	stopDefrag();
+	stopWriteback();
+	if (tier != NULL) {
+		LOGF("tier: %zu hits, %zu misses", tier->hits, tier->misses);
+		delete tier;
+		tier = NULL;
+		delayLimit = DELALLOC_MAX_BLOCKS;
+	}
+
+	/* apart from delayed writes and the dirty block of a handle, all changes have been written back by the operations
+	 * themselves */
+	writeBackBlock();
+	flushAll();
+	syncChecksums();
+	if (dedupBuffer != NULL)
+		sync(sb.dedup_start, dedupBuffer, sb.dedup_size);
+
+	/* everything else is on disk now, the bitmap makes the next mount fast */
+	sync(sb.map_start, freeMap, MAP_SIZE);
+	this->blockDevice->sync();
+	sb.free_blocks = freeBlocks;
+	sb.state = MYFS_CLEAN;
+	syncSuperBlock();
+	this->blockCache->clear();
+	this->blockCache->setChecksums(0, 0, NULL);
+	this->blockDevice->close();
+
+	free(fatBuffer);
+	free(refBuffer);
+	free(rootBuffer);
+	free(rootWritten);
+	free(snapBuffer);
+	free(freeMap);
+	free(csumBuffer);
+	free(dedupBuffer);
+	dedupIndex.clear();
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		free(extents[i].data);
+		extents[i].data = NULL;
+		resetExtents(&extents[i], EOC_BLOCK);
+	}
+	fatBuffer = NULL;
+	refBuffer = NULL;
+	rootBuffer = NULL;
+	rootWritten = NULL;
+	snapBuffer = NULL;
+	freeMap = NULL;
+	csumBuffer = NULL;
+	dedupBuffer = NULL;
 }
 
 // TODO: [PART 2] You may add your own additional methods here!
 
+// Number of runs of consecutive blocks in a chain
+// \param [in] start_block First block of the chain.
+// \param [out] num_blocks Length of the chain, may be NULL.
+// \return number of runs, 0 for an empty chain.
+int MyOnDiskFS::countFragments(int start_block, int *num_blocks)
+{
+	int fragments = 0, blocks = 0, prev_block = -1;
+
+	for (int block = start_block; block != EOC_BLOCK; block = fatEntry(block)) {
+		if (block != prev_block + 1)
+			fragments++;
+		prev_block = block;
+		blocks++;
+	}
+
+	if (num_blocks != NULL)
+		*num_blocks = blocks;
+
+	return fragments;
+}
+
+// Check if the blocks of a file can be relocated
+// Files with delayed writes get a run of blocks in flushFile() anyway, blocks shared with a snapshot stay in place.
+bool MyOnDiskFS::isMovable(int index)
+{
+	DiskFileInfo *file = &rootBuffer[index];
+
+	if (file->name[0] == '\0' || file->firstblock == EOC_BLOCK)
+		return false;
+	if (!delayed[index].blocks.empty() || delayed[index].size > 0)
+		return false;
+
+	for (int block = file->firstblock; block != EOC_BLOCK; block = fatEntry(block)) {
+		if (refEntry(block) > 1)
+			return false;
+	}
+
+	return true;
+}
+
+// Look for the next fragmented file and reserve a run of free blocks for it
+// Reserved blocks are marked as end of chain without a reference, so they are neither free nor part of a file.
+// \return true if a job was started, false if the end of the root directory was reached.
+bool MyOnDiskFS::startDefragJob()
+{
+	int fragments, num_blocks, run_start;
+	int total_files = 0, total_fragments = 0;
+
+	while (defragNext < NUM_DIR_ENTRIES) {
+		int index = defragNext++;
+
+		if (!isMovable(index))
+			continue;
+
+		fragments = countFragments(rootBuffer[index].firstblock, &num_blocks);
+		if (fragments < 2)
+			continue;
+
+		run_start = findFreeRun(num_blocks);
+		if (run_start == -1) {
+			LOGF("defrag: no run of %d free blocks for %s", num_blocks, rootBuffer[index].name);
+			continue;
+		}
+
+		for (int i = 0; i < num_blocks; i++) {
+			fatEntry(run_start + i) = EOC_BLOCK;
+			refEntry(run_start + i) = 0;
+			claimBlock(run_start + i);
+		}
+
+		defragJob.index = index;
+		defragJob.run_start = run_start;
+		defragJob.num_blocks = num_blocks;
+		defragJob.done = 0;
+		defragJob.fragments = fragments;
+
+		LOGF("defrag: moving %s, %d blocks in %d fragments", rootBuffer[index].name, num_blocks, fragments);
+		return true;
+	}
+
+	/* end of a pass, report what is left */
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (rootBuffer[i].name[0] == '\0' || rootBuffer[i].firstblock == EOC_BLOCK)
+			continue;
+		total_files++;
+		total_fragments += countFragments(rootBuffer[i].firstblock, NULL);
+	}
+	LOGF("defrag: pass finished, %d files in %d fragments", total_files, total_fragments);
+
+	defragNext = 0;
+	return false;
+}
+
+// Check that the file of the current job has not been changed in a way that invalidates the job
+bool MyOnDiskFS::checkDefragJob()
+{
+	int num_blocks, block;
+
+	if (!isMovable(defragJob.index))
+		return false;
+
+	countFragments(rootBuffer[defragJob.index].firstblock, &num_blocks);
+	if (num_blocks != defragJob.num_blocks)
+		return false;
+
+	/* the part that has been moved already must still be in place */
+	block = rootBuffer[defragJob.index].firstblock;
+	for (int i = 0; i < defragJob.done; i++, block = fatEntry(block)) {
+		if (block != defragJob.run_start + i)
+			return false;
+	}
+
+	return true;
+}
+
+// Give back the reserved blocks that have not been used by the current job
+void MyOnDiskFS::abortDefragJob()
+{
+	for (int i = defragJob.done; i < defragJob.num_blocks; i++)
+		releaseBlock(defragJob.run_start + i);
+
+	defragJob.index = -1;
+}
+
+// Free the blocks moved away from, unless the reply of a fuseReadBuf() request may still splice them
+// Such a reply refers to the request that was running when the blocks were moved. It has been sent once the next
+// request starts, as mount.myfs serves requests on a single thread.
+// \param [in] force Free them in any case, used when no more requests are served.
+void MyOnDiskFS::releaseQuarantine(bool force)
+{
+	if (quarantine.empty() || (!force && requests == quarantineSeq && spliceSeq == quarantineSeq))
+		return;
+
+	for (size_t i = 0; i < quarantine.size(); i++)
+		releaseBlock(quarantine[i]);
+	quarantine.clear();
+
+	syncFAT();
+}
+
+/// @brief Move the next part of a fragmented file into its run of blocks.
+///
+/// A step runs with fsLock held, so it is atomic with respect to FUSE requests. Up to DEFRAG_STEP_BLOCKS blocks
+/// behind the part moved already are copied into the reserved run, and the copies are chained to the rest of the
+/// file before the link to the old blocks is switched over. A crash leaves the file intact, blocks that were
+/// reserved or moved away from are lost until the container is checked. If the last request replied with pieces
+/// of the container from fuseReadBuf(), the old blocks are not freed before the next request has started, as the
+/// reply may still read them.
+/// \return number of blocks moved, 0 if there is nothing to move, -ERRNO on failure.
+int MyOnDiskFS::defragStep()
+{
+	int ret = 0;
+	int count, first, rest, fragments;
+	int *link;
+	char *buffer;
+	std::vector<int> moved;
+	DiskFileInfo *file;
+
+	releaseQuarantine(false);
+
+	if (defragJob.index != -1 && !checkDefragJob()) {
+		LOGF("defrag: %s has been changed, relocation aborted", rootBuffer[defragJob.index].name);
+		abortDefragJob();
+		syncFAT();
+	}
+
+	if (defragJob.index == -1 && !startDefragJob())
+		return 0;
+
+	file = &rootBuffer[defragJob.index];
+	first = defragJob.run_start + defragJob.done;
+	count = std::min(DEFRAG_STEP_BLOCKS, defragJob.num_blocks - defragJob.done);
+	link = (defragJob.done == 0) ? &file->firstblock : &fatEntry(first - 1);
+
+	buffer = this->blockDevice->allocBuffer();
+	if (buffer == NULL)
+		return -ENOMEM;
+
+	/* the old blocks are read with one batch and written to the run at once */
+	ret = prefetchChain(*link, count);
+	rest = *link;
+	for (int i = 0; i < count && ret >= 0; i++) {
+		moved.push_back(rest);
+		ret = blockCache->read(fatToDataAddress(rest), buffer + i * BLOCK_SIZE);
+		rest = fatEntry(rest);
+	}
+	if (ret >= 0)
+		ret = blockCache->writeBlocks(fatToDataAddress(first), count, buffer);
+
+	this->blockDevice->releaseBuffer(buffer);
+
+	if (ret < 0) {
+		abortDefragJob();
+		syncFAT();
+		return ret;
+	}
+
+	/* chain the copies to the rest of the file, nothing links to them yet */
+	for (int i = 0; i < count; i++) {
+		fatEntry(first + i) = (i < count - 1) ? first + i + 1 : rest;
+		refEntry(first + i) = 1;
+		if (dedupBuffer != NULL)
+			setFingerprint(first + i, dedupBuffer[moved[i]]);
+	}
+	syncRange(sb.fat_start, fatBuffer, first * sizeof(int), count * sizeof(int));
+	syncRange(sb.ref_start, refBuffer, first * sizeof(uint16_t), count * sizeof(uint16_t));
+
+	/* switch the link over */
+	*link = first;
+	if (defragJob.done == 0)
+		syncRoot();
+	else
+		syncRange(sb.fat_start, fatBuffer, (first - 1) * sizeof(int), sizeof(int));
+
+	/* the old blocks are free at once, unless the reply of the last request may still splice them */
+	for (size_t i = 0; i < moved.size(); i++) {
+		refEntry(moved[i]) = 0;
+		blockCache->invalidate(fatToDataAddress(moved[i]));
+		if (spliceSeq == requests) {
+			fatEntry(moved[i]) = EOC_BLOCK;
+			quarantine.push_back(moved[i]);
+		} else {
+			releaseBlock(moved[i]);
+		}
+	}
+	quarantineSeq = requests;
+	syncFAT();
+	syncRefs();
+
+	/* the extents of a compressed file have moved */
+	resetExtents(&extents[defragJob.index], file->firstblock);
+
+	defragJob.done += count;
+	if (defragJob.done == defragJob.num_blocks) {
+		fragments = countFragments(file->firstblock, NULL);
+		LOGF("defrag: %s moved, %d fragments before, %d after", file->name, defragJob.fragments, fragments);
+		defragJob.index = -1;
+	}
+
+	return count;
+}
+
+// Body of the defragmenter thread
+// The lock is only released while waiting between steps, which limits the rate at which blocks are moved.
+void MyOnDiskFS::defragLoop()
+{
+	std::unique_lock<std::recursive_mutex> lock(fsLock);
+	int moved;
+
+	while (!defragStop) {
+		moved = defragStep();
+		syncChecksums();
+		if (moved < 0)
+			LOGF("defrag: step failed with error %d", moved);
+
+		if (moved > 0)
+			defragWake.wait_for(lock, std::chrono::milliseconds(1000L * moved / DEFRAG_RATE_BLOCKS),
+				[this] { return defragStop; });
+		else
+			defragWake.wait_for(lock, std::chrono::seconds(DEFRAG_SCAN_INTERVAL), [this] { return defragStop; });
+	}
+}
+
+// Start the defragmenter thread
+void MyOnDiskFS::startDefrag()
+{
+	defragStop = false;
+
+	try {
+		defragThread = std::thread(&MyOnDiskFS::defragLoop, this);
+		defragRunning = true;
+	} catch (const std::system_error &e) {
+		LOGF("ERROR: Cannot start defragmenter: %s", e.what());
+	}
+}
+
+// Stop the defragmenter thread, a relocation in progress is given up
+void MyOnDiskFS::stopDefrag()
+{
+	if (!defragRunning)
+		return;
+
+	{
+		std::lock_guard<std::recursive_mutex> lock(fsLock);
+		defragStop = true;
+	}
+	defragWake.notify_all();
+	defragThread.join();
+	defragRunning = false;
+
+	if (defragJob.index != -1)
+		abortDefragJob();
+	releaseQuarantine(true);
+	syncFAT();
+}
+
+// Write back delayed writes in tiered mode when the limit is reached, coldest files first, until half of the limit is
+// left. Hot files keep collecting writes in memory.
+// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::flushColdest()
+{
+	std::vector<std::pair<double, int>> order;
+	double now = tierClock();
+
+	for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+		if (!delayed[i].blocks.empty())
+			order.push_back(std::make_pair(tier->heat(i, now), i));
+	}
+	std::sort(order.begin(), order.end());
+
+	for (size_t i = 0; i < order.size() && delayedBlocks > delayLimit / 2; i++) {
+		int ret = flushFile(order[i].second);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+// Body of the write-back thread of the tiered mode
+// Files are written back once their oldest delayed write is TIER_WRITEBACK_AGE seconds old.
+void MyOnDiskFS::writebackLoop()
+{
+	std::unique_lock<std::recursive_mutex> lock(fsLock);
+
+	while (!writebackStop) {
+		time_t now = time(NULL);
+
+		for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+			if (delayed[i].blocks.empty() || now - delayed[i].since < TIER_WRITEBACK_AGE)
+				continue;
+
+			int ret = flushFile(i);
+			if (ret < 0)
+				LOGF("write-back: %s failed with error %d", rootBuffer[i].name, ret);
+		}
+		syncChecksums();
+
+		writebackWake.wait_for(lock, std::chrono::seconds(TIER_WRITEBACK_INTERVAL), [this] { return writebackStop; });
+	}
+}
+
+// Start the write-back thread
+void MyOnDiskFS::startWriteback()
+{
+	writebackStop = false;
+
+	try {
+		writebackThread = std::thread(&MyOnDiskFS::writebackLoop, this);
+		writebackRunning = true;
+	} catch (const std::system_error &e) {
+		LOGF("ERROR: Cannot start write-back, files are written back when closed: %s", e.what());
+	}
+}
+
+// Stop the write-back thread, the remaining delayed writes are left to the caller
+void MyOnDiskFS::stopWriteback()
+{
+	if (!writebackRunning)
+		return;
+
+	{
+		std::lock_guard<std::recursive_mutex> lock(fsLock);
+		writebackStop = true;
+	}
+	writebackWake.notify_all();
+	writebackThread.join();
+	writebackRunning = false;
+}
+
 // DO NOT EDIT ANYTHING BELOW THIS LINE!!!
 
 /// @brief Set the static instance of the file system.
@@ -73,6 +73,12 @@ int wrap_read(const char *path, char *buf, size_t size, off_t offset, struct fus
 int wrap_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
     return MyFS::Instance()->fuseWrite(path, buf, size, offset, fileInfo);
 }
+int wrap_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
+    return MyFS::Instance()->fuseReadBuf(path, bufp, size, offset, fileInfo);
+}
+int wrap_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fileInfo) {
+    return MyFS::Instance()->fuseWriteBuf(path, buf, offset, fileInfo);
+}
 int wrap_statfs(const char *path, struct statvfs *statInfo) {
     return MyFS::Instance()->fuseStatfs(path, statInfo);
 }
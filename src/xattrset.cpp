@@ -0,0 +1,151 @@
+//
+//  xattrset.cpp
+//  myfs
+//
+
+#include <cstring>
+#include <errno.h>
+#include <sys/xattr.h>
+
+#include "xattrset.h"
+
+XattrSet::XattrSet() {
+    this->bytes = 0;
+}
+
+int XattrSet::get(const char *name, char *value, size_t size) const {
+    auto it = attrs.find(name);
+    if (it == attrs.end())
+        return -ENODATA;
+
+    if (size == 0)
+        return (int) it->second.size();
+    if (size < it->second.size())
+        return -ERANGE;
+
+    memcpy(value, it->second.data(), it->second.size());
+    return (int) it->second.size();
+}
+
+int XattrSet::set(const char *name, const char *value, size_t size, int flags) {
+    size_t nameLen = strlen(name);
+
+    if (nameLen == 0 || nameLen > XATTR_NAME_MAX_LEN)
+        return -ERANGE;
+    if (size > XATTR_VALUE_MAX_LEN)
+        return -E2BIG;
+
+    auto it = attrs.find(name);
+    if (it != attrs.end() && (flags & XATTR_CREATE))
+        return -EEXIST;
+    if (it == attrs.end() && (flags & XATTR_REPLACE))
+        return -ENODATA;
+
+    size_t newBytes = bytes + size;
+    if (it != attrs.end())
+        newBytes -= it->second.size();
+    else
+        newBytes += sizeof(XattrRecord) + nameLen;
+    if (sizeof(XattrHeader) + newBytes > XATTR_MAX_BYTES)
+        return -ENOSPC;
+
+    if (it != attrs.end())
+        it->second.assign(value, size);
+    else
+        attrs.emplace(std::string(name, nameLen), std::string(value, size));
+    bytes = newBytes;
+
+    return 0;
+}
+
+int XattrSet::remove(const char *name) {
+    auto it = attrs.find(name);
+    if (it == attrs.end())
+        return -ENODATA;
+
+    bytes -= sizeof(XattrRecord) + it->first.size() + it->second.size();
+    attrs.erase(it);
+    return 0;
+}
+
+int XattrSet::list(char *list, size_t size) const {
+    size_t len = 0;
+
+    for (auto it = attrs.begin(); it != attrs.end(); ++it)
+        len += it->first.size() + 1;
+
+    if (size == 0)
+        return (int) len;
+    if (size < len)
+        return -ERANGE;
+
+    for (auto it = attrs.begin(); it != attrs.end(); ++it) {
+        memcpy(list, it->first.c_str(), it->first.size() + 1);
+        list += it->first.size() + 1;
+    }
+    return (int) len;
+}
+
+size_t XattrSet::storedSize() const {
+    return attrs.empty() ? 0 : sizeof(XattrHeader) + bytes;
+}
+
+void XattrSet::store(char *buf) const {
+    XattrHeader header = { XATTR_MAGIC, (uint32_t) attrs.size(), (uint32_t) bytes };
+
+    memcpy(buf, &header, sizeof(header));
+    buf += sizeof(header);
+
+    for (auto it = attrs.begin(); it != attrs.end(); ++it) {
+        XattrRecord record = { (uint32_t) it->first.size(), (uint32_t) it->second.size() };
+
+        memcpy(buf, &record, sizeof(record));
+        buf += sizeof(record);
+        memcpy(buf, it->first.data(), record.nameLen);
+        buf += record.nameLen;
+        memcpy(buf, it->second.data(), record.valueLen);
+        buf += record.valueLen;
+    }
+}
+
+int XattrSet::load(const char *buf, size_t len) {
+    XattrHeader header;
+    size_t pos = sizeof(header);
+
+    clear();
+
+    if (len < sizeof(header))
+        return -EIO;
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != XATTR_MAGIC || header.size > len - sizeof(header) ||
+        sizeof(header) + header.size > XATTR_MAX_BYTES)
+        return -EIO;
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        XattrRecord record;
+
+        if (pos + sizeof(record) > sizeof(header) + header.size)
+            break;
+        memcpy(&record, buf + pos, sizeof(record));
+        pos += sizeof(record);
+        if (record.nameLen == 0 || record.nameLen > XATTR_NAME_MAX_LEN || record.valueLen > XATTR_VALUE_MAX_LEN ||
+            pos + record.nameLen + record.valueLen > sizeof(header) + header.size)
+            break;
+
+        attrs[std::string(buf + pos, record.nameLen)] = std::string(buf + pos + record.nameLen, record.valueLen);
+        pos += record.nameLen + record.valueLen;
+    }
+
+    if (attrs.size() != header.count || pos != sizeof(header) + header.size) {
+        clear();
+        return -EIO;
+    }
+
+    bytes = header.size;
+    return 0;
+}
+
+void XattrSet::clear() {
+    attrs.clear();
+    bytes = 0;
+}
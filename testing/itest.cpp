@@ -4,14 +4,21 @@
 //
 
 #include <cstdio>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <string.h>
+#include <map>
+#include <set>
+#include <string>
 
 #include "../catch/catch.hpp"
 
 #include "tools.hpp"
+#include "myondiskfs.h"
+#include "myinmemoryfs.h"
 
 #define FILENAME "file"
 #define SMALL_SIZE 1024
@@ -489,3 +496,822 @@ TEST_CASE("T-1.10", "[Part_1]") {
     // remove file
     REQUIRE(unlink(FILENAME) >= 0);
 }
+
+TEST_CASE("T-2.01", "[.][Part_2]") {
+    printf("Testcase 2.1: Snapshot keeps the old content of a file\n");
+
+    int fd;
+
+    // remove file and snapshot (just to be sure)
+    unlink(FILENAME);
+    rmdir(".snapshots/snap");
+
+    // set up read & write buffers
+    char* r= new char[SMALL_SIZE];
+    memset(r, 0, SMALL_SIZE);
+    char* w= new char[SMALL_SIZE];
+    gen_random(w, SMALL_SIZE);
+    char* w2= new char[SMALL_SIZE];
+    gen_random(w2, SMALL_SIZE);
+
+    // Create file
+    fd = open(FILENAME, O_EXCL | O_RDWR | O_CREAT, 0666);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, w, SMALL_SIZE) == SMALL_SIZE);
+    REQUIRE(close(fd) >= 0);
+
+    // Take snapshot
+    REQUIRE(mkdir(".snapshots/snap", 0755) == 0);
+
+    // Overwrite the file
+    fd = open(FILENAME, O_RDWR);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, w2, SMALL_SIZE) == SMALL_SIZE);
+    REQUIRE(close(fd) >= 0);
+
+    // Snapshot still has the old content and is read-only
+    REQUIRE(open(".snapshots/snap/" FILENAME, O_RDWR) < 0);
+    fd = open(".snapshots/snap/" FILENAME, O_RDONLY);
+    REQUIRE(fd >= 0);
+    REQUIRE(read(fd, r, SMALL_SIZE) == SMALL_SIZE);
+    REQUIRE(memcmp(r, w, SMALL_SIZE) == 0);
+    REQUIRE(close(fd) >= 0);
+
+    // File has the new content
+    fd = open(FILENAME, O_RDONLY);
+    REQUIRE(fd >= 0);
+    REQUIRE(read(fd, r, SMALL_SIZE) == SMALL_SIZE);
+    REQUIRE(memcmp(r, w2, SMALL_SIZE) == 0);
+    REQUIRE(close(fd) >= 0);
+
+    // remove file and snapshot
+    REQUIRE(unlink(FILENAME) >= 0);
+    REQUIRE(rmdir(".snapshots/snap") == 0);
+    REQUIRE(open(".snapshots/snap/" FILENAME, O_RDONLY) < 0);
+
+    delete [] r;
+    delete [] w;
+    delete [] w2;
+}
+
+TEST_CASE("T-2.02", "[.][Part_2]") {
+    printf("Testcase 2.2: statfs reports the space used by a file\n");
+
+    int fd;
+    struct statvfs before, written, removed;
+
+    // remove file (just to be sure)
+    unlink(FILENAME);
+
+    // set up write buffer
+    char* w= new char[SMALL_SIZE];
+    gen_random(w, SMALL_SIZE);
+
+    REQUIRE(statvfs(".", &before) == 0);
+    REQUIRE(before.f_bfree <= before.f_blocks);
+    REQUIRE(before.f_ffree <= before.f_files);
+
+    // Create and write file
+    fd = open(FILENAME, O_EXCL | O_RDWR | O_CREAT, 0666);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, w, SMALL_SIZE) == SMALL_SIZE);
+    REQUIRE(close(fd) >= 0);
+
+    // One more directory entry and the blocks of the file are in use
+    REQUIRE(statvfs(".", &written) == 0);
+    REQUIRE(written.f_ffree == before.f_ffree - 1);
+    REQUIRE(written.f_bfree == before.f_bfree - (SMALL_SIZE + written.f_frsize - 1) / written.f_frsize);
+
+    // Everything is free again after removing the file
+    REQUIRE(unlink(FILENAME) >= 0);
+    REQUIRE(statvfs(".", &removed) == 0);
+    REQUIRE(removed.f_ffree == before.f_ffree);
+    REQUIRE(removed.f_bfree == before.f_bfree);
+
+    delete [] w;
+}
+
+// Entries of a directory read by list_dir()
+struct Listing {
+    std::map<std::string, struct stat> entries;
+    int pageLeft;       // number of entries that still fit into the current page
+    off_t next;         // offset of the next page
+};
+
+static int list_filler(void *buf, const char *name, const struct stat *stbuf, off_t off) {
+    Listing *listing = (Listing *) buf;
+
+    if (listing->pageLeft == 0)
+        return 1;
+    listing->pageLeft--;
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    if (stbuf != NULL)
+        st = *stbuf;
+    listing->entries[name] = st;
+    listing->next = off;
+
+    return 0;
+}
+
+// Read a directory in pages of pageSize entries, the way FUSE does with a small buffer
+static void list_dir(MyFS *fs, const char *path, int pageSize, Listing *listing) {
+    size_t count;
+
+    listing->entries.clear();
+    listing->next = 0;
+    do {
+        count = listing->entries.size();
+        listing->pageLeft = pageSize;
+        REQUIRE(fs->fuseReaddir(path, listing, list_filler, listing->next, NULL) == 0);
+    } while (listing->entries.size() > count);
+}
+
+// The file systems are run without FUSE here, see mount_fs()
+TEST_CASE("T-2.03", "[Part_2]") {
+    MyFsInfo info;
+    MyFS *fs;
+
+    init_info(&info);
+    unlink(TEST_CONTAINER);
+    unlink(TEST_COPY);
+    unlink(TEST_IMAGE);
+
+    // set up read & write buffers
+    char* r= new char[LARGE_SIZE / 10];
+    memset(r, 0, LARGE_SIZE / 10);
+    char* w= new char[LARGE_SIZE / 10];
+    gen_random(w, LARGE_SIZE / 10);
+    char* w2= new char[LARGE_SIZE / 10];
+    gen_random(w2, LARGE_SIZE / 10);
+
+    SECTION("delayed allocation") {
+        printf("Testcase 2.3.1: Delayed writes are allocated on flush and kept across a remount\n");
+
+        struct fuse_file_info fileInfo;
+        struct statvfs before, after;
+        struct stat st;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseStatfs("/", &before) == 0);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+
+        // Write the file in pieces smaller than a block, they are read back before they have blocks
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.flags = O_RDWR;
+        REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfo) == 0);
+        for (int i = 0; i < 8 * SMALL_SIZE; i += 64)
+            REQUIRE(fs->fuseWrite("/" FILENAME, w + i, 64, i, &fileInfo) == 64);
+        REQUIRE(fs->fuseGetattr("/" FILENAME, &st) == 0);
+        REQUIRE(st.st_size == 8 * SMALL_SIZE);
+        REQUIRE(fs->fuseRead("/" FILENAME, r, 8 * SMALL_SIZE, 0, &fileInfo) == 8 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 8 * SMALL_SIZE) == 0);
+
+        // Flush and close the file, it takes only the blocks its size needs
+        REQUIRE(fs->fuseFlush("/" FILENAME, &fileInfo) == 0);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfo) == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree - 8 * SMALL_SIZE / BLOCK_SIZE);
+        unmount_fs(fs);
+
+        // Reopen the file after a remount
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        memset(r, 0, 8 * SMALL_SIZE);
+        REQUIRE(read_file(fs, "/" FILENAME, r, 8 * SMALL_SIZE, 0) == 8 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 8 * SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree - 8 * SMALL_SIZE / BLOCK_SIZE);
+        unmount_fs(fs);
+    }
+
+    SECTION("read_buf and write_buf") {
+        printf("Testcase 2.3.2: read_buf splices committed data and write_buf overwrites it\n");
+
+        struct fuse_file_info fileInfo;
+        size_t fdPieces;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, 64 * SMALL_SIZE, 0) == 64 * SMALL_SIZE);
+
+        // Committed data is described by the container file, reads stop at the end of the file
+        REQUIRE(read_file_buf(fs, "/" FILENAME, r, 65 * SMALL_SIZE, 0, &fdPieces) == 64 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 64 * SMALL_SIZE) == 0);
+        REQUIRE(fdPieces > 0);
+        REQUIRE(read_file_buf(fs, "/" FILENAME, r, SMALL_SIZE, 64 * SMALL_SIZE - 100, NULL) == 100);
+        REQUIRE(memcmp(r, w + 64 * SMALL_SIZE - 100, 100) == 0);
+        REQUIRE(read_file_buf(fs, "/" FILENAME, r, SMALL_SIZE, 64 * SMALL_SIZE, NULL) == 0);
+
+        // Overwrite whole blocks and extend the file with a piece that is not aligned
+        REQUIRE(write_file_buf(fs, "/" FILENAME, w2, 4 * SMALL_SIZE, 8 * SMALL_SIZE) == 4 * SMALL_SIZE);
+        REQUIRE(write_file_buf(fs, "/" FILENAME, w2, 300, 64 * SMALL_SIZE - 100) == 300);
+        REQUIRE(read_file(fs, "/" FILENAME, r, 65 * SMALL_SIZE, 0) == 64 * SMALL_SIZE + 200);
+        REQUIRE(memcmp(r, w, 8 * SMALL_SIZE) == 0);
+        REQUIRE(memcmp(r + 8 * SMALL_SIZE, w2, 4 * SMALL_SIZE) == 0);
+        REQUIRE(memcmp(r + 12 * SMALL_SIZE, w + 12 * SMALL_SIZE, 52 * SMALL_SIZE - 100) == 0);
+        REQUIRE(memcmp(r + 64 * SMALL_SIZE - 100, w2, 300) == 0);
+
+        // Writes that are not flushed yet are part of what read_buf returns
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.flags = O_RDWR;
+        REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfo) == 0);
+        REQUIRE(fs->fuseWrite("/" FILENAME, w2, 100, 1000, &fileInfo) == 100);
+        REQUIRE(read_file_buf(fs, "/" FILENAME, r, 4 * SMALL_SIZE, 0, NULL) == 4 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 1000) == 0);
+        REQUIRE(memcmp(r + 1000, w2, 100) == 0);
+        REQUIRE(memcmp(r + 1100, w + 1100, 4 * SMALL_SIZE - 1100) == 0);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfo) == 0);
+        unmount_fs(fs);
+
+        // Everything is in the container after a remount
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(read_file_buf(fs, "/" FILENAME, r, 65 * SMALL_SIZE, 0, NULL) == 64 * SMALL_SIZE + 200);
+        REQUIRE(memcmp(r + 1000, w2, 100) == 0);
+        REQUIRE(memcmp(r + 8 * SMALL_SIZE, w2, 4 * SMALL_SIZE) == 0);
+        REQUIRE(memcmp(r + 64 * SMALL_SIZE - 100, w2, 300) == 0);
+        unmount_fs(fs);
+    }
+
+    SECTION("defragmentation") {
+        printf("Testcase 2.3.3: The defragmenter moves fragmented files into one run\n");
+
+        struct statvfs before, after;
+
+        // Files written in turns take their blocks in turns
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+        for (int i = 0; i < 300 * SMALL_SIZE; i += 3 * SMALL_SIZE) {
+            REQUIRE(write_file(fs, "/a", w + i, 3 * SMALL_SIZE, i) == 3 * SMALL_SIZE);
+            REQUIRE(write_file(fs, "/b", w2 + i, 3 * SMALL_SIZE, i) == 3 * SMALL_SIZE);
+        }
+        REQUIRE(fs->fuseStatfs("/", &before) == 0);
+        unmount_fs(fs);
+
+        // Both files are moved in the background while they are read
+        info.defrag = 1;
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        for (int i = 0; i < 200 && count_log("fragments before") < 2; i++) {
+            REQUIRE(read_file(fs, "/a", r, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+            REQUIRE(memcmp(r, w, 300 * SMALL_SIZE) == 0);
+            REQUIRE(read_file_buf(fs, "/b", r, 300 * SMALL_SIZE, 0, NULL) == 300 * SMALL_SIZE);
+            REQUIRE(memcmp(r, w2, 300 * SMALL_SIZE) == 0);
+            usleep(50000);
+        }
+
+        // The blocks moved away from are free once no reply can splice them any more
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        unmount_fs(fs);
+        REQUIRE(count_log("fragments before") == 2);
+        REQUIRE(count_log(", 1 after") == 2);
+
+        // The moved files have their content and no more blocks than before
+        info.defrag = 0;
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(read_file(fs, "/a", r, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 300 * SMALL_SIZE) == 0);
+        REQUIRE(read_file(fs, "/b", r, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w2, 300 * SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        unmount_fs(fs);
+    }
+
+    SECTION("remount") {
+        printf("Testcase 2.3.4: Remount after a clean unmount and after a crash\n");
+
+        struct statvfs before, after;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/a", w, 100 * SMALL_SIZE, 0) == 100 * SMALL_SIZE);
+        REQUIRE(fs->fuseStatfs("/", &before) == 0);
+        unmount_fs(fs);
+
+        // After a clean unmount the free blocks are taken from the container
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(count_log("was unmounted cleanly") == 1);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        REQUIRE(after.f_ffree == before.f_ffree);
+        REQUIRE(read_file(fs, "/a", r, 300 * SMALL_SIZE, 0) == 100 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 100 * SMALL_SIZE) == 0);
+
+        // Keep a copy of the container as a crash would leave it
+        REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/b", w + 5, 300 * SMALL_SIZE - 5, 0) == 300 * SMALL_SIZE - 5);
+        REQUIRE(fs->fuseUnlink("/a") == 0);
+        REQUIRE(fs->fuseStatfs("/", &before) == 0);
+        REQUIRE(copy_file(TEST_CONTAINER, TEST_COPY) == 0);
+        unmount_fs(fs);
+
+        // Without a clean unmount the free blocks are counted in the FAT
+        info.contFile = (char *) TEST_COPY;
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(count_log("was not unmounted cleanly") == 1);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        REQUIRE(after.f_ffree == before.f_ffree);
+        REQUIRE(read_file(fs, "/a", r, 300 * SMALL_SIZE, 0) == -ENOENT);
+        REQUIRE(read_file(fs, "/b", r, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE - 5);
+        REQUIRE(memcmp(r, w + 5, 300 * SMALL_SIZE - 5) == 0);
+        unmount_fs(fs);
+
+        // The next mount is a clean one again
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(count_log("was unmounted cleanly") == 1);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        unmount_fs(fs);
+    }
+
+    SECTION("deduplication") {
+        printf("Testcase 2.3.5: Duplicate files share their blocks\n");
+
+        struct statvfs before, after;
+        const int blocks = 300 * SMALL_SIZE / BLOCK_SIZE;
+
+        info.dedup = 1;
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseStatfs("/", &before) == 0);
+        REQUIRE(fs->fuseMknod("/a", S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/a", w, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(before.f_bfree - after.f_bfree == blocks);
+
+        // Copies take no blocks of their own
+        REQUIRE(fs->fuseMknod("/b", S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/b", w, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+        REQUIRE(fs->fuseMknod("/c", S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/c", w, 100 * SMALL_SIZE, 0) == 100 * SMALL_SIZE);
+        REQUIRE(write_file(fs, "/c", w + 100 * SMALL_SIZE, 200 * SMALL_SIZE, 100 * SMALL_SIZE) == 200 * SMALL_SIZE);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(before.f_bfree - after.f_bfree == blocks);
+        unmount_fs(fs);
+
+        // The blocks stay shared after a remount, a write to one copy leaves the others alone
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(before.f_bfree - after.f_bfree == blocks);
+        REQUIRE(write_file(fs, "/b", "XYZ", 3, 1000) == 3);
+        REQUIRE(read_file(fs, "/a", r, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 300 * SMALL_SIZE) == 0);
+        REQUIRE(read_file(fs, "/c", r, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 300 * SMALL_SIZE) == 0);
+        REQUIRE(read_file(fs, "/b", r, 300 * SMALL_SIZE, 0) == 300 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 1000) == 0);
+        REQUIRE(memcmp(r + 1000, "XYZ", 3) == 0);
+        REQUIRE(memcmp(r + 1003, w + 1003, 300 * SMALL_SIZE - 1003) == 0);
+
+        // Blocks are freed with their last user
+        REQUIRE(fs->fuseUnlink("/a") == 0);
+        REQUIRE(fs->fuseUnlink("/c") == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(before.f_bfree - after.f_bfree == blocks);
+        REQUIRE(fs->fuseUnlink("/b") == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        unmount_fs(fs);
+    }
+
+    SECTION("inline data") {
+        printf("Testcase 2.3.6: A small file uses no data blocks\n");
+
+        struct statvfs before, after;
+        struct stat st;
+
+        // A file of 100 bytes is kept in its directory entry
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseStatfs("/", &before) == 0);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, 100, 0) == 100);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        REQUIRE(fs->fuseGetattr("/" FILENAME, &st) == 0);
+        REQUIRE(st.st_size == 100);
+        REQUIRE(read_file(fs, "/" FILENAME, r, SMALL_SIZE, 0) == 100);
+        REQUIRE(memcmp(r, w, 100) == 0);
+
+        // So is a file that is only grown by truncate
+        REQUIRE(fs->fuseMknod("/empty", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseTruncate("/empty", 100) == 0);
+        REQUIRE(read_file(fs, "/empty", r, SMALL_SIZE, 0) == 100);
+        REQUIRE(r[0] == 0);
+        REQUIRE(r[99] == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        unmount_fs(fs);
+
+        // The content is still there after a remount
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(read_file(fs, "/" FILENAME, r, SMALL_SIZE, 0) == 100);
+        REQUIRE(memcmp(r, w, 100) == 0);
+
+        // A file that grows out of the entry takes blocks, which are freed when it is truncated to 0
+        REQUIRE(write_file(fs, "/" FILENAME, w + 100, SMALL_SIZE - 100, 100) == SMALL_SIZE - 100);
+        REQUIRE(read_file(fs, "/" FILENAME, r, SMALL_SIZE, 0) == SMALL_SIZE);
+        REQUIRE(memcmp(r, w, SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree - SMALL_SIZE / BLOCK_SIZE);
+        REQUIRE(fs->fuseTruncate("/" FILENAME, 0) == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        unmount_fs(fs);
+    }
+
+    SECTION("clone") {
+        printf("Testcase 2.3.7: Overwriting a clone leaves its source unchanged\n");
+
+        struct statvfs before, after;
+        struct stat st;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0640, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, 200 * SMALL_SIZE, 0) == 200 * SMALL_SIZE);
+        REQUIRE(fs->fuseStatfs("/", &before) == 0);
+
+        // The clone shares all blocks of its source
+        REQUIRE(fs->fuseSetxattr("/" FILENAME, CLONE_XATTR, "/clone", 6, 0) == 0);
+        REQUIRE(fs->fuseSetxattr("/" FILENAME, CLONE_XATTR, "/clone", 6, 0) == -EEXIST);
+        REQUIRE(fs->fuseSetxattr("/missing", CLONE_XATTR, "/other", 6, 0) == -ENOENT);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree);
+        REQUIRE(fs->fuseGetattr("/clone", &st) == 0);
+        REQUIRE(st.st_size == 200 * SMALL_SIZE);
+        REQUIRE((st.st_mode & 0777) == 0640);
+        REQUIRE(read_file(fs, "/clone", r, 200 * SMALL_SIZE, 0) == 200 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 200 * SMALL_SIZE) == 0);
+
+        // Overwrite the clone, the blocks up to the written ones are copied and the rest of the chain stays shared
+        REQUIRE(write_file(fs, "/clone", w2, SMALL_SIZE, 70 * SMALL_SIZE) == SMALL_SIZE);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree - 71 * SMALL_SIZE / BLOCK_SIZE);
+        REQUIRE(read_file(fs, "/" FILENAME, r, 200 * SMALL_SIZE, 0) == 200 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 200 * SMALL_SIZE) == 0);
+        REQUIRE(read_file(fs, "/clone", r, 200 * SMALL_SIZE, 0) == 200 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 70 * SMALL_SIZE) == 0);
+        REQUIRE(memcmp(r + 70 * SMALL_SIZE, w2, SMALL_SIZE) == 0);
+        REQUIRE(memcmp(r + 71 * SMALL_SIZE, w + 71 * SMALL_SIZE, 129 * SMALL_SIZE) == 0);
+        unmount_fs(fs);
+
+        // Both files keep their content after a remount and after the source is removed
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(read_file(fs, "/" FILENAME, r, 200 * SMALL_SIZE, 0) == 200 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 200 * SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseUnlink("/" FILENAME) == 0);
+        REQUIRE(read_file(fs, "/clone", r, 200 * SMALL_SIZE, 0) == 200 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 70 * SMALL_SIZE) == 0);
+        REQUIRE(memcmp(r + 70 * SMALL_SIZE, w2, SMALL_SIZE) == 0);
+        REQUIRE(memcmp(r + 71 * SMALL_SIZE, w + 71 * SMALL_SIZE, 129 * SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseUnlink("/clone") == 0);
+        REQUIRE(fs->fuseStatfs("/", &after) == 0);
+        REQUIRE(after.f_bfree == before.f_bfree + 200 * SMALL_SIZE / BLOCK_SIZE);
+        unmount_fs(fs);
+    }
+
+    SECTION("readdir on disk") {
+        printf("Testcase 2.3.8: readdir returns attributes and stable inode numbers on disk\n");
+
+        Listing listing;
+        struct stat st;
+        char path[32];
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMkdir("/d", 0750) == 0);
+        REQUIRE(fs->fuseMkdir("/d/sub", 0755) == 0);
+        for (int i = 0; i < 40; i++) {
+            snprintf(path, sizeof(path), "/d/f%d", i);
+            REQUIRE(fs->fuseMknod(path, S_IFREG | 0640, 0) == 0);
+            REQUIRE(write_file(fs, path, w, i * 100, 0) == i * 100);
+        }
+
+        // Every page continues where the last one stopped, the attributes are those of getattr
+        list_dir(fs, "/d", 7, &listing);
+        REQUIRE(listing.entries.size() == 43);
+        std::set<ino_t> inodes;
+        for (auto &entry : listing.entries) {
+            if (entry.first == "..")
+                continue;
+            std::string name = (entry.first == ".") ? "/d" : "/d/" + entry.first;
+            REQUIRE(fs->fuseGetattr(name.c_str(), &st) == 0);
+            REQUIRE(entry.second.st_ino == st.st_ino);
+            REQUIRE(entry.second.st_mode == st.st_mode);
+            REQUIRE(entry.second.st_size == st.st_size);
+            REQUIRE(entry.second.st_nlink == st.st_nlink);
+            REQUIRE(st.st_ino != 0);
+            REQUIRE(inodes.insert(st.st_ino).second);
+        }
+        REQUIRE(listing.entries["f39"].st_size == 3900);
+        REQUIRE(S_ISDIR(listing.entries["sub"].st_mode));
+        REQUIRE(listing.entries["."].st_nlink == 3);
+
+        // Inode numbers stay the same across a remount
+        REQUIRE(fs->fuseGetattr("/d/f3", &st) == 0);
+        unmount_fs(fs);
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        list_dir(fs, "/d", 50, &listing);
+        REQUIRE(listing.entries.size() == 43);
+        REQUIRE(listing.entries["f3"].st_ino == st.st_ino);
+        unmount_fs(fs);
+    }
+
+    SECTION("readdir in memory") {
+        printf("Testcase 2.3.9: readdir returns attributes and unique inode numbers in memory\n");
+
+        Listing listing;
+        struct stat st;
+        char path[32];
+
+        fs = mount_fs(new MyInMemoryFS(), &info);
+        for (int i = 0; i < 20; i++) {
+            snprintf(path, sizeof(path), "/f%d", i);
+            REQUIRE(fs->fuseMknod(path, S_IFREG | 0640, 0) == 0);
+            REQUIRE(write_file(fs, path, w, i * 100, 0) == i * 100);
+        }
+
+        list_dir(fs, "/", 3, &listing);
+        REQUIRE(listing.entries.size() == 22);
+        std::set<ino_t> inodes;
+        for (auto &entry : listing.entries) {
+            if (entry.first == "." || entry.first == "..")
+                continue;
+            REQUIRE(fs->fuseGetattr(("/" + entry.first).c_str(), &st) == 0);
+            REQUIRE(entry.second.st_ino == st.st_ino);
+            REQUIRE(entry.second.st_mode == st.st_mode);
+            REQUIRE(entry.second.st_size == st.st_size);
+            REQUIRE(st.st_ino != 0);
+            REQUIRE(inodes.insert(st.st_ino).second);
+        }
+        REQUIRE(listing.entries["f19"].st_size == 1900);
+        unmount_fs(fs);
+    }
+
+    SECTION("image") {
+        printf("Testcase 2.3.10: The in-memory file system is saved to its image and restored from it\n");
+
+        struct stat before, st;
+        char value[16];
+
+        info.imageFile = (char *) TEST_IMAGE;
+        fs = mount_fs(new MyInMemoryFS(), &info);
+        REQUIRE(fs->fuseMkdir("/d", 0700) == 0);
+        REQUIRE(fs->fuseMknod("/d/" FILENAME, S_IFREG | 0600, 0) == 0);
+        REQUIRE(write_file(fs, "/d/" FILENAME, w, LARGE_SIZE / 10, 0) == LARGE_SIZE / 10);
+        REQUIRE(fs->fuseSetxattr("/d/" FILENAME, "user.key", "value", 5, 0) == 0);
+        REQUIRE(fs->fuseMknod("/empty", S_IFREG | 0644, 0) == 0);
+        REQUIRE(fs->fuseGetattr("/d/" FILENAME, &before) == 0);
+        unmount_fs(fs);
+
+        // Everything is back after the next mount
+        fs = mount_fs(new MyInMemoryFS(), &info);
+        REQUIRE(fs->fuseGetattr("/d/" FILENAME, &st) == 0);
+        REQUIRE(st.st_size == LARGE_SIZE / 10);
+        REQUIRE(st.st_mode == before.st_mode);
+        REQUIRE(st.st_mtime == before.st_mtime);
+        REQUIRE(st.st_ino == before.st_ino);
+        REQUIRE(read_file(fs, "/d/" FILENAME, r, LARGE_SIZE / 10, 0) == LARGE_SIZE / 10);
+        REQUIRE(memcmp(r, w, LARGE_SIZE / 10) == 0);
+        REQUIRE(fs->fuseGetxattr("/d/" FILENAME, "user.key", value, sizeof(value)) == 5);
+        REQUIRE(memcmp(value, "value", 5) == 0);
+        REQUIRE(fs->fuseGetattr("/empty", &st) == 0);
+        REQUIRE(st.st_size == 0);
+        REQUIRE(fs->fuseRmdir("/d") == -ENOTEMPTY);
+
+        // The image can be saved while the file system is in use, the copy that reads it is deleted without saving
+        REQUIRE(write_file(fs, "/empty", "abc", 3, 0) == 3);
+        REQUIRE(fs->fuseSetxattr("/", SAVE_XATTR, "", 0, 0) == 0);
+        MyFS *other = mount_fs(new MyInMemoryFS(), &info);
+        REQUIRE(read_file(other, "/empty", r, SMALL_SIZE, 0) == 3);
+        REQUIRE(memcmp(r, "abc", 3) == 0);
+        delete other;
+        unmount_fs(fs);
+
+        // A damaged image is neither restored nor overwritten
+        REQUIRE(stat(TEST_IMAGE, &before) == 0);
+        int fd = open(TEST_IMAGE, O_RDWR);
+        REQUIRE(fd >= 0);
+        REQUIRE(pwrite(fd, "X", 1, SMALL_SIZE) == 1);
+        REQUIRE(close(fd) >= 0);
+        fs = mount_fs(new MyInMemoryFS(), &info);
+        REQUIRE(fs->fuseGetattr("/d/" FILENAME, &st) == -ENOENT);
+        REQUIRE(fs->fuseSetxattr("/", SAVE_XATTR, "", 0, 0) == -ENOTSUP);
+        unmount_fs(fs);
+        REQUIRE(stat(TEST_IMAGE, &st) == 0);
+        REQUIRE(st.st_size == before.st_size);
+    }
+
+    SECTION("open files") {
+        printf("Testcase 2.3.11: File handles follow their file through reads, renames and removal\n");
+
+        struct fuse_file_info fileInfos[20];
+        struct fuse_file_info fileInfo;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, 500 * SMALL_SIZE, 0) == 500 * SMALL_SIZE);
+
+        // Every open file gets a handle of its own, released handles are reused
+        for (int i = 0; i < 20; i++) {
+            memset(&fileInfos[i], 0, sizeof(fileInfos[i]));
+            REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfos[i]) == 0);
+            for (int j = 0; j < i; j++)
+                REQUIRE(fileInfos[i].fh != fileInfos[j].fh);
+        }
+        uint64_t released = fileInfos[5].fh;
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfos[5]) == 0);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfos[5]) == 0);
+        REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfos[5]) == 0);
+        REQUIRE(fileInfos[5].fh == released);
+
+        // Sequential reads, reads behind them and reads on other handles see the right blocks
+        for (int off = 0; off < 490 * SMALL_SIZE; off += 7 * SMALL_SIZE + 100) {
+            REQUIRE(fs->fuseRead("/" FILENAME, r, 5 * SMALL_SIZE, off, &fileInfos[0]) == 5 * SMALL_SIZE);
+            REQUIRE(memcmp(r, w + off, 5 * SMALL_SIZE) == 0);
+            REQUIRE(fs->fuseRead("/" FILENAME, r, SMALL_SIZE, off / 2, &fileInfos[0]) == SMALL_SIZE);
+            REQUIRE(memcmp(r, w + off / 2, SMALL_SIZE) == 0);
+            REQUIRE(fs->fuseRead("/" FILENAME, r, SMALL_SIZE, off / 3, &fileInfos[1]) == SMALL_SIZE);
+            REQUIRE(memcmp(r, w + off / 3, SMALL_SIZE) == 0);
+        }
+
+        // A handle reads the new blocks of its file after a truncate
+        REQUIRE(fs->fuseTruncate("/" FILENAME, 200 * SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseRead("/" FILENAME, r, 8 * SMALL_SIZE, 198 * SMALL_SIZE, &fileInfos[0]) == 2 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w + 198 * SMALL_SIZE, 2 * SMALL_SIZE) == 0);
+
+        // Handles stay with their file across a rename and go stale when it is removed
+        REQUIRE(fs->fuseRename("/" FILENAME, "/renamed") == 0);
+        REQUIRE(fs->fuseWrite("/" FILENAME, "XYZ", 3, 0, &fileInfos[2]) == 3);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfos[2]) == 0);
+        REQUIRE(read_file(fs, "/renamed", r, 3, 0) == 3);
+        REQUIRE(memcmp(r, "XYZ", 3) == 0);
+        REQUIRE(fs->fuseUnlink("/renamed") == 0);
+        REQUIRE(fs->fuseRead("/renamed", r, SMALL_SIZE, 0, &fileInfos[3]) == -ENOENT);
+
+        // Stale handles are kept until they are released, a new file gets a handle of its own
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, SMALL_SIZE, 0) == SMALL_SIZE);
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfo) == 0);
+        for (int i = 0; i < 20; i++) {
+            if (i != 2)
+                REQUIRE(fileInfo.fh != fileInfos[i].fh);
+        }
+        REQUIRE(fs->fuseRead("/" FILENAME, r, SMALL_SIZE, 0, &fileInfo) == SMALL_SIZE);
+        REQUIRE(memcmp(r, w, SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfo) == 0);
+        for (int i = 0; i < 20; i++) {
+            if (i != 2)
+                REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfos[i]) == 0);
+        }
+        unmount_fs(fs);
+    }
+
+    SECTION("full container") {
+        printf("Testcase 2.3.12: Copy-on-write in a full container fails with ENOSPC\n");
+
+        struct fuse_file_info fileInfo;
+        struct statvfs st;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, 100 * SMALL_SIZE, 0) == 100 * SMALL_SIZE);
+        REQUIRE(fs->fuseSetxattr("/" FILENAME, "user.a", w2, SMALL_SIZE, 0) == 0);
+        REQUIRE(fs->fuseMkdir(SNAPSHOT_DIR "/snap", 0755) == 0);
+
+        // Fill the container
+        REQUIRE(fs->fuseStatfs("/", &st) == 0);
+        size_t left = st.f_bfree * BLOCK_SIZE;
+        REQUIRE(fs->fuseMknod("/fill", S_IFREG | 0644, 0) == 0);
+        for (size_t off = 0; off < left; off += LARGE_SIZE / 10) {
+            size_t size = (left - off < LARGE_SIZE / 10) ? left - off : LARGE_SIZE / 10;
+            REQUIRE(write_file(fs, "/fill", w, size, off) == (int) size);
+        }
+        REQUIRE(fs->fuseStatfs("/", &st) == 0);
+        REQUIRE(st.f_bfree == 0);
+
+        // Every change to the file needs copies of the blocks it shares with the snapshot
+        REQUIRE(fs->fuseSetxattr("/" FILENAME, "user.b", "value", 5, 0) == -ENOSPC);
+        REQUIRE(fs->fuseTruncate("/" FILENAME, 200 * SMALL_SIZE) == -ENOSPC);
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.flags = O_RDWR;
+        REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfo) == 0);
+        REQUIRE(fs->fuseWrite("/" FILENAME, w2, SMALL_SIZE, 0, &fileInfo) == SMALL_SIZE);
+        REQUIRE(fs->fuseFlush("/" FILENAME, &fileInfo) == -ENOSPC);
+        fs->fuseRelease("/" FILENAME, &fileInfo);
+
+        // The snapshot keeps its content, the file can be changed again once there is space
+        REQUIRE(read_file(fs, SNAPSHOT_DIR "/snap/" FILENAME, r, 100 * SMALL_SIZE, 0) == 100 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w, 100 * SMALL_SIZE) == 0);
+        REQUIRE(fs->fuseUnlink("/fill") == 0);
+        REQUIRE(fs->fuseSetxattr("/" FILENAME, "user.b", "value", 5, 0) == 0);
+        REQUIRE(fs->fuseTruncate("/" FILENAME, 200 * SMALL_SIZE) == 0);
+        unmount_fs(fs);
+    }
+
+    SECTION("block buffer") {
+        printf("Testcase 2.3.13: Small reads and writes within a block are served from the file handle\n");
+
+        struct fuse_file_info fileInfo;
+        struct fuse_file_info other;
+        struct stat st;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, 20 * SMALL_SIZE, 0) == 20 * SMALL_SIZE);
+        unmount_fs(fs);
+
+        // Nothing is cached after a remount, only the first small read of a block goes to the device
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.flags = O_RDWR;
+        REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfo) == 0);
+        long reads = count_reads();
+        REQUIRE(reads >= 0);
+        REQUIRE(fs->fuseRead("/" FILENAME, r, 100, 3 * BLOCK_SIZE, &fileInfo) == 100);
+        REQUIRE(count_reads() > reads);
+        reads = count_reads();
+        REQUIRE(fs->fuseRead("/" FILENAME, r + 100, 100, 3 * BLOCK_SIZE + 100, &fileInfo) == 100);
+        REQUIRE(count_reads() == reads);
+        REQUIRE(memcmp(r, w + 3 * BLOCK_SIZE, 200) == 0);
+
+        // Small writes stay in the block of the handle, other handles see them nevertheless
+        memset(&other, 0, sizeof(other));
+        other.flags = O_RDONLY;
+        REQUIRE(fs->fuseOpen("/" FILENAME, &other) == 0);
+        REQUIRE(fs->fuseRead("/" FILENAME, r, 100, 3 * BLOCK_SIZE, &other) == 100);
+        reads = count_reads();
+        REQUIRE(fs->fuseWrite("/" FILENAME, "XYZ", 3, 3 * BLOCK_SIZE + 10, &fileInfo) == 3);
+        REQUIRE(fs->fuseWrite("/" FILENAME, "ABC", 3, 3 * BLOCK_SIZE + 20, &fileInfo) == 3);
+        REQUIRE(count_reads() == reads);
+        REQUIRE(fs->fuseRead("/" FILENAME, r, 30, 3 * BLOCK_SIZE, &other) == 30);
+        REQUIRE(memcmp(r, w + 3 * BLOCK_SIZE, 10) == 0);
+        REQUIRE(memcmp(r + 10, "XYZ", 3) == 0);
+        REQUIRE(memcmp(r + 20, "ABC", 3) == 0);
+
+        // A small write behind the end of the file grows it right away
+        REQUIRE(fs->fuseWrite("/" FILENAME, "END", 3, 20 * SMALL_SIZE, &fileInfo) == 3);
+        REQUIRE(fs->fuseGetattr("/" FILENAME, &st) == 0);
+        REQUIRE(st.st_size == 20 * SMALL_SIZE + 3);
+
+        // The dirty block is written back on release
+        REQUIRE(fs->fuseWrite("/" FILENAME, "Q", 1, 0, &fileInfo) == 1);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfo) == 0);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &other) == 0);
+        unmount_fs(fs);
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(read_file(fs, "/" FILENAME, r, 21 * SMALL_SIZE, 0) == 20 * SMALL_SIZE + 3);
+        REQUIRE(r[0] == 'Q');
+        REQUIRE(memcmp(r + 1, w + 1, 3 * BLOCK_SIZE + 9) == 0);
+        REQUIRE(memcmp(r + 3 * BLOCK_SIZE + 10, "XYZ", 3) == 0);
+        REQUIRE(memcmp(r + 3 * BLOCK_SIZE + 20, "ABC", 3) == 0);
+        REQUIRE(memcmp(r + 20 * SMALL_SIZE, "END", 3) == 0);
+        unmount_fs(fs);
+    }
+
+    SECTION("allocations") {
+        printf("Testcase 2.3.14: Reads and writes of several blocks do not allocate memory\n");
+
+        struct fuse_file_info fileInfo;
+
+        fs = mount_fs(new MyOnDiskFS(), &info);
+        REQUIRE(fs->fuseMknod("/" FILENAME, S_IFREG | 0644, 0) == 0);
+        REQUIRE(write_file(fs, "/" FILENAME, w, 20 * SMALL_SIZE, 0) == 20 * SMALL_SIZE);
+
+        // The first requests set up the buffers that are kept for later ones
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.flags = O_RDWR;
+        REQUIRE(fs->fuseOpen("/" FILENAME, &fileInfo) == 0);
+        REQUIRE(fs->fuseRead("/" FILENAME, r, 8 * BLOCK_SIZE, 0, &fileInfo) == 8 * BLOCK_SIZE);
+        REQUIRE(fs->fuseWrite("/" FILENAME, w2, 8 * BLOCK_SIZE, 0, &fileInfo) == 8 * BLOCK_SIZE);
+        REQUIRE(fs->fuseFlush("/" FILENAME, &fileInfo) == 0);
+
+        long allocations = count_allocations();
+        int read = fs->fuseRead("/" FILENAME, r, 8 * BLOCK_SIZE, 8 * BLOCK_SIZE, &fileInfo);
+        int written = fs->fuseWrite("/" FILENAME, w2, 8 * BLOCK_SIZE, 16 * BLOCK_SIZE, &fileInfo);
+        if (allocations < 0)
+            WARN("allocations cannot be counted in this build");
+        else
+            REQUIRE(count_allocations() == allocations);
+        REQUIRE(read == 8 * BLOCK_SIZE);
+        REQUIRE(written == 8 * BLOCK_SIZE);
+
+        REQUIRE(memcmp(r, w + 8 * BLOCK_SIZE, 8 * BLOCK_SIZE) == 0);
+        REQUIRE(fs->fuseRelease("/" FILENAME, &fileInfo) == 0);
+        REQUIRE(read_file(fs, "/" FILENAME, r, 20 * SMALL_SIZE, 0) == 20 * SMALL_SIZE);
+        REQUIRE(memcmp(r, w2, 8 * BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(r + 8 * BLOCK_SIZE, w + 8 * BLOCK_SIZE, 8 * BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(r + 16 * BLOCK_SIZE, w2, 8 * BLOCK_SIZE) == 0);
+        unmount_fs(fs);
+    }
+
+    unlink(TEST_CONTAINER);
+    unlink(TEST_COPY);
+    unlink(TEST_IMAGE);
+
+    delete [] r;
+    delete [] w;
+    delete [] w2;
+}
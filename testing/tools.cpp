@@ -3,8 +3,12 @@
 //  Copyright © 2017-2020 Oliver Waldhorst. All rights reserved.
 //
 
+#include <cstdio>
 #include <cstdlib>
+#include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "../catch/catch.hpp"
 
@@ -21,4 +25,245 @@ void gen_random(char *s, const int len) {
     }
 }
 
-// TODO: Implement you helper functions here
+// Mount options for TEST_CONTAINER and TEST_LOGFILE, all features off
+void init_info(MyFsInfo *info) {
+    memset(info, 0, sizeof(MyFsInfo));
+    info->contFile = (char *) TEST_CONTAINER;
+    info->logFile = (char *) TEST_LOGFILE;
+}
+
+// Mount a file system without FUSE, the options must stay valid until it is unmounted
+MyFS *mount_fs(MyFS *fs, MyFsInfo *info) {
+    struct fuse_conn_info conn;
+
+    memset(&conn, 0, sizeof(conn));
+    fs->setInfo(info);
+    fs->fuseInit(&conn);
+
+    return fs;
+}
+
+// Unmount and delete a file system mounted with mount_fs()
+void unmount_fs(MyFS *fs) {
+    fs->fuseDestroy();
+    delete fs;
+}
+
+// Write to a file through its own file handle
+int write_file(MyFS *fs, const char *path, const char *buf, size_t size, off_t offset) {
+    struct fuse_file_info fileInfo;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_RDWR;
+    int ret = fs->fuseOpen(path, &fileInfo);
+    if (ret < 0)
+        return ret;
+
+    ret = fs->fuseWrite(path, buf, size, offset, &fileInfo);
+    fs->fuseRelease(path, &fileInfo);
+
+    return ret;
+}
+
+// Read from a file through its own file handle
+int read_file(MyFS *fs, const char *path, char *buf, size_t size, off_t offset) {
+    struct fuse_file_info fileInfo;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_RDONLY;
+    int ret = fs->fuseOpen(path, &fileInfo);
+    if (ret < 0)
+        return ret;
+
+    ret = fs->fuseRead(path, buf, size, offset, &fileInfo);
+    fs->fuseRelease(path, &fileInfo);
+
+    return ret;
+}
+
+// Write to a file with fuseWriteBuf() through its own file handle
+int write_file_buf(MyFS *fs, const char *path, const char *buf, size_t size, off_t offset) {
+    struct fuse_file_info fileInfo;
+    struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_RDWR;
+    int ret = fs->fuseOpen(path, &fileInfo);
+    if (ret < 0)
+        return ret;
+
+    src.buf[0].mem = (void *) buf;
+    ret = fs->fuseWriteBuf(path, &src, offset, &fileInfo);
+    fs->fuseRelease(path, &fileInfo);
+
+    return ret;
+}
+
+// Read from a file with fuseReadBuf() through its own file handle
+// The pieces are copied to buf the way FUSE copies them to the kernel. fdPieces is set to the number of pieces that
+// refer to the container file instead of memory, if it is not NULL.
+int read_file_buf(MyFS *fs, const char *path, char *buf, size_t size, off_t offset, size_t *fdPieces) {
+    struct fuse_file_info fileInfo;
+    struct fuse_bufvec *bufv = NULL;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.flags = O_RDONLY;
+    int ret = fs->fuseOpen(path, &fileInfo);
+    if (ret < 0)
+        return ret;
+
+    ret = fs->fuseReadBuf(path, &bufv, size, offset, &fileInfo);
+    fs->fuseRelease(path, &fileInfo);
+    if (ret < 0)
+        return ret;
+
+    size_t len = fuse_buf_size(bufv);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(len);
+    dst.buf[0].mem = buf;
+    ret = (int) fuse_buf_copy(&dst, bufv, (enum fuse_buf_copy_flags) 0);
+
+    if (fdPieces != NULL)
+        *fdPieces = 0;
+    for (size_t i = 0; i < bufv->count; i++) {
+        if (bufv->buf[i].flags & FUSE_BUF_IS_FD) {
+            if (fdPieces != NULL)
+                (*fdPieces)++;
+        } else {
+            free(bufv->buf[i].mem);
+        }
+    }
+    free(bufv);
+
+    return ret;
+}
+
+// Number of lines of TEST_LOGFILE containing a text
+int count_log(const char *text) {
+    char line[1024];
+    int count = 0;
+
+    FILE *f = fopen(TEST_LOGFILE, "r");
+    if (f == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strstr(line, text) != NULL)
+            count++;
+    }
+    fclose(f);
+
+    return count;
+}
+
+// Number of read system calls of the calling thread, e.g. reads of the container, without the ones made here
+// \return number of reads so far, -1 if it cannot be found out.
+long count_reads(void) {
+    static long own = 0;
+    char text[1024];
+
+    int fd = open("/proc/thread-self/io", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t len = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+
+    text[len] = '\0';
+    char *count = strstr(text, "syscr:");
+    if (count == NULL)
+        return -1;
+
+    return strtol(count + strlen("syscr:"), NULL, 10) - own++;
+}
+
+// The test binaries replace the allocator functions of glibc to count the calls, but not under the address sanitizer,
+// which replaces them itself.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCATIONS
+#endif
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#undef COUNT_ALLOCATIONS
+#endif
+#endif
+
+#ifdef COUNT_ALLOCATIONS
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+// calls of the calling thread, so other threads do not disturb a test
+static __thread long allocations = 0;
+
+extern "C" void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+    allocations++;
+    return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    allocations++;
+    *ptr = __libc_memalign(alignment, size);
+    return (*ptr == NULL) ? ENOMEM : 0;
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+    allocations++;
+    return __libc_memalign(alignment, size);
+}
+#endif
+
+// Number of calls of malloc() and its relatives by the calling thread, operator new included
+// \return number of calls so far, -1 if they cannot be counted.
+long count_allocations(void) {
+#ifdef COUNT_ALLOCATIONS
+    return allocations;
+#else
+    return -1;
+#endif
+}
+
+// Copy a file, e.g. a container while it is mounted, to get the state a crash would leave behind
+// \return 0 on success, -1 on failure.
+int copy_file(const char *from, const char *to) {
+    char buf[65536];
+    ssize_t len = 0;
+    int ret = 0;
+
+    int in = open(from, O_RDONLY);
+    if (in < 0)
+        return -1;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+
+    while ((len = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, len) != len) {
+            ret = -1;
+            break;
+        }
+    }
+    if (len < 0)
+        ret = -1;
+
+    close(in);
+    close(out);
+
+    return ret;
+}
@@ -10,7 +10,27 @@
 #define helper_hpp
 
 #include "blockdevice.h"
+#include "myfs.h"
+#include "myfs-info.h"
+
+// files of the file systems the tests run without FUSE
+#define TEST_CONTAINER "/tmp/myfs-test.bin"
+#define TEST_LOGFILE "/tmp/myfs-test.log"
+#define TEST_IMAGE "/tmp/myfs-test.img"
+#define TEST_COPY "/tmp/myfs-test-copy.bin"
 
 void gen_random(char *s, const int len);
 
+void init_info(MyFsInfo *info);
+MyFS *mount_fs(MyFS *fs, MyFsInfo *info);
+void unmount_fs(MyFS *fs);
+int write_file(MyFS *fs, const char *path, const char *buf, size_t size, off_t offset);
+int read_file(MyFS *fs, const char *path, char *buf, size_t size, off_t offset);
+int write_file_buf(MyFS *fs, const char *path, const char *buf, size_t size, off_t offset);
+int read_file_buf(MyFS *fs, const char *path, char *buf, size_t size, off_t offset, size_t *fdPieces);
+int count_log(const char *text);
+long count_reads(void);
+long count_allocations(void);
+int copy_file(const char *from, const char *to);
+
 #endif /* helper_hpp */
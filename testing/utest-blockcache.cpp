@@ -0,0 +1,110 @@
+//
+//  utest-blockcache.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+
+#include "tools.hpp"
+
+#include "blockdevice.h"
+#include "blockcache.h"
+
+#define BC_PATH "/tmp/bc.bin"
+#define NUM_TESTBLOCKS 64
+#define BLOCK_SIZE 512
+
+TEST_CASE( "BC_READ_WRITE", "[blockcache]" ) {
+
+    remove(BC_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BC_PATH) == 0);
+
+    BlockCache bc(&bd, BLOCK_SIZE, NUM_TESTBLOCKS / 2);
+
+    char* w= new char[BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BLOCK_SIZE];
+
+    for(int b= 0; b < NUM_TESTBLOCKS; b++) {
+        REQUIRE(bd.write(b, w + b*BLOCK_SIZE) == 0);
+    }
+
+    SECTION("repeated reads are served from the cache") {
+        REQUIRE(bc.read(3, r) == 0);
+        REQUIRE(memcmp(r, w + 3*BLOCK_SIZE, BLOCK_SIZE) == 0);
+        REQUIRE(bc.misses == 1);
+        REQUIRE(bc.read(3, r) == 0);
+        REQUIRE(memcmp(r, w + 3*BLOCK_SIZE, BLOCK_SIZE) == 0);
+        REQUIRE(bc.hits == 1);
+    }
+
+    SECTION("writes go through to the device") {
+        REQUIRE(bc.read(5, r) == 0);
+        REQUIRE(bc.write(5, w) == 0);
+        REQUIRE(bc.read(5, r) == 0);
+        REQUIRE(memcmp(r, w, BLOCK_SIZE) == 0);
+        REQUIRE(bd.read(5, r) == 0);
+        REQUIRE(memcmp(r, w, BLOCK_SIZE) == 0);
+    }
+
+    SECTION("loaded blocks are cached, least recently used ones are dropped") {
+        REQUIRE(bc.load(0, NUM_TESTBLOCKS / 2) == 0);
+        for(int b= 0; b < NUM_TESTBLOCKS / 2; b++) {
+            REQUIRE(bc.contains(b));
+        }
+        REQUIRE(bc.read(NUM_TESTBLOCKS / 2, r) == 0);
+        REQUIRE(!bc.contains(0));
+        REQUIRE(bc.contains(NUM_TESTBLOCKS / 2));
+        REQUIRE(bc.read(1, r) == 0);
+        REQUIRE(memcmp(r, w + BLOCK_SIZE, BLOCK_SIZE) == 0);
+        REQUIRE(bc.misses == 1);
+    }
+
+    SECTION("checksummed blocks are verified when read from the device") {
+        uint32_t table[NUM_TESTBLOCKS / 2];
+        memset(table, 0, sizeof(table));
+        bc.setChecksums(NUM_TESTBLOCKS / 2, NUM_TESTBLOCKS / 2, table);
+
+        REQUIRE(bc.writeBlocks(NUM_TESTBLOCKS / 2, 2, w) == 0);
+        REQUIRE(bc.write(NUM_TESTBLOCKS - 1, w) == 0);
+        std::vector<uint32_t> dirty;
+        bc.dirtyChecksums(dirty);
+        REQUIRE(dirty.size() == 1);
+        REQUIRE(dirty[0] == 0);
+        bc.dirtyChecksums(dirty);
+        REQUIRE(dirty.empty());
+
+        // blocks outside of the range are not checked
+        bc.clear();
+        REQUIRE(bc.read(0, r) == 0);
+
+        REQUIRE(bc.read(NUM_TESTBLOCKS / 2, r) == 0);
+        REQUIRE(memcmp(r, w, BLOCK_SIZE) == 0);
+        REQUIRE(bc.load(NUM_TESTBLOCKS / 2 + 1, 1) == 0);
+
+        // corrupt a block behind the back of the cache
+        bc.clear();
+        memcpy(r, w, BLOCK_SIZE);
+        r[17] ^= 1;
+        REQUIRE(bd.write(NUM_TESTBLOCKS / 2 + 1, r) == 0);
+        REQUIRE(bc.read(NUM_TESTBLOCKS / 2 + 1, r) == -EIO);
+        REQUIRE(!bc.contains(NUM_TESTBLOCKS / 2 + 1));
+        REQUIRE(bc.load(NUM_TESTBLOCKS / 2, 2) == -EIO);
+        REQUIRE(bc.contains(NUM_TESTBLOCKS / 2));
+        REQUIRE(!bc.contains(NUM_TESTBLOCKS / 2 + 1));
+        REQUIRE(bc.checksumErrors == 2);
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BC_PATH);
+
+    delete [] r;
+    delete [] w;
+}
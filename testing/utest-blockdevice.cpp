@@ -82,6 +82,148 @@ TEST_CASE( "BD_OPEN_NON-EXISTING_FILE", "[blockdevice]" ) {
     REQUIRE(bd.open(BD_PATH) < 0);
 }
 
+TEST_CASE( "BD_READ_MULTIPLE_BLOCKS", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * (NUM_TESTBLOCKS + 2)];
+
+    for(int b= 0; b < NUM_TESTBLOCKS; b++) {
+        REQUIRE(bd.write(b, w + b*BD_BLOCK_SIZE) == 0);
+    }
+
+    SECTION("read all blocks at once") {
+        REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+    }
+
+    SECTION("read beyond the end of the container") {
+        memset(r, 1, BD_BLOCK_SIZE * (NUM_TESTBLOCKS + 2));
+        REQUIRE(bd.readBlocks(NUM_TESTBLOCKS - 2, 4, r) == 0);
+        REQUIRE(memcmp(w + (NUM_TESTBLOCKS - 2)*BD_BLOCK_SIZE, r, 2*BD_BLOCK_SIZE) == 0);
+        for(int i= 2*BD_BLOCK_SIZE; i < 4*BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_BATCH", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    // more runs than requests can be in flight at the same time
+    const int numRuns= NUM_TESTBLOCKS / 8;
+    BlockRequest runs[numRuns];
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+
+    // runs are not in block order
+    for(int i= 0; i < numRuns; i++) {
+        int run= (i * 37) % numRuns;
+        runs[i].blockNo= run * 8;
+        runs[i].count= 8;
+        runs[i].buffer= w + run * 8 * BD_BLOCK_SIZE;
+    }
+    REQUIRE(bd.writeBatch(runs, numRuns) == 0);
+
+    SECTION("read batch") {
+        for(int i= 0; i < numRuns; i++)
+            runs[i].buffer= r + runs[i].blockNo * BD_BLOCK_SIZE;
+        REQUIRE(bd.readBatch(runs, numRuns) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+    }
+
+    SECTION("read batch beyond the end of the container") {
+        memset(r, 1, BD_BLOCK_SIZE * 8);
+        runs[0].blockNo= NUM_TESTBLOCKS - 2;
+        runs[0].count= 4;
+        runs[0].buffer= r;
+        runs[1].blockNo= 0;
+        runs[1].count= 4;
+        runs[1].buffer= r + 4*BD_BLOCK_SIZE;
+        REQUIRE(bd.readBatch(runs, 2) == 0);
+        REQUIRE(memcmp(w + (NUM_TESTBLOCKS - 2)*BD_BLOCK_SIZE, r, 2*BD_BLOCK_SIZE) == 0);
+        for(int i= 2*BD_BLOCK_SIZE; i < 4*BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+        REQUIRE(memcmp(w, r + 4*BD_BLOCK_SIZE, 4*BD_BLOCK_SIZE) == 0);
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_DIRECT_IO", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    bd.setDirectIO(true);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+
+    // single blocks and runs that do not start or end at an aligned block
+    for(int b= 0; b < 16; b++) {
+        REQUIRE(bd.write(b, w + b*BD_BLOCK_SIZE) == 0);
+    }
+    REQUIRE(bd.writeBlocks(16, 3, w + 16*BD_BLOCK_SIZE) == 0);
+    REQUIRE(bd.writeBlocks(19, NUM_TESTBLOCKS - 21, w + 19*BD_BLOCK_SIZE) == 0);
+    REQUIRE(bd.writeBlocks(NUM_TESTBLOCKS - 2, 2, w + (NUM_TESTBLOCKS - 2)*BD_BLOCK_SIZE) == 0);
+
+    SECTION("read unaligned") {
+        for(int b= 0; b < 16; b++) {
+            REQUIRE(bd.read(b, r + b*BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(bd.readBlocks(16, NUM_TESTBLOCKS - 16, r + 16*BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+    }
+
+    SECTION("read through the page cache") {
+        BlockDevice bd2(BLOCK_SIZE);
+        REQUIRE(bd2.open(BD_PATH) == 0);
+        REQUIRE(bd2.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        REQUIRE(bd2.close() == 0);
+    }
+
+    SECTION("pool buffers are aligned") {
+        char *buf= bd.allocBuffer();
+        REQUIRE(buf != NULL);
+        REQUIRE((uintptr_t) buf % BD_DIRECT_ALIGN == 0);
+        bd.releaseBuffer(buf);
+        REQUIRE(bd.allocBuffer() == buf);
+        bd.releaseBuffer(buf);
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+
+    delete [] r;
+    delete [] w;
+}
+
 // ***
 // *** Helper functions
 // ***
@@ -0,0 +1,64 @@
+//
+//  utest-blockslab.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <string.h>
+#include <set>
+
+#include "blockslab.h"
+
+#define TEST_BLOCK_SIZE 512
+
+TEST_CASE( "SLAB_BUFFERS", "[blockslab]" ) {
+
+    BlockSlab slab(TEST_BLOCK_SIZE, 4, 8);
+
+    SECTION("reserved buffers are there right away") {
+        REQUIRE(slab.capacity == 8);
+        REQUIRE(slab.used == 0);
+    }
+
+    SECTION("buffers are distinct and keep their content") {
+        char *blocks[8];
+
+        for (int i = 0; i < 8; i++) {
+            blocks[i] = slab.get();
+            REQUIRE(blocks[i] != NULL);
+            memset(blocks[i], 'a' + i, TEST_BLOCK_SIZE);
+        }
+        REQUIRE(slab.used == 8);
+        REQUIRE(slab.capacity == 8);
+
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < TEST_BLOCK_SIZE; j++)
+                REQUIRE(blocks[i][j] == 'a' + i);
+        }
+    }
+
+    SECTION("buffers given back are handed out again") {
+        std::set<char *> first;
+
+        for (int i = 0; i < 8; i++)
+            first.insert(slab.get());
+        for (std::set<char *>::iterator it = first.begin(); it != first.end(); it++)
+            slab.put(*it);
+        REQUIRE(slab.used == 0);
+
+        for (int i = 0; i < 8; i++)
+            REQUIRE(first.count(slab.get()) == 1);
+        REQUIRE(slab.capacity == 8);
+    }
+
+    SECTION("the slab grows by chunks once all buffers are in use") {
+        std::set<char *> blocks;
+
+        for (int i = 0; i < 13; i++)
+            blocks.insert(slab.get());
+        REQUIRE(blocks.size() == 13);
+        REQUIRE(slab.used == 13);
+        REQUIRE(slab.capacity == 16);
+    }
+}
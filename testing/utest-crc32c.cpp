@@ -0,0 +1,99 @@
+//
+//  utest-crc32c.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "tools.hpp"
+
+#include "blockdevice.h"
+#include "blockcache.h"
+#include "crc32c.h"
+
+#define CRC_PATH "/tmp/crc.bin"
+#define BLOCK_SIZE 512
+
+TEST_CASE( "CRC32C_VALUES", "[crc32c]" ) {
+
+    SECTION("known check values") {
+        REQUIRE(crc32c(0, "", 0) == 0);
+        REQUIRE(crc32c(0, "123456789", 9) == 0xe3069283);
+        REQUIRE(crc32cSoftware(0, "123456789", 9) == 0xe3069283);
+
+        // RFC 3720, B.4: 32 bytes of zeros
+        char zeros[32];
+        memset(zeros, 0, sizeof(zeros));
+        REQUIRE(crc32c(0, zeros, sizeof(zeros)) == 0x8a9136aa);
+    }
+
+    SECTION("checksums can be computed piecewise") {
+        REQUIRE(crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xe3069283);
+    }
+
+    SECTION("hardware and software agree for all lengths and alignments") {
+        char data[BLOCK_SIZE + 16];
+        gen_random(data, sizeof(data));
+
+        for (size_t offset = 0; offset < 8; offset++) {
+            for (size_t len = 0; len <= BLOCK_SIZE; len += (len < 64) ? 1 : 37)
+                REQUIRE(crc32c(0, data + offset, len) == crc32cSoftware(0, data + offset, len));
+        }
+    }
+}
+
+// Throughput of block checksums, and their overhead on cached reads and writes of the block cache
+// Hidden, run it with: unittests "[benchmark]"
+TEST_CASE( "CRC32C_THROUGHPUT", "[.][benchmark]" ) {
+    const int numBlocks = 4096;
+    const int rounds = 16;
+    std::vector<char> data((size_t) numBlocks * BLOCK_SIZE);
+    std::vector<uint32_t> table(numBlocks, 0);
+    uint32_t sum = 0;
+
+    gen_random(data.data(), data.size());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds * numBlocks; i++)
+        sum += crc32c(0, &data[(size_t) (i % numBlocks) * BLOCK_SIZE], BLOCK_SIZE);
+    double hw = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds * numBlocks; i++)
+        sum += crc32cSoftware(0, &data[(size_t) (i % numBlocks) * BLOCK_SIZE], BLOCK_SIZE);
+    double sw = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double mib = (double) rounds * numBlocks * BLOCK_SIZE / (1 << 20);
+    printf("crc32c (%s): %.0f MiB/s, software: %.0f MiB/s (%08x)\n",
+           crc32cHardware() ? "CRC32 instructions" : "software", mib / hw, mib / sw, sum);
+
+    // write all blocks through the cache, then read them back from the device, with and without checksums
+    remove(CRC_PATH);
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(CRC_PATH) == 0);
+
+    for (int checksums = 0; checksums < 2; checksums++) {
+        BlockCache bc(&bd, BLOCK_SIZE, numBlocks);
+        if (checksums)
+            bc.setChecksums(0, numBlocks, table.data());
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds / 4; r++) {
+            REQUIRE(bc.writeBlocks(0, numBlocks, data.data()) == 0);
+            bc.clear();
+            REQUIRE(bc.load(0, numBlocks) == 0);
+            bc.clear();
+        }
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("block cache write + read %s checksums: %.0f MiB/s\n", checksums ? "with" : "without",
+               2 * mib / 4 / t);
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(CRC_PATH);
+}
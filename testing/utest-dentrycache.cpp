@@ -0,0 +1,99 @@
+//
+//  utest-dentrycache.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <errno.h>
+#include <string.h>
+
+#include "dentrycache.h"
+
+#define TEST_ROOT 64
+
+TEST_CASE( "DENTRY_LOOKUP", "[dentrycache]" ) {
+
+    DentryCache cache(TEST_ROOT);
+    cache.insert(TEST_ROOT, "dir", 0, true);
+    cache.insert(0, "file", 1, false);
+    cache.insert(TEST_ROOT, "file", 2, false);
+
+    SECTION("names are looked up per directory") {
+        bool directory = false;
+        REQUIRE(cache.lookup(TEST_ROOT, "dir", 3, &directory) == 0);
+        REQUIRE(directory);
+        REQUIRE(cache.lookup(0, "file", 4, &directory) == 1);
+        REQUIRE_FALSE(directory);
+        REQUIRE(cache.lookup(TEST_ROOT, "file", 4) == 2);
+        REQUIRE(cache.lookup(TEST_ROOT, "fil", 3) == -1);
+        REQUIRE(cache.lookup(1, "file", 4) == -1);
+    }
+
+    SECTION("entries are counted per directory") {
+        REQUIRE(cache.size() == 3);
+        REQUIRE(cache.countChildren(TEST_ROOT) == 2);
+        REQUIRE(cache.countSubdirs(TEST_ROOT) == 1);
+        REQUIRE(cache.countChildren(0) == 1);
+        REQUIRE(cache.countSubdirs(0) == 0);
+        REQUIRE(cache.childrenOf(TEST_ROOT) == std::set<int>({0, 2}));
+
+        cache.remove(0, "file");
+        cache.remove(0, "file");
+        REQUIRE(cache.countChildren(0) == 0);
+        REQUIRE(cache.lookup(0, "file", 4) == -1);
+
+        cache.insert(TEST_ROOT, "file", 3, true);
+        REQUIRE(cache.countChildren(TEST_ROOT) == 2);
+        REQUIRE(cache.countSubdirs(TEST_ROOT) == 2);
+        REQUIRE(cache.childrenOf(TEST_ROOT) == std::set<int>({0, 3}));
+        REQUIRE(cache.childrenOf(0).empty());
+
+        cache.clear();
+        REQUIRE(cache.size() == 0);
+        REQUIRE(cache.countChildren(TEST_ROOT) == 0);
+    }
+}
+
+TEST_CASE( "DENTRY_RESOLVE", "[dentrycache]" ) {
+
+    DentryCache cache(TEST_ROOT);
+    cache.insert(TEST_ROOT, "a", 0, true);
+    cache.insert(0, "b", 1, true);
+    cache.insert(1, "c", 2, false);
+
+    int dir;
+    const char *name;
+
+    SECTION("existing paths") {
+        REQUIRE(cache.resolve("/", &dir, &name) == TEST_ROOT);
+        REQUIRE(dir == TEST_ROOT);
+        REQUIRE(strcmp(name, "") == 0);
+
+        REQUIRE(cache.resolve("/a", &dir, &name) == 0);
+        REQUIRE(dir == TEST_ROOT);
+        REQUIRE(strcmp(name, "a") == 0);
+
+        REQUIRE(cache.resolve("/a/b/c", &dir, &name) == 2);
+        REQUIRE(dir == 1);
+        REQUIRE(strcmp(name, "c") == 0);
+
+        REQUIRE(cache.resolve("//a//b", &dir, &name) == 1);
+        REQUIRE(dir == 0);
+    }
+
+    SECTION("missing entries") {
+        REQUIRE(cache.resolve("/a/b/d", &dir, &name) == -ENOENT);
+        REQUIRE(dir == 1);
+        REQUIRE(strcmp(name, "d") == 0);
+
+        REQUIRE(cache.resolve("/a/x/d", &dir, &name) == -ENOENT);
+        REQUIRE(dir == -1);
+    }
+
+    SECTION("files on the way") {
+        REQUIRE(cache.resolve("/a/b/c/d", &dir, &name) == -ENOTDIR);
+        REQUIRE(dir == -1);
+        REQUIRE(cache.resolve("/a/b/c/d/e", &dir, &name) == -ENOTDIR);
+    }
+}
@@ -0,0 +1,94 @@
+//
+//  utest-filetier.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <string.h>
+#include <vector>
+
+#include "filetier.h"
+
+TEST_CASE( "TIER_HEAT", "[filetier]" ) {
+
+    FileTier tier(1000, 10);
+
+    SECTION("heat adds up and halves every half-life") {
+        REQUIRE(tier.heat(1, 0) == 0);
+        tier.touch(1, 100, 0);
+        tier.touch(1, 100, 0);
+        REQUIRE(tier.heat(1, 0) == Approx(200));
+        REQUIRE(tier.heat(1, 10) == Approx(100));
+        REQUIRE(tier.heat(1, 20) == Approx(50));
+
+        tier.touch(1, 50, 10);
+        REQUIRE(tier.heat(1, 10) == Approx(150));
+
+        tier.forget(1);
+        REQUIRE(tier.heat(1, 10) == 0);
+    }
+
+    SECTION("files are admitted once they were read in full") {
+        tier.touch(1, 100, 0);
+        REQUIRE_FALSE(tier.admit(1, 400, 0));
+        tier.touch(1, 300, 0);
+        REQUIRE(tier.admit(1, 400, 0));
+        REQUIRE_FALSE(tier.admit(2, 10, 0));
+
+        tier.touch(3, 2000, 0);
+        REQUIRE_FALSE(tier.admit(3, 2000, 0));
+    }
+}
+
+TEST_CASE( "TIER_COPIES", "[filetier]" ) {
+
+    FileTier tier(1000, 10);
+    std::vector<char> data(400);
+    char buf[400];
+
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (char) i;
+
+    tier.touch(1, 800, 0);
+    REQUIRE(tier.admit(1, 400, 0));
+    tier.store(1, data.data(), data.size());
+
+    SECTION("copies are read until they are dropped") {
+        REQUIRE(tier.read(1, buf, 100, 50) == 100);
+        REQUIRE(memcmp(buf, data.data() + 50, 100) == 0);
+        REQUIRE(tier.read(1, buf, 100, 350) == 50);
+        REQUIRE(tier.read(1, buf, 100, 400) == 0);
+        REQUIRE(tier.hits == 3);
+
+        tier.drop(1);
+        REQUIRE(tier.read(1, buf, 100, 0) == -1);
+        REQUIRE(tier.misses == 1);
+        REQUIRE(tier.used() == 0);
+        REQUIRE(tier.heat(1, 0) == Approx(800));
+    }
+
+    SECTION("colder copies make room for hotter files") {
+        tier.touch(2, 500, 0);
+        REQUIRE(tier.admit(2, 400, 0));
+        tier.store(2, data.data(), data.size());
+        REQUIRE(tier.used() == 800);
+
+        // a file colder than all copies stays out
+        tier.touch(3, 400, 0);
+        REQUIRE_FALSE(tier.admit(3, 400, 0));
+        REQUIRE(tier.used() == 800);
+
+        // a hotter one pushes out the coldest copy only
+        tier.touch(3, 300, 0);
+        REQUIRE(tier.admit(3, 400, 0));
+        tier.store(3, data.data(), data.size());
+        REQUIRE(tier.used() == 800);
+        REQUIRE(tier.read(1, buf, 1, 0) == 1);
+        REQUIRE(tier.read(2, buf, 1, 0) == -1);
+
+        tier.clear();
+        REQUIRE(tier.used() == 0);
+        REQUIRE(tier.read(3, buf, 1, 0) == -1);
+    }
+}
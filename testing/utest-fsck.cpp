@@ -0,0 +1,247 @@
+//
+//  utest-fsck.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "blockdevice.h"
+#include "fsck.h"
+
+#define FSCK_PATH "/tmp/fsck.bin"
+
+// Tables of a container built by hand, laid out like MyOnDiskFS lays out a new container
+struct TestContainer {
+    MyFsSuperBlock sb;
+    std::vector<int> fat;
+    std::vector<uint16_t> refs;
+    std::vector<DiskFileInfo> root;
+    std::vector<DiskSnapshot> snaps;
+
+    TestContainer() : fat(FAT_ENTRY_COUNT, EMPTY_BLOCK), refs(FAT_ENTRY_COUNT, 0), root(NUM_DIR_ENTRIES),
+                      snaps(NUM_SNAPSHOTS) {
+        memset(&sb, 0, sizeof(sb));
+        memset(root.data(), 0, root.size() * sizeof(DiskFileInfo));
+        memset(snaps.data(), 0, snaps.size() * sizeof(DiskSnapshot));
+
+        sb.magic = MYFS_MAGIC;
+        sb.fat_start = BD_DIRECT_ALIGN / BLOCK_SIZE;
+        sb.fat_size = alignSize(FAT_ENTRY_COUNT * sizeof(int));
+        sb.ref_start = sb.fat_start + sb.fat_size / BLOCK_SIZE;
+        sb.ref_size = alignSize(FAT_ENTRY_COUNT * sizeof(uint16_t));
+        sb.root_start = sb.ref_start + sb.ref_size / BLOCK_SIZE;
+        sb.root_size = alignSize(NUM_DIR_ENTRIES * sizeof(DiskFileInfo));
+        sb.snap_start = sb.root_start + sb.root_size / BLOCK_SIZE;
+        sb.snap_size = alignSize(NUM_SNAPSHOTS * sizeof(DiskSnapshot));
+        sb.data_start = sb.snap_start + sb.snap_size / BLOCK_SIZE;
+    }
+
+    static size_t alignSize(size_t x) {
+        return (x + BD_DIRECT_ALIGN - 1) & ~(size_t) (BD_DIRECT_ALIGN - 1);
+    }
+
+    // Add a file with a chain through the given blocks, each block gets one reference
+    void addFile(int slot, const char *name, size_t size, std::vector<int> blocks, int parent = ROOT_DIR) {
+        strcpy(root[slot].name, name);
+        root[slot].parent = parent;
+        root[slot].mode = S_IFREG | 0644;
+        root[slot].size = size;
+        root[slot].firstblock = blocks.empty() ? EOC_BLOCK : blocks[0];
+        for (size_t i = 0; i < blocks.size(); i++) {
+            fat[blocks[i]] = (i + 1 < blocks.size()) ? blocks[i + 1] : EOC_BLOCK;
+            refs[blocks[i]] = 1;
+        }
+    }
+
+    // Add an empty directory
+    void addDir(int slot, const char *name, int parent = ROOT_DIR) {
+        addFile(slot, name, 0, {}, parent);
+        root[slot].mode = S_IFDIR | 0755;
+    }
+
+    void transfer(BlockDevice *bd, bool write, uint32_t start, void *table, size_t len) {
+        std::vector<char> buf(TestContainer::alignSize(len), 0);
+
+        if (write)
+            memcpy(buf.data(), table, len);
+        for (size_t b = 0; b < buf.size() / BLOCK_SIZE; b++) {
+            if (write)
+                REQUIRE(bd->write(start + b, buf.data() + b * BLOCK_SIZE) == 0);
+            else
+                REQUIRE(bd->read(start + b, buf.data() + b * BLOCK_SIZE) == 0);
+        }
+        if (!write)
+            memcpy(table, buf.data(), len);
+    }
+
+    void save() {
+        BlockDevice bd(BLOCK_SIZE);
+        char block[BLOCK_SIZE];
+
+        remove(FSCK_PATH);
+        REQUIRE(bd.create(FSCK_PATH) == 0);
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, &sb, sizeof(sb));
+        REQUIRE(bd.write(0, block) == 0);
+        transfer(&bd, true, sb.fat_start, fat.data(), fat.size() * sizeof(int));
+        transfer(&bd, true, sb.ref_start, refs.data(), refs.size() * sizeof(uint16_t));
+        transfer(&bd, true, sb.root_start, root.data(), root.size() * sizeof(DiskFileInfo));
+        transfer(&bd, true, sb.snap_start, snaps.data(), snaps.size() * sizeof(DiskSnapshot));
+        REQUIRE(bd.close() == 0);
+    }
+
+    void reload() {
+        BlockDevice bd(BLOCK_SIZE);
+
+        REQUIRE(bd.open(FSCK_PATH) == 0);
+        transfer(&bd, false, sb.fat_start, fat.data(), fat.size() * sizeof(int));
+        transfer(&bd, false, sb.ref_start, refs.data(), refs.size() * sizeof(uint16_t));
+        transfer(&bd, false, sb.root_start, root.data(), root.size() * sizeof(DiskFileInfo));
+        REQUIRE(bd.close() == 0);
+    }
+};
+
+TEST_CASE( "FSCK_CLEAN_CONTAINER", "[fsck]" ) {
+
+    TestContainer c;
+    c.addFile(0, "a", 3 * BLOCK_SIZE - 10, {1, 2, 3});
+    c.addFile(1, "b", 2 * BLOCK_SIZE, {7, 5});
+    c.addFile(2, "empty", 0, {});
+    c.addFile(3, "small", 50, {});
+    c.root[3].flags = FILE_INLINE;
+    c.addDir(4, "dir");
+    c.addDir(5, "sub", 4);
+    c.addFile(6, "a", BLOCK_SIZE, {9}, 5);
+
+    SECTION("an empty container is consistent") {
+        TestContainer empty;
+        empty.save();
+        MyFsChecker checker(false, 4);
+        REQUIRE(checker.run(FSCK_PATH) == FSCK_OK);
+    }
+
+    SECTION("files are consistent") {
+        c.save();
+        MyFsChecker checker(false, 4);
+        REQUIRE(checker.run(FSCK_PATH) == FSCK_OK);
+    }
+
+    SECTION("chains shared with a snapshot are consistent") {
+        strcpy(c.snaps[0].name, "snap");
+        c.snaps[0].files[0] = c.root[0];
+        c.refs[1]++;
+        c.save();
+        MyFsChecker checker(false, 4);
+        REQUIRE(checker.run(FSCK_PATH) == FSCK_OK);
+    }
+
+    SECTION("attribute chains are consistent") {
+        c.root[0].attrblock = 12;
+        c.fat[12] = 13;
+        c.fat[13] = EOC_BLOCK;
+        c.refs[12] = 2;
+        c.refs[13] = 1;
+        strcpy(c.snaps[0].name, "snap");
+        c.snaps[0].files[0] = c.root[0];
+        c.refs[1]++;
+        c.save();
+        MyFsChecker checker(false, 4);
+        REQUIRE(checker.run(FSCK_PATH) == FSCK_OK);
+    }
+
+    SECTION("a bad superblock is not checked any further") {
+        c.sb.ref_start = c.sb.fat_start;
+        c.save();
+        MyFsChecker checker(true, 4);
+        REQUIRE(checker.run(FSCK_PATH) == FSCK_UNCORRECTED);
+    }
+
+    remove(FSCK_PATH);
+}
+
+TEST_CASE( "FSCK_REPAIR", "[fsck]" ) {
+
+    TestContainer c;
+    c.addFile(0, "a", 3 * BLOCK_SIZE, {1, 2, 3});
+    c.addFile(1, "long", BLOCK_SIZE, {10, 11, 12});
+    c.addFile(2, "short", 4 * BLOCK_SIZE, {20, 21});
+    c.addFile(3, "broken", 3 * BLOCK_SIZE, {30, 31, 32});
+    c.addFile(4, "loop", 3 * BLOCK_SIZE, {40, 41, 42});
+    c.fat[31] = 33;         // link to a free block
+    c.fat[42] = 40;         // loop
+    c.refs[2] = 2;          // too many references
+    c.addFile(5, "x", BLOCK_SIZE, {50});
+    c.root[5].name[0] = '\0';   // leaked block 50
+    c.fat[60] = c.fat[61] = EOC_BLOCK;  // leaked blocks 60-61
+    c.addFile(7, "inline", 2 * BLOCK_SIZE, {});
+    c.root[7].flags = FILE_INLINE;      // too large for the entry
+    c.addFile(8, "orphan", 0, {}, 9);   // directory 9 does not exist
+    c.addDir(10, "d1", 11);
+    c.addDir(11, "d2", 10);             // loop of directories
+    c.save();
+
+    MyFsChecker check(false, 3);
+    REQUIRE(check.run(FSCK_PATH) == FSCK_UNCORRECTED);
+    int problems = check.problemsFound();
+    REQUIRE(problems >= 10);
+
+    // checking does not change the container
+    REQUIRE(check.run(FSCK_PATH) == FSCK_UNCORRECTED);
+    REQUIRE(check.problemsFound() == problems);
+
+    MyFsChecker repair(true, 3);
+    REQUIRE(repair.run(FSCK_PATH) == FSCK_REPAIRED);
+    REQUIRE(repair.problemsFound() == problems);
+    REQUIRE(check.run(FSCK_PATH) == FSCK_OK);
+
+    c.reload();
+    REQUIRE(c.refs[2] == 1);
+    REQUIRE(c.fat[10] == EOC_BLOCK);
+    REQUIRE(c.fat[11] == EMPTY_BLOCK);
+    REQUIRE(c.fat[12] == EMPTY_BLOCK);
+    REQUIRE(c.root[2].size == 2 * BLOCK_SIZE);
+    REQUIRE(c.fat[31] == EOC_BLOCK);
+    REQUIRE(c.root[3].size == 2 * BLOCK_SIZE);
+    REQUIRE(c.fat[42] == EOC_BLOCK);
+    REQUIRE(c.fat[50] == EMPTY_BLOCK);
+    REQUIRE(c.fat[60] == EMPTY_BLOCK);
+    REQUIRE(c.fat[61] == EMPTY_BLOCK);
+    REQUIRE(c.root[7].size == INLINE_DATA_SIZE);
+    REQUIRE(c.root[8].parent == ROOT_DIR);
+    REQUIRE((c.root[10].parent == ROOT_DIR || c.root[11].parent == ROOT_DIR));
+
+    SECTION("broken attribute chains are cut") {
+        c.root[0].attrblock = 80;
+        c.fat[80] = 81;     // link to a free block
+        c.refs[80] = 1;
+        c.fat[82] = 82;     // loop in the chain of the next attributes
+        c.refs[82] = 1;
+        c.root[1].attrblock = 82;
+        c.save();
+        MyFsChecker repairAttrs(true, 2);
+        REQUIRE(repairAttrs.run(FSCK_PATH) == FSCK_REPAIRED);
+        REQUIRE(repairAttrs.problemsFound() == 2);
+        REQUIRE(check.run(FSCK_PATH) == FSCK_OK);
+        c.reload();
+        REQUIRE(c.fat[80] == EOC_BLOCK);
+        REQUIRE(c.fat[82] == EOC_BLOCK);
+    }
+
+    SECTION("chains shared with a snapshot are not cut") {
+        c.addFile(6, "shared", BLOCK_SIZE, {70, 71});
+        strcpy(c.snaps[0].name, "snap");
+        c.snaps[0].files[0] = c.root[6];
+        c.snaps[0].files[0].size = 2 * BLOCK_SIZE;
+        c.refs[70]++;
+        c.save();
+        MyFsChecker repairShared(true, 2);
+        REQUIRE(repairShared.run(FSCK_PATH) == FSCK_UNCORRECTED);
+        REQUIRE(repairShared.problemsFound() == 1);
+    }
+
+    remove(FSCK_PATH);
+}
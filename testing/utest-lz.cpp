@@ -0,0 +1,97 @@
+//
+//  utest-lz.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "tools.hpp"
+
+#include "lz.h"
+
+#define LZ_TEST_SIZE 16384
+
+// Compress and decompress a buffer, return the compressed length
+static size_t roundTrip(const char *data, size_t len) {
+    std::vector<char> packed(len + len / 64 + 16);
+    std::vector<char> unpacked(len + 1);
+
+    size_t packedLen = lzCompress(data, len, packed.data(), packed.size());
+    REQUIRE(packedLen > 0);
+    REQUIRE(lzDecompress(packed.data(), packedLen, unpacked.data(), unpacked.size()) == (long) len);
+    REQUIRE(memcmp(data, unpacked.data(), len) == 0);
+
+    return packedLen;
+}
+
+TEST_CASE( "LZ_ROUND_TRIP", "[lz]" ) {
+
+    std::vector<char> data(LZ_TEST_SIZE);
+
+    SECTION("short and empty buffers") {
+        REQUIRE(roundTrip("", 0) == 1);
+        REQUIRE(roundTrip("abc", 3) == 4);
+        REQUIRE(roundTrip("abcabcabcabcabc", 15) > 0);
+    }
+
+    SECTION("repeated text compresses well") {
+        const char *line = "{\"time\": 1700000000, \"level\": \"info\", \"msg\": \"request done\"}\n";
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = line[i % strlen(line)];
+        REQUIRE(roundTrip(data.data(), data.size()) < data.size() / 10);
+    }
+
+    SECTION("zeros and long matches") {
+        memset(data.data(), 0, data.size());
+        REQUIRE(roundTrip(data.data(), data.size()) < 100);
+    }
+
+    SECTION("random data does not grow much") {
+        gen_random(data.data(), data.size());
+        REQUIRE(roundTrip(data.data(), data.size()) < data.size() + data.size() / 64 + 16);
+    }
+
+    SECTION("every length up to a few hundred bytes") {
+        gen_random(data.data(), 400);
+        for (size_t i = 0; i < 400; i++)
+            data[i] = (data[i] % 4) + 'a';
+        for (size_t len = 0; len < 400; len++)
+            roundTrip(data.data(), len);
+    }
+}
+
+TEST_CASE( "LZ_BOUNDS", "[lz]" ) {
+
+    std::vector<char> data(LZ_TEST_SIZE, 'x');
+    std::vector<char> packed(LZ_TEST_SIZE);
+    std::vector<char> unpacked(LZ_TEST_SIZE);
+
+    size_t packedLen = lzCompress(data.data(), data.size(), packed.data(), packed.size());
+    REQUIRE(packedLen > 0);
+
+    SECTION("output that does not fit is rejected") {
+        gen_random(data.data(), data.size());
+        REQUIRE(lzCompress(data.data(), data.size(), packed.data(), data.size() / 2) == 0);
+        REQUIRE(lzDecompress(packed.data(), packedLen, unpacked.data(), LZ_TEST_SIZE - 1) == -1);
+    }
+
+    SECTION("corrupted input is detected") {
+        REQUIRE(lzDecompress(packed.data(), packedLen - 1, unpacked.data(), unpacked.size()) <= (long) data.size());
+        packed[1] = 0;
+        packed[2] = 0;
+        REQUIRE(lzDecompress(packed.data(), packedLen, unpacked.data(), unpacked.size()) == -1);
+    }
+
+    SECTION("random input never leaves the buffers") {
+        for (int i = 0; i < 1000; i++) {
+            gen_random(packed.data(), 64);
+            long len = lzDecompress(packed.data(), 64, unpacked.data(), 256);
+            REQUIRE(len >= -1);
+            REQUIRE(len <= 256);
+        }
+    }
+}
@@ -0,0 +1,100 @@
+//
+//  utest-xattrset.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/xattr.h>
+#include <string>
+#include <vector>
+
+#include "xattrset.h"
+
+TEST_CASE( "XATTR_SET_GET", "[xattr]" ) {
+
+    XattrSet set;
+    char value[64];
+
+    REQUIRE(set.set("user.a", "alpha", 5, 0) == 0);
+    REQUIRE(set.set("user.b", "", 0, 0) == 0);
+
+    SECTION("values are returned with their length") {
+        REQUIRE(set.get("user.a", NULL, 0) == 5);
+        REQUIRE(set.get("user.a", value, sizeof(value)) == 5);
+        REQUIRE(memcmp(value, "alpha", 5) == 0);
+        REQUIRE(set.get("user.b", value, sizeof(value)) == 0);
+        REQUIRE(set.get("user.a", value, 4) == -ERANGE);
+        REQUIRE(set.get("user.c", value, sizeof(value)) == -ENODATA);
+    }
+
+    SECTION("flags and limits") {
+        REQUIRE(set.set("user.a", "x", 1, XATTR_CREATE) == -EEXIST);
+        REQUIRE(set.set("user.c", "x", 1, XATTR_REPLACE) == -ENODATA);
+        REQUIRE(set.set("user.a", "beta", 4, XATTR_REPLACE) == 0);
+        REQUIRE(set.get("user.a", value, sizeof(value)) == 4);
+
+        std::string longName(XATTR_NAME_MAX_LEN + 1, 'n');
+        std::vector<char> big(XATTR_VALUE_MAX_LEN + 1, 'v');
+        REQUIRE(set.set(longName.c_str(), "x", 1, 0) == -ERANGE);
+        REQUIRE(set.set("user.big", big.data(), big.size(), 0) == -E2BIG);
+
+        int ret = 0;
+        for (int i = 0; ret == 0; i++)
+            ret = set.set(("user.v" + std::to_string(i)).c_str(), big.data(), XATTR_VALUE_MAX_LEN, 0);
+        REQUIRE(ret == -ENOSPC);
+        REQUIRE(set.storedSize() <= XATTR_MAX_BYTES);
+    }
+
+    SECTION("names are listed in order") {
+        REQUIRE(set.remove("user.c") == -ENODATA);
+        REQUIRE(set.set("user.0", "z", 1, 0) == 0);
+        REQUIRE(set.list(NULL, 0) == 21);
+        REQUIRE(set.list(value, 20) == -ERANGE);
+        REQUIRE(set.list(value, sizeof(value)) == 21);
+        REQUIRE(memcmp(value, "user.0\0user.a\0user.b\0", 21) == 0);
+
+        REQUIRE(set.remove("user.a") == 0);
+        REQUIRE(set.size() == 2);
+        REQUIRE(set.list(NULL, 0) == 14);
+    }
+}
+
+TEST_CASE( "XATTR_STORE_LOAD", "[xattr]" ) {
+
+    XattrSet set, copy;
+    for (int i = 0; i < 2000; i++) {
+        std::string name = "user.attr" + std::to_string(i);
+        REQUIRE(set.set(name.c_str(), name.c_str() + 5, name.size() - 5, 0) == 0);
+    }
+
+    std::vector<char> buf(set.storedSize());
+    set.store(buf.data());
+
+    SECTION("a stored set is loaded again") {
+        REQUIRE(copy.load(buf.data(), buf.size()) == 0);
+        REQUIRE(copy.size() == 2000);
+        REQUIRE(copy.storedSize() == set.storedSize());
+
+        char value[32];
+        REQUIRE(copy.get("user.attr1234", value, sizeof(value)) == 8);
+        REQUIRE(memcmp(value, "attr1234", 8) == 0);
+    }
+
+    SECTION("damaged stored forms are rejected") {
+        REQUIRE(copy.load(buf.data(), buf.size() - 1) == -EIO);
+        buf[sizeof(XattrHeader)] = (char) 0xff;
+        REQUIRE(copy.load(buf.data(), buf.size()) == -EIO);
+        REQUIRE(copy.size() == 0);
+        buf[0] = 0;
+        REQUIRE(copy.load(buf.data(), buf.size()) == -EIO);
+    }
+
+    SECTION("an empty set has no stored form") {
+        set.clear();
+        REQUIRE(set.storedSize() == 0);
+        REQUIRE(set.list(NULL, 0) == 0);
+    }
+}